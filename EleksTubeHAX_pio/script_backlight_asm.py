@@ -0,0 +1,203 @@
+# EleksTubeHAX_pio/script_backlight_asm.py
+#
+# Assembler for the backlight programs run by the "Program" backlight pattern (see src/BacklightProgram.h).
+#
+# Source format: one instruction per line, ';' starts a comment, 'name:' defines a jump label.
+# 'push <number>' selects the 8 or 16 bit form automatically, 'jz'/'jmp' take a label.
+#
+# Example, a rainbow running along the LEDs:
+#   time  push 4  shr        ; phase from time
+#   led   push 64 mul  add   ; shifted per LED
+#   wheel end
+#
+# Usage:
+#   python script_backlight_asm.py program.asm [-o data/backlight.bin] [--hex] [--run LEDS]
+#
+# The .bin file can be uploaded to SPIFFS (data/backlight.bin) or sent to the MQTT topic
+# <MQTT_CLIENT>/back/program/set (Home Assistant) or <MQTT_CLIENT>/directive/backlightProgram (plain MQTT),
+# as raw bytes or as the hex string printed with --hex.
+# --run executes the program for one frame and prints the colors and the number of executed
+# instructions per LED, which has to stay below BACKLIGHT_PROGRAM_STEPS_PER_LED.
+
+import sys
+import re
+import math
+import argparse
+
+# Keep in sync with BacklightProgram::opcode_t!
+OPCODES = ['end', 'push8', 'push16', 'time', 'led', 'num_leds', 'second', 'minute', 'intensity',
+           'add', 'sub', 'mul', 'div', 'mod', 'and', 'or', 'xor', 'shl', 'shr',
+           'dup', 'swap', 'drop', 'over', 'min', 'max', 'lt', 'gt', 'eq',
+           'jz', 'jmp', 'sin8', 'wheel', 'rgb']
+OPERAND_SIZE = {'push8': 1, 'push16': 2, 'jz': 1, 'jmp': 1}
+HEADER = bytes([ord('B'), ord('L'), 1])
+MAX_SIZE = 256
+STACK_SIZE = 16
+STEPS_PER_LED = 128
+
+
+def tokenize(source):
+    tokens = []
+    for line_no, line in enumerate(source.splitlines(), 1):
+        line = line.split(';')[0]
+        for word in line.split():
+            tokens.append((word.lower(), line_no))
+    return tokens
+
+
+def assemble(source):
+    tokens = tokenize(source)
+    # first pass: instruction sizes and label addresses
+    labels = {}
+    items = []
+    pc = 0
+    i = 0
+    while i < len(tokens):
+        word, line_no = tokens[i]
+        i += 1
+        if word.endswith(':'):
+            labels[word[:-1]] = pc
+            continue
+        if word == 'push':
+            value = int(tokens[i][0], 0)
+            i += 1
+            op = 'push8' if 0 <= value <= 255 else 'push16'
+            if not -32768 <= value <= 32767:
+                sys.exit(f"line {line_no}: value {value} out of range, build it with shl/or")
+            items.append((op, value, line_no))
+        elif word in ('jz', 'jmp'):
+            items.append((word, tokens[i][0], line_no))
+            i += 1
+        elif word in OPCODES and word not in ('push8', 'push16'):
+            items.append((word, None, line_no))
+        else:
+            sys.exit(f"line {line_no}: unknown instruction '{word}'")
+        pc += 1 + OPERAND_SIZE.get(items[-1][0], 0)
+
+    # second pass: emit code
+    code = bytearray()
+    for op, arg, line_no in items:
+        code.append(OPCODES.index(op))
+        if op == 'push8':
+            code.append(arg)
+        elif op == 'push16':
+            code += (arg & 0xFFFF).to_bytes(2, 'little')
+        elif op in ('jz', 'jmp'):
+            if arg not in labels:
+                sys.exit(f"line {line_no}: unknown label '{arg}'")
+            offset = labels[arg] - (len(code) + 1)
+            if not -128 <= offset <= 127:
+                sys.exit(f"line {line_no}: jump to '{arg}' too far")
+            code.append(offset & 0xFF)
+    if not code or code[-1] != OPCODES.index('end') and items[-1][0] != 'jmp':
+        sys.exit("program must end with 'end' or 'jmp'")
+    if len(code) > MAX_SIZE:
+        sys.exit(f"program too large: {len(code)} bytes, max. {MAX_SIZE}")
+    return HEADER + bytes(code)
+
+
+def run(program, led, num_leds, time_ms, second=0, minute=0, intensity=7):
+    """Reference interpreter, same semantics as BacklightProgram::run(). Returns (color, steps)."""
+    code = program[len(HEADER):]
+    sin_table = [round(127.5 + 127.5 * math.sin(2 * math.pi * i / 256)) for i in range(256)]
+    stack = []
+    pc = 0
+
+    def s8(b):
+        return b - 256 if b > 127 else b
+
+    def trunc_div(a, b):
+        q = abs(a) // abs(b)
+        return q if (a < 0) == (b < 0) else -q
+
+    for steps in range(1, STEPS_PER_LED + 1):
+        op = OPCODES[code[pc]]
+        pc += 1
+        if op == 'end':
+            return stack[-1] & 0xFFFFFF, steps
+        elif op == 'push8':
+            stack.append(code[pc])
+            pc += 1
+        elif op == 'push16':
+            stack.append(int.from_bytes(code[pc:pc + 2], 'little', signed=True))
+            pc += 2
+        elif op in ('time', 'led', 'num_leds', 'second', 'minute', 'intensity'):
+            stack.append({'time': time_ms & 0x7FFFFFFF, 'led': led, 'num_leds': num_leds, 'second': second,
+                          'minute': minute, 'intensity': intensity}[op])
+        elif op == 'dup':
+            stack.append(stack[-1])
+        elif op == 'over':
+            stack.append(stack[-2])
+        elif op == 'swap':
+            stack[-1], stack[-2] = stack[-2], stack[-1]
+        elif op == 'drop':
+            stack.pop()
+        elif op == 'jz':
+            if stack.pop() == 0:
+                pc += s8(code[pc])
+            pc += 1
+        elif op == 'jmp':
+            pc += s8(code[pc]) + 1
+        elif op == 'sin8':
+            stack[-1] = sin_table[stack[-1] & 0xFF]
+        elif op == 'wheel':
+            a = stack[-1] % 768
+            c = []
+            for i in range(3):
+                p = (a + i * 256) % 768
+                c.append(p if p <= 255 else (511 - p if p <= 511 else 0))
+            stack[-1] = (c[0] << 16) | (c[1] << 8) | c[2]
+        elif op == 'rgb':
+            b, g, r = stack.pop(), stack.pop(), stack.pop()
+            stack.append((min(max(r, 0), 255) << 16) | (min(max(g, 0), 255) << 8) | min(max(b, 0), 255))
+        else:
+            b = stack.pop()
+            a = stack.pop()
+            if op == 'add': a += b
+            elif op == 'sub': a -= b
+            elif op == 'mul': a *= b
+            elif op == 'div': a = trunc_div(a, b) if b else 0
+            elif op == 'mod': a = (a - trunc_div(a, b) * b) % abs(b) if b else 0
+            elif op == 'and': a &= b
+            elif op == 'or': a |= b
+            elif op == 'xor': a ^= b
+            elif op == 'shl': a <<= (b & 31)
+            elif op == 'shr': a >>= (b & 31)
+            elif op == 'min': a = min(a, b)
+            elif op == 'max': a = max(a, b)
+            elif op == 'lt': a = int(a < b)
+            elif op == 'gt': a = int(a > b)
+            elif op == 'eq': a = int(a == b)
+            a = ((a + 2**31) % 2**32) - 2**31  # 32 bit wrap around like on the ESP32
+            stack.append(a)
+        if len(stack) > STACK_SIZE:
+            sys.exit(f"stack overflow at byte {pc - 1}")
+    sys.exit(f"LED {led}: instruction budget of {STEPS_PER_LED} exceeded")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Assemble a backlight program.")
+    parser.add_argument("source")
+    parser.add_argument("-o", "--output", help="output .bin file (default: source name with .bin)")
+    parser.add_argument("--hex", action="store_true", help="print the program as hex string for MQTT")
+    parser.add_argument("--run", type=int, metavar="LEDS", help="run one frame for this number of LEDs")
+    args = parser.parse_args()
+
+    with open(args.source, 'r') as f:
+        program = assemble(f.read())
+
+    output = args.output or re.sub(r'\.[^.]*$', '', args.source) + '.bin'
+    with open(output, 'wb') as f:
+        f.write(program)
+    print(f"{output}: {len(program)} bytes")
+
+    if args.hex:
+        print(program.hex().upper())
+
+    if args.run:
+        max_steps = 0
+        for led in range(args.run):
+            color, steps = run(program, led, args.run, time_ms=12345)
+            max_steps = max(max_steps, steps)
+            print(f"LED {led:2d}: #{color:06X} ({steps} instructions)")
+        print(f"max. {max_steps} instructions per LED, {max_steps * args.run} per frame")
@@ -0,0 +1,303 @@
+#include "BacklightProgram.h"
+#include <math.h>
+
+uint8_t BacklightProgram::sin_table[256];
+bool BacklightProgram::sin_table_ready = false;
+
+int8_t BacklightProgram::operandSize(uint8_t opcode)
+{
+  switch (opcode)
+  {
+  case op_push8:
+  case op_jz:
+  case op_jmp:
+    return 1;
+  case op_push16:
+    return 2;
+  default:
+    return opcode < num_opcodes ? 0 : -1; // -1 = invalid opcode
+  }
+}
+
+bool BacklightProgram::load(const uint8_t *data, size_t length)
+{
+  if (length <= header_size || data[0] != 'B' || data[1] != 'L' || data[2] != version)
+  {
+    Serial.println("ERROR: Backlight program has no valid header!");
+    return false;
+  }
+  const uint8_t *code = data + header_size;
+  size_t size = length - header_size;
+  if (size > BACKLIGHT_PROGRAM_MAX_SIZE)
+  {
+    Serial.println("ERROR: Backlight program is too large!");
+    return false;
+  }
+
+  // First pass: mark the start of every instruction and check the opcodes.
+  uint8_t is_instruction[(BACKLIGHT_PROGRAM_MAX_SIZE + 7) / 8] = {0};
+  size_t pc = 0;
+  size_t last_pc = 0;
+  while (pc < size)
+  {
+    int8_t operand = operandSize(code[pc]);
+    if (operand < 0 || pc + 1 + operand > size)
+    { // unknown opcode or operand cut off
+      Serial.printf("ERROR: Backlight program invalid at byte %d!\n", pc);
+      return false;
+    }
+    is_instruction[pc / 8] |= 1 << (pc % 8);
+    last_pc = pc;
+    pc += 1 + operand;
+  }
+  if (code[last_pc] != op_end && code[last_pc] != op_jmp)
+  { // must not run past the end of the code
+    Serial.println("ERROR: Backlight program must end with END or JMP!");
+    return false;
+  }
+
+  // Second pass: all jumps must land on an instruction.
+  pc = 0;
+  while (pc < size)
+  {
+    uint8_t opcode = code[pc];
+    if (opcode == op_jz || opcode == op_jmp)
+    {
+      int32_t target = int32_t(pc) + 2 + int8_t(code[pc + 1]);
+      if (target < 0 || target >= int32_t(size) || !(is_instruction[target / 8] & (1 << (target % 8))))
+      {
+        Serial.printf("ERROR: Backlight program jump at byte %d has an invalid target!\n", pc);
+        return false;
+      }
+    }
+    pc += 1 + operandSize(opcode);
+  }
+
+  if (!sin_table_ready)
+  {
+    for (uint16_t i = 0; i < 256; i++)
+    {
+      sin_table[i] = uint8_t(round(127.5f + 127.5f * sin(2 * M_PI * i / 256)));
+    }
+    sin_table_ready = true;
+  }
+
+  memcpy(program, data, length);
+  code_length = size;
+  max_frame_us = 0;
+  Serial.printf("Backlight program loaded, %d bytes.\n", size);
+  return true;
+}
+
+bool BacklightProgram::runFrame(const Inputs &inputs, uint32_t *colors)
+{
+  if (!isLoaded())
+  {
+    return false;
+  }
+  uint32_t start_us = micros();
+  const uint8_t *code = program + header_size;
+  bool ok = true;
+  for (uint16_t led = 0; led < inputs.num_leds; led++)
+  {
+    if (!run(code, led, inputs, colors[led]))
+    {
+      memset(colors, 0, inputs.num_leds * sizeof(uint32_t));
+      ok = false;
+      break;
+    }
+  }
+  frame_us = micros() - start_us;
+  if (frame_us > max_frame_us)
+  {
+    max_frame_us = frame_us;
+  }
+  return ok;
+}
+
+bool BacklightProgram::run(const uint8_t *code, uint16_t led, const Inputs &inputs, uint32_t &color)
+{
+  int32_t stack[BACKLIGHT_PROGRAM_STACK_SIZE];
+  uint8_t sp = 0; // number of values on the stack
+  uint16_t pc = 0;
+  uint16_t budget = BACKLIGHT_PROGRAM_STEPS_PER_LED;
+
+// Stack checks, the program is already validated otherwise.
+#define NEED(n)   \
+  if (sp < (n))   \
+    goto error;
+#define ROOM(n)                                    \
+  if (sp + (n) > BACKLIGHT_PROGRAM_STACK_SIZE)     \
+    goto error;
+
+  while (budget--)
+  {
+    uint8_t opcode = code[pc++];
+    int32_t a, b;
+    switch (opcode)
+    {
+    case op_end:
+      NEED(1);
+      color = uint32_t(stack[sp - 1]) & 0xFFFFFF;
+      return true;
+    case op_push8:
+      ROOM(1);
+      stack[sp++] = code[pc++];
+      break;
+    case op_push16:
+      ROOM(1);
+      stack[sp++] = int16_t(code[pc] | (code[pc + 1] << 8));
+      pc += 2;
+      break;
+    case op_time:
+      ROOM(1);
+      stack[sp++] = int32_t(inputs.time_ms & 0x7FFFFFFF);
+      break;
+    case op_led:
+      ROOM(1);
+      stack[sp++] = led;
+      break;
+    case op_num_leds:
+      ROOM(1);
+      stack[sp++] = inputs.num_leds;
+      break;
+    case op_second:
+      ROOM(1);
+      stack[sp++] = inputs.second;
+      break;
+    case op_minute:
+      ROOM(1);
+      stack[sp++] = inputs.minute;
+      break;
+    case op_intensity:
+      ROOM(1);
+      stack[sp++] = inputs.intensity;
+      break;
+    case op_dup:
+      NEED(1);
+      ROOM(1);
+      stack[sp] = stack[sp - 1];
+      sp++;
+      break;
+    case op_over:
+      NEED(2);
+      ROOM(1);
+      stack[sp] = stack[sp - 2];
+      sp++;
+      break;
+    case op_swap:
+      NEED(2);
+      a = stack[sp - 1];
+      stack[sp - 1] = stack[sp - 2];
+      stack[sp - 2] = a;
+      break;
+    case op_drop:
+      NEED(1);
+      sp--;
+      break;
+    case op_jz:
+      NEED(1);
+      if (stack[--sp] == 0)
+      {
+        pc += int8_t(code[pc]);
+      }
+      pc++;
+      break;
+    case op_jmp:
+      pc += int8_t(code[pc]) + 1;
+      break;
+    case op_sin8:
+      NEED(1);
+      stack[sp - 1] = sin_table[stack[sp - 1] & 0xFF];
+      break;
+    case op_wheel:
+      NEED(1);
+      { // same as Backlights::phaseToColor()
+        a = stack[sp - 1] % 768;
+        if (a < 0)
+        {
+          a += 768;
+        }
+        uint8_t c[3];
+        for (uint8_t i = 0; i < 3; i++)
+        {
+          int32_t p = (a + i * 256) % 768;
+          c[i] = p <= 255 ? p : (p <= 511 ? 511 - p : 0);
+        }
+        stack[sp - 1] = (int32_t(c[0]) << 16) | (int32_t(c[1]) << 8) | c[2];
+      }
+      break;
+    case op_rgb:
+      NEED(3);
+      sp -= 2;
+      stack[sp - 1] = (constrain(stack[sp - 1], 0, 255) << 16) | (constrain(stack[sp], 0, 255) << 8) | constrain(stack[sp + 1], 0, 255);
+      break;
+    default: // binary operators
+      NEED(2);
+      b = stack[--sp];
+      a = stack[sp - 1];
+      switch (opcode)
+      {
+      case op_add:
+        a += b;
+        break;
+      case op_sub:
+        a -= b;
+        break;
+      case op_mul:
+        a *= b;
+        break;
+      case op_div:
+        a = b ? a / b : 0;
+        break;
+      case op_mod:
+        a = b ? a % b : 0;
+        if (a < 0)
+        {
+          a += b < 0 ? -b : b;
+        }
+        break;
+      case op_and:
+        a &= b;
+        break;
+      case op_or:
+        a |= b;
+        break;
+      case op_xor:
+        a ^= b;
+        break;
+      case op_shl:
+        a <<= (b & 31);
+        break;
+      case op_shr:
+        a >>= (b & 31);
+        break;
+      case op_min:
+        a = min(a, b);
+        break;
+      case op_max:
+        a = max(a, b);
+        break;
+      case op_lt:
+        a = a < b;
+        break;
+      case op_gt:
+        a = a > b;
+        break;
+      case op_eq:
+        a = a == b;
+        break;
+      }
+      stack[sp - 1] = a;
+      break;
+    }
+  }
+  budget_overruns++;
+  return false;
+
+error:
+  runtime_errors++;
+  return false;
+#undef NEED
+#undef ROOM
+}
@@ -0,0 +1,106 @@
+#ifndef BACKLIGHT_PROGRAM_H
+#define BACKLIGHT_PROGRAM_H
+
+#include "GLOBAL_DEFINES.h"
+
+/*
+ * A tiny stack machine to run user defined backlight effects, loaded at runtime from SPIFFS or MQTT.
+ *
+ * The program is run once for every LED in every frame and has to leave the color (0xRRGGBB) on the
+ * stack when it reaches END. All values are 32 bit signed integers.
+ *
+ * Program format: "BL", version byte, followed by the bytecode. Operands are little endian.
+ * Programs are checked once when loaded (valid opcodes, operands and jump targets), so the
+ * interpreter only has to check the stack depth and the instruction budget.
+ *
+ * Use script_backlight_asm.py to assemble programs from text.
+ */
+
+class BacklightProgram
+{
+public:
+  BacklightProgram() : code_length(0), frame_us(0), max_frame_us(0), budget_overruns(0), runtime_errors(0) {}
+
+  // Keep in sync with script_backlight_asm.py!
+  enum opcode_t : uint8_t
+  {
+    op_end,       // pop color, done
+    op_push8,     // push unsigned 8 bit operand
+    op_push16,    // push signed 16 bit operand
+    op_time,      // push millis()
+    op_led,       // push index of the LED being calculated
+    op_num_leds,  // push number of LEDs
+    op_second,    // push current second, 0..59
+    op_minute,    // push current minute, 0..59
+    op_intensity, // push backlight intensity, 0..7
+    op_add,       // a b -> a+b
+    op_sub,       // a b -> a-b
+    op_mul,       // a b -> a*b
+    op_div,       // a b -> a/b (0 if b == 0)
+    op_mod,       // a b -> a%b (0 if b == 0), result always positive
+    op_and,       // a b -> a&b
+    op_or,        // a b -> a|b
+    op_xor,       // a b -> a^b
+    op_shl,       // a b -> a<<b
+    op_shr,       // a b -> a>>b
+    op_dup,       // a -> a a
+    op_swap,      // a b -> b a
+    op_drop,      // a ->
+    op_over,      // a b -> a b a
+    op_min,       // a b -> min(a,b)
+    op_max,       // a b -> max(a,b)
+    op_lt,        // a b -> a<b
+    op_gt,        // a b -> a>b
+    op_eq,        // a b -> a==b
+    op_jz,        // a -> ; jump by signed 8 bit operand if a == 0
+    op_jmp,       // jump by signed 8 bit operand
+    op_sin8,      // a -> sine of a (0..255 is one period), result 0..255
+    op_wheel,     // phase -> color, 0..767 like the color phase of the other patterns
+    op_rgb,       // r g b -> 0xRRGGBB, each clamped to 0..255
+    num_opcodes
+  };
+
+  struct Inputs
+  {
+    uint32_t time_ms;
+    uint16_t num_leds;
+    uint8_t second;
+    uint8_t minute;
+    uint8_t intensity;
+  };
+
+  // Checks and copies the program. The running program is kept if the new one is invalid.
+  bool load(const uint8_t *data, size_t length);
+  void unload() { code_length = 0; }
+  bool isLoaded() { return code_length > 0; }
+  const uint8_t *getData() { return program; }
+  size_t getLength() { return code_length > 0 ? code_length + header_size : 0; }
+
+  // Calculates the colors of all LEDs. Returns false, if the program failed (colors are then black).
+  bool runFrame(const Inputs &inputs, uint32_t *colors);
+
+  uint32_t getFrameUs() { return frame_us; }
+  uint32_t getMaxFrameUs() { return max_frame_us; }
+  uint32_t getBudgetOverruns() { return budget_overruns; }
+  uint32_t getRuntimeErrors() { return runtime_errors; }
+
+  const static uint8_t header_size = 3;
+  const static uint8_t version = 1;
+
+private:
+  uint8_t program[BACKLIGHT_PROGRAM_MAX_SIZE + header_size];
+  uint16_t code_length; // without header, 0 = no program loaded
+
+  uint32_t frame_us;
+  uint32_t max_frame_us;
+  uint32_t budget_overruns;
+  uint32_t runtime_errors;
+
+  static uint8_t sin_table[256];
+  static bool sin_table_ready;
+
+  static int8_t operandSize(uint8_t opcode);
+  bool run(const uint8_t *code, uint16_t led, const Inputs &inputs, uint32_t &color);
+};
+
+#endif // BACKLIGHT_PROGRAM_H
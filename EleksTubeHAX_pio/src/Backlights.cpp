@@ -1,8 +1,16 @@
 #include "Backlights.h"
+#include "Clock.h"
 
-void Backlights::begin(StoredConfig::Config::Backlights *config_)
+#define FS_NO_GLOBALS
+#include <FS.h>
+#include "SPIFFS.h"
+
+const Backlights::Zone Backlights::zones[NUM_BACKLIGHT_ZONES] = BACKLIGHT_ZONES;
+
+void Backlights::begin(StoredConfig::Config::Backlights *config_, StoredConfig::Config::BacklightZones *zones_config_)
 {
   config = config_;
+  zones_config = zones_config_;
 
   if (config->is_valid != StoredConfig::valid)
   {
@@ -17,7 +25,65 @@ void Backlights::begin(StoredConfig::Config::Backlights *config_)
     setRainbowDuration(DEFAULT_BL_RAINBOW_DURATION_SEC);
     config->is_valid = StoredConfig::valid;
   }
+  // New zones start with the settings of zone 0, also the ones a build with more zones adds to the saved ones.
+  uint8_t saved_zones = zones_config->is_valid == StoredConfig::valid ? zones_config->count : 1;
+  for (uint8_t zone = max(saved_zones, (uint8_t)1); zone < NUM_BACKLIGHT_ZONES; zone++)
+  {
+    zones_config->zone[zone].pattern = config->pattern;
+    zones_config->zone[zone].color_phase = config->color_phase;
+    zones_config->zone[zone].intensity = config->intensity;
+  }
+  zones_config->count = NUM_BACKLIGHT_ZONES;
+  zones_config->is_valid = StoredConfig::valid;
+
+  // Map every LED to its zone, so a frame can be drawn in a single pass over all LEDs.
+  memset(led_zone, no_zone, sizeof(led_zone));
+  for (uint8_t zone = 0; zone < NUM_BACKLIGHT_ZONES; zone++)
+  {
+    if (zones[zone].first + zones[zone].length > NUM_BACKLIGHT_LEDS)
+    {
+      Serial.print("ERROR: Backlight zone ");
+      Serial.print(zones[zone].name);
+      Serial.println(" is outside of the LEDs, check BACKLIGHT_ZONES!");
+    }
+    for (uint16_t led = zones[zone].first; led < zones[zone].first + zones[zone].length && led < NUM_BACKLIGHT_LEDS; led++)
+    {
+      led_zone[led] = zone;
+    }
+    zone_off[zone] = false;
+  }
   off = false;
+  night_fade.jump(0);
+
+  events.subscribe(EventBus::maskOf(EventBus::second_tick) | EventBus::maskOf(EventBus::hour_chime) | EventBus::maskOf(EventBus::dimming_changed),
+                   &Backlights::onEvent, this);
+}
+
+void Backlights::onEvent(const EventBus::Event &event, void *context)
+{
+  Backlights *self = static_cast<Backlights *>(context);
+  switch (event.type)
+  {
+  case EventBus::second_tick:
+    if (self->pulseFitsSecond())
+    { // a pulse ends at the tick anyway, this only takes out the drift between both
+      self->millis_pulse_start = millis();
+    }
+    break;
+  case EventBus::hour_chime:
+#ifdef BACKLIGHT_HOUR_CHIME
+    if (!self->dimming)
+    { // no flashing during the night
+      self->millis_at_chime = millis() | 1; // never 0, which means "no chime active"
+    }
+#endif
+    break;
+  case EventBus::dimming_changed:
+    self->setDimming(event.value != 0);
+    break;
+  default:
+    break;
+  }
 }
 
 // These feel like they should be generalizable into a helper function.
@@ -55,126 +121,295 @@ void Backlights::adjustIntensity(int16_t adj)
 void Backlights::setIntensity(uint8_t intensity)
 {
   config->intensity = intensity;
-  setBrightness(0xFF >> max_intensity - config->intensity - 1);
   pattern_needs_init = true;
 }
 
-void Backlights::loop()
+void Backlights::setZonePattern(uint8_t zone, patterns p)
 {
-  //   enum patterns { dark, test, constant, rainbow, pulse, breath, num_patterns };
-  if (off || config->pattern == dark)
+  if (zone == 0)
   {
-    if (pattern_needs_init)
-    {
-      clear();
-      show();
-    }
+    setPattern(p);
+    return;
   }
-  else if (config->pattern == test)
+  zones_config->zone[zone].pattern = uint8_t(p);
+  pattern_needs_init = true;
+}
+
+void Backlights::setZoneColorPhase(uint8_t zone, uint16_t phase)
+{
+  if (zone == 0)
   {
-    testPattern();
+    setColorPhase(phase);
+    return;
   }
-  else if (config->pattern == constant)
+  zones_config->zone[zone].color_phase = phase % max_phase;
+  pattern_needs_init = true;
+}
+
+void Backlights::setZoneIntensity(uint8_t zone, uint8_t intensity)
+{
+  if (zone == 0)
   {
-    if (pattern_needs_init)
-    {
-      fill(phaseToColor(config->color_phase));
-    }
-    if (dimming)
-    {
-      setBrightness(0xFF >> max_intensity - BACKLIGHT_DIMMED_INTENSITY - 1);
-    }
-    else
-    {
-      setBrightness(0xFF >> max_intensity - config->intensity - 1);
-    }
-    show();
+    setIntensity(intensity);
+    return;
   }
-  else if (config->pattern == rainbow)
+  zones_config->zone[zone].intensity = intensity % max_intensity;
+  pattern_needs_init = true;
+}
+
+void Backlights::setZonePower(uint8_t zone, bool on)
+{
+  if (zone == 0)
   {
-    rainbowPattern();
+    on ? PowerOn() : PowerOff();
+    return;
   }
-  else if (config->pattern == pulse)
+  zone_off[zone] = !on;
+  pattern_needs_init = true;
+}
+
+void Backlights::loop()
+{
+  //   enum patterns { dark, test, constant, rainbow, pulse, breath, program, num_patterns };
+  night_fade.update();
+
+  if (millis_at_chime != 0 && millis() - millis_at_chime >= BACKLIGHT_CHIME_DURATION_MS)
+  { // chime is over, continue with the normal pattern
+    millis_at_chime = 0;
+    pattern_needs_init = true;
+  }
+
+  if (millis_at_chime != 0 && !off)
   {
-    pulsePattern();
+    chimePattern();
   }
-  else if (config->pattern == breath)
+  else
   {
-    breathPattern();
+    renderZones();
   }
 
   pattern_needs_init = false;
 }
 
-void Backlights::pulsePattern()
+void Backlights::renderZones()
 {
-  fill(phaseToColor(config->color_phase));
-
-  float pulse_length_millis = (60.0f * 1000) / config->pulse_bpm;
-  float val = 1 + abs(sin(2 * M_PI * millis() / pulse_length_millis)) * 254;
-  if (dimming)
+  ZoneFrame frames[NUM_BACKLIGHT_ZONES];
+  bool all_dark = true;
+  for (uint8_t zone = 0; zone < NUM_BACKLIGHT_ZONES; zone++)
   {
-    val = val * BACKLIGHT_DIMMED_INTENSITY / 7;
+    prepareZone(zone, frames[zone]);
+    all_dark = all_dark && frames[zone].pattern == dark;
   }
-  else
+  if (all_dark && !pattern_needs_init)
+  { // nothing changed, no need to send the same data to the LEDs again
+    return;
+  }
+
+  // The brightness is applied per zone below, the NeoPixel brightness would scale all LEDs the same way.
+  if (getBrightness() != 255)
   {
-    val = val * config->intensity / 7;
+    setBrightness(255);
   }
-  setBrightness((uint8_t)val);
 
+  // One pass over all LEDs, every LED takes its color from the precalculated frame of its zone.
+  for (uint16_t led = 0; led < NUM_BACKLIGHT_LEDS; led++)
+  {
+    uint8_t zone = led_zone[led];
+    if (zone == no_zone || frames[zone].pattern == dark)
+    {
+      setPixelColor(led, 0);
+      continue;
+    }
+    const ZoneFrame &frame = frames[zone];
+    uint16_t index = led - zones[zone].first; // LED number inside the zone
+    uint32_t color;
+    switch (frame.pattern)
+    {
+    case test:
+      color = index == frame.test_led ? frame.color : 0;
+      break;
+    case rainbow:
+      color = phaseToColor((frame.phase + index * frame.phase_per_led) % max_phase);
+      break;
+    case program:
+      color = program_colors[led];
+      break;
+    default:
+      color = frame.color;
+      break;
+    }
+    uint16_t scale = uint16_t(frame.brightness) + 1;
+    setPixelColor(led, ((color >> 16 & 0xFF) * scale) >> 8, ((color >> 8 & 0xFF) * scale) >> 8, ((color & 0xFF) * scale) >> 8);
+  }
   show();
 }
 
-void Backlights::breathPattern()
+void Backlights::prepareZone(uint8_t zone, ZoneFrame &frame)
 {
-  fill(phaseToColor(config->color_phase));
-
-  // https://sean.voisen.org/blog/2011/10/breathing-led-with-arduino/
-  // Avoid a 0 value as it shuts off the LEDs and we have to re-initialize.
-  float pulse_length_millis = (60.0f * 1000) / config->breath_per_min;
-  float val = (exp(sin(2 * M_PI * millis() / pulse_length_millis)) - 0.36787944f) * 108.0f;
+  frame.pattern = (off || zone_off[zone]) ? dark : getZonePattern(zone);
+  uint8_t intensity = getZoneIntensity(zone);
+  frame.color = phaseToColor(getZoneColorPhase(zone));
+  frame.brightness = 0;
 
-  if (dimming)
+  switch (frame.pattern)
+  {
+  case test:
   {
-    val = val * BACKLIGHT_DIMMED_INTENSITY / 7;
+    const uint8_t num_colors = 4; // or 3 if you don't want black
+    uint16_t num_states = zones[zone].length * num_colors;
+    uint16_t state = (millis() / test_ms_delay) % num_states;
+    frame.test_led = state / num_colors;
+    frame.color = 0xFF0000 >> (state % num_colors) * 8;
+    frame.brightness = dimmedBrightness(intensity, false);
+    break;
   }
-  else
+  case constant:
+    frame.brightness = dimmedBrightness(intensity, false);
+    break;
+  case rainbow:
   {
-    val = val * config->intensity / 7;
+    // Divide by 3 to spread it out some, so the whole rainbow isn't displayed at once.
+    // TODO Make this /3 a parameter
+    frame.phase_per_led = (max_phase / zones[zone].length) / 3;
+    // Rainbow roatation speed now configurable
+    uint16_t duration = uint16_t(round(getRainbowDuration() * 1000));
+    frame.phase = uint16_t(round(float(millis() % duration) / duration * max_phase));
+#if BACKLIGHT_DIMMED_INTENSITY > 0
+    frame.brightness = dimmedBrightness(intensity, false);
+#else // turn off backlight if intensity is 0
+    frame.brightness = dimmedBrightness(intensity, true);
+#endif
+    break;
   }
+  case pulse:
+    frame.brightness = pulseBrightness(intensity);
+    break;
+  case breath:
+    frame.brightness = breathBrightness(intensity);
+    break;
+  case program:
+    runProgram(zone);
+    frame.brightness = dimmedBrightness(intensity, false);
+    break;
+  default:
+    break;
+  }
+}
+
+uint8_t Backlights::dimmedBrightness(uint8_t intensity, bool night_off)
+{
+  uint8_t night_brightness = night_off ? 0 : 0xFF >> max_intensity - (uint8_t)BACKLIGHT_DIMMED_INTENSITY - 1;
+  return (uint8_t)dimmedValue(0xFF >> max_intensity - intensity - 1, night_brightness);
+}
+
+// True if a whole number of pulses (half periods of the sine) fits into one second, e.g. at 30, 60 or 90 bpm.
+// Only then the pulse can restart at every seconds tick without a jump in the brightness.
+bool Backlights::pulseFitsSecond()
+{
+  return config->pulse_bpm > 0 && config->pulse_bpm % 30 == 0; // bpm / 30 = pulses per second
+}
+
+uint8_t Backlights::pulseBrightness(uint8_t intensity)
+{
+  // The phase runs on continuously, it is only lined up with the seconds tick if the pulse fits into a second.
+  float pulse_length_millis = (60.0f * 1000) / config->pulse_bpm;
+  float val = 1 + abs(sin(2 * M_PI * (millis() - millis_pulse_start) / pulse_length_millis)) * 254;
+  val = val * dimmedValue(intensity, BACKLIGHT_DIMMED_INTENSITY) / 7;
+  return (uint8_t)val;
+}
+
+uint8_t Backlights::breathBrightness(uint8_t intensity)
+{
+  // https://sean.voisen.org/blog/2011/10/breathing-led-with-arduino/
+  // Avoid a 0 value, so the LEDs don't turn off completely.
+  float pulse_length_millis = (60.0f * 1000) / config->breath_per_min;
+  float val = (exp(sin(2 * M_PI * millis() / pulse_length_millis)) - 0.36787944f) * 108.0f;
+  val = val * dimmedValue(intensity, BACKLIGHT_DIMMED_INTENSITY) / 7;
 
   uint8_t brightness = (uint8_t)val;
   if (brightness < 1)
   {
     brightness = 1;
   }
-  setBrightness(brightness);
+  return brightness;
+}
+
+void Backlights::chimePattern()
+{
+  uint32_t elapsed = millis() - millis_at_chime;
 
+  // Full white flash, fading out over the chime duration.
+  fill(0xFFFFFF);
+  setBrightness(uint8_t(255 - (elapsed * 255) / BACKLIGHT_CHIME_DURATION_MS));
   show();
 }
 
-void Backlights::testPattern()
+void Backlights::runProgram(uint8_t zone)
 {
-  const uint8_t num_colors = 4; // or 3 if you don't want black
-  uint8_t num_states = NUM_BACKLIGHT_LEDS * num_colors;
-  uint8_t state = (millis() / test_ms_delay) % num_states;
+  uint32_t *colors = program_colors + zones[zone].first;
+  uint16_t num_leds = min<uint16_t>(zones[zone].length, NUM_BACKLIGHT_LEDS - zones[zone].first);
+
+  if (!program_file_checked)
+  { // SPIFFS is not mounted yet in begin(), so load on first use
+    program_file_checked = true;
+    if (!user_program.isLoaded())
+    {
+      loadProgramFromFile();
+    }
+  }
 
-  uint8_t digit = state / num_colors;
-  uint32_t color = 0xFF0000 >> (state % num_colors) * 8;
+  if (!user_program.isLoaded())
+  { // nothing to run, show the constant color instead
+    uint32_t color = phaseToColor(getZoneColorPhase(zone));
+    for (uint16_t led = 0; led < num_leds; led++)
+    {
+      colors[led] = color;
+    }
+    return;
+  }
 
-  clear();
-  setPixelColor(digit, color);
+  // Every zone runs the program with its own LED numbers, starting at 0.
+  BacklightProgram::Inputs inputs;
+  inputs.time_ms = millis();
+  inputs.num_leds = num_leds;
+  inputs.second = uclock.getSecond();
+  inputs.minute = uclock.getMinute();
+  inputs.intensity = getZoneIntensity(zone);
+  user_program.runFrame(inputs, colors); // black on error
+}
 
-  if (dimming)
+bool Backlights::loadProgram(const uint8_t *data, size_t length, bool save)
+{
+  if (!user_program.load(data, length))
   {
-    setBrightness(0xFF >> max_intensity - (uint8_t)BACKLIGHT_DIMMED_INTENSITY - 1);
+    return false;
   }
-  else
+  program_file_checked = true; // newer than the file
+  pattern_needs_init = true;
+  if (save)
   {
-    setBrightness(0xFF >> max_intensity - config->intensity - 1);
+    fs::File f = SPIFFS.open(BACKLIGHT_PROGRAM_FILE, "w");
+    if (!f || f.write(data, length) != length)
+    {
+      Serial.println("ERROR: Saving the backlight program failed!");
+    }
+    f.close();
   }
+  return true;
+}
 
-  show();
+void Backlights::loadProgramFromFile()
+{
+  fs::File f = SPIFFS.open(BACKLIGHT_PROGRAM_FILE, "r");
+  if (!f)
+  {
+    Serial.println("No backlight program found in SPIFFS.");
+    return;
+  }
+  uint8_t buffer[BACKLIGHT_PROGRAM_MAX_SIZE + BacklightProgram::header_size];
+  size_t length = f.read(buffer, sizeof(buffer));
+  f.close();
+  user_program.load(buffer, length);
 }
 
 uint8_t Backlights::phaseToIntensity(uint16_t phase)
@@ -233,36 +468,5 @@ float Backlights::phaseToHue(uint32_t phase)
   return (round(hue));
 }
 
-void Backlights::rainbowPattern()
-{
-  // Divide by 3 to spread it out some, so the whole rainbow isn't displayed at once.
-  // TODO Make this /3 a parameter
-  const uint16_t phase_per_digit = (max_phase / NUM_BACKLIGHT_LEDS) / 3;
-
-  // Rainbow roatation speed now configurable
-  uint16_t duration = uint16_t(round(getRainbowDuration() * 1000));
-  uint16_t phase = uint16_t(round(float(millis() % duration) / duration * max_phase));
-
-  for (uint8_t digit = 0; digit < NUM_DIGITS; digit++)
-  {
-    // Shift the phase for this LED.
-    uint16_t my_phase = (phase + digit * phase_per_digit) % max_phase;
-    setPixelColor(digit, phaseToColor(my_phase));
-  }
-  if (dimming)
-  {
-#if BACKLIGHT_DIMMED_INTENSITY > 0
-    setBrightness(0xFF >> max_intensity - (uint8_t)BACKLIGHT_DIMMED_INTENSITY - 1);
-#else // turn off backlight if intensity is 0
-    setBrightness(0);
-#endif
-  }
-  else
-  {
-    setBrightness(0xFF >> max_intensity - config->intensity - 1);
-  }
-  show();
-}
-
 const String Backlights::patterns_str[Backlights::num_patterns] =
-    {"Dark", "Test", "Constant", "Rainbow", "Pulse", "Breath"};
+    {"Dark", "Test", "Constant", "Rainbow", "Pulse", "Breath", "Program"};
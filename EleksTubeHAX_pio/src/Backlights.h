@@ -16,6 +16,9 @@
 #include <stdint.h>
 #include <math.h>
 #include "StoredConfig.h"
+#include "EventBus.h"
+#include "Fade.h"
+#include "BacklightProgram.h"
 #include <Adafruit_NeoPixel.h>
 
 class Backlights : public Adafruit_NeoPixel
@@ -34,13 +37,15 @@ public:
     rainbow,
     pulse,
     breath,
+    program,
     num_patterns
   };
   const static String patterns_str[num_patterns];
 
-  void begin(StoredConfig::Config::Backlights *config_);
+  void begin(StoredConfig::Config::Backlights *config_, StoredConfig::Config::BacklightZones *zones_config_);
   void loop();
 
+  // Power switches all zones, the power of a single zone can be set with setZonePower().
   void togglePower()
   {
     off = !off;
@@ -90,9 +95,36 @@ public:
   void adjustIntensity(int16_t adj);
   uint8_t getIntensity() { return config->intensity; }
 
+  // User program for the "Program" pattern. If save is set, the program is stored in SPIFFS for the next start.
+  bool loadProgram(const uint8_t *data, size_t length, bool save);
+  BacklightProgram &getProgram() { return user_program; }
+
+  // Backlight zones, see BACKLIGHT_ZONES. Zone 0 is the same as the methods above, all other zones have
+  // their own pattern, color and intensity. Pulse rate, breath rate and rainbow duration are shared.
+  struct Zone
+  {
+    uint16_t first;   // first LED
+    uint16_t length;  // number of LEDs
+    const char *name; // for Home Assistant
+  };
+  const static Zone zones[NUM_BACKLIGHT_ZONES];
+
+  uint8_t getNumZones() { return NUM_BACKLIGHT_ZONES; }
+  const char *getZoneName(uint8_t zone) { return zones[zone].name; }
+  void setZonePattern(uint8_t zone, patterns p);
+  patterns getZonePattern(uint8_t zone) { return patterns(zone == 0 ? config->pattern : zones_config->zone[zone].pattern); }
+  String getZonePatternStr(uint8_t zone) { return patterns_str[getZonePattern(zone)]; }
+  void setZoneColorPhase(uint8_t zone, uint16_t phase);
+  uint16_t getZoneColorPhase(uint8_t zone) { return zone == 0 ? config->color_phase : zones_config->zone[zone].color_phase; }
+  void setZoneIntensity(uint8_t zone, uint8_t intensity);
+  uint8_t getZoneIntensity(uint8_t zone) { return zone == 0 ? config->intensity : zones_config->zone[zone].intensity; }
+  void setZonePower(uint8_t zone, bool on);
+  bool getZonePower(uint8_t zone) { return zone == 0 ? !off : !zone_off[zone]; }
+
   void setDimming(bool dim)
   {
     dimming = dim;
+    night_fade.start(dim ? 255 : 0);
     pattern_needs_init = true;
   }
 
@@ -107,17 +139,49 @@ public:
 
 private:
   bool dimming = false;
+  Fade night_fade; // 0 = day time brightness, 255 = night time brightness, ramps between both when dimming changes
+  // Value between the day and the night value, following the dimming fade.
+  float dimmedValue(float day_value, float night_value) { return day_value + (night_value - day_value) * night_fade.value() / 255.0f; }
   bool pattern_needs_init;
   bool off;
 
+  // Clock events from the event bus
+  static void onEvent(const EventBus::Event &event, void *context);
+  uint32_t millis_pulse_start = 0; // phase origin of the pulse pattern, moved to the seconds tick if the pulse fits into a second
+  uint32_t millis_at_chime = 0;    // when the hour chime was started, 0 = no chime active
+  bool pulseFitsSecond();
+
   // Pattern configs, get backed up.
   StoredConfig::Config::Backlights *config;
+  StoredConfig::Config::BacklightZones *zones_config;
+  bool zone_off[NUM_BACKLIGHT_ZONES];
+  uint8_t led_zone[NUM_BACKLIGHT_LEDS]; // zone of every LED, no_zone if the LED is not part of any zone
+  const static uint8_t no_zone = 0xFF;
+
+  // Everything a pattern needs for one frame of one zone, calculated once per frame in renderZones().
+  struct ZoneFrame
+  {
+    uint8_t pattern;
+    uint32_t color;     // constant color, or the color of the lit LED in the test pattern
+    uint16_t phase;     // rainbow phase of the first LED
+    uint16_t phase_per_led;
+    uint16_t test_led;  // lit LED in the test pattern, counted from the start of the zone
+    uint8_t brightness; // 0 to 255, applied to the colors of all LEDs in the zone
+  };
 
   // Pattern methods
-  void testPattern();
-  void rainbowPattern();
-  void pulsePattern();
-  void breathPattern();
+  void renderZones();
+  void prepareZone(uint8_t zone, ZoneFrame &frame);
+  uint8_t dimmedBrightness(uint8_t intensity, bool night_off);
+  uint8_t pulseBrightness(uint8_t intensity);
+  uint8_t breathBrightness(uint8_t intensity);
+  void chimePattern();
+  void runProgram(uint8_t zone);
+
+  BacklightProgram user_program;
+  bool program_file_checked = false;
+  uint32_t program_colors[NUM_BACKLIGHT_LEDS];
+  void loadProgramFromFile();
 
   const uint32_t test_ms_delay = 250;
 };
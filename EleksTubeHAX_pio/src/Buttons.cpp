@@ -1,4 +1,5 @@
 #include "Buttons.h"
+#include "EventBus.h"
 
 //----------------------------------------------
 // Implementation of Button class
@@ -130,6 +131,15 @@ void Buttons::loop()
   mode.loop();
   right.loop();
   power.loop();
+
+  if (left.isDownEdge())
+    events.publish(EventBus::button_pressed, 0);
+  if (mode.isDownEdge())
+    events.publish(EventBus::button_pressed, 1);
+  if (right.isDownEdge())
+    events.publish(EventBus::button_pressed, 2);
+  if (power.isDownEdge())
+    events.publish(EventBus::button_pressed, 3);
 }
 
 bool Buttons::stateChanged()
@@ -151,6 +161,9 @@ void Buttons::begin()
 void Buttons::loop()
 {
   mode.loop();
+
+  if (mode.isDownEdge())
+    events.publish(EventBus::button_pressed, 1);
 }
 
 bool Buttons::stateChanged()
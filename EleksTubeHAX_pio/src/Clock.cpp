@@ -1,6 +1,8 @@
 #include "Clock.h"
 #include "WiFi_WPS.h"
 
+extern StoredConfig stored_config;
+
 #if defined(HARDWARE_SI_HAI_CLOCK) || defined(HARDWARE_IPSTUBE_CLOCK) // for Clocks with DS1302 chip (SI HAI or IPSTUBE)
 #include <ThreeWire.h>
 #include <RtcDS1302.h>
@@ -123,6 +125,9 @@ uint32_t RtcGet()
 #include <RTClib.h>
 
 RTC_DS3231 RTC; // DS3231, works also with DS1307 or PCF8523
+#ifndef RTC_NO_AGING_REGISTER
+#define RTC_AGING_REGISTER
+#endif
 
 void RtcBegin()
 {
@@ -227,11 +232,31 @@ void RtcSet(uint32_t tt)
   Serial.println("DEBUG_OUTPUT_RTC: DS3231/DS1307 RTC time updated.");
 #endif
 }
+
+#ifdef RTC_AGING_REGISTER
+void RtcSetAging(int8_t aging)
+{
+  // Aging offset register of the DS3231: about 0.1 ppm per step, positive values slow the oscillator down.
+  // It is used with the next temperature conversion, so after 64 s at the latest.
+  Wire.beginTransmission(0x68);
+  Wire.write(0x10);
+  Wire.write((uint8_t)aging);
+  if (Wire.endTransmission() != 0)
+  {
+    Serial.println("Writing the DS3231 aging register failed!");
+  }
+#ifdef DEBUG_OUTPUT_RTC
+  Serial.print("DEBUG_OUTPUT_RTC: DS3231 aging register set to: ");
+  Serial.println(aging);
+#endif
+}
+#endif
 #endif // end of RTC chip selection
 
-void Clock::begin(StoredConfig::Config::Clock *config_)
+void Clock::begin(StoredConfig::Config::Clock *config_, StoredConfig::Config::RtcDrift *drift_config_, StoredConfig::Config::TimeZone *tz_config_)
 {
   config = config_;
+  tz_config = tz_config_;
 
   if (config->is_valid != StoredConfig::valid)
   {
@@ -245,26 +270,452 @@ void Clock::begin(StoredConfig::Config::Clock *config_)
     config->is_valid = StoredConfig::valid;
   }
 
+  if (tz_config->is_valid != StoredConfig::valid)
+  {
+    tz_config->rule[0] = '\0'; // fixed offset, like before time zone rules existed
+#ifdef TIME_ZONE
+    setTimeZone(TIME_ZONE);
+#endif
+    tz_config->is_valid = StoredConfig::valid;
+  }
+  else if (hasTimeZoneRule() && !time_zone.setRule(tz_config->rule))
+  {
+    Serial.println("Stored time zone rule is invalid, using the fixed offset.");
+    tz_config->rule[0] = '\0';
+  }
+  updateDigits();
+
   RtcBegin();
+  rtc_drift.begin(drift_config_);
+#ifdef RTC_AGING_REGISTER
+  RtcSetAging(rtc_drift.getAging()); // the DS3231 forgets it without power
+#endif
+  if (rtc_drift.isCalibrated())
+  {
+    Serial.print("RTC drift: ");
+    Serial.print(rtc_drift.getPpm(), 2);
+    Serial.print(" ppm, aging offset: ");
+    Serial.println(rtc_drift.getAging());
+  }
   ntpTimeClient.begin();
-  ntpTimeClient.update();  
-  Serial.print("NTP time = ");
-  //millis_last_ntp = millis();
-  Serial.println(ntpTimeClient.getFormattedTime());
+  if (WifiState == connected)
+  { // Waiting is fine during start-up, so the first displayed time is already the NTP time.
+    startNtpBurst();
+    uint32_t start = millis();
+    while (ntp_burst_active && millis() - start < NTP_BURST_SAMPLES * (NTP_BURST_INTERVAL_MS + NTP_DEFAULT_REQUEST_TIMEOUT))
+    {
+      loopNtp();
+      delay(10);
+    }
+  }
+  if (timeStatus() == timeNotSet)
+  { // Not synced by the NTP burst. Syncing again would replace its time by the not yet corrected RTC.
+    setSyncProvider(&Clock::syncProvider);
+  }
+}
+
+void Clock::startNtpBurst()
+{
+  Serial.println("Try to get the actual time from NTP servers...");
+  ntp_filter.reset();
+  ntp_burst_active = true;
+  ntp_request_running = false;
+  ntp_burst_sample = 0;
+  ntp_burst_start = millis();
+  millis_next_ntp_request = millis();
+  millis_last_ntp_try = millis();
+  // The DNS lookups block for up to seconds, so they run in a task, once per burst instead of once per request.
+  ntp_resolving = true;
+  if (xTaskCreatePinnedToCore(ntpResolveTask, "ntp_resolve", NTP_RESOLVE_TASK_STACK, NULL, 1, NULL, 0) != pdPASS)
+  {
+    Serial.println("ERROR: Can't start the NTP resolve task!");
+    ntp_resolving = false; // use the addresses of the last burst
+  }
+}
+
+void Clock::ntpResolveTask(void *parameter)
+{
+  for (uint8_t i = 0; i < num_ntp_servers; i++)
+  {
+    IPAddress ip;
+    if (!WiFi.hostByName(ntp_servers[i], ip))
+      ip = IPAddress(0, 0, 0, 0);
+    ntp_server_ips[i] = ip;
+  }
+  ntp_resolving = false;
+  vTaskDelete(NULL);
+}
+
+void Clock::finishNtpBurst()
+{
+  ntp_burst_active = false;
+  if (!ntp_filter.compute())
+  {
+    Serial.print("NTP burst failed: ");
+    Serial.print(ntp_filter.getNumSamples());
+    Serial.print(" answers, ");
+    Serial.print(ntp_filter.getNumFalsetickers());
+    Serial.println(" servers disagree. Using RTC time.");
+    return;
+  }
+  ntp_epoch_ms_at_burst_start = ntp_filter.getOffset();
+  ntp_jitter_ms = ntp_filter.getJitter();
+  ntp_result_ready = true;
+  Serial.print("NTP burst done: ");
+  Serial.print(ntp_filter.getNumSamples());
+  Serial.print(" answers, ");
+  Serial.print(ntp_filter.getNumTruechimers());
+  Serial.print(" servers used, ");
+  Serial.print(ntp_filter.getNumFalsetickers());
+  Serial.print(" rejected, delay ");
+  Serial.print(ntp_filter.getDelay());
+  Serial.print(" ms, jitter ");
+  Serial.print(ntp_jitter_ms);
+  Serial.println(" ms");
+  // Let TimeLib sync now, syncProvider() picks up the new result.
   setSyncProvider(&Clock::syncProvider);
 }
 
+void Clock::loopNtp()
+{
+  if (ntp_request_running)
+  {
+    NTPClient::RequestState state = ntpTimeClient.poll();
+    if (state == NTPClient::REQUEST_WAITING)
+    {
+      return;
+    }
+    uint8_t server = ntp_burst_sample % num_ntp_servers;
+    if (ntpTimeClient.consumeResult())
+    {
+      uint64_t ntp_ms = ntpTimeClient.getEpochMillis();
+      if (ntp_ms / 1000 < 1743364444)
+      { // NTP can't be valid!
+        Serial.print("Time returned from NTP server ");
+        Serial.print(ntp_servers[server]);
+        Serial.println(" is not valid!");
+      }
+      else
+      { // The sample is the NTP time at the start of the burst, so all samples are comparable.
+        ntp_filter.addSample(server, int64_t(ntp_ms) - (uint32_t)(millis() - ntp_burst_start), ntpTimeClient.getRoundTripDelay());
+      }
+    }
+    else
+    {
+      Serial.print("NTP query to ");
+      Serial.print(ntp_servers[server]);
+      Serial.println(" failed.");
+    }
+    ntp_request_running = false;
+    ntp_burst_sample++;
+    millis_next_ntp_request = millis() + NTP_BURST_INTERVAL_MS;
+    if (ntp_burst_sample >= NTP_BURST_SAMPLES)
+    {
+      finishNtpBurst();
+    }
+    return;
+  }
+
+  if (ntp_burst_active)
+  {
+    if (!ntp_resolving && (int32_t)(millis() - millis_next_ntp_request) >= 0)
+    {
+      ntpTimeClient.setPoolServerIP(ntp_server_ips[ntp_burst_sample % num_ntp_servers]);
+      ntpTimeClient.startRequest(); // a send error shows up as failed request in the next poll()
+      ntp_request_running = true;
+    }
+    return;
+  }
+
+  bool ntp_due = millis_last_ntp == 0 || millis() - millis_last_ntp > refresh_ntp_ms;
+  if (ntp_due && WifiState == connected && (millis_last_ntp_try == 0 || millis() - millis_last_ntp_try > retry_ntp_every_ms))
+  {
+    startNtpBurst();
+  }
+}
+
+uint32_t Clock::rtcRead(uint32_t max_age_ms)
+{
+  if (rtc_cache_valid && millis() - millis_rtc_cache <= max_age_ms)
+  {
+    rtc_stats.cache_hits++;
+    return rtc_cache_second;
+  }
+  // All libraries read the time registers in one burst: a single I2C transaction or a DS1302 burst read.
+  uint32_t start_us = micros();
+  rtc_cache_second = RtcGet();
+  uint32_t read_us = micros() - start_us;
+  millis_rtc_cache = millis();
+  rtc_cache_valid = true;
+  rtc_stats.reads++;
+  rtc_stats.read_us_sum += read_us;
+  if (read_us > rtc_stats.max_read_us)
+  {
+    rtc_stats.max_read_us = read_us;
+  }
+  return rtc_cache_second;
+}
+
+void Clock::rtcWrite(uint32_t t)
+{
+  uint32_t start_us = micros();
+  RtcSet(t);
+  uint32_t write_us = micros() - start_us;
+  rtc_stats.writes++;
+  if (write_us > rtc_stats.max_write_us)
+  {
+    rtc_stats.max_write_us = write_us;
+  }
+  rtc_cache_second = t; // the RTC has just started this second
+  millis_rtc_cache = millis();
+  rtc_cache_valid = true;
+}
+
+void Clock::printRtcStats()
+{
+  Serial.print("RTC access: ");
+  Serial.print(rtc_stats.reads);
+  Serial.print(" reads, ");
+  Serial.print(rtc_stats.cache_hits);
+  Serial.print(" from cache, read time avg/max (us) ");
+  Serial.print(getRtcAvgReadUs());
+  Serial.print("/");
+  Serial.print(rtc_stats.max_read_us);
+  Serial.print(", ");
+  Serial.print(rtc_stats.writes);
+  Serial.print(" writes, max write time (us) ");
+  Serial.println(rtc_stats.max_write_us);
+}
+
+void Clock::startRtcCheck(bool align)
+{
+  rtc_check = rtc_check_start;
+  rtc_check_align = align;
+}
+
+void Clock::loopRtcCheck()
+{
+  // The RTC counts whole seconds and restarts its second when it is written,
+  // so it is measured at its second boundary and written shortly after the real one.
+  if (rtc_check == rtc_check_start)
+  {
+    rtc_read_done = false;
+    rtc_check_start_us = esp_timer_get_time();
+    if (rtc_check_align)
+    {
+      millis_last_rtc_align = millis();
+    }
+    rtc_check = rtc_check_measure;
+  }
+
+  if (rtc_check == rtc_check_measure)
+  {
+    int64_t now_us = esp_timer_get_time();
+    if (rtc_read_done && now_us - rtc_read_us < rtc_poll_us)
+    {
+      return;
+    }
+    uint32_t rtc_second = rtcRead(0); // always a fresh read
+    if (rtc_read_done && rtc_second == rtc_last_second + 1)
+    { // The RTC second started between the last read and this one.
+      int64_t half_us = (now_us - rtc_read_us) / 2;
+      int64_t boundary_us = rtc_read_us + half_us;
+      rtc_check = rtc_check_none;
+      if (rtc_check_align)
+      { // The RTC second started at rtc_second + its predicted error.
+        uint64_t rtc_us = uint64_t(int64_t(rtc_second) * 1000000 - llroundf(rtc_drift.predictError(rtc_second) * 1000));
+        if (ms_known)
+        {
+          Serial.print("Clock aligned with the RTC second, error ");
+          Serial.print((int32_t)(disciplined_clock.discipline(boundary_us, rtc_us) / 1000));
+          Serial.print(" ms, crystal rate ");
+          Serial.print(disciplined_clock.getRatePpm(), 1);
+          Serial.println(" ppm.");
+        }
+        else
+        {
+          disciplined_clock.set(boundary_us, rtc_us);
+          Serial.println("Clock aligned with the RTC second.");
+        }
+        ms_known = true;
+      }
+      else
+      {
+        uint64_t ntp_ms = disciplined_clock.now(boundary_us) / 1000;
+        checkRtcError(rtc_second, float(int64_t(rtc_second) * 1000 - int64_t(ntp_ms)), half_us / 1000);
+      }
+      return;
+    }
+    if (now_us - rtc_check_start_us > 2000000)
+    {
+      Serial.println("RTC second does not change, RTC not checked!");
+      rtc_check = rtc_check_none;
+      return;
+    }
+    rtc_last_second = rtc_second;
+    rtc_read_us = now_us;
+    rtc_read_done = true;
+    return;
+  }
+
+  if (rtc_check == rtc_check_set)
+  {
+    uint64_t ms = nowMs();
+    uint32_t fraction = ms % 1000;
+    if (fraction < 100)
+    {
+      rtc_check = rtc_check_none;
+      rtcWrite(ms / 1000);
+      // The RTC starts its second now, so it lags by the fraction.
+      if (rtc_new_segment)
+      {
+        rtc_drift.startSegment(ms / 1000, -float(fraction));
+      }
+      else
+      {
+        rtc_drift.addCorrection(rtc_error_before_set, -float(fraction));
+      }
+      stored_config.save();
+      Serial.print("RTC set to NTP time, ");
+      Serial.print(fraction);
+      Serial.println(" ms after the second.");
+    }
+  }
+}
+
+void Clock::checkRtcError(uint32_t rtc_second, float error_ms, uint32_t uncertainty_ms)
+{
+  Serial.print("RTC error: ");
+  Serial.print(error_ms, 0);
+  Serial.print(" ms (+-");
+  Serial.print(uncertainty_ms);
+  Serial.println(" ms)");
+
+  rtc_new_segment = fabsf(error_ms) > 10000;
+  if (rtc_new_segment)
+  { // Not drift, the RTC was reset or lost its power.
+    refresh_ntp_ms = NTP_REFRESH_MIN_MS;
+    rtc_error_before_set = error_ms;
+    rtc_check = rtc_check_set;
+    return;
+  }
+
+  // Sync less often while the drift model predicts the RTC well, the clock follows the RTC in between.
+  if (rtc_drift.isCalibrated())
+  {
+    float predicted_ms = rtc_drift.predictError(rtc_second);
+    if (fabsf(error_ms - predicted_ms) < RTC_DRIFT_GOOD_MS + uncertainty_ms)
+    {
+      refresh_ntp_ms = min(2 * refresh_ntp_ms, (uint32_t)NTP_REFRESH_MAX_MS);
+    }
+    else
+    {
+      refresh_ntp_ms = NTP_REFRESH_MIN_MS;
+    }
+    Serial.print("Predicted RTC error: ");
+    Serial.print(predicted_ms, 0);
+    Serial.print(" ms, next NTP sync in ");
+    Serial.print(refresh_ntp_ms / 60000);
+    Serial.println(" min.");
+  }
+
+  if (rtc_drift.addMeasurement(rtc_second, error_ms))
+  {
+    Serial.print("RTC drift: ");
+    Serial.print(rtc_drift.getPpm(), 2);
+    Serial.println(" ppm");
+#ifdef RTC_AGING_REGISTER
+    int aging = rtc_drift.getAging();
+    int steps = constrain(lroundf(rtc_drift.getPpm() * 10), -128 - aging, 127 - aging);
+    if (abs(steps) >= 2) // below that the software correction is good enough, avoids toggling between two values
+    {
+      RtcSetAging(aging + steps);
+      rtc_drift.applyAging(steps, rtc_second, error_ms);
+      Serial.print("DS3231 aging offset set to ");
+      Serial.println(aging + steps);
+    }
+#endif
+  }
+  stored_config.save();
+
+  // Only correct the RTC if it is off by more than the measurement can tell.
+  if (fabsf(error_ms) > rtc_tolerance_ms + uncertainty_ms)
+  {
+    rtc_error_before_set = error_ms;
+    rtc_check = rtc_check_set;
+  }
+  else
+  {
+    Serial.print("RTC is within ");
+    Serial.print(rtc_tolerance_ms + uncertainty_ms);
+    Serial.println(" ms of NTP time.");
+  }
+}
+
 void Clock::loop()
 {
+  changed_fields = 0;
+  loopNtp();
+  if (rtc_check != rtc_check_none)
+  {
+    loopRtcCheck();
+  }
+  else if (!ntp_burst_active && (!ms_known || rtc_drift.isCalibrated()) &&
+           (millis_last_rtc_align == 0 || millis() - millis_last_rtc_align > RTC_ANCHOR_EVERY_MS) &&
+           (millis_last_ntp == 0 || millis() - millis_last_ntp > RTC_ANCHOR_EVERY_MS))
+  { // No recent NTP time, follow the RTC.
+    startRtcCheck(true);
+  }
+
   if (timeStatus() == timeNotSet)
   {
     time_valid = false;
   }
   else
   {
-    loop_time = now();
-    local_time = loop_time + config->time_zone_offset;
+    loop_time = now(); // keeps TimeLib syncing
+    if (ms_known)
+    { // the digits change on the real second boundary, not when TimeLib synced last
+      loop_time = nowMs() / 1000;
+    }
+    local_time = loop_time + getTimeZoneOffset();
     time_valid = true;
+    if (local_time != cached_local_time)
+    {
+      updateTimeCache();
+    }
+    publishTimeEvents();
+  }
+}
+
+void Clock::publishTimeEvents()
+{
+  uint8_t current_second = getSecond();
+  if (current_second == last_second)
+  {
+    return;
+  }
+  last_second = current_second;
+  events.publish(EventBus::second_tick, current_second);
+
+  uint8_t current_minute = getMinute();
+  if (current_minute != last_minute)
+  {
+    if (last_minute != 255) // no rollover on the first valid time after boot
+    {
+      events.publish(EventBus::minute_rollover, current_minute);
+    }
+    last_minute = current_minute;
+  }
+
+  uint8_t current_hour = getHour24();
+  if (current_hour != last_hour)
+  {
+    if (last_hour != 255)
+    {
+      events.publish(EventBus::hour_chime, current_hour);
+    }
+    last_hour = current_hour;
   }
 }
 
@@ -274,76 +725,156 @@ time_t Clock::syncProvider()
 #ifdef DEBUG_OUTPUT_RTC
   Serial.println("DEBUG_OUTPUT_RTC: Clock:syncProvider() entered.");
 #endif
-  time_t rtc_now;
-  rtc_now = RtcGet(); // Get the RTC time
-
-  if (millis() - millis_last_ntp > refresh_ntp_every_ms || millis_last_ntp == 0) // Get NTP time only every 10 minutes or if not yet done
-  { // It's time to get a new NTP sync
-    if (WifiState == connected)
-    { // We have WiFi, so try to get NTP time.
-      Serial.print("Try to get the actual time from NTP server...");
-      if (ntpTimeClient.update())
-      {
-        Serial.println("NTP query done.");
-        time_t ntp_now = ntpTimeClient.getEpochTime();
-        Serial.print("NTP time = ");
-        Serial.println(ntpTimeClient.getFormattedTime());
-        rtc_now = RtcGet(); // Get the RTC time again, because it may have changed in the meantime
-        // Sync the RTC to NTP if needed.
-        Serial.print("NTP  :");
-        Serial.println(ntp_now);
-        Serial.print("RTC  :");
-        Serial.println(rtc_now);
-        Serial.print("Diff: ");
-        Serial.println(ntp_now - rtc_now);
-        if ((ntp_now != rtc_now) && (ntp_now > 1743364444)) // check if we have a difference and a valid NTP time
-        {                                                   // NTP time is valid and different from RTC time
-          Serial.println("RTC time is not valid, updating RTC.");
-          RtcSet(ntp_now);
-          Serial.println("RTC is now set to NTP time.");
-          rtc_now = RtcGet(); // Check if RTC time is set correctly
-          Serial.print("RTC time = ");
-          Serial.println(rtc_now);
-        }
-        else if ((ntp_now != rtc_now) && (ntp_now < 1743364444))
-        { // NTP can't be valid!
-          Serial.println("Time returned from NTP is not valid! Using RTC time!");
-          rtc_now = RtcGet(); // Get the RTC time again, because it may have changed in the meantime
-          return rtc_now;
-        }
-        millis_last_ntp = millis(); // store the last time we tried to get NTP time
+  uint32_t rtc_second = rtcRead(); // Get the RTC time
+  // Correct the known drift in ms, rounding it to whole seconds would leave up to 500 ms.
+  int64_t rtc_ms = int64_t(rtc_second) * 1000 - llroundf(rtc_drift.predictError(rtc_second));
+  time_t rtc_now = rtc_ms / 1000;
 
-        Serial.println("Using NTP time!");
-        return ntp_now;
-      }
-      else
-      {                     // NTP return value is not valid
-        rtc_now = RtcGet(); // Get the RTC time again, because it may have changed in the meantime
-        Serial.println("Invalid NTP response, using RTC time.");
-        return rtc_now;
-      }
-    } // no WiFi!
-    Serial.println("No WiFi, using RTC time.");
+  if (!ntp_result_ready)
+  { // No new NTP time, loop() takes care of getting one.
+    // Keep the known fraction of the second, the RTC only counts whole seconds.
+    // Unless the RTC is clearly away from it, which is much more than the clock can drift until the next alignment.
+    int64_t drift_ms = rtc_ms - int64_t(nowMs());
+    if (!ms_known || drift_ms >= 2000 || drift_ms <= -2000)
+    {
+      disciplined_clock.set(esp_timer_get_time(), uint64_t(rtc_ms) * 1000);
+      ms_known = false;
+    }
+    Serial.println("Using RTC time.");
     return rtc_now;
   }
-  Serial.println("Using RTC time.");
-  return rtc_now;
+  ntp_result_ready = false;
+
+  uint64_t ntp_ms = ntp_epoch_ms_at_burst_start + (uint32_t)(millis() - ntp_burst_start);
+  time_t ntp_now = ntp_ms / 1000;
+  Serial.print("NTP  :");
+  Serial.println(ntp_now);
+  Serial.print("RTC  :");
+  Serial.println(rtc_now);
+  if (ms_known)
+  { // adjusts the rate estimate of the crystal and slews small offsets out
+    ntp_offset_ms = -disciplined_clock.discipline(esp_timer_get_time(), ntp_ms * 1000) / 1000;
+    Serial.print("Offset to the running clock (ms): ");
+    Serial.print(ntp_offset_ms);
+    Serial.print(", crystal rate ");
+    Serial.print(disciplined_clock.getRatePpm(), 1);
+    Serial.println(" ppm");
+  }
+  else
+  {
+    disciplined_clock.set(esp_timer_get_time(), ntp_ms * 1000);
+  }
+  ms_known = true;
+  millis_last_ntp = millis(); // store the last time we got a valid NTP time
+
+  // Measure the RTC error, see loopRtcCheck(). Errors below the NTP jitter are not significant.
+  rtc_tolerance_ms = max((uint32_t)NTP_MIN_CORRECTION_MS, 3 * ntp_jitter_ms);
+  if (rtc_tolerance_ms <= 400)
+  {
+    startRtcCheck(false);
+  }
+  else
+  {
+    Serial.println("NTP jitter too high, RTC not checked.");
+  }
+
+  printRtcStats();
+  Serial.println("Using NTP time!");
+  return ntp_now;
+}
+
+bool Clock::setTimeZone(const char *name_or_rule)
+{
+  const char *rule = TimeZone::findRule(name_or_rule);
+  if (rule == NULL)
+  {
+    rule = name_or_rule;
+  }
+  if (strlen(rule) >= sizeof(tz_config->rule) || !time_zone.setRule(rule))
+  {
+    Serial.print("Unknown time zone: ");
+    Serial.println(name_or_rule);
+    return false;
+  }
+  strcpy(tz_config->rule, rule);
+  Serial.print("Time zone rule: ");
+  Serial.println(rule);
+  return true;
 }
 
-uint8_t Clock::getHoursTens()
+void Clock::updateTimeCache()
 {
-  uint8_t hour_tens = getHour() / 10;
+  tmElements_t last_tm = local_tm;
+  breakTime(local_time, local_tm); // the only breakTime() per second
+  cached_local_time = local_time;
+  if (display_zone != NULL)
+  {
+    breakTime(loop_time + display_zone->getOffset(loop_time), display_tm);
+  }
 
-  if (config->blank_hours_zero && hour_tens == 0)
+  changed_fields = 0;
+  if (local_tm.Second != last_tm.Second)
+    changed_fields |= changed_second;
+  if (local_tm.Minute != last_tm.Minute)
+    changed_fields |= changed_minute;
+  if (local_tm.Hour != last_tm.Hour)
+    changed_fields |= changed_hour;
+  if (local_tm.Day != last_tm.Day || local_tm.Month != last_tm.Month || local_tm.Year != last_tm.Year)
+    changed_fields |= changed_day;
+  if (changed_fields != 0)
   {
-    return TFTs::blanked;
+    updateDigits();
   }
-  else
+}
+
+void Clock::setDisplayZone(TimeZone *zone)
+{
+  display_zone = zone;
+  if (display_zone != NULL)
+  {
+    breakTime(loop_time + display_zone->getOffset(loop_time), display_tm);
+  }
+  updateDigits();
+  digits_changed = true; // redraw, even if only the zone label changed
+}
+
+void Clock::updateDigits()
+{
+  const tmElements_t &tm = display_zone != NULL ? display_tm : local_tm;
+  uint8_t hour = config->twelve_hour ? toHour12(tm.Hour) : tm.Hour;
+  uint8_t new_digits[NUM_DIGITS];
+  new_digits[SECONDS_ONES] = tm.Second % 10;
+  new_digits[SECONDS_TENS] = tm.Second / 10;
+  new_digits[MINUTES_ONES] = tm.Minute % 10;
+  new_digits[MINUTES_TENS] = tm.Minute / 10;
+  new_digits[HOURS_ONES] = hour % 10;
+  new_digits[HOURS_TENS] = (config->blank_hours_zero && hour < 10) ? TFTs::blanked : hour / 10;
+  if (memcmp(new_digits, digits, sizeof(digits)) != 0)
   {
-    return hour_tens;
+    memcpy(digits, new_digits, sizeof(digits));
+    digits_changed = true;
   }
 }
 
 uint32_t Clock::millis_last_ntp = 0;
+DisciplinedClock Clock::disciplined_clock;
+bool Clock::ms_known = false;
+bool Clock::ntp_result_ready = false;
+uint64_t Clock::ntp_epoch_ms_at_burst_start = 0;
+uint32_t Clock::ntp_burst_start = 0;
+uint32_t Clock::ntp_jitter_ms = 0;
+int32_t Clock::ntp_offset_ms = 0;
+Clock::rtc_check_t Clock::rtc_check = Clock::rtc_check_none;
+bool Clock::rtc_check_align = false;
+RtcDrift Clock::rtc_drift;
+Clock::RtcStats Clock::rtc_stats = {};
+uint32_t Clock::rtc_cache_second = 0;
+uint32_t Clock::millis_rtc_cache = 0;
+bool Clock::rtc_cache_valid = false;
+uint32_t Clock::rtc_tolerance_ms = NTP_MIN_CORRECTION_MS;
+const char *Clock::ntp_servers[] = NTP_SERVERS;
+const uint8_t Clock::num_ntp_servers = sizeof(Clock::ntp_servers) / sizeof(Clock::ntp_servers[0]);
+IPAddress Clock::ntp_server_ips[sizeof(Clock::ntp_servers) / sizeof(Clock::ntp_servers[0])];
+volatile bool Clock::ntp_resolving = false;
 WiFiUDP Clock::ntpUDP;
 NTPClient Clock::ntpTimeClient(ntpUDP);
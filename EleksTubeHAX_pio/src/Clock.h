@@ -8,37 +8,71 @@
 // For NTP
 #include <WiFi.h>
 #include "NTPClient_AO.h"
+#include "NtpFilter.h"
+#include "RtcDrift.h"
+#include "TimeZone.h"
+#include "DisciplinedClock.h"
+#include <esp_timer.h>
 
 #include "StoredConfig.h"
 // For TFTs::blanked
 #include "TFTs.h"
+#include "EventBus.h"
 
 class Clock
 {
 public:
-  Clock() : loop_time(0), local_time(0), time_valid(false), config(NULL) {}
+  Clock() : loop_time(0), local_time(0), time_valid(false), config(NULL), last_second(255), last_minute(255), last_hour(255) { breakTime(0, local_tm); }
 
   // The global WiFi from WiFi.h must already be .begin()'d before calling Clock::begin()
-  void begin(StoredConfig::Config::Clock *config_);
+  void begin(StoredConfig::Config::Clock *config_, StoredConfig::Config::RtcDrift *drift_config_, StoredConfig::Config::TimeZone *tz_config_);
   void loop();
 
-  // Calls NTPClient::getEpochTime() or RTC::get() as appropriate
+  // Returns the result of the last completed NTP request, if there is a new one, or RTC::get() otherwise.
+  // Never waits for the network, the NTP request runs in loop().
   // This has to be static to pass to TimeLib::setSyncProvider.
   static time_t syncProvider();
 
+  // UTC time since Jan 1 1970 from the esp_timer, disciplined by NTP and the RTC second, no RTC access.
+  // Sub-second precise after the first NTP sync or alignment with the RTC second, before that
+  // the fraction counts from the last RTC sync.
+  static uint64_t nowUs() { return disciplined_clock.now(esp_timer_get_time()); }
+  static uint64_t nowMs() { return nowUs() / 1000; }
+  static float getClockRatePpm() { return disciplined_clock.getRatePpm(); } // rate error of the ESP32 crystal
+  static int32_t getNtpOffsetMs() { return ntp_offset_ms; }  // NTP time - running clock at the last NTP sync
+  static uint32_t getNtpJitterMs() { return ntp_jitter_ms; } // of the last NTP burst
+
   // Set preferred hour format. true = 12hr, false = 24hr
-  void setTwelveHour(bool th) { config->twelve_hour = th; }
+  void setTwelveHour(bool th)
+  {
+    config->twelve_hour = th;
+    updateDigits();
+  }
   bool getTwelveHour() { return config->twelve_hour; }
-  void toggleTwelveHour() { config->twelve_hour = !config->twelve_hour; }
+  void toggleTwelveHour() { setTwelveHour(!config->twelve_hour); }
   // Blanked: 1:23   Not blanked: 01:23
-  void setBlankHoursZero(bool bhz) { config->blank_hours_zero = bhz; }
+  void setBlankHoursZero(bool bhz)
+  {
+    config->blank_hours_zero = bhz;
+    updateDigits();
+  }
   bool getBlankHoursZero() { return config->blank_hours_zero; }
-  void toggleBlankHoursZero() { config->blank_hours_zero = !config->blank_hours_zero; }
+  void toggleBlankHoursZero() { setBlankHoursZero(!config->blank_hours_zero); }
 
   // Internal time is kept in UTC. This affects the displayed time.
-  void setTimeZoneOffset(time_t offset) { config->time_zone_offset = offset; }
-  time_t getTimeZoneOffset() { return config->time_zone_offset; }
-  void adjustTimeZoneOffset(time_t adj) { config->time_zone_offset += adj; }
+  // A time zone rule switches to and from daylight saving time by itself, setting a fixed offset removes the rule.
+  bool setTimeZone(const char *name_or_rule); // "Europe/Berlin" or "CET-1CEST,M3.5.0,M10.5.0/3"
+  bool hasTimeZoneRule() { return tz_config->rule[0] != '\0'; }
+  const char *getTimeZoneRule() { return tz_config->rule; }
+  void setTimeZoneOffset(time_t offset)
+  {
+    config->time_zone_offset = offset;
+    tz_config->rule[0] = '\0';
+  }
+  time_t getTimeZoneOffset() { return hasTimeZoneRule() ? time_zone.getOffset(loop_time) : config->time_zone_offset; }
+  // Show the digits for another time zone, NULL = home time zone. The getters and events keep using the home time zone.
+  void setDisplayZone(TimeZone *zone);
+  void adjustTimeZoneOffset(time_t adj) { setTimeZoneOffset(getTimeZoneOffset() + adj); }
   void setActiveGraphicIdx(int8_t idx) { config->selected_graphic = idx; }
   int8_t getActiveGraphicIdx() { return config->selected_graphic; }
   void adjustClockGraphicsIdx(int8_t adj)
@@ -68,45 +102,159 @@ public:
       set = 1;
     }
 
-    config->selected_graphic = set;
+    if (config->selected_graphic != set)
+    {
+      config->selected_graphic = set;
+      events.publish(EventBus::face_changed, set);
+    }
   }
 
-  // Proxy C functions from TimeLib.h
-  // I really wish it were a class we could just subclass, but here we are.
-  uint16_t getYear() { return year(local_time); }
-  uint8_t getMonth() { return month(local_time); }
-  uint8_t getDay() { return day(local_time); }
-  uint8_t getHour() { return config->twelve_hour ? hourFormat12(local_time) : hour(local_time); }
-  uint8_t getHour12() { return hourFormat12(local_time); }
-  uint8_t getHour24() { return hour(local_time); }
-  uint8_t getMinute() { return minute(local_time); }
-  uint8_t getSecond() { return second(local_time); }
-  bool isAm() { return isAM(local_time); }
-  bool isPm() { return isPM(local_time); }
-
-  // Helper functions for making a clock.
-  uint8_t getHoursTens();
-  uint8_t getHoursOnes() { return getHour() % 10; }
+  // The local time is broken down once in loop() when it changes, the getters read the cached values.
+  uint16_t getYear() { return tmYearToCalendar(local_tm.Year); }
+  uint8_t getMonth() { return local_tm.Month; }
+  uint8_t getDay() { return local_tm.Day; }
+  uint8_t getHour() { return config->twelve_hour ? getHour12() : getHour24(); }
+  uint8_t getHour12() { return toHour12(local_tm.Hour); }
+  uint8_t getHour24() { return local_tm.Hour; }
+  uint8_t getMinute() { return local_tm.Minute; }
+  uint8_t getSecond() { return local_tm.Second; }
+  bool isAm() { return local_tm.Hour < 12; }
+  bool isPm() { return local_tm.Hour >= 12; }
+
+  // Helper functions for making a clock. The displayed digits are cached, see updateDigits().
+  uint8_t getHoursTens() { return digits[HOURS_TENS]; }
+  uint8_t getHoursOnes() { return digits[HOURS_ONES]; }
   uint8_t getHours12Tens() { return getHour12() / 10; }
   uint8_t getHours12Ones() { return getHour12() % 10; }
   uint8_t getHours24Tens() { return getHour24() / 10; }
   uint8_t getHours24Ones() { return getHour24() % 10; }
-  uint8_t getMinutesTens() { return getMinute() / 10; }
-  uint8_t getMinutesOnes() { return getMinute() % 10; }
-  uint8_t getSecondsTens() { return getSecond() / 10; }
-  uint8_t getSecondsOnes() { return getSecond() % 10; }
+  uint8_t getMinutesTens() { return digits[MINUTES_TENS]; }
+  uint8_t getMinutesOnes() { return digits[MINUTES_ONES]; }
+  uint8_t getSecondsTens() { return digits[SECONDS_TENS]; }
+  uint8_t getSecondsOnes() { return digits[SECONDS_ONES]; }
+
+  // Fields of the local time changed by the last loop()
+  enum changed_fields_t
+  {
+    changed_second = 0x01,
+    changed_minute = 0x02,
+    changed_hour = 0x04,
+    changed_day = 0x08
+  };
+  uint8_t getChangedFields() { return changed_fields; }
+  // True once after the displayed digits changed, by the time or the hour format.
+  bool takeDigitsChanged()
+  {
+    bool changed = digits_changed;
+    digits_changed = false;
+    return changed;
+  }
+
+  // Cost of the RTC access (I2C or DS1302 3-wire), for diagnostics.
+  struct RtcStats
+  {
+    uint32_t reads;      // transactions on the bus
+    uint32_t cache_hits; // reads answered from the cache
+    uint32_t writes;
+    uint64_t read_us_sum;
+    uint32_t max_read_us;
+    uint32_t max_write_us;
+  };
+  static const RtcStats &getRtcStats() { return rtc_stats; }
+  static uint32_t getRtcAvgReadUs() { return rtc_stats.reads ? rtc_stats.read_us_sum / rtc_stats.reads : 0; }
+  static void printRtcStats();
 
   time_t loop_time, local_time;
 
 private:
   bool time_valid;
   StoredConfig::Config::Clock *config;
+  StoredConfig::Config::TimeZone *tz_config = NULL;
+  TimeZone time_zone;
+  TimeZone *display_zone = NULL;
+  static uint8_t toHour12(uint8_t hour) { return hour % 12 == 0 ? 12 : hour % 12; }
+
+  // Local time broken down for the cached local_time, and the digits shown for it
+  tmElements_t local_tm;
+  tmElements_t display_tm; // local time in the display_zone
+  time_t cached_local_time = 0;
+  uint8_t digits[NUM_DIGITS] = {};
+  uint8_t changed_fields = 0;
+  bool digits_changed = true;
+  void updateTimeCache();
+  void updateDigits();
+
+  // Last published values, to detect second, minute and hour changes for the event bus
+  uint8_t last_second, last_minute, last_hour;
+  void publishTimeEvents();
+
+  // Starts an NTP burst when needed and advances the running request, a few microseconds per call.
+  // A burst sends NTP_BURST_SAMPLES requests to the NTP_SERVERS in turn, NtpFilter combines the answers.
+  void loopNtp();
+  void startNtpBurst();
+  void finishNtpBurst();
+  NtpFilter ntp_filter;
+  bool ntp_burst_active = false;
+  bool ntp_request_running = false;
+  uint8_t ntp_burst_sample = 0;
+  uint32_t millis_next_ntp_request = 0;
+  uint32_t millis_last_ntp_try = 0;
+  const static uint32_t retry_ntp_every_ms = 60000; // Retry a failed NTP burst after a minute.
+  const static char *ntp_servers[];
+  const static uint8_t num_ntp_servers;
+  static IPAddress ntp_server_ips[]; // resolved once per burst, 0.0.0.0 if the lookup failed
+  static volatile bool ntp_resolving; // ntpResolveTask() is running
+  static void ntpResolveTask(void *parameter);
+
+  // The RTC error is measured by reading the RTC every rtc_poll_us until its second changes, which gives
+  // the position of its second boundary within a few ms. After an NTP sync this is compared with the NTP time,
+  // to track the RTC drift and to correct the RTC. Between NTP syncs the clock is aligned with the RTC second.
+  enum rtc_check_t
+  {
+    rtc_check_none,
+    rtc_check_start,
+    rtc_check_measure,
+    rtc_check_set
+  };
+  static rtc_check_t rtc_check;
+  static bool rtc_check_align;      // the measurement aligns the clock with the RTC instead of checking the RTC
+  const static int64_t rtc_poll_us = 5000; // between two reads, so a fast loop() doesn't keep the I2C bus busy
+  static uint32_t rtc_tolerance_ms; // RTC errors below this are not significant
+  bool rtc_read_done = false;
+  uint32_t rtc_last_second = 0;
+  int64_t rtc_read_us = 0; // esp_timer
+  int64_t rtc_check_start_us = 0;
+  uint32_t millis_last_rtc_align = 0;
+  float rtc_error_before_set = 0;
+  bool rtc_new_segment = false; // the RTC was completely wrong, start a new drift segment after setting it
+  static void startRtcCheck(bool align);
+  void loopRtcCheck();
+  void checkRtcError(uint32_t rtc_second, float error_ms, uint32_t uncertainty_ms);
+  static RtcDrift rtc_drift;
+  uint32_t refresh_ntp_ms = NTP_REFRESH_MIN_MS; // grows while the RTC keeps the predicted time
+
+  // All RTC access goes through these. A read within max_age_ms of the last one returns the cached second.
+  static uint32_t rtcRead(uint32_t max_age_ms = rtc_cache_ms);
+  static void rtcWrite(uint32_t t);
+  const static uint32_t rtc_cache_ms = 100;
+  static RtcStats rtc_stats;
+  static uint32_t rtc_cache_second;
+  static uint32_t millis_rtc_cache;
+  static bool rtc_cache_valid;
 
   // Static variables needed for syncProvider()
   static WiFiUDP ntpUDP;
   static NTPClient ntpTimeClient;
-  static uint32_t millis_last_ntp;
-  const static uint32_t refresh_ntp_every_ms = 3600000; // Get new NTP every hour, use RTC in between.
+  static uint32_t millis_last_ntp; // when the last valid NTP time was used, 0 = never
+  // Source of nowUs()
+  static DisciplinedClock disciplined_clock;
+  static bool ms_known; // the reference comes from NTP or an RTC second boundary, so the fraction of the second is known
+  // Result of the last NTP burst, used by syncProvider(): the NTP time in ms at the millis() value ntp_burst_start.
+  static bool ntp_result_ready;
+  static uint64_t ntp_epoch_ms_at_burst_start;
+  static uint32_t ntp_burst_start;
+  static uint32_t ntp_jitter_ms;
+  static int32_t ntp_offset_ms;
 };
 
 extern Clock uclock;
@@ -0,0 +1,64 @@
+#include "DisciplinedClock.h"
+
+int64_t DisciplinedClock::slewed(int64_t elapsed_us)
+{
+  int64_t max_us = elapsed_us * max_slew_ppm / 1000000;
+  if (slew_us > max_us)
+    return max_us;
+  if (slew_us < -max_us)
+    return -max_us;
+  return slew_us;
+}
+
+uint64_t DisciplinedClock::now(int64_t timer_us)
+{
+  int64_t elapsed_us = timer_us - ref_timer_us;
+  int64_t corrected_us = elapsed_us - int64_t(elapsed_us * (double)rate_ppm / 1e6);
+  return ref_epoch_us + corrected_us + slewed(elapsed_us);
+}
+
+void DisciplinedClock::set(int64_t timer_us, uint64_t epoch_us)
+{
+  ref_timer_us = timer_us;
+  ref_epoch_us = epoch_us;
+  slew_us = 0;
+  time_set = true;
+}
+
+int64_t DisciplinedClock::discipline(int64_t timer_us, uint64_t epoch_us)
+{
+  if (!time_set)
+  {
+    set(timer_us, epoch_us);
+    last_error_us = 0;
+    return 0;
+  }
+  uint64_t predicted_us = now(timer_us);
+  int64_t error_us = int64_t(predicted_us - epoch_us);
+  last_error_us = error_us;
+  if (error_us > max_slew_error_us || error_us < -max_slew_error_us)
+  {
+    set(timer_us, epoch_us);
+    return error_us;
+  }
+
+  // The part of the error not explained by the correction still to be slewed comes from the rate error.
+  int64_t interval_us = timer_us - ref_timer_us;
+  int64_t pending_us = slew_us - slewed(interval_us);
+  if (interval_us >= min_rate_interval_us)
+  {
+    float measured_ppm = float(error_us + pending_us) * 1e6f / float(interval_us);
+    float gain = float(interval_us) / (float(interval_us) + rate_time_constant_s * 1e6f);
+    rate_ppm += gain * measured_ppm;
+    if (rate_ppm > max_rate_ppm)
+      rate_ppm = max_rate_ppm;
+    if (rate_ppm < -max_rate_ppm)
+      rate_ppm = -max_rate_ppm;
+  }
+
+  // Continue from the predicted time and slew the error out.
+  ref_timer_us = timer_us;
+  ref_epoch_us = predicted_us;
+  slew_us = -error_us;
+  return error_us;
+}
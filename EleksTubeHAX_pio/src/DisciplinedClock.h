@@ -0,0 +1,46 @@
+#ifndef DISCIPLINED_CLOCK_H
+#define DISCIPLINED_CLOCK_H
+
+#include <stdint.h>
+
+/*
+ * UTC time in microseconds from the esp_timer counter, disciplined by reference times (NTP, RTC second).
+ *
+ * The rate error of the ESP32 crystal is estimated from the phase error between two references, smoothed
+ * with a time constant of rate_time_constant_s. Small phase errors are slewed out at max. max_slew_ppm, so the
+ * time never jumps back over a second boundary. Larger errors (or the first reference) set the time.
+ */
+
+class DisciplinedClock
+{
+public:
+  DisciplinedClock() : time_set(false), ref_timer_us(0), ref_epoch_us(0), slew_us(0), rate_ppm(0), last_error_us(0) {}
+
+  // UTC time in us since 1970 at the esp_timer value timer_us
+  uint64_t now(int64_t timer_us);
+  // Sets the time, the rate estimate is kept.
+  void set(int64_t timer_us, uint64_t epoch_us);
+  // The reference time at timer_us is epoch_us. Returns the error of the clock (clock - reference) in us.
+  int64_t discipline(int64_t timer_us, uint64_t epoch_us);
+
+  bool isSet() { return time_set; }
+  float getRatePpm() { return rate_ppm; } // positive: the esp_timer runs fast
+  int64_t getLastErrorUs() { return last_error_us; }
+
+  const static int32_t max_slew_ppm = 500;
+  const static int64_t max_slew_error_us = 200000;  // above this the time is set
+  const static int64_t min_rate_interval_us = 10000000; // a reference this soon after the last one doesn't update the rate
+  const static int32_t rate_time_constant_s = 3600;
+  const static int32_t max_rate_ppm = 200;
+
+private:
+  bool time_set;
+  int64_t ref_timer_us;  // esp_timer value of the reference point
+  uint64_t ref_epoch_us; // time at the reference point
+  int64_t slew_us;       // phase correction to be slewed in after the reference point
+  float rate_ppm;
+  int64_t last_error_us;
+  int64_t slewed(int64_t elapsed_us);
+};
+
+#endif // DISCIPLINED_CLOCK_H
@@ -0,0 +1,135 @@
+#include "EventBus.h"
+
+bool EventBus::subscribe(uint16_t mask, handler_t handler, void *context)
+{
+  if (handler == NULL || num_subscribers >= EVENT_BUS_MAX_SUBSCRIBERS)
+  {
+    Serial.println("ERROR: Event bus subscriber table is full!");
+    return false;
+  }
+  subscribers[num_subscribers].mask = mask;
+  subscribers[num_subscribers].handler = handler;
+  subscribers[num_subscribers].context = context;
+  num_subscribers++;
+  return true;
+}
+
+bool EventBus::publish(event_t type, uint8_t value)
+{
+  bool queued = false;
+
+  portENTER_CRITICAL(&queue_mux);
+  if (count < EVENT_BUS_QUEUE_SIZE)
+  {
+    Event &event = queue[(head + count) % EVENT_BUS_QUEUE_SIZE];
+    event.type = type;
+    event.value = value;
+    event.published_us = micros();
+    count++;
+    queued = true;
+  }
+  else
+  {
+    dropped_events++;
+  }
+  portEXIT_CRITICAL(&queue_mux);
+
+#ifdef DEBUG_OUTPUT_EVENTS
+  Serial.print("Event ");
+  Serial.print(event_str[type]);
+  Serial.print(" (");
+  Serial.print(value);
+  Serial.println(queued ? ") published" : ") dropped, queue full!");
+#endif
+  return queued;
+}
+
+uint8_t EventBus::dispatch()
+{
+  uint32_t start_us = micros();
+  uint8_t handled = 0;
+
+  while (handled < EVENT_BUS_MAX_EVENTS_PER_FRAME)
+  {
+    Event event;
+    portENTER_CRITICAL(&queue_mux);
+    if (count == 0)
+    {
+      portEXIT_CRITICAL(&queue_mux);
+      break;
+    }
+    event = queue[head];
+    head = (head + 1) % EVENT_BUS_QUEUE_SIZE;
+    count--;
+    if (deferred_queued > 0)
+    {
+      deferred_queued--;
+    }
+    portEXIT_CRITICAL(&queue_mux);
+
+    uint32_t latency_us = micros() - event.published_us;
+    latency_sum_us += latency_us;
+    if (latency_us > max_latency_us)
+    {
+      max_latency_us = latency_us;
+    }
+
+    uint16_t mask = maskOf(event.type);
+    for (uint8_t i = 0; i < num_subscribers; i++)
+    {
+      if (subscribers[i].mask & mask)
+      {
+        subscribers[i].handler(event, subscribers[i].context);
+      }
+    }
+    handled++;
+    dispatched_events++;
+
+#ifdef DEBUG_OUTPUT_EVENTS
+    if (event.type == minute_rollover)
+    {
+      printStats();
+    }
+#endif
+
+    if (micros() - start_us > EVENT_BUS_DISPATCH_BUDGET_US)
+    { // Time budget for this frame is used up, handle the rest in the next loop.
+      break;
+    }
+  }
+
+  // every event left over counts once, not again in each frame it keeps waiting
+  portENTER_CRITICAL(&queue_mux);
+  if (count > deferred_queued)
+  {
+    deferred_events += count - deferred_queued;
+    deferred_queued = count;
+  }
+  portEXIT_CRITICAL(&queue_mux);
+
+  uint32_t dispatch_us = micros() - start_us;
+  if (dispatch_us > max_dispatch_us)
+  {
+    max_dispatch_us = dispatch_us;
+  }
+  return handled;
+}
+
+void EventBus::printStats()
+{
+  Serial.print("Event bus: dispatched ");
+  Serial.print(dispatched_events);
+  Serial.print(", dropped ");
+  Serial.print(dropped_events);
+  Serial.print(", deferred ");
+  Serial.print(deferred_events);
+  Serial.print(", latency avg/max (us) ");
+  Serial.print(getAvgLatencyUs());
+  Serial.print("/");
+  Serial.print(max_latency_us);
+  Serial.print(", max dispatch time (us) ");
+  Serial.println(max_dispatch_us);
+}
+
+const char *EventBus::event_str[EventBus::num_events] =
+    {"second_tick", "minute_rollover", "hour_chime", "face_changed", "dimming_changed", "mqtt_connected", "button_pressed", "power_changed"};
@@ -0,0 +1,95 @@
+#ifndef EVENT_BUS_H
+#define EVENT_BUS_H
+
+#include "GLOBAL_DEFINES.h"
+
+/*
+ * A small publish/subscribe event bus, so modules can react to clock events without
+ * main.cpp wiring every call by hand.
+ *
+ * Events are fixed size and kept in a static ring buffer, so publishing never allocates.
+ * Subscribers are called from dispatch(), which is run once per loop() and handles at most
+ * EVENT_BUS_MAX_EVENTS_PER_FRAME events or EVENT_BUS_DISPATCH_BUDGET_US microseconds per call.
+ * Everything left over is handled in the next frame.
+ *
+ * Subscribers are called in the context of loop(), never from the publisher.
+ */
+
+class EventBus
+{
+public:
+  EventBus() : head(0), count(0), deferred_queued(0), num_subscribers(0), dropped_events(0), deferred_events(0),
+               dispatched_events(0), latency_sum_us(0), max_latency_us(0), max_dispatch_us(0) {}
+
+  enum event_t : uint8_t
+  {
+    second_tick,     // value: new second, 0..59
+    minute_rollover, // value: new minute, 0..59
+    hour_chime,      // value: new hour, 0..23
+    face_changed,    // value: new clock face index
+    dimming_changed, // value: 1 = night time (dimmed), 0 = day time
+    mqtt_connected,  // value: 1 = connected to broker, 0 = connection lost
+    button_pressed,  // value: 0 = left, 1 = mode, 2 = right, 3 = power
+    power_changed,   // value: 1 = displays on, 0 = off
+    num_events
+  };
+  const static char *event_str[num_events];
+
+  struct Event
+  {
+    event_t type;
+    uint8_t value;
+    uint32_t published_us; // micros() at publish time, for latency statistics
+  };
+
+  typedef void (*handler_t)(const Event &event, void *context);
+
+  static uint16_t maskOf(event_t type) { return uint16_t(1) << type; }
+  const static uint16_t all_events = (uint16_t(1) << num_events) - 1;
+
+  // Register a handler for all events in mask. Returns false if the subscriber table is full.
+  bool subscribe(uint16_t mask, handler_t handler, void *context = NULL);
+  // Queue an event. Returns false (and counts a dropped event) if the queue is full.
+  bool publish(event_t type, uint8_t value = 0);
+  // Deliver queued events to the subscribers. Returns the number of events handled.
+  uint8_t dispatch();
+
+  uint8_t getQueueDepth() { return count; }
+  uint32_t getDroppedEvents() { return dropped_events; }
+  uint32_t getDeferredEvents() { return deferred_events; }
+  uint32_t getDispatchedEvents() { return dispatched_events; }
+  uint32_t getAvgLatencyUs() { return dispatched_events ? latency_sum_us / dispatched_events : 0; }
+  uint32_t getMaxLatencyUs() { return max_latency_us; }
+  uint32_t getMaxDispatchUs() { return max_dispatch_us; }
+  void printStats();
+
+private:
+  struct Subscriber
+  {
+    uint16_t mask;
+    handler_t handler;
+    void *context;
+  };
+
+  Event queue[EVENT_BUS_QUEUE_SIZE];
+  uint8_t head; // index of the oldest queued event
+  uint8_t count;
+  uint8_t deferred_queued; // the oldest queued events, already counted in deferred_events
+
+  Subscriber subscribers[EVENT_BUS_MAX_SUBSCRIBERS];
+  uint8_t num_subscribers;
+
+  // Statistics
+  uint32_t dropped_events;
+  uint32_t deferred_events; // events left in the queue because the frame budget was used up, each counted once
+  uint32_t dispatched_events;
+  uint64_t latency_sum_us;
+  uint32_t max_latency_us;  // publish to delivery
+  uint32_t max_dispatch_us; // time spent in a single dispatch() call
+
+  portMUX_TYPE queue_mux = portMUX_INITIALIZER_UNLOCKED;
+};
+
+extern EventBus events;
+
+#endif // EVENT_BUS_H
@@ -0,0 +1,63 @@
+#include "Fade.h"
+
+uint8_t Fade::ramp[FADE_RAMP_STEPS + 1];
+bool Fade::ramp_ready = false;
+
+void Fade::buildRamp()
+{
+  // Smoothstep: slow start and end, so the change is hardly noticeable at both ends of the fade.
+  for (uint16_t i = 0; i <= FADE_RAMP_STEPS; i++)
+  {
+    float t = float(i) / FADE_RAMP_STEPS;
+    ramp[i] = uint8_t(round(255.0f * t * t * (3.0f - 2.0f * t)));
+  }
+  ramp_ready = true;
+}
+
+void Fade::start(uint8_t target, uint16_t duration)
+{
+  if (!ramp_ready)
+  {
+    buildRamp();
+  }
+  if (duration == 0 || target == current)
+  {
+    jump(target);
+    return;
+  }
+  from = current;
+  to = target;
+  start_ms = millis();
+  duration_ms = duration;
+  active = true;
+}
+
+void Fade::jump(uint8_t target)
+{
+  from = target;
+  to = target;
+  current = target;
+  active = false;
+}
+
+bool Fade::update()
+{
+  if (!active)
+  {
+    return false;
+  }
+
+  uint8_t last = current;
+  uint32_t elapsed = millis() - start_ms;
+  if (elapsed >= duration_ms)
+  {
+    current = to;
+    active = false;
+  }
+  else
+  {
+    uint8_t step = (elapsed * FADE_RAMP_STEPS) / duration_ms;
+    current = from + ((int16_t(to) - from) * ramp[step]) / 255;
+  }
+  return current != last;
+}
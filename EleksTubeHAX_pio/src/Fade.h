@@ -0,0 +1,43 @@
+#ifndef FADE_H
+#define FADE_H
+
+#include "GLOBAL_DEFINES.h"
+
+/*
+ * Time based brightness ramp between two 0..255 values.
+ *
+ * The easing curve is precomputed once into a table of FADE_RAMP_STEPS entries, so a fade
+ * step is only a table lookup and an integer multiply. The value changes at most
+ * FADE_RAMP_STEPS times per fade, which limits the number of redraws for software dimming.
+ */
+
+class Fade
+{
+public:
+  Fade() : from(255), to(255), current(255), start_ms(0), duration_ms(0), active(false) {}
+
+  // Start a ramp from the current value to target. A duration of 0 jumps directly.
+  void start(uint8_t target, uint16_t duration = DIMMING_FADE_DURATION_MS);
+  // Set the value immediately, cancels a running fade.
+  void jump(uint8_t target);
+  // Advance the fade. Returns true if the value has changed since the last call.
+  bool update();
+
+  uint8_t value() { return current; }
+  uint8_t target() { return to; }
+  bool isActive() { return active; }
+
+private:
+  uint8_t from;
+  uint8_t to;
+  uint8_t current;
+  uint32_t start_ms;
+  uint16_t duration_ms;
+  bool active;
+
+  static uint8_t ramp[FADE_RAMP_STEPS + 1]; // eased 0..255 progress, filled on first use
+  static bool ramp_ready;
+  static void buildRamp();
+};
+
+#endif // FADE_H
@@ -32,11 +32,74 @@
 #define CONFIG_ESP32_WIFI_NVS_ENABLED 1 // Force NVS usage for WiFi driver
 
 // ************ MQTT config *********************
-#define MQTT_RECONNECT_WAIT_SEC 30      // how long to wait between retries to connect to broker
-#define MQTT_REPORT_STATUS_EVERY_SEC 15 // How often report status to MQTT Broker
+#define MQTT_RECONNECT_MIN_SEC 2        // wait before the first retry to connect to broker, doubled after every failure...
+#define MQTT_RECONNECT_WAIT_SEC 30      // ...up to this long
+#define MQTT_CONNECT_TASK_STACK 8192    // the connect task does the TLS handshake
+#define MQTT_REPORT_STATUS_EVERY_SEC 15 // How often report status to MQTT Broker, per entity if it didn't change
+#define MQTT_STATE_DEBOUNCE_MS 100      // collect state changes this long before reporting them
+#define MQTT_STATE_BURST 3              // state messages in a row per entity...
+#define MQTT_STATE_REFILL_MS 500        // ...then one message per entity every this many ms
+#define MQTT_JSON_ARENA_SIZE 6144       // static memory for the JSON documents of sent and received messages, the heap is only used beyond it
+#define MQTT_DISCOVERY_CACHE_FILE "/discovery.bin" // serialized Home Assistant discovery messages in SPIFFS
+#define MQTT_DISCOVERY_INTERVAL_MS 150  // pause between two discovery messages
+#define MQTT_DISCOVERY_RETRY_MIN_SEC 10 // retry building the discovery messages after a failure, doubled after every failure...
+#define MQTT_DISCOVERY_RETRY_WAIT_SEC 600 // ...up to this long
+#define MQTT_EVENT_QUEUE_SIZE 32        // events (button presses, power changes) kept in RAM until they are sent...
+#define MQTT_EVENT_SPILL_FILE "/mqtt_events.bin" // ...further ones are kept in SPIFFS
+#define MQTT_EVENT_SPILL_MAX 512        // max. events in the spill file, newer ones are dropped
+#define MQTT_EVENT_DRAIN_INTERVAL_MS 50 // pause between two event messages
+#define MQTT_MESSAGES_PER_LOOP 8        // received messages processed per loop pass
+#define MQTT_COMMAND_COALESCE_MS 50     // apply received commands when no further one came for this long...
+#define MQTT_COMMAND_COALESCE_MAX_MS 250 // ...but at the latest this long after the first one
 
 // ************ Backlight config *********************
 #define DEFAULT_BL_RAINBOW_DURATION_SEC 8
+#define BACKLIGHT_CHIME_DURATION_MS 1500 // length of the flash at every full hour, if BACKLIGHT_HOUR_CHIME is enabled
+
+// ************ Backlight program config *********************
+#define BACKLIGHT_PROGRAM_FILE "/backlight.bin" // program for the "Program" backlight pattern, loaded from SPIFFS at start, replaced by programs received over MQTT
+#define BACKLIGHT_PROGRAM_MAX_SIZE 256          // bytes of bytecode
+#define BACKLIGHT_PROGRAM_STACK_SIZE 16         // values
+#define BACKLIGHT_PROGRAM_STEPS_PER_LED 128     // instruction budget per LED and frame, a program using more is stopped
+
+// ************ Brightness fade config *********************
+#define DIMMING_FADE_DURATION_MS 2000 // day/night brightness changes of the displays and backlights are ramped over this time
+#define FADE_RAMP_STEPS 32            // brightness steps per fade, every step redraws all digits if software dimming is used
+
+// ************ Sunrise / sunset dimming config *********************
+#define SOLAR_DIM_AFTER_SUNSET_MIN 30     // dim the displays this many minutes after sunset (negative = before)
+#define SOLAR_BRIGHT_AFTER_SUNRISE_MIN 0  // full brightness this many minutes after sunrise (negative = before)
+
+// ************ NTP config *********************
+#define NTP_SERVERS {"0.pool.ntp.org", "1.pool.ntp.org", "2.pool.ntp.org", "3.pool.ntp.org"} // queried in turn, use different servers to detect a wrong one
+#define NTP_BURST_SAMPLES 8        // queries per sync, spread over all NTP_SERVERS
+#define NTP_BURST_INTERVAL_MS 500  // pause between two queries of a burst (each server is queried every 2 s with the default 4 servers)
+#define NTP_RESOLVE_TASK_STACK 4096 // the DNS lookups of NTP_SERVERS run in a task at the start of a burst
+#define NTP_MIN_CORRECTION_MS 20   // the RTC is only written if its time is off by more than this, or by 3x the measured jitter
+#define NTP_REFRESH_MIN_MS 3600000UL   // NTP sync every hour, while the drift of the RTC is unknown or the RTC does not follow it
+#define NTP_REFRESH_MAX_MS 86400000UL  // up to once per day, if the RTC keeps the predicted time
+#define RTC_DRIFT_MIN_HOURS 6          // measure the RTC drift over at least this time before using it
+#define RTC_DRIFT_GOOD_MS 50           // the RTC error is predicted this good, so NTP syncs can be less frequent
+#define RTC_ANCHOR_EVERY_MS 600000UL   // between NTP syncs, align the clock with the second of the calibrated RTC every 10 minutes
+
+// ************ Event bus config *********************
+#define EVENT_BUS_QUEUE_SIZE 16           // events waiting for dispatch; publishing into a full queue drops the event
+#define EVENT_BUS_MAX_SUBSCRIBERS 8       // number of handlers which can be registered
+#define EVENT_BUS_MAX_EVENTS_PER_FRAME 8  // max. events delivered per loop()
+#define EVENT_BUS_DISPATCH_BUDGET_US 2000 // stop delivering events in this loop() after this time
+
+// ************ Timer mode config *********************
+#define TIMER_FPS 25                    // frames per second of the stopwatch/countdown (hundredths on the seconds displays)
+#define TIMER_COUNTDOWN_DEFAULT_SEC 300 // countdown time, if none is given
+
+// ************ World clock config *********************
+#define WORLD_CLOCK_MAX_ZONES 4        // time zones shown in turn with the home time zone, configured over MQTT
+#define WORLD_CLOCK_LABEL_SIZE 8       // max. label length + 1, shown at the top of the hours tens display
+#define WORLD_CLOCK_PREFETCH_MS 1000   // fill the image cache this long before the next zone is shown
+
+// ************ Diagnostics config *********************
+#define LOOP_STATS_BUCKET_US 500         // resolution of the loop time percentiles
+#define MQTT_DIAGNOSTICS_EVERY_SEC 60    // how often the diagnostics are sent over MQTT, 0 = never
 
 // ************ Hardware definitions *********************
 
@@ -328,6 +391,10 @@
 // ATTENTION: SOME IPSTUBE clocks has a LED stripe on the bottom of the clock! SOME NOT! Define the number of LEDs here!
 // #define NUM_BACKLIGHT_LEDS  (34) // 6 LEDs on the bottom of every LCD. For IPSTUBE clock with LED stripe: 28 LEDs in a stripe on the bottom of the clock = 34 LEDs in total.
 #define NUM_BACKLIGHT_LEDS (6) // 6 LEDs on the bottom of every LCD. For IPSTUBE clock without LED stripe.
+// With the LED stripe, the stripe can be controlled separately from the LEDs under the displays.
+// Every zone has its own pattern, color and intensity: {first LED, number of LEDs, name}
+// #define NUM_BACKLIGHT_ZONES (3)
+// #define BACKLIGHT_ZONES {{0, 6, "Back"}, {6, 14, "Stripe Left"}, {20, 14, "Stripe Right"}}
 
 // Only one Button on IPSTUBE clocks!
 #define ONE_BUTTON_ONLY_MENU
@@ -433,6 +500,17 @@
 
 #endif // IPSTUBE clock models (H401 and H402) XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
 
+// Backlight zones: all LEDs are one zone, if not defined otherwise for the hardware above.
+// Zone 0 is controlled by the normal backlight settings (menu, "Back" light in Home Assistant).
+#ifndef NUM_BACKLIGHT_ZONES
+#define NUM_BACKLIGHT_ZONES (1)
+#define BACKLIGHT_ZONES {{0, NUM_BACKLIGHT_LEDS, "Back"}}
+#endif
+#define BACKLIGHT_ZONES_MAX (8) // zones kept in the stored config, the same for all builds so its size doesn't change
+#if NUM_BACKLIGHT_ZONES > BACKLIGHT_ZONES_MAX
+#error "NUM_BACKLIGHT_ZONES is larger than BACKLIGHT_ZONES_MAX!"
+#endif
+
 // ************ Helper macros *********************
 #define concat2(first, second) first second
 #define concat3(first, second, third) first second third
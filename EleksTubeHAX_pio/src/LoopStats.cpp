@@ -0,0 +1,51 @@
+#include "LoopStats.h"
+
+void LoopStats::add(uint32_t busy_us)
+{
+  uint32_t bucket = busy_us / LOOP_STATS_BUCKET_US;
+  if (bucket >= num_buckets)
+  {
+    bucket = num_buckets - 1;
+  }
+  if (buckets[bucket] < UINT16_MAX)
+  {
+    buckets[bucket]++;
+  }
+  loops++;
+  if (busy_us > max_us)
+  {
+    max_us = busy_us;
+  }
+}
+
+void LoopStats::reset()
+{
+  memset(buckets, 0, sizeof(buckets));
+  loops = 0;
+  max_us = 0;
+}
+
+uint32_t LoopStats::percentileUs(uint8_t p)
+{
+  uint32_t total = 0;
+  for (uint8_t i = 0; i < num_buckets; i++)
+  {
+    total += buckets[i];
+  }
+  if (total == 0)
+  {
+    return 0;
+  }
+  // smallest bucket with at least p percent of the loops at or below it
+  uint32_t needed = (total * p + 99) / 100;
+  uint32_t count = 0;
+  for (uint8_t i = 0; i < num_buckets - 1; i++)
+  {
+    count += buckets[i];
+    if (count >= needed)
+    {
+      return (i + 1) * LOOP_STATS_BUCKET_US;
+    }
+  }
+  return max_us; // in the overflow bucket
+}
@@ -0,0 +1,36 @@
+#ifndef LOOP_STATS_H
+#define LOOP_STATS_H
+
+#include "GLOBAL_DEFINES.h"
+
+/*
+ * Histogram of the time the main loop is busy (without the sleep at its end), for diagnostics.
+ *
+ * The times are counted in buckets of LOOP_STATS_BUCKET_US, longer loops go into the last bucket.
+ * Percentiles are read from the histogram, so they are precise to one bucket and cost no sorting.
+ * The caller resets the histogram after reading it, so the values are per reporting interval.
+ */
+
+class LoopStats
+{
+public:
+  LoopStats() { reset(); }
+
+  void add(uint32_t busy_us);
+  void reset();
+
+  // Busy time in us that p percent of the loops didn't exceed, upper end of the bucket. 0 = no loops counted.
+  uint32_t percentileUs(uint8_t p);
+  uint32_t getMaxUs() { return max_us; }
+  uint32_t getLoops() { return loops; }
+
+private:
+  const static uint8_t num_buckets = 64;
+  uint16_t buckets[num_buckets];
+  uint32_t loops;
+  uint32_t max_us;
+};
+
+extern LoopStats loop_stats;
+
+#endif // LOOP_STATS_H
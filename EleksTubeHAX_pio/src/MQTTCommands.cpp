@@ -0,0 +1,269 @@
+#include "MQTTCommands.h"
+
+#if defined(MQTT_PLAIN_ENABLED) || defined(MQTT_HOME_ASSISTANT)
+#include "MQTT_client_ips.h"
+#include "Backlights.h"
+#include "TFTs.h"
+#include "Clock.h"
+#include "Stopwatch.h"
+#include "WorldClock.h"
+#include "main.h"
+
+bool applyMQTTCommands()
+{
+  uint8_t redraws = 0;
+  bool settings_changed =
+      MQTTCommandMainPowerReceived ||
+      MQTTCommandBackPowerReceived ||
+      MQTTCommandStateReceived ||
+      MQTTCommandBrightnessReceived ||
+      MQTTCommandMainBrightnessReceived ||
+      MQTTCommandBackBrightnessReceived ||
+      MQTTCommandPatternReceived ||
+      MQTTCommandBackPatternReceived ||
+      MQTTCommandBackColorPhaseReceived ||
+      MQTTCommandGraphicReceived ||
+      MQTTCommandMainGraphicReceived ||
+      MQTTCommandUseTwelveHoursReceived ||
+      MQTTCommandBlankZeroHoursReceived ||
+      MQTTCommandPulseBpmReceived ||
+      MQTTCommandBreathBpmReceived ||
+      MQTTCommandRainbowSecReceived;
+#ifdef MQTT_BACKLIGHT_ZONES
+  for (uint8_t zone = 1; zone < NUM_BACKLIGHT_ZONES; zone++)
+  {
+    settings_changed = settings_changed ||
+                       MQTTCommandZonePowerReceived[zone] ||
+                       MQTTCommandZoneBrightnessReceived[zone] ||
+                       MQTTCommandZonePatternReceived[zone] ||
+                       MQTTCommandZoneColorPhaseReceived[zone];
+  }
+#endif
+
+  if (MQTTCommandMainPowerReceived)
+  {
+    MQTTCommandMainPowerReceived = false;
+    if (MQTTCommandMainPower)
+    {
+      if (!tfts.isEnabled()) // perform reinit, enable, redraw only if displays are actually off. HA sends ON command together with clock face change which causes flickering.
+      {
+#ifdef HARDWARE_Elekstube_CLOCK // original EleksTube hardware and direct clones need a reinit to wake up the displays properly
+        tfts.reinit();
+#else
+        tfts.enableAllDisplays(); // for all other clocks, just enable the displays
+#endif
+        redraws++; // redraw all the clock digits -> needed because the displays was blanked before turning off
+      }
+    }
+    else
+    {
+      tfts.chip_select.setAll();
+      tfts.fillScreen(TFT_BLACK); // blank the screens before turning off -> needed for all clocks without a real "power switch curcuit" to "simulate" the off-switched displays
+      tfts.disableAllDisplays();
+    }
+  }
+
+  if (MQTTCommandBackPowerReceived)
+  {
+    MQTTCommandBackPowerReceived = false;
+    if (MQTTCommandBackPower)
+    {
+      backlights.PowerOn();
+    }
+    else
+    {
+      backlights.PowerOff();
+    }
+  }
+
+  if (MQTTCommandStateReceived)
+  {
+    MQTTCommandStateReceived = false;
+    randomSeed(millis());
+    uint8_t idx;
+    if (MQTTCommandState >= 90)
+    {
+      idx = random(1, tfts.NumberOfClockFaces + 1);
+    }
+    else
+    {
+      idx = (MQTTCommandState / 5) - 1;
+    } // 10..40 -> graphic 1..6
+    Serial.print("Graphic change request from MQTT; command: ");
+    Serial.print(MQTTCommandState);
+    Serial.print(", index: ");
+    Serial.println(idx);
+    uclock.setClockGraphicsIdx(idx);
+    tfts.current_graphic = uclock.getActiveGraphicIdx();
+    redraws++; // redraw everything
+  }
+
+  if (MQTTCommandMainBrightnessReceived)
+  {
+    MQTTCommandMainBrightnessReceived = false;
+    tfts.dimming = MQTTCommandMainBrightness;
+    tfts.ProcessUpdatedDimming();
+    redraws++;
+  }
+
+  if (MQTTCommandBackBrightnessReceived)
+  {
+    MQTTCommandBackBrightnessReceived = false;
+    backlights.setIntensity(uint8_t(MQTTCommandBackBrightness));
+  }
+
+  if (MQTTCommandPatternReceived)
+  {
+    MQTTCommandPatternReceived = false;
+
+    for (int8_t i = 0; i < Backlights::num_patterns; i++)
+    {
+      Serial.print("New pattern ");
+      Serial.print(MQTTCommandPattern);
+      Serial.print(", check pattern ");
+      Serial.println(Backlights::patterns_str[i]);
+      if (strcmp(MQTTCommandPattern, (Backlights::patterns_str[i]).c_str()) == 0)
+      {
+        backlights.setPattern(Backlights::patterns(i));
+        break;
+      }
+    }
+  }
+
+  if (MQTTCommandBackPatternReceived)
+  {
+    MQTTCommandBackPatternReceived = false;
+    for (int8_t i = 0; i < Backlights::num_patterns; i++)
+    {
+      Serial.print("new pattern ");
+      Serial.print(MQTTCommandBackPattern);
+      Serial.print(", check pattern ");
+      Serial.println(Backlights::patterns_str[i]);
+      if (strcmp(MQTTCommandBackPattern, (Backlights::patterns_str[i]).c_str()) == 0)
+      {
+        backlights.setPattern(Backlights::patterns(i));
+        break;
+      }
+    }
+  }
+
+  if (MQTTCommandBackProgramReceived)
+  {
+    MQTTCommandBackProgramReceived = false;
+    if (backlights.loadProgram(MQTTCommandBackProgram, MQTTCommandBackProgramLength, true))
+    {
+      backlights.setPattern(Backlights::program);
+    }
+  }
+
+  if (MQTTCommandTimerReceived)
+  {
+    MQTTCommandTimerReceived = false;
+    stopwatch.command(MQTTCommandTimer);
+    redraws++; // clock or timer digits
+  }
+
+  if (MQTTCommandWorldClockReceived)
+  {
+    MQTTCommandWorldClockReceived = false;
+    if (worldclock.command(MQTTCommandWorldClock))
+    {
+      settings_changed = true; // saved after MQTT_SAVE_PREFERENCES_AFTER_SEC, not with every retained message
+    }
+  }
+
+  if (MQTTCommandBackColorPhaseReceived)
+  {
+    MQTTCommandBackColorPhaseReceived = false;
+
+    backlights.setColorPhase(MQTTCommandBackColorPhase);
+  }
+
+#ifdef MQTT_BACKLIGHT_ZONES
+  for (uint8_t zone = 1; zone < NUM_BACKLIGHT_ZONES; zone++)
+  {
+    if (MQTTCommandZonePowerReceived[zone])
+    {
+      MQTTCommandZonePowerReceived[zone] = false;
+      backlights.setZonePower(zone, MQTTCommandZonePower[zone]);
+    }
+    if (MQTTCommandZoneBrightnessReceived[zone])
+    {
+      MQTTCommandZoneBrightnessReceived[zone] = false;
+      backlights.setZoneIntensity(zone, MQTTCommandZoneBrightness[zone]);
+    }
+    if (MQTTCommandZonePatternReceived[zone])
+    {
+      MQTTCommandZonePatternReceived[zone] = false;
+      for (int8_t i = 0; i < Backlights::num_patterns; i++)
+      {
+        if (strcmp(MQTTCommandZonePattern[zone], (Backlights::patterns_str[i]).c_str()) == 0)
+        {
+          backlights.setZonePattern(zone, Backlights::patterns(i));
+          break;
+        }
+      }
+    }
+    if (MQTTCommandZoneColorPhaseReceived[zone])
+    {
+      MQTTCommandZoneColorPhaseReceived[zone] = false;
+      backlights.setZoneColorPhase(zone, MQTTCommandZoneColorPhase[zone]);
+    }
+  }
+#endif
+
+  if (MQTTCommandGraphicReceived)
+  {
+    MQTTCommandGraphicReceived = false;
+
+    uclock.setClockGraphicsIdx(MQTTCommandGraphic);
+    tfts.current_graphic = uclock.getActiveGraphicIdx();
+    redraws++; // redraw everything
+  }
+
+  if (MQTTCommandMainGraphicReceived)
+  {
+    MQTTCommandMainGraphicReceived = false;
+    uclock.setClockGraphicsIdx(MQTTCommandMainGraphic);
+    tfts.current_graphic = uclock.getActiveGraphicIdx();
+    redraws++; // redraw everything
+  }
+
+  if (MQTTCommandUseTwelveHoursReceived)
+  {
+    MQTTCommandUseTwelveHoursReceived = false;
+    uclock.setTwelveHour(MQTTCommandUseTwelveHours);
+  }
+
+  if (MQTTCommandBlankZeroHoursReceived)
+  {
+    MQTTCommandBlankZeroHoursReceived = false;
+    uclock.setBlankHoursZero(MQTTCommandBlankZeroHours);
+  }
+
+  if (MQTTCommandPulseBpmReceived)
+  {
+    MQTTCommandPulseBpmReceived = false;
+    backlights.setPulseRate(MQTTCommandPulseBpm);
+  }
+
+  if (MQTTCommandBreathBpmReceived)
+  {
+    MQTTCommandBreathBpmReceived = false;
+    backlights.setBreathRate(MQTTCommandBreathBpm);
+  }
+
+  if (MQTTCommandRainbowSecReceived)
+  {
+    MQTTCommandRainbowSecReceived = false;
+    backlights.setRainbowDuration(MQTTCommandRainbowSec);
+  }
+
+  if (redraws > 0)
+  {
+    updateClockDisplay(TFTs::force);
+    MQTTCmdStats.redraws_avoided += redraws - 1;
+  }
+  return settings_changed;
+}
+#endif // MQTT_PLAIN_ENABLED || MQTT_HOME_ASSISTANT
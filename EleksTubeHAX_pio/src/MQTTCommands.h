@@ -0,0 +1,18 @@
+#ifndef MQTT_COMMANDS_H
+#define MQTT_COMMANDS_H
+
+#include "GLOBAL_DEFINES.h"
+
+/*
+ * Applies the commands the MQTT client received (the MQTTCommand...Received flags) to the clock, from loop().
+ *
+ * All commands received since the last call are applied together. The displays are redrawn once at the end, also if
+ * several commands need it (e.g. power, brightness and clock face from one Home Assistant scene).
+ */
+
+#if defined(MQTT_PLAIN_ENABLED) || defined(MQTT_HOME_ASSISTANT)
+// Returns true if a setting was changed that is stored in the config.
+bool applyMQTTCommands();
+#endif
+
+#endif // MQTT_COMMANDS_H
@@ -33,6 +33,11 @@
 #include "TFTs.h"
 #include "Backlights.h"
 #include "Clock.h"
+#include "EventBus.h"
+#include "WiFi_WPS.h"
+#include "LoopStats.h"
+#include "Stopwatch.h"
+#include <esp_heap_caps.h>
 #ifdef MQTT_USE_TLS
 #include <WiFiClientSecure.h> // for secure WiFi client
 
@@ -44,38 +49,85 @@ WiFiClient espClient;
 // initialize the MQTT client
 PubSubClient MQTTclient(espClient);
 
+struct MQTTMessage; // received message, see MQTTCallback()
+
 // functions for general MQTT handling
 void MQTTCallback(char *topic, byte *payload, unsigned int length);
+void MQTTReceiveBacklightProgram(const byte *payload, unsigned int length);
 void checkIfMQTTIsConnected();
+bool MQTTIsConnected();
 bool MQTTPublish(const char *Topic, const char *Message, const bool Retain);
 bool MQTTPublish(const char *Topic, JsonDocument *Json, const bool Retain);
-void MQTTReportState(bool forceUpdateEverything);
-void MQTTReportBackOnChange();
-void MQTTReportBackEverything(bool forceUpdateEverything);
-void MQTTPeriodicReportBack();
+void MQTTStateMarkDirty(uint32_t entities);
+void MQTTStateCommandReceived(uint8_t entity);
+void MQTTStateLoop();
+void MQTTReportDiagnostics();
+void MQTTEventQueueBegin();
+void MQTTEventQueueLoop();
+uint16_t MQTTEventQueueDepth();
 
 // plain MQTT mode functions
-void MQTTReportPowerState(bool forceUpdate);
-void MQTTReportWiFiSignal();
-void MQTTReportStatus(bool forceUpdate);
+bool MQTTReportPowerState();
+bool MQTTReportWiFiSignal();
+bool MQTTReportStatus();
+bool MQTTReportSun();
 
 // Home Assistant mode functions
-bool MQTTReportDiscovery();
+bool MQTTBuildDiscovery();
+void MQTTDiscoveryPrepare();
+void MQTTDiscoveryStart(uint32_t delay_ms, bool force);
+void MQTTDiscoveryLoop();
 bool MQTTReportAvailability(const char *status);
 
 // helper functions
 double round1(double value);
+void minutesToTimeStr(int16_t minutes, char *str, size_t size);
+#ifdef MQTT_BACKLIGHT_ZONES
+void MQTTZoneTopic(uint8_t zone, const char *suffix, char *topic, size_t size);
+bool MQTTReceiveZone(const char *suffix, MQTTMessage &msg, JsonDocument &doc);
+#endif
 bool endsWith(const char *str, const char *suffix);
 #ifdef MQTT_USE_TLS
 bool loadCARootCert();
 #endif // MQTT_USE_TLS
 
+// reported entities, one state topic each, see MQTTStateLoop()
+enum MQTTEntity : uint8_t
+{
+#ifdef MQTT_PLAIN_ENABLED
+  MQTTEntityPower,
+  MQTTEntitySetpoint,
+  MQTTEntitySignal,
+#endif
+#ifdef MQTT_HOME_ASSISTANT
+  MQTTEntityMain,
+  MQTTEntityBack,
+  MQTTEntityTwelveHours,
+  MQTTEntityBlankZeroHours,
+  MQTTEntityPulse,
+  MQTTEntityBreath,
+  MQTTEntityRainbow,
+#endif
+#ifdef DIMMING_SUNRISE_SUNSET
+  MQTTEntitySun,
+#endif
+#ifdef MQTT_HOME_ASSISTANT
+  MQTTEntityZone, // backlight zones 1.., zone 0 is "Back"
+  MQTTEntityCount = MQTTEntityZone + NUM_BACKLIGHT_ZONES - 1,
+#else
+  MQTTEntityCount,
+#endif
+  MQTTEntityNone = 0xff
+};
+
+#define MQTT_ENTITY(entity) (1UL << (entity))
+#define MQTT_ENTITY_ALL ((uint32_t)(((uint64_t)1 << MQTTEntityCount) - 1))
+
 // variables
-uint32_t lastTimeSent = (uint32_t)(MQTT_REPORT_STATUS_EVERY_SEC * -1000);
-uint32_t LastTimeTriedToConnect = 0;
 
 bool MQTTConnected = false;     // Show connection status on the clock's LCD
 bool discoveryReported = false; // initial state of discovery messages sent to HA
+bool MQTTDiscoveryReplayActive = false; // discovery messages are being sent, see MQTTDiscoveryLoop()
 bool availabilityReported = false;
 
 // commands from server for plain MQTT mode
@@ -91,6 +143,10 @@ bool MQTTCommandStateReceived = false;
 #define TopicPulse "pulse_bpm"
 #define TopicBreath "breath_bpm"
 #define TopicRainbow "rainbow_duration"
+#define TopicSun "sun"
+#define TopicDiagnostics "diagnostics"
+#define TopicEvent "event"
+#define TopicBackZone "back_z" // followed by the zone number
 #endif
 
 bool MQTTCommandMainPower = true;
@@ -131,6 +187,24 @@ bool MQTTCommandBreathBpmReceived = false;
 float MQTTCommandRainbowSec = -1;
 bool MQTTCommandRainbowSecReceived = false;
 
+uint8_t MQTTCommandBackProgram[BACKLIGHT_PROGRAM_MAX_SIZE + 3];
+size_t MQTTCommandBackProgramLength = 0;
+bool MQTTCommandBackProgramReceived = false;
+char MQTTCommandTimer[32];
+bool MQTTCommandTimerReceived = false;
+char MQTTCommandWorldClock[256];
+bool MQTTCommandWorldClockReceived = false;
+#ifdef MQTT_BACKLIGHT_ZONES
+bool MQTTCommandZonePower[NUM_BACKLIGHT_ZONES];
+bool MQTTCommandZonePowerReceived[NUM_BACKLIGHT_ZONES];
+uint8_t MQTTCommandZoneBrightness[NUM_BACKLIGHT_ZONES];
+bool MQTTCommandZoneBrightnessReceived[NUM_BACKLIGHT_ZONES];
+char MQTTCommandZonePattern[NUM_BACKLIGHT_ZONES][24];
+bool MQTTCommandZonePatternReceived[NUM_BACKLIGHT_ZONES];
+uint16_t MQTTCommandZoneColorPhase[NUM_BACKLIGHT_ZONES];
+bool MQTTCommandZoneColorPhaseReceived[NUM_BACKLIGHT_ZONES];
+#endif
+
 // status to server for Home Assistant
 bool MQTTStatusMainPower = true;
 bool MQTTStatusBackPower = true;
@@ -151,6 +225,17 @@ uint8_t MQTTStatusMainGraphic = 0;
 uint8_t MQTTStatusPulseBpm = 0;
 uint8_t MQTTStatusBreathBpm = 0;
 float MQTTStatusRainbowSec = 0;
+#ifdef DIMMING_SUNRISE_SUNSET
+int16_t MQTTStatusSunrise = -1;
+int16_t MQTTStatusSunset = -1;
+bool MQTTStatusNightTime = false;
+#endif
+#ifdef MQTT_BACKLIGHT_ZONES
+bool MQTTStatusZonePower[NUM_BACKLIGHT_ZONES];
+uint8_t MQTTStatusZoneBrightness[NUM_BACKLIGHT_ZONES];
+char MQTTStatusZonePattern[NUM_BACKLIGHT_ZONES][24];
+uint16_t MQTTStatusZoneColorPhase[NUM_BACKLIGHT_ZONES];
+#endif
 
 int LastSentMainPowerState = -1;
 int LastSentBackPowerState = -1;
@@ -167,6 +252,17 @@ bool LastSentBlankZeroHours = false;
 uint8_t LastSentPulseBpm = -1;
 uint8_t LastSentBreathBpm = -1;
 float LastSentRainbowSec = -1;
+#ifdef DIMMING_SUNRISE_SUNSET
+int16_t LastSentSunrise = -2;
+int16_t LastSentSunset = -2;
+bool LastSentNightTime = false;
+#endif
+#ifdef MQTT_BACKLIGHT_ZONES
+bool LastSentZonePower[NUM_BACKLIGHT_ZONES];
+uint8_t LastSentZoneBrightness[NUM_BACKLIGHT_ZONES];
+char LastSentZonePattern[NUM_BACKLIGHT_ZONES][24];
+uint16_t LastSentZoneColorPhase[NUM_BACKLIGHT_ZONES];
+#endif
 
 // plain MQTT
 int LastSentSignalLevel = 999;
@@ -224,7 +320,7 @@ void printMQTTconnectionStatus(void)
 
 bool MQTTPublish(const char *Topic, const char *Message, const bool Retain)
 {
-  if (!MQTTclient.connected())
+  if (!MQTTIsConnected())
     return false;
 
   bool ok = MQTTclient.publish(Topic, Message, Retain);
@@ -248,145 +344,318 @@ bool MQTTPublish(const char *Topic, const char *Message, const bool Retain)
   return ok;
 }
 
-bool MQTTPublish(const char *Topic, JsonDocument *Json, const bool Retain)
+// Collects the serialized JSON in a small static buffer and writes it to the MQTT client in chunks,
+// instead of one TCP write per character.
+class MQTTChunkWriter : public Print
 {
-  size_t buffSize = measureJson(*Json) + 3; // Discovery Light = about 720 bytes
-#ifdef DEBUG_OUTPUT_MQTT
-  Serial.printf("DEBUG: TX MQTT message JSON size: %d\n", buffSize);
-#endif
-  char *buffer = (char *)malloc(buffSize);
-  if (buffer == NULL)
+public:
+  size_t write(uint8_t c) override
   {
-    Serial.printf("ERROR: Error allocating %d bytes to serialize JSON.\n", buffSize);
-    return false;
+    chunk[chunk_length++] = c;
+    if (chunk_length == sizeof(chunk))
+    {
+      send();
+    }
+    return 1;
   }
-  size_t dataSize = serializeJson(*Json, buffer, buffSize);
-  if ((dataSize < buffSize) && (dataSize > 0))
+  size_t write(const uint8_t *data, size_t size) override
   {
-    bool ok = MQTTPublish(Topic, buffer, Retain);
-    Json->clear();
-    free(buffer);
-    return ok;
+    for (size_t i = 0; i < size; i++)
+    {
+      write(data[i]);
+    }
+    return size;
   }
-  else
+  void send()
   {
-    Serial.println("ERROR: Error serializing JSON data.");
-    Json->clear();
-    free(buffer);
-    return false;
+    if (chunk_length > 0)
+    {
+      written += MQTTclient.write(chunk, chunk_length);
+      chunk_length = 0;
+    }
   }
-}
-
-void MQTTReportState(bool forceUpdateEverything)
-{
-#ifdef MQTT_HOME_ASSISTANT
-  if (!MQTTclient.connected())
-    return;
-
-  // send availability message
-  if (forceUpdateEverything || !availabilityReported)
+  void reset()
   {
-    if (!MQTTReportAvailability(MQTT_ALIVE_MSG_ONLINE))
-      return;
-    availabilityReported = true;
+    chunk_length = 0;
+    written = 0;
   }
+  size_t written = 0;
 
-  if (forceUpdateEverything || MQTTStatusMainPower != LastSentMainPowerState || MQTTStatusMainBrightness != LastSentMainBrightness || MQTTStatusMainGraphic != LastSentMainGraphic)
-  {
-    JsonDocument state;
-    state["state"] = MQTTStatusMainPower == 0 ? MQTT_STATE_OFF : MQTT_STATE_ON;
-    state["brightness"] = MQTTStatusMainBrightness;
-    state["effect"] = tfts.clockFaceToName(MQTTStatusMainGraphic);
-    state["color_mode"] = "brightness";
+private:
+  uint8_t chunk[64];
+  size_t chunk_length = 0;
+};
 
-    if (!MQTTPublish(concat3(MQTT_CLIENT, "/", TopicFront), &state, MQTT_RETAIN_STATE_MESSAGES))
-      return;
+MQTTPublishStats MQTTStats = {};
 
-    LastSentMainPowerState = MQTTStatusMainPower;
-    LastSentMainBrightness = MQTTStatusMainBrightness;
-    LastSentMainGraphic = MQTTStatusMainGraphic;
+// Memory of the JsonDocuments of sent and received messages. They only live while a message is built or
+// handled, so a static buffer is used from the start and starts over when all of them are freed. Only what
+// does not fit goes to the heap, counted in MQTTStats.heap_allocs.
+class MQTTArenaAllocator : public ArduinoJson::Allocator
+{
+public:
+  void *allocate(size_t size) override
+  {
+    size_t block = (size + 2 * alignment - 1) & ~(alignment - 1); // with the header keeping the size
+    if (used + block > sizeof(arena))
+    {
+      MQTTStats.heap_allocs++;
+      return malloc(size);
+    }
+    uint8_t *header = arena + used;
+    *(size_t *)header = size;
+    used += block;
+    live++;
+    if (used > MQTTStats.arena_peak)
+    {
+      MQTTStats.arena_peak = used;
+    }
+    return header + alignment;
   }
-
-  if (forceUpdateEverything || MQTTStatusBackPower != LastSentBackPowerState || MQTTStatusBackBrightness != LastSentBackBrightness || strcmp(MQTTStatusBackPattern, LastSentBackPattern) != 0 || MQTTStatusBackColorPhase != LastSentBackColorPhase || MQTTStatusPulseBpm != LastSentPulseBpm || MQTTStatusBreathBpm != LastSentBreathBpm || MQTTStatusRainbowSec != LastSentRainbowSec)
+  void deallocate(void *ptr) override
   {
-    JsonDocument state;
-    state["state"] = MQTTStatusBackPower == 0 ? MQTT_STATE_OFF : MQTT_STATE_ON;
-    state["brightness"] = MQTTStatusBackBrightness;
-    state["effect"] = MQTTStatusBackPattern;
-    state["color_mode"] = "hs";
-    state["color"]["h"] = backlights.phaseToHue(MQTTStatusBackColorPhase);
-    state["color"]["s"] = 100.f;
-    state["pulse_bpm"] = MQTTStatusPulseBpm;
-    state["beath_bpm"] = MQTTStatusBreathBpm;
-    state["rainbow_sec"] = round1(MQTTStatusRainbowSec);
-
-    if (!MQTTPublish(concat3(MQTT_CLIENT, "/", TopicBack), &state, MQTT_RETAIN_STATE_MESSAGES))
+    if (!inArena(ptr))
+    {
+      free(ptr);
       return;
-
-    LastSentBackPowerState = MQTTStatusBackPower;
-    LastSentBackBrightness = MQTTStatusBackBrightness;
-    strncpy(LastSentBackPattern, MQTTStatusBackPattern, sizeof(LastSentBackPattern) - 1);
-    LastSentBackPattern[sizeof(LastSentBackPattern) - 1] = '\0';
-    LastSentBackColorPhase = MQTTStatusBackColorPhase;
+    }
+    if (isLast(ptr))
+    {
+      used = (uint8_t *)ptr - alignment - arena;
+    }
+    if (--live == 0)
+    {
+      used = 0;
+    }
   }
-
-  if (forceUpdateEverything || MQTTStatusUseTwelveHours != LastSentUseTwelveHours)
+  void *reallocate(void *ptr, size_t new_size) override
   {
-    JsonDocument state;
-    state["state"] = MQTTStatusUseTwelveHours ? MQTT_STATE_ON : MQTT_STATE_OFF;
-
-    if (!MQTTPublish(concat3(MQTT_CLIENT, "/", Topic12hr), &state, MQTT_RETAIN_STATE_MESSAGES))
-      return;
-
-    LastSentUseTwelveHours = MQTTStatusUseTwelveHours;
+    if (ptr == NULL)
+    {
+      return allocate(new_size);
+    }
+    if (!inArena(ptr))
+    {
+      MQTTStats.heap_allocs++;
+      return realloc(ptr, new_size);
+    }
+    size_t &size = *(size_t *)((uint8_t *)ptr - alignment);
+    size_t start = (uint8_t *)ptr - arena;
+    size_t block = (new_size + alignment - 1) & ~(alignment - 1);
+    if (isLast(ptr) && start + block <= sizeof(arena))
+    { // the last block grows or shrinks in place
+      size = new_size;
+      used = start + block;
+      if (used > MQTTStats.arena_peak)
+      {
+        MQTTStats.arena_peak = used;
+      }
+      return ptr;
+    }
+    if (new_size <= size)
+    {
+      return ptr;
+    }
+    void *moved = allocate(new_size);
+    if (moved != NULL)
+    {
+      memcpy(moved, ptr, size);
+      deallocate(ptr);
+    }
+    return moved;
   }
 
-  if (forceUpdateEverything || MQTTStatusBlankZeroHours != LastSentBlankZeroHours)
+private:
+  static const size_t alignment = 8;
+  bool inArena(void *ptr) const { return (uint8_t *)ptr >= arena && (uint8_t *)ptr < arena + sizeof(arena); }
+  bool isLast(void *ptr) const
   {
-    JsonDocument state;
-    state["state"] = MQTTStatusBlankZeroHours ? MQTT_STATE_ON : MQTT_STATE_OFF;
+    size_t size = *(size_t *)((uint8_t *)ptr - alignment);
+    return (uint8_t *)ptr + ((size + alignment - 1) & ~(alignment - 1)) == arena + used;
+  }
+  alignas(8) uint8_t arena[MQTT_JSON_ARENA_SIZE];
+  size_t used = 0;
+  uint16_t live = 0; // blocks not freed yet
+};
 
-    if (!MQTTPublish(concat3(MQTT_CLIENT, "/", TopicBlank0), &state, MQTT_RETAIN_STATE_MESSAGES))
-      return;
+MQTTArenaAllocator MQTTJsonArena;
 
-    LastSentBlankZeroHours = MQTTStatusBlankZeroHours;
+bool MQTTPublishDocument(const char *Topic, JsonDocument *Json, const bool Retain, const bool MsgPack)
+{
+  // The document is serialized directly into the MQTT packet, no message buffer is allocated.
+  static MQTTChunkWriter writer;
+  size_t length = MsgPack ? measureMsgPack(*Json) : measureJson(*Json); // Discovery Light = about 720 bytes as JSON
+  bool ok = MQTTclient.beginPublish(Topic, length, Retain);
+  if (ok)
+  {
+    writer.reset();
+    if (MsgPack)
+    {
+      serializeMsgPack(*Json, writer);
+    }
+    else
+    {
+      serializeJson(*Json, writer);
+    }
+    writer.send();
+    ok = MQTTclient.endPublish() && writer.written == length;
   }
 
-  if (forceUpdateEverything || MQTTStatusPulseBpm != LastSentPulseBpm)
+  MQTTStats.messages++;
+  MQTTStats.bytes += length;
+  if (MsgPack)
   {
-    JsonDocument state;
-    state["state"] = MQTTStatusPulseBpm;
-
-    if (!MQTTPublish(concat3(MQTT_CLIENT, "/", TopicPulse), &state, MQTT_RETAIN_STATE_MESSAGES))
-      return;
+    MQTTStats.msgpack_bytes += length;
+    MQTTStats.msgpack_json_bytes += measureJson(*Json);
+  }
+  if (!ok)
+  {
+    MQTTStats.failed++;
+  }
 
-    LastSentPulseBpm = MQTTStatusPulseBpm;
+#ifdef DEBUG_OUTPUT_MQTT
+  if (ok)
+  {
+    Serial.print("DEBUG: TX MQTT: Topic: ");
+    Serial.print(Topic);
+    Serial.print(MsgPack ? " - Message (as JSON): " : " - Message: ");
+    serializeJson(*Json, Serial);
+    Serial.print(" - Retain: ");
+    Serial.println(Retain ? "true" : "false");
+  }
+  else
+  {
+    Serial.print("DEBUG: TX MQTT Error for topic: ");
+    Serial.println(Topic);
   }
+  Serial.printf("DEBUG: TX MQTT message %s size: %d, heap allocations so far: %d\n", MsgPack ? "MessagePack" : "JSON", length, MQTTStats.heap_allocs);
+#endif
+  return ok;
+}
 
-  if (forceUpdateEverything || MQTTStatusBreathBpm != LastSentBreathBpm)
+bool MQTTPublish(const char *Topic, JsonDocument *Json, const bool Retain)
+{
+  if (!MQTTIsConnected())
+  {
+    Json->clear();
+    return false;
+  }
+  bool ok = MQTTPublishDocument(Topic, Json, Retain, false);
+#ifdef MQTT_MSGPACK
+  // The same document once more under "<MQTT_CLIENT>/msgpack/" for compact clients, only for the device's own topics.
+  const size_t prefix_length = sizeof(MQTT_CLIENT) - 1;
+  if (ok && strncmp(Topic, MQTT_CLIENT, prefix_length) == 0 && Topic[prefix_length] == '/')
   {
-    JsonDocument state;
-    state["state"] = MQTTStatusBreathBpm;
+    char topic[96];
+    snprintf(topic, sizeof(topic), "%s%s%s", MQTT_CLIENT, MQTT_MSGPACK_TOPIC, Topic + prefix_length);
+    MQTTPublishDocument(topic, Json, Retain, true);
+  }
+#endif
+  Json->clear();
+  return ok;
+}
 
-    if (!MQTTPublish(concat3(MQTT_CLIENT, "/", TopicBreath), &state, MQTT_RETAIN_STATE_MESSAGES))
-      return;
+#ifdef MQTT_HOME_ASSISTANT
+bool MQTTReportMain()
+{
+  JsonDocument state(&MQTTJsonArena);
+  state["state"] = MQTTStatusMainPower == 0 ? MQTT_STATE_OFF : MQTT_STATE_ON;
+  state["brightness"] = MQTTStatusMainBrightness;
+  state["effect"] = tfts.clockFaceToName(MQTTStatusMainGraphic);
+  state["color_mode"] = "brightness";
 
-    LastSentBreathBpm = MQTTStatusBreathBpm;
-  }
+  if (!MQTTPublish(concat3(MQTT_CLIENT, "/", TopicFront), &state, MQTT_RETAIN_STATE_MESSAGES))
+    return false;
 
-  if (forceUpdateEverything || MQTTStatusRainbowSec != LastSentRainbowSec)
-  {
+  LastSentMainPowerState = MQTTStatusMainPower;
+  LastSentMainBrightness = MQTTStatusMainBrightness;
+  LastSentMainGraphic = MQTTStatusMainGraphic;
+  return true;
+}
 
-    JsonDocument state;
-    state["state"] = round1(MQTTStatusRainbowSec);
+bool MQTTReportBack()
+{
+  JsonDocument state(&MQTTJsonArena);
+  state["state"] = MQTTStatusBackPower == 0 ? MQTT_STATE_OFF : MQTT_STATE_ON;
+  state["brightness"] = MQTTStatusBackBrightness;
+  state["effect"] = MQTTStatusBackPattern;
+  state["color_mode"] = "hs";
+  state["color"]["h"] = backlights.phaseToHue(MQTTStatusBackColorPhase);
+  state["color"]["s"] = 100.f;
+  state["pulse_bpm"] = MQTTStatusPulseBpm;
+  state["beath_bpm"] = MQTTStatusBreathBpm;
+  state["rainbow_sec"] = round1(MQTTStatusRainbowSec);
+
+  if (!MQTTPublish(concat3(MQTT_CLIENT, "/", TopicBack), &state, MQTT_RETAIN_STATE_MESSAGES))
+    return false;
 
-    if (!MQTTPublish(concat3(MQTT_CLIENT, "/", TopicRainbow), &state, MQTT_RETAIN_STATE_MESSAGES))
-      return;
+  LastSentBackPowerState = MQTTStatusBackPower;
+  LastSentBackBrightness = MQTTStatusBackBrightness;
+  strncpy(LastSentBackPattern, MQTTStatusBackPattern, sizeof(LastSentBackPattern) - 1);
+  LastSentBackPattern[sizeof(LastSentBackPattern) - 1] = '\0';
+  LastSentBackColorPhase = MQTTStatusBackColorPhase;
+  return true;
+}
 
-    LastSentRainbowSec = MQTTStatusRainbowSec;
-  }
+#ifdef MQTT_BACKLIGHT_ZONES
+bool MQTTReportZone(uint8_t zone)
+{
+  JsonDocument state(&MQTTJsonArena);
+  state["state"] = MQTTStatusZonePower[zone] ? MQTT_STATE_ON : MQTT_STATE_OFF;
+  state["brightness"] = MQTTStatusZoneBrightness[zone];
+  state["effect"] = MQTTStatusZonePattern[zone];
+  state["color_mode"] = "hs";
+  state["color"]["h"] = backlights.phaseToHue(MQTTStatusZoneColorPhase[zone]);
+  state["color"]["s"] = 100.f;
+
+  char topic[64];
+  MQTTZoneTopic(zone, "", topic, sizeof(topic));
+  if (!MQTTPublish(topic, &state, MQTT_RETAIN_STATE_MESSAGES))
+    return false;
+
+  LastSentZonePower[zone] = MQTTStatusZonePower[zone];
+  LastSentZoneBrightness[zone] = MQTTStatusZoneBrightness[zone];
+  strcpy(LastSentZonePattern[zone], MQTTStatusZonePattern[zone]);
+  LastSentZoneColorPhase[zone] = MQTTStatusZoneColorPhase[zone];
+  return true;
+}
 #endif
+
+bool MQTTReportSwitch(const char *topic, bool on)
+{
+  JsonDocument state(&MQTTJsonArena);
+  state["state"] = on ? MQTT_STATE_ON : MQTT_STATE_OFF;
+  return MQTTPublish(topic, &state, MQTT_RETAIN_STATE_MESSAGES);
+}
+
+bool MQTTReportNumber(const char *topic, double value)
+{
+  JsonDocument state(&MQTTJsonArena);
+  state["state"] = value;
+  return MQTTPublish(topic, &state, MQTT_RETAIN_STATE_MESSAGES);
+}
+
+#ifdef DIMMING_SUNRISE_SUNSET
+bool MQTTReportSun()
+{
+  char sunrise[6], sunset[6];
+  minutesToTimeStr(MQTTStatusSunrise, sunrise, sizeof(sunrise));
+  minutesToTimeStr(MQTTStatusSunset, sunset, sizeof(sunset));
+  JsonDocument state(&MQTTJsonArena);
+  state["sunrise"] = sunrise;
+  state["sunset"] = sunset;
+  state["night"] = MQTTStatusNightTime ? MQTT_STATE_ON : MQTT_STATE_OFF;
+
+  if (!MQTTPublish(concat3(MQTT_CLIENT, "/", TopicSun), &state, MQTT_RETAIN_STATE_MESSAGES))
+    return false;
+
+  LastSentSunrise = MQTTStatusSunrise;
+  LastSentSunset = MQTTStatusSunset;
+  LastSentNightTime = MQTTStatusNightTime;
+  return true;
 }
+#endif
+#endif // MQTT_HOME_ASSISTANT
 
 #ifdef MQTT_USE_TLS
 bool loadCARootCert()
@@ -436,524 +705,1669 @@ bool loadCARootCert()
 }
 #endif
 
-bool MQTTStart(bool restart)
+// The connection to the broker is made by a short-lived FreeRTOS task, so the TCP connect, the TLS handshake and
+// loading the CA certificate don't block the clock. While the task runs, MQTTclient belongs to it: everything else
+// only uses the client after checking MQTTIsConnected(). Failed attempts are retried with exponential backoff
+// (MQTT_RECONNECT_MIN_SEC, doubled per failure up to MQTT_RECONNECT_WAIT_SEC) and random jitter, so clocks that
+// lost the broker together don't all come back at the same moment.
+
+enum MQTTLinkState : uint8_t
 {
-  MQTTConnected = false;
-  if (((millis() - LastTimeTriedToConnect) > (MQTT_RECONNECT_WAIT_SEC * 1000)) || (LastTimeTriedToConnect == 0))
-  { // try to connect to MQTT broker only if the time since last connection attempt is greater than the defined wait time (default 30 sec)
-    if (restart)
-    {
-      Serial.println("MQTT reconnecting...");
-      printMQTTconnectionStatus();
-    }
-    else
-    {
-      LastTimeTriedToConnect = millis();
-#ifdef DEBUG_OUTPUT_MQTT
-      Serial.println("DEBUG: Set MQTT broker to: ");
-      Serial.print(MQTT_BROKER);
-      Serial.print(":");
-      Serial.println(MQTT_PORT);
-#endif
-      MQTTclient.setServer(MQTT_BROKER, MQTT_PORT);
-      MQTTclient.setCallback(MQTTCallback);
-      MQTTclient.setBufferSize(2048);
+  MQTTLinkIdle,        // waiting for the next attempt
+  MQTTLinkConnecting,  // MQTTConnectTask() is running
+  MQTTLinkAttemptDone, // MQTTConnectTask() finished, result in MQTTConnectOk / MQTTConnectResult
+  MQTTLinkConnected
+};
+
+volatile MQTTLinkState MQTTLink = MQTTLinkIdle;
+volatile bool MQTTConnectOk = false;
+volatile int MQTTConnectResult = MQTT_DISCONNECTED;
+uint32_t MQTTConnectStartMs = 0;
+uint32_t MQTTNextAttemptMs = 0;
+uint8_t MQTTConnectFailures = 0; // in a row, for the backoff
+MQTTConnectionStats MQTTConnStats = {};
+
+bool MQTTIsConnected()
+{
+  return MQTTLink == MQTTLinkConnected && MQTTclient.connected();
+}
+
+void MQTTConnectTask(void *parameter)
+{
+  bool ok = true;
+  int result = MQTT_CONNECT_NO_CERTIFICATE;
 #ifdef MQTT_USE_TLS
-      bool result = loadCARootCert();
-      if (!result)
-      {
-        return false; // load certificate failed -> do not continue
-      }
+  static bool certificate_loaded = false;
+  if (!certificate_loaded)
+  {
+    certificate_loaded = loadCARootCert();
+    ok = certificate_loaded;
+  }
 #endif
-    }
-    Serial.println("");
-    Serial.println("Connecting to MQTT...");
-    // Attempt to connect. Set the last will (LWT) message, if the connection get lost
-    if (MQTTclient.connect(MQTT_CLIENT,                                 // MQTT client id
-                           MQTT_USERNAME,                               // MQTT username
-                           MQTT_PASSWORD,                               // MQTT password
-                           concat3(MQTT_CLIENT, "/", MQTT_ALIVE_TOPIC), // last will topic
-                           0,                                           // last will QoS
-                           MQTT_RETAIN_ALIVE_MESSAGES,                  // retain message
-                           MQTT_ALIVE_MSG_OFFLINE))                     // last will message
-    {
-      Serial.println("MQTT connected");
-      MQTTConnected = true;
-      MQTTReportAvailability(MQTT_ALIVE_MSG_ONLINE); // Publish online status
-    }
-    else
-    {
-      Serial.println("MQTT connection failed!");
-      LastTimeTriedToConnect = millis();
-      printMQTTconnectionStatus();
-      return false; // do not continue if not connected
-    } // connect failed
+  if (ok)
+  { // Attempt to connect. Set the last will (LWT) message, if the connection get lost
+    ok = MQTTclient.connect(MQTT_CLIENT,                                 // MQTT client id
+                            MQTT_USERNAME,                               // MQTT username
+                            MQTT_PASSWORD,                               // MQTT password
+                            concat3(MQTT_CLIENT, "/", MQTT_ALIVE_TOPIC), // last will topic
+                            0,                                           // last will QoS
+                            MQTT_RETAIN_ALIVE_MESSAGES,                  // retain message
+                            MQTT_ALIVE_MSG_OFFLINE);                     // last will message
+    result = MQTTclient.state();
+  }
+  MQTTConnectResult = result;
+  MQTTConnectOk = ok;
+  MQTTLink = MQTTLinkAttemptDone;
+  vTaskDelete(NULL);
+}
+
+void MQTTScheduleRetry()
+{
+  uint32_t delay_ms = MQTT_RECONNECT_MIN_SEC * 1000;
+  for (uint8_t i = 0; i < MQTTConnectFailures && delay_ms < MQTT_RECONNECT_WAIT_SEC * 1000; i++)
+  {
+    delay_ms *= 2;
+  }
+  if (delay_ms > MQTT_RECONNECT_WAIT_SEC * 1000)
+  {
+    delay_ms = MQTT_RECONNECT_WAIT_SEC * 1000;
+  }
+  delay_ms = delay_ms / 2 + random(delay_ms / 2 + 1); // jitter: 50..100% of the backoff
+  MQTTNextAttemptMs = millis() + delay_ms;
+  Serial.printf("MQTT: next connection attempt in %u ms\n", delay_ms);
+}
 
+void MQTTSubscribe()
+{
 #ifdef DEBUG_OUTPUT_MQTT
-    Serial.println("DEBUG: subscribing to MQTT topics...");
+  Serial.println("DEBUG: subscribing to MQTT topics...");
 #endif
 
 #ifdef MQTT_PLAIN_ENABLED
-    bool ok = MQTTclient.subscribe(concat2(MQTT_CLIENT, "/directive/#")); // Subscribes only to messages send to the device
-    if (!ok)
-      Serial.println("Error subscribing to /directive messages!");
+  bool ok = MQTTclient.subscribe(concat2(MQTT_CLIENT, "/directive/#")); // Subscribes only to messages send to the device
+  if (!ok)
+    Serial.println("Error subscribing to /directive messages!");
+#ifdef MQTT_MSGPACK
+  MQTTclient.subscribe(concat3(MQTT_CLIENT, MQTT_MSGPACK_TOPIC, "/directive/#"));
+#endif
 #ifdef DEBUG_OUTPUT_MQTT
-    Serial.println("DEBUG: Subscribed to /directive/# messages sent to the device.");
-    Serial.println("DEBUG: Sending initial status messages...");
+  Serial.println("DEBUG: Subscribed to /directive/# messages sent to the device.");
 #endif
-    // send initial status messages
-    MQTTReportAvailability(MQTT_ALIVE_MSG_ONLINE);                                                                          // Reports that the device is online
-    MQTTPublish(concat2(MQTT_CLIENT, "/report/firmware"), FIRMWARE_VERSION, MQTT_RETAIN_STATE_MESSAGES);                    // Reports the firmware version
-    MQTTPublish(concat2(MQTT_CLIENT, "/report/ip"), (char *)WiFi.localIP().toString().c_str(), MQTT_RETAIN_STATE_MESSAGES); // Reports the ip
-    MQTTPublish(concat2(MQTT_CLIENT, "/report/network"), (char *)WiFi.SSID().c_str(), MQTT_RETAIN_STATE_MESSAGES);          // Reports the network name
-    MQTTReportWiFiSignal();
 #endif // MQTT_PLAIN_ENABLED
 
 #ifdef MQTT_HOME_ASSISTANT
-    MQTTclient.subscribe(TopicHAstatus); // Subscribe to homeassistant/status for receiving LWT and Birth messages from Home Assistant
-    MQTTclient.subscribe(concat4(MQTT_CLIENT, "/", TopicFront, "/set"));
-    MQTTclient.subscribe(concat4(MQTT_CLIENT, "/", TopicBack, "/set"));
-    MQTTclient.subscribe(concat4(MQTT_CLIENT, "/", Topic12hr, "/set"));
-    MQTTclient.subscribe(concat4(MQTT_CLIENT, "/", TopicBlank0, "/set"));
-    MQTTclient.subscribe(concat4(MQTT_CLIENT, "/", TopicBreath, "/set"));
-    MQTTclient.subscribe(concat4(MQTT_CLIENT, "/", TopicPulse, "/set"));
-    MQTTclient.subscribe(concat4(MQTT_CLIENT, "/", TopicRainbow, "/set"));
+  if (MQTTConnStats.connects == 1)
+  {
+    MQTTDiscoveryPrepare();
+  }
+  MQTTclient.subscribe(TopicHAstatus); // Subscribe to homeassistant/status for receiving LWT and Birth messages from Home Assistant
+  MQTTclient.subscribe(concat4(MQTT_CLIENT, "/", TopicFront, "/set"));
+  MQTTclient.subscribe(concat4(MQTT_CLIENT, "/", TopicBack, "/set"));
+  MQTTclient.subscribe(concat4(MQTT_CLIENT, "/", Topic12hr, "/set"));
+  MQTTclient.subscribe(concat4(MQTT_CLIENT, "/", TopicBlank0, "/set"));
+  MQTTclient.subscribe(concat4(MQTT_CLIENT, "/", TopicBreath, "/set"));
+  MQTTclient.subscribe(concat4(MQTT_CLIENT, "/", TopicPulse, "/set"));
+  MQTTclient.subscribe(concat4(MQTT_CLIENT, "/", TopicRainbow, "/set"));
+  MQTTclient.subscribe(concat2(MQTT_CLIENT, MQTT_BACKLIGHT_PROGRAM_TOPIC));
+  MQTTclient.subscribe(concat2(MQTT_CLIENT, MQTT_TIMER_TOPIC));
+  MQTTclient.subscribe(concat2(MQTT_CLIENT, MQTT_WORLD_CLOCK_TOPIC));
+  MQTTclient.subscribe(concat2(MQTT_CLIENT, MQTT_BATCH_TOPIC));
+#ifdef MQTT_MSGPACK
+  MQTTclient.subscribe(concat3(MQTT_CLIENT, MQTT_MSGPACK_TOPIC, "/+/set"));   // all commands, incl. zones and batch...
+  MQTTclient.subscribe(concat3(MQTT_CLIENT, MQTT_MSGPACK_TOPIC, "/+/+/set")); // ...and "back/program/set"
+#endif
+#ifdef MQTT_BACKLIGHT_ZONES
+  for (uint8_t zone = 1; zone < NUM_BACKLIGHT_ZONES; zone++)
+  {
+    char topic[64];
+    MQTTZoneTopic(zone, "/set", topic, sizeof(topic));
+    MQTTclient.subscribe(topic);
+  }
+#endif
 #ifdef DEBUG_OUTPUT_MQTT
-    Serial.println("DEBUG: subscribed to topics: ");
-    Serial.print(concat4(MQTT_CLIENT, "/", TopicFront, "/set"));
-    Serial.println(", ");
-    Serial.print(concat4(MQTT_CLIENT, "/", TopicBack, "/set"));
-    Serial.println(", ");
-    Serial.print(concat4(MQTT_CLIENT, "/", Topic12hr, "/set"));
-    Serial.println(", ");
-    Serial.print(concat4(MQTT_CLIENT, "/", TopicBlank0, "/set"));
-    Serial.println(", ");
-    Serial.print(concat4(MQTT_CLIENT, "/", TopicBreath, "/set"));
-    Serial.println(", ");
-    Serial.print(concat4(MQTT_CLIENT, "/", TopicPulse, "/set"));
-    Serial.println(", ");
-    Serial.print(concat4(MQTT_CLIENT, "/", TopicRainbow, "/set"));
-    Serial.println(", ");
-    Serial.println(TopicHAstatus);
+  Serial.println("DEBUG: subscribed to topics: ");
+  Serial.print(concat4(MQTT_CLIENT, "/", TopicFront, "/set"));
+  Serial.println(", ");
+  Serial.print(concat4(MQTT_CLIENT, "/", TopicBack, "/set"));
+  Serial.println(", ");
+  Serial.print(concat4(MQTT_CLIENT, "/", Topic12hr, "/set"));
+  Serial.println(", ");
+  Serial.print(concat4(MQTT_CLIENT, "/", TopicBlank0, "/set"));
+  Serial.println(", ");
+  Serial.print(concat4(MQTT_CLIENT, "/", TopicBreath, "/set"));
+  Serial.println(", ");
+  Serial.print(concat4(MQTT_CLIENT, "/", TopicPulse, "/set"));
+  Serial.println(", ");
+  Serial.print(concat4(MQTT_CLIENT, "/", TopicRainbow, "/set"));
+  Serial.println(", ");
+  Serial.println(TopicHAstatus);
 #endif // DEBUG_OUTPUT_MQTT
 #endif // MQTT_HOME_ASSISTANT
-  }
-  return true;
 }
 
-void checkIfMQTTIsConnected()
+void MQTTConnectionEstablished()
 {
-  MQTTConnected = MQTTclient.connected();
-  if (!MQTTConnected)
+  uint32_t connect_ms = millis() - MQTTConnectStartMs;
+  MQTTConnStats.connects++;
+  MQTTConnStats.last_connect_ms = connect_ms;
+  if (connect_ms > MQTTConnStats.max_connect_ms)
   {
-    availabilityReported = false;
-    MQTTStart(true); // Try to reconnect to MQTT broker
+    MQTTConnStats.max_connect_ms = connect_ms;
   }
+  MQTTConnectFailures = 0;
+  MQTTLink = MQTTLinkConnected;
+  Serial.printf("MQTT connected in %u ms\n", connect_ms);
+  MQTTConnected = true;
+  events.publish(EventBus::mqtt_connected, 1);
+  MQTTReportAvailability(MQTT_ALIVE_MSG_ONLINE); // Publish online status
+  MQTTStateMarkDirty(MQTT_ENTITY_ALL);           // and all states with the next report
+  MQTTSubscribe();                               // the session is not persistent, subscribe again after every connect
+#ifdef MQTT_PLAIN_ENABLED
+  // send initial status messages
+  MQTTPublish(concat2(MQTT_CLIENT, "/report/firmware"), FIRMWARE_VERSION, MQTT_RETAIN_STATE_MESSAGES);                    // Reports the firmware version
+  MQTTPublish(concat2(MQTT_CLIENT, "/report/ip"), (char *)WiFi.localIP().toString().c_str(), MQTT_RETAIN_STATE_MESSAGES); // Reports the ip
+  MQTTPublish(concat2(MQTT_CLIENT, "/report/network"), (char *)WiFi.SSID().c_str(), MQTT_RETAIN_STATE_MESSAGES);          // Reports the network name
+#endif
 }
 
-// void MQTTStop(void)
-// {
-//   MQTTReportAvailability(MQTT_ALIVE_MSG_OFFLINE);
-//   delay(100);
-//   MQTTclient.disconnect();
-// }
-
-void MQTTCallback(char *topic, byte *payload, unsigned int length)
+void MQTTConnectionFailed()
 {
-#ifdef DEBUG_OUTPUT_MQTT
-  Serial.println("");
-  Serial.println("DEBUG: Entering MQTTCallback...");
-  Serial.print("DEBUG: Received topic: ");
-  Serial.println(topic);
-  Serial.print("DEBUG: Payload length: ");
-  Serial.println(length);
-#endif
-
-  const size_t bufferSize = 256; // Use a fixed-size character buffer for the payload (adjust size as needed)
-  char message[bufferSize];
-  memset(message, 0, bufferSize);
-  if (length < bufferSize)
+  if (MQTTConnectResult >= MQTT_CONNECT_NO_CERTIFICATE && MQTTConnectResult <= MQTT_CONNECT_UNAUTHORIZED)
+  {
+    MQTTConnStats.failures[MQTTConnectResult - MQTT_CONNECT_NO_CERTIFICATE]++;
+  }
+  if (MQTTConnectFailures < 255)
+  {
+    MQTTConnectFailures++;
+  }
+  MQTTLink = MQTTLinkIdle;
+  Serial.println("MQTT connection failed!");
+  if (MQTTConnectResult == MQTT_CONNECT_NO_CERTIFICATE)
   {
-    memcpy(message, payload, length);
-    message[length] = '\0';
+    Serial.println("Error: no CA certificate");
   }
   else
   {
-    // in case the incoming payload exceeds our buffer size, truncate it
-    memcpy(message, payload, bufferSize - 1);
-    message[bufferSize - 1] = '\0';
-    Serial.println("WARNING: MQTT Payload too long, truncated!");
+    printMQTTconnectionStatus();
   }
+  MQTTScheduleRetry();
+}
 
+void MQTTStart()
+{
 #ifdef DEBUG_OUTPUT_MQTT
-  Serial.print("DEBUG: Converted payload to char array: ");
-  Serial.println(message);
-  Serial.println("DEBUG: Processing MQTT message...");
-  Serial.print("DEBUG: RX MQTT: ");
-  Serial.print(topic);
-  Serial.print(" ");
-  Serial.println(message);
+  Serial.println("DEBUG: Set MQTT broker to: ");
+  Serial.print(MQTT_BROKER);
+  Serial.print(":");
+  Serial.println(MQTT_PORT);
 #endif
+  MQTTclient.setServer(MQTT_BROKER, MQTT_PORT);
+  MQTTclient.setCallback(MQTTCallback);
+  MQTTclient.setBufferSize(2048);
+  MQTTNextAttemptMs = millis(); // connect as soon as WiFi is up
+  MQTTEventQueueBegin();
+}
 
-#ifdef MQTT_PLAIN_ENABLED
-  // Check if topic ends with "/directive/powerState"
-  if (endsWith(topic, "/directive/powerState"))
+void checkIfMQTTIsConnected()
+{
+  switch (MQTTLink)
   {
-    // Turn On or OFF based on payload
-    if (strcmp(message, "ON") == 0)
+  case MQTTLinkConnected:
+    if (MQTTclient.connected())
     {
-      MQTTCommandMainPower = true;
-      MQTTCommandBackPower = true;
-      MQTTCommandMainPowerReceived = true;
-      MQTTCommandBackPowerReceived = true;
+      return;
     }
-    else if (strcmp(message, "OFF") == 0)
+    Serial.println("MQTT connection lost!");
+    printMQTTconnectionStatus();
+    MQTTConnStats.disconnects++;
+    MQTTConnected = false;
+    availabilityReported = false;
+    events.publish(EventBus::mqtt_connected, 0);
+    MQTTLink = MQTTLinkIdle;
+    MQTTScheduleRetry();
+    break;
+
+  case MQTTLinkAttemptDone:
+    if (MQTTConnectOk)
     {
-      MQTTCommandMainPower = false;
-      MQTTCommandBackPower = false;
-      MQTTCommandMainPowerReceived = true;
-      MQTTCommandBackPowerReceived = true;
+      MQTTConnectionEstablished();
     }
-  }
-  else if (endsWith(topic, "/directive/setpoint") || endsWith(topic, "/directive/percentage"))
-  {
-    double valueD = atof(message);
-    if (!isnan(valueD))
+    else
     {
-      MQTTCommandState = (int)valueD;
-      MQTTCommandStateReceived = true;
+      MQTTConnectionFailed();
     }
-  }
-#endif // MQTT_PLAIN_ENABLED
-
-#ifdef MQTT_HOME_ASSISTANT
-  if (strcmp(topic, TopicHAstatus) == 0) // Process "homeassistant/status" messages -> react if Home Assistant is online or offline
+    break;
 
-  {
-    if (strcmp(message, "online") == 0)
-    {
-      Serial.println("Detected Home Assistant online status! Sending discovery messages!");
-      uint16_t randomDelay = random(100, 400);
-      Serial.print("Delaying discovery for ");
-      Serial.print(randomDelay);
-      Serial.println(" ms.");
-      delay(randomDelay);
-      discoveryReported = MQTTReportDiscovery();
-      if (!discoveryReported)
-      {
-        Serial.println("ERROR: Failure while (re-)sending discovery messages!");
-      }
-    }
-    else if (strcmp(message, "offline") == 0)
+  case MQTTLinkIdle:
+    if (WiFi.status() != WL_CONNECTED || (int32_t)(millis() - MQTTNextAttemptMs) < 0)
     {
-      Serial.println("Detected Home Assistant offline status!");
-      discoveryReported = false;
+      return;
     }
-    else
+    Serial.println("");
+    Serial.println("Connecting to MQTT...");
+    MQTTConnStats.attempts++;
+    MQTTConnectStartMs = millis();
+    MQTTLink = MQTTLinkConnecting;
+    if (xTaskCreatePinnedToCore(MQTTConnectTask, "mqtt_connect", MQTT_CONNECT_TASK_STACK, NULL, 1, NULL, 0) != pdPASS)
     {
-      Serial.print("WARNING: Unhandled \"homeassistant/status\" payload: ");
-      Serial.println(message);
+      Serial.println("ERROR: Can't start the MQTT connect task!");
+      MQTTLink = MQTTLinkIdle;
+      MQTTScheduleRetry();
     }
+    break;
+
+  case MQTTLinkConnecting:
+    break;
   }
-  else // process all other MQTT messages
-  {
-    if (strcmp(topic, concat4(MQTT_CLIENT, "/", TopicFront, "/set")) == 0) // Process "<MQTT_CLIENT>/main/set"
-    {                                                                      // Process JSON for main set command
-      JsonDocument doc;
-      DeserializationError err = deserializeJson(doc, payload, length);
-      if (err)
-      {
-        Serial.print("DEBUG: JSON deserialization error in main/set: ");
-        Serial.println(err.c_str());
-        return;
-      }
-      if (doc["state"].is<const char *>())
-      {
-        MQTTCommandMainPower = (strcmp(doc["state"].as<const char *>(), MQTT_STATE_ON) == 0);
-        MQTTCommandMainPowerReceived = true;
-      }
-      if (doc["brightness"].is<int>())
-      {
-        MQTTCommandMainBrightness = doc["brightness"];
-        MQTTCommandMainBrightnessReceived = true;
+}
+
+// void MQTTStop(void)
+// {
+//   MQTTReportAvailability(MQTT_ALIVE_MSG_OFFLINE);
+//   delay(100);
+//   MQTTclient.disconnect();
+// }
+
+// Incoming messages are routed by the topic after "<MQTT_CLIENT>/": the FNV-1a hash of this suffix is looked up
+// in a table built at compile time, then the suffix is compared once to rule out hash collisions.
+// JSON payloads are parsed once, before the handler is called, keeping only the fields the handlers use.
+// The handlers set the typed MQTTCommand... values, which are applied in main.cpp.
+// Commands arriving close together (a Home Assistant scene sets power, brightness and effect with three messages)
+// are collected and applied in one go, see MQTTCommandsDue(), so the displays are redrawn only once.
+// "<MQTT_CLIENT>/batch/set" takes several commands in one message, keyed by their topics.
+// With MQTT_MSGPACK the same topics are also accepted under "<MQTT_CLIENT>/msgpack/", with MessagePack payloads:
+// maps for the JSON routes, strings (or any other value, which is converted to JSON text) for the others.
+// A backlight program sent as bin is passed to its handler as it is, without a copy.
+
+struct MQTTMessage
+{
+  const byte *payload;
+  unsigned int length;
+  JsonDocument *json; // parsed payload, only for JSON routes
+  bool msgpack;       // received under "<MQTT_CLIENT>/msgpack/", the payload is MessagePack
+};
+
+typedef void (*MQTTHandler)(const MQTTMessage &msg);
+
+struct MQTTRoute
+{
+  uint32_t hash;
+  const char *suffix;
+  bool json;
+  MQTTHandler handler;
+  uint8_t entity; // its state is reported back after the command, MQTTEntityNone for none
+};
+
+constexpr uint32_t MQTTTopicHash(const char *str, uint32_t hash = 2166136261u)
+{
+  return *str ? MQTTTopicHash(str + 1, (hash ^ (uint8_t)*str) * 16777619u) : hash;
+}
+
+#define MQTT_ROUTE(suffix, json, handler, entity) {MQTTTopicHash(suffix), suffix, json, handler, entity}
+
+bool MQTTDispatch(const char *suffix, MQTTMessage msg);
+
+MQTTReceiveStats MQTTRxStats = {};
+MQTTCommandBatchStats MQTTCmdStats = {};
+bool MQTTCommandsWaiting = false;
+uint32_t MQTTCommandFirstMs = 0;
+uint32_t MQTTCommandLastMs = 0;
+
+void MQTTCopyText(const MQTTMessage &msg, char *text, size_t size) // Helper function to copy the payload as a string
+{
+  size_t length = msg.length < size ? msg.length : size - 1;
+  if (length < msg.length)
+  {
+    Serial.println("WARNING: MQTT Payload too long, truncated!");
+  }
+  memcpy(text, msg.payload, length);
+  text[length] = '\0';
+}
+
+bool MQTTPayloadIs(const MQTTMessage &msg, const char *text) // Helper function to compare the payload with a string
+{
+  return msg.length == strlen(text) && memcmp(msg.payload, text, msg.length) == 0;
+}
+
+bool MQTTJsonIsOn(JsonDocument *json)
+{
+  return strcmp((*json)["state"].as<const char *>(), MQTT_STATE_ON) == 0;
+}
+
+void MQTTHandleBacklightProgram(const MQTTMessage &msg)
+{ // bytecode, not a string
+  MQTTReceiveBacklightProgram(msg.payload, msg.length);
+}
+
+void MQTTHandleTimer(const MQTTMessage &msg)
+{ // plain text command, the same for both MQTT modes
+  MQTTCopyText(msg, MQTTCommandTimer, sizeof(MQTTCommandTimer));
+  MQTTCommandTimerReceived = true;
+}
+
+void MQTTHandleWorldClock(const MQTTMessage &msg)
+{ // parsed by WorldClock::command()
+  MQTTCopyText(msg, MQTTCommandWorldClock, sizeof(MQTTCommandWorldClock));
+  MQTTCommandWorldClockReceived = true;
+}
+
+size_t MQTTValueToText(JsonVariant value, char *text, size_t size) // >= size if it doesn't fit
+{
+  // strings are passed as they are (timer, world clock, plain mode), everything else as JSON text
+  if (value.is<const char *>())
+  {
+    return strlcpy(text, value.as<const char *>(), size);
+  }
+  return serializeJson(value, text, size);
+}
+
+#ifdef MQTT_MSGPACK
+// Points msg at the bytes of a MessagePack bin 8/16/32 (lengths big endian). False if the payload is something else,
+// or the length in the header doesn't match.
+bool MQTTMsgPackBin(MQTTMessage &msg)
+{
+  size_t header;
+  uint32_t length = 0;
+  switch (msg.length > 0 ? msg.payload[0] : 0)
+  {
+  case 0xc4:
+    header = 2;
+    break;
+  case 0xc5:
+    header = 3;
+    break;
+  case 0xc6:
+    header = 5;
+    break;
+  default:
+    return false;
+  }
+  if (msg.length < header)
+  {
+    return false;
+  }
+  for (size_t i = 1; i < header; i++)
+  {
+    length = (length << 8) | msg.payload[i];
+  }
+  if (msg.length - header != length)
+  {
+    return false;
+  }
+  msg = {msg.payload + header, (unsigned int)length, NULL, false};
+  return true;
+}
+#endif
+
+void MQTTHandleBatch(const MQTTMessage &msg)
+{ // {"<topic of the command>": <its payload>, ...}, every entry is handled as if it came on its own topic
+  static bool in_batch = false;
+  if (in_batch)
+  {
+    return; // no batch in a batch
+  }
+  JsonDocument batch(&MQTTJsonArena);
+  DeserializationError err = deserializeJson(batch, msg.payload, msg.length);
+  if (err || !batch.is<JsonObject>())
+  {
+    Serial.print("ERROR: MQTT batch is not a JSON object: ");
+    Serial.println(err ? err.c_str() : "wrong type");
+    return;
+  }
+  in_batch = true;
+  for (JsonPair entry : batch.as<JsonObject>())
+  {
+    char suffix[64];
+    snprintf(suffix, sizeof(suffix), "%s%s%s", MQTT_BATCH_KEY_PREFIX, entry.key().c_str(), MQTT_BATCH_KEY_SUFFIX);
+    char payload[sizeof(MQTTCommandWorldClock)];
+    size_t length = MQTTValueToText(entry.value(), payload, sizeof(payload));
+    if (length >= sizeof(payload) || !MQTTDispatch(suffix, {(const byte *)payload, length, NULL, false}))
+    {
+      Serial.print("WARNING: Unhandled MQTT batch entry: ");
+      Serial.println(entry.key().c_str());
+    }
+  }
+  in_batch = false;
+}
+
+#ifdef MQTT_PLAIN_ENABLED
+void MQTTHandlePowerState(const MQTTMessage &msg)
+{
+  // Turn On or OFF based on payload
+  if (MQTTPayloadIs(msg, "ON"))
+  {
+    MQTTCommandMainPower = true;
+    MQTTCommandBackPower = true;
+    MQTTCommandMainPowerReceived = true;
+    MQTTCommandBackPowerReceived = true;
+  }
+  else if (MQTTPayloadIs(msg, "OFF"))
+  {
+    MQTTCommandMainPower = false;
+    MQTTCommandBackPower = false;
+    MQTTCommandMainPowerReceived = true;
+    MQTTCommandBackPowerReceived = true;
+  }
+}
+
+void MQTTHandleSetpoint(const MQTTMessage &msg)
+{
+  char text[16];
+  MQTTCopyText(msg, text, sizeof(text));
+  double valueD = atof(text);
+  if (!isnan(valueD))
+  {
+    MQTTCommandState = (int)valueD;
+    MQTTCommandStateReceived = true;
+  }
+}
+
+const MQTTRoute MQTTRoutes[] = {
+    MQTT_ROUTE("directive/powerState", false, MQTTHandlePowerState, MQTTEntityPower),
+    MQTT_ROUTE("directive/setpoint", false, MQTTHandleSetpoint, MQTTEntitySetpoint),
+    MQTT_ROUTE("directive/percentage", false, MQTTHandleSetpoint, MQTTEntitySetpoint),
+    MQTT_ROUTE(MQTT_BACKLIGHT_PROGRAM_TOPIC + 1, false, MQTTHandleBacklightProgram, MQTTEntityNone),
+    MQTT_ROUTE(MQTT_TIMER_TOPIC + 1, false, MQTTHandleTimer, MQTTEntityNone),
+    MQTT_ROUTE(MQTT_WORLD_CLOCK_TOPIC + 1, false, MQTTHandleWorldClock, MQTTEntityNone),
+    MQTT_ROUTE(MQTT_BATCH_TOPIC + 1, false, MQTTHandleBatch, MQTTEntityNone),
+};
+#endif // MQTT_PLAIN_ENABLED
+
+#ifdef MQTT_HOME_ASSISTANT
+void MQTTHandleMain(const MQTTMessage &msg)
+{ // "<MQTT_CLIENT>/main/set"
+  JsonDocument &doc = *msg.json;
+  if (doc["state"].is<const char *>())
+  {
+    MQTTCommandMainPower = MQTTJsonIsOn(msg.json);
+    MQTTCommandMainPowerReceived = true;
+  }
+  if (doc["brightness"].is<int>())
+  {
+    MQTTCommandMainBrightness = doc["brightness"];
+    MQTTCommandMainBrightnessReceived = true;
+  }
+  if (doc["effect"].is<const char *>())
+  {
+    MQTTCommandMainGraphic = tfts.nameToClockFace(doc["effect"]);
+    MQTTCommandMainGraphicReceived = true;
+  }
+}
+
+void MQTTHandleBack(const MQTTMessage &msg)
+{ // "<MQTT_CLIENT>/back/set"
+  JsonDocument &doc = *msg.json;
+  if (doc["state"].is<const char *>())
+  {
+    MQTTCommandBackPower = MQTTJsonIsOn(msg.json);
+    MQTTCommandBackPowerReceived = true;
+  }
+  if (doc["brightness"].is<int>())
+  {
+    MQTTCommandBackBrightness = doc["brightness"];
+    MQTTCommandBackBrightnessReceived = true;
+  }
+  if (doc["effect"].is<const char *>())
+  {
+    strncpy(MQTTCommandBackPattern, doc["effect"], sizeof(MQTTCommandBackPattern) - 1);
+    MQTTCommandBackPattern[sizeof(MQTTCommandBackPattern) - 1] = '\0';
+    MQTTCommandBackPatternReceived = true;
+  }
+  if (doc["color"].is<JsonObject>())
+  {
+    MQTTCommandBackColorPhase = backlights.hueToPhase(doc["color"]["h"]);
+    MQTTCommandBackColorPhaseReceived = true;
+  }
+}
+
+void MQTTHandleTwelveHours(const MQTTMessage &msg)
+{ // "<MQTT_CLIENT>/use_twelve_hours/set"
+  if ((*msg.json)["state"].is<const char *>())
+  {
+    MQTTCommandUseTwelveHours = MQTTJsonIsOn(msg.json);
+    MQTTCommandUseTwelveHoursReceived = true;
+  }
+}
+
+void MQTTHandleBlankZeroHours(const MQTTMessage &msg)
+{ // "<MQTT_CLIENT>/blank_zero_hours/set"
+  if ((*msg.json)["state"].is<const char *>())
+  {
+    MQTTCommandBlankZeroHours = MQTTJsonIsOn(msg.json);
+    MQTTCommandBlankZeroHoursReceived = true;
+  }
+}
+
+void MQTTHandlePulseBpm(const MQTTMessage &msg)
+{ // "<MQTT_CLIENT>/pulse_bpm/set"
+  if ((*msg.json)["state"].is<uint8_t>())
+  {
+    MQTTCommandPulseBpm = (*msg.json)["state"];
+    MQTTCommandPulseBpmReceived = true;
+  }
+}
+
+void MQTTHandleBreathBpm(const MQTTMessage &msg)
+{ // "<MQTT_CLIENT>/breath_bpm/set"
+  if ((*msg.json)["state"].is<uint8_t>())
+  {
+    MQTTCommandBreathBpm = (*msg.json)["state"];
+    MQTTCommandBreathBpmReceived = true;
+  }
+}
+
+void MQTTHandleRainbowSec(const MQTTMessage &msg)
+{ // "<MQTT_CLIENT>/rainbow_duration/set"
+  if ((*msg.json)["state"].is<float>())
+  {
+    MQTTCommandRainbowSec = (*msg.json)["state"];
+    MQTTCommandRainbowSecReceived = true;
+  }
+}
+
+const MQTTRoute MQTTRoutes[] = {
+    MQTT_ROUTE(concat2(TopicFront, "/set"), true, MQTTHandleMain, MQTTEntityMain),
+    MQTT_ROUTE(concat2(TopicBack, "/set"), true, MQTTHandleBack, MQTTEntityBack),
+    MQTT_ROUTE(concat2(Topic12hr, "/set"), true, MQTTHandleTwelveHours, MQTTEntityTwelveHours),
+    MQTT_ROUTE(concat2(TopicBlank0, "/set"), true, MQTTHandleBlankZeroHours, MQTTEntityBlankZeroHours),
+    MQTT_ROUTE(concat2(TopicPulse, "/set"), true, MQTTHandlePulseBpm, MQTTEntityPulse),
+    MQTT_ROUTE(concat2(TopicBreath, "/set"), true, MQTTHandleBreathBpm, MQTTEntityBreath),
+    MQTT_ROUTE(concat2(TopicRainbow, "/set"), true, MQTTHandleRainbowSec, MQTTEntityRainbow),
+    MQTT_ROUTE(MQTT_BACKLIGHT_PROGRAM_TOPIC + 1, false, MQTTHandleBacklightProgram, MQTTEntityNone),
+    MQTT_ROUTE(MQTT_TIMER_TOPIC + 1, false, MQTTHandleTimer, MQTTEntityNone),
+    MQTT_ROUTE(MQTT_WORLD_CLOCK_TOPIC + 1, false, MQTTHandleWorldClock, MQTTEntityNone),
+    MQTT_ROUTE(MQTT_BATCH_TOPIC + 1, false, MQTTHandleBatch, MQTTEntityNone),
+};
+
+void MQTTReceiveHAStatus(const MQTTMessage &msg) // Process "homeassistant/status" messages -> react if Home Assistant is online or offline
+{
+  if (MQTTPayloadIs(msg, "online"))
+  {
+    Serial.println("Detected Home Assistant online status! Sending discovery messages!");
+    uint16_t randomDelay = random(100, 400); // not all devices at once
+    Serial.print("Delaying discovery for ");
+    Serial.print(randomDelay);
+    Serial.println(" ms.");
+    MQTTDiscoveryStart(randomDelay, true);
+  }
+  else if (MQTTPayloadIs(msg, "offline"))
+  {
+    Serial.println("Detected Home Assistant offline status!");
+    discoveryReported = false;
+  }
+  else
+  {
+    char text[32];
+    MQTTCopyText(msg, text, sizeof(text));
+    Serial.print("WARNING: Unhandled \"homeassistant/status\" payload: ");
+    Serial.println(text);
+  }
+}
+#endif // MQTT_HOME_ASSISTANT
+
+const MQTTRoute *MQTTFindRoute(const char *suffix)
+{
+  uint32_t hash = MQTTTopicHash(suffix);
+  for (const MQTTRoute &route : MQTTRoutes)
+  {
+    if (route.hash == hash && strcmp(route.suffix, suffix) == 0)
+    {
+      return &route;
+    }
+  }
+  return NULL;
+}
+
+bool MQTTParseJson(const MQTTMessage &msg, JsonDocument &doc)
+{
+  // Only the fields used by the handlers are kept, everything else HA sends is skipped while parsing.
+  static JsonDocument filter;
+  if (filter.isNull())
+  {
+    filter["state"] = true;
+    filter["brightness"] = true;
+    filter["effect"] = true;
+    filter["color"]["h"] = true;
+  }
+  DeserializationError err = msg.msgpack ? deserializeMsgPack(doc, msg.payload, msg.length, DeserializationOption::Filter(filter))
+                                         : deserializeJson(doc, msg.payload, msg.length, DeserializationOption::Filter(filter));
+  if (err)
+  {
+    Serial.print(msg.msgpack ? "DEBUG: MessagePack deserialization error: " : "DEBUG: JSON deserialization error: ");
+    Serial.println(err.c_str());
+    return false;
+  }
+  return true;
+}
+
+void MQTTCallback(char *topic, byte *payload, unsigned int length)
+{
+  uint32_t start_us = micros();
+#ifdef DEBUG_OUTPUT_MQTT
+  Serial.println("");
+  Serial.println("DEBUG: Entering MQTTCallback...");
+  Serial.print("DEBUG: Received topic: ");
+  Serial.println(topic);
+  Serial.print("DEBUG: Payload length: ");
+  Serial.println(length);
+#endif
+
+  MQTTMessage msg = {payload, length, NULL, false};
+  MQTTRxStats.messages++;
+
+#ifdef MQTT_HOME_ASSISTANT
+  if (strcmp(topic, TopicHAstatus) == 0)
+  {
+    MQTTReceiveHAStatus(msg);
+    return;
+  }
+#endif
+
+  // the part after "<MQTT_CLIENT>/" selects the handler
+  const size_t prefix_length = sizeof(concat2(MQTT_CLIENT, "/")) - 1;
+  const char *suffix = strncmp(topic, concat2(MQTT_CLIENT, "/"), prefix_length) == 0 ? topic + prefix_length : "";
+#ifdef MQTT_MSGPACK
+  const size_t msgpack_length = sizeof(MQTT_MSGPACK_TOPIC) - 1;
+  if (strncmp(suffix, MQTT_MSGPACK_TOPIC + 1, msgpack_length - 1) == 0 && suffix[msgpack_length - 1] == '/')
+  {
+    suffix += msgpack_length;
+    msg.msgpack = true;
+  }
+#endif
+  if (!MQTTDispatch(suffix, msg))
+  {
+    MQTTRxStats.unhandled++;
+    Serial.print("WARNING: Unhandled MQTT topic: ");
+    Serial.println(topic);
+    return;
+  }
+
+  uint32_t callback_us = micros() - start_us;
+  MQTTRxStats.callback_us_sum += callback_us;
+  if (callback_us > MQTTRxStats.max_callback_us)
+  {
+    MQTTRxStats.max_callback_us = callback_us;
+  }
+
+#ifdef DEBUG_OUTPUT_MQTT
+  Serial.printf("DEBUG: Exiting MQTTCallback after %u us\n", callback_us);
+#endif
+} // end of MQTTCallback
+
+bool MQTTDispatch(const char *suffix, MQTTMessage msg) // false if there is no handler for the topic
+{
+  const MQTTRoute *route = MQTTFindRoute(suffix);
+  JsonDocument doc(&MQTTJsonArena);
+  bool handled = false;
+#ifdef MQTT_MSGPACK
+  char text[sizeof(MQTTCommandWorldClock)];
+  if (route != NULL && route->handler == MQTTHandleBacklightProgram && msg.msgpack)
+  {
+    MQTTMsgPackBin(msg); // bytecode as bin is passed as it is, other values are converted below
+  }
+  if (route != NULL && !route->json && msg.msgpack)
+  { // the handlers of these routes take text
+    DeserializationError err = deserializeMsgPack(doc, msg.payload, msg.length);
+    size_t length = err ? sizeof(text) : MQTTValueToText(doc.as<JsonVariant>(), text, sizeof(text));
+    if (length >= sizeof(text))
+    {
+      Serial.println("ERROR: MessagePack payload not readable or too long!");
+      return true;
+    }
+    msg = {(const byte *)text, length, NULL, false};
+    doc.clear();
+  }
+#endif
+  if (route != NULL)
+  {
+    if (route->json)
+    {
+      if (!MQTTParseJson(msg, doc))
+      {
+        return true; // known topic, the error is already logged
       }
-      if (doc["effect"].is<const char *>())
+      msg.json = &doc;
+    }
+    route->handler(msg);
+    if (route->entity != MQTTEntityNone)
+    {
+      MQTTStateCommandReceived(route->entity);
+    }
+    handled = true;
+  }
+#ifdef MQTT_BACKLIGHT_ZONES
+  else
+  {
+    handled = MQTTReceiveZone(suffix, msg, doc);
+  }
+#endif
+  if (handled)
+  {
+    MQTTCmdStats.commands++;
+    MQTTCommandLastMs = millis();
+    if (!MQTTCommandsWaiting)
+    {
+      MQTTCommandsWaiting = true;
+      MQTTCommandFirstMs = MQTTCommandLastMs;
+    }
+  }
+  return handled;
+}
+
+bool MQTTCommandsDue() // true once the received commands should be applied, see main.cpp
+{
+  if (!MQTTCommandsWaiting)
+  {
+    return false;
+  }
+  uint32_t now = millis();
+  if (now - MQTTCommandLastMs < MQTT_COMMAND_COALESCE_MS && now - MQTTCommandFirstMs < MQTT_COMMAND_COALESCE_MAX_MS)
+  {
+    return false; // more may follow
+  }
+  MQTTCommandsWaiting = false;
+  MQTTCmdStats.batches++;
+  return true;
+}
+
+void MQTTReceiveBacklightProgram(const byte *payload, unsigned int length)
+{
+  // Accept the raw program ("BL" header) or the same as a hex string, which is easier to send from automations.
+  if (length >= 3 && payload[0] == 'B' && payload[1] == 'L')
+  {
+    if (length > sizeof(MQTTCommandBackProgram))
+    {
+      Serial.println("ERROR: Backlight program too large!");
+      return;
+    }
+    memcpy(MQTTCommandBackProgram, payload, length);
+    MQTTCommandBackProgramLength = length;
+  }
+  else
+  {
+    // checked completely before decoding, a bad string must not overwrite a program waiting to be applied
+    if (length % 2 != 0)
+    {
+      Serial.println("ERROR: Backlight program is not a valid hex string!");
+      return;
+    }
+    if (length / 2 > sizeof(MQTTCommandBackProgram))
+    {
+      Serial.println("ERROR: Backlight program too large!");
+      return;
+    }
+    for (unsigned int i = 0; i < length; i++)
+    {
+      if (!isxdigit(payload[i]))
       {
-        MQTTCommandMainGraphic = tfts.nameToClockFace(doc["effect"]);
-        MQTTCommandMainGraphicReceived = true;
+        Serial.println("ERROR: Backlight program is not a valid hex string!");
+        return;
       }
     }
-    else
-    { // Process "<MQTT_CLIENT>/back/set"
-      if (strcmp(topic, concat4(MQTT_CLIENT, "/", TopicBack, "/set")) == 0)
+    size_t bytes = 0;
+    for (unsigned int i = 0; i < length; i += 2)
+    {
+      char hex[3] = {(char)payload[i], (char)payload[i + 1], '\0'};
+      MQTTCommandBackProgram[bytes++] = strtoul(hex, NULL, 16);
+    }
+    MQTTCommandBackProgramLength = bytes;
+  }
+  MQTTCommandBackProgramReceived = true;
+}
+
+// Events (button presses, power changes, lost broker connection) are not states: every single one counts, also
+// if the broker is not reachable when it happens. They are kept in a RAM ring of MQTT_EVENT_QUEUE_SIZE entries and
+// sent to "<MQTT_CLIENT>/event" one every MQTT_EVENT_DRAIN_INTERVAL_MS while connected. If the ring is full, further
+// events are appended to MQTT_EVENT_SPILL_FILE in SPIFFS (max. MQTT_EVENT_SPILL_MAX), which is read back into the
+// ring as it drains, so the order is kept. Events moved back into the ring are cut from the file right away, so
+// the file only ever holds events not sent yet: it survives a restart and is sent after the next connect, without
+// repeating the ones delivered before. The (up to MQTT_EVENT_QUEUE_SIZE) events in the ring are lost on a restart.
+// PubSubClient can only publish with QoS 0, so an event counts as sent when it was written to the connection.
+
+struct MQTTQueuedEvent
+{
+  uint32_t time; // UTC, when it happened
+  uint8_t type;  // EventBus::event_t
+  uint8_t value;
+  uint16_t reserved;
+};
+
+MQTTQueuedEvent MQTTEventRing[MQTT_EVENT_QUEUE_SIZE];
+uint8_t MQTTEventHead = 0; // oldest event
+uint8_t MQTTEventCount = 0;
+uint16_t MQTTEventSpilled = 0; // events in the spill file
+uint32_t MQTTEventLastSentMs = 0;
+MQTTEventQueueStats MQTTEventStats = {};
+
+uint16_t MQTTEventQueueDepth()
+{
+  return MQTTEventCount + MQTTEventSpilled;
+}
+
+void MQTTEventPush(const MQTTQueuedEvent &event)
+{
+  MQTTEventRing[(MQTTEventHead + MQTTEventCount) % MQTT_EVENT_QUEUE_SIZE] = event;
+  MQTTEventCount++;
+}
+
+void MQTTEventEnqueue(EventBus::event_t type, uint8_t value)
+{
+  MQTTQueuedEvent event = {(uint32_t)(Clock::nowMs() / 1000), type, value, 0};
+  MQTTEventStats.queued++;
+  if (MQTTEventCount < MQTT_EVENT_QUEUE_SIZE && MQTTEventSpilled == 0)
+  {
+    MQTTEventPush(event);
+    return;
+  }
+  // older events are waiting in the spill file, append to keep the order
+  if (MQTTEventSpilled < MQTT_EVENT_SPILL_MAX)
+  {
+    fs::File f = SPIFFS.open(MQTT_EVENT_SPILL_FILE, "a");
+    if (f && f.write((const uint8_t *)&event, sizeof(event)) == sizeof(event))
+    {
+      f.close();
+      MQTTEventSpilled++;
+      MQTTEventStats.spilled++;
+      return;
+    }
+    f.close();
+  }
+  MQTTEventStats.dropped++;
+}
+
+void MQTTEventHandler(const EventBus::Event &event, void *context)
+{
+  if (event.type == EventBus::mqtt_connected && event.value != 0)
+  {
+    return; // only the lost connection is worth reporting
+  }
+  MQTTEventEnqueue(event.type, event.value);
+}
+
+// Move events from the spill file back into the ring. The rest is copied to a new file which replaces the old one,
+// SPIFFS can't cut the start of a file. Removes the file when all are read.
+void MQTTEventRefill()
+{
+  fs::File f = SPIFFS.open(MQTT_EVENT_SPILL_FILE, "r");
+  if (!f)
+  {
+    Serial.println("ERROR: Can't read the MQTT event spill file!");
+    MQTTEventStats.dropped += MQTTEventSpilled;
+    MQTTEventSpilled = 0;
+    return;
+  }
+  MQTTQueuedEvent event;
+  while (MQTTEventCount < MQTT_EVENT_QUEUE_SIZE && MQTTEventSpilled > 0 && f.read((uint8_t *)&event, sizeof(event)) == sizeof(event))
+  {
+    MQTTEventPush(event);
+    MQTTEventSpilled--;
+  }
+  uint16_t kept = 0;
+  if (MQTTEventSpilled > 0 && MQTTEventCount == MQTT_EVENT_QUEUE_SIZE)
+  {
+    fs::File rest = SPIFFS.open(MQTT_EVENT_SPILL_FILE ".new", "w");
+    while (rest && kept < MQTTEventSpilled && f.read((uint8_t *)&event, sizeof(event)) == sizeof(event) &&
+           rest.write((const uint8_t *)&event, sizeof(event)) == sizeof(event))
+    {
+      kept++;
+    }
+    rest.close();
+  }
+  f.close();
+  SPIFFS.remove(MQTT_EVENT_SPILL_FILE);
+  if (kept < MQTTEventSpilled)
+  {
+    Serial.println("ERROR: Can't read the MQTT event spill file!");
+    MQTTEventStats.dropped += MQTTEventSpilled - kept;
+  }
+  MQTTEventSpilled = kept;
+  if (kept > 0)
+  {
+    SPIFFS.rename(MQTT_EVENT_SPILL_FILE ".new", MQTT_EVENT_SPILL_FILE);
+  }
+  else
+  {
+    SPIFFS.remove(MQTT_EVENT_SPILL_FILE ".new");
+  }
+}
+
+// Picks up the spill file left over from before the restart.
+void MQTTEventQueueRestore()
+{
+  fs::File f = SPIFFS.open(MQTT_EVENT_SPILL_FILE, "r");
+  if (f)
+  {
+    MQTTEventSpilled = f.size() / sizeof(MQTTQueuedEvent);
+    f.close();
+    Serial.printf("MQTT: %u unsent events from before the restart\n", MQTTEventSpilled);
+  }
+}
+
+void MQTTEventQueueBegin()
+{
+  events.subscribe(EventBus::maskOf(EventBus::button_pressed) | EventBus::maskOf(EventBus::power_changed) | EventBus::maskOf(EventBus::mqtt_connected),
+                   MQTTEventHandler);
+  MQTTEventQueueRestore();
+}
+
+void MQTTEventQueueLoop()
+{
+  if (MQTTEventCount == 0 && MQTTEventSpilled > 0)
+  {
+    MQTTEventRefill();
+  }
+  if (MQTTEventCount == 0 || !MQTTIsConnected() || (millis() - MQTTEventLastSentMs) < MQTT_EVENT_DRAIN_INTERVAL_MS)
+    return;
+
+  const MQTTQueuedEvent &event = MQTTEventRing[MQTTEventHead];
+  JsonDocument message(&MQTTJsonArena);
+  message["event_type"] = event.type < EventBus::num_events ? EventBus::event_str[event.type] : "unknown";
+  message["value"] = event.value;
+  message["time"] = event.time;
+  MQTTEventLastSentMs = millis();
+#ifdef MQTT_HOME_ASSISTANT
+  if (!MQTTPublish(concat3(MQTT_CLIENT, "/", TopicEvent), &message, false))
+    return;
+#else
+  if (!MQTTPublish(concat2(MQTT_CLIENT, "/report/event"), &message, false))
+    return;
+#endif
+  MQTTEventHead = (MQTTEventHead + 1) % MQTT_EVENT_QUEUE_SIZE;
+  MQTTEventCount--;
+  MQTTEventStats.sent++;
+}
+
+void MQTTLoopFrequently()
+{
+  checkIfMQTTIsConnected();
+  if (MQTTLink == MQTTLinkConnected)
+  {
+    // PubSubClient reads one message per loop() call, take the ones already waiting (e.g. a scene) in this pass
+    for (uint8_t i = 0; i < MQTT_MESSAGES_PER_LOOP; i++)
+    {
+      if (!MQTTclient.loop() || espClient.available() == 0)
       {
-        JsonDocument doc;
-        DeserializationError err = deserializeJson(doc, payload, length);
-        if (err)
-        {
-          Serial.print("DEBUG: JSON deserialization error in back/set: ");
-          Serial.println(err.c_str());
-          return;
-        }
-        if (doc["state"].is<const char *>())
-        {
-          MQTTCommandBackPower = (strcmp(doc["state"].as<const char *>(), MQTT_STATE_ON) == 0);
-          MQTTCommandBackPowerReceived = true;
-        }
-        if (doc["brightness"].is<int>())
-        {
-          MQTTCommandBackBrightness = doc["brightness"];
-          MQTTCommandBackBrightnessReceived = true;
-        }
-        if (doc["effect"].is<const char *>())
-        {
-          strncpy(MQTTCommandBackPattern, doc["effect"], sizeof(MQTTCommandBackPattern) - 1);
-          MQTTCommandBackPattern[sizeof(MQTTCommandBackPattern) - 1] = '\0';
-          MQTTCommandBackPatternReceived = true;
-        }
-        if (doc["color"].is<JsonObject>())
-        {
-          MQTTCommandBackColorPhase = backlights.hueToPhase(doc["color"]["h"]);
-          MQTTCommandBackColorPhaseReceived = true;
-        }
+        break;
       }
-      else
-      { // Process "<MQTT_CLIENT>/use_twelve_hours/set"
-        if (strcmp(topic, concat4(MQTT_CLIENT, "/", Topic12hr, "/set")) == 0)
-        {
-          JsonDocument doc;
-          DeserializationError err = deserializeJson(doc, payload, length);
-          if (err)
-          {
-            Serial.print("DEBUG: JSON error in use_twelve_hours/set: ");
-            Serial.println(err.c_str());
-            return;
-          }
-          if (doc["state"].is<const char *>())
-          {
-            MQTTCommandUseTwelveHours = (strcmp(doc["state"].as<const char *>(), MQTT_STATE_ON) == 0);
-            MQTTCommandUseTwelveHoursReceived = true;
-          }
-        }
-        else
-        { // Process "<MQTT_CLIENT>/blank_zero_hours/set"
-          if (strcmp(topic, concat4(MQTT_CLIENT, "/", TopicBlank0, "/set")) == 0)
-          {
-            JsonDocument doc;
-            DeserializationError err = deserializeJson(doc, payload, length);
-            if (err)
-            {
-              Serial.print("DEBUG: JSON error in blank_zero_hours/set: ");
-              Serial.println(err.c_str());
-              return;
-            }
-            if (doc["state"].is<const char *>())
-            {
-              MQTTCommandBlankZeroHours = (strcmp(doc["state"].as<const char *>(), MQTT_STATE_ON) == 0);
-              MQTTCommandBlankZeroHoursReceived = true;
-            }
-          }
-          else
-          { // Process "<MQTT_CLIENT>/pulse_bpm/set"
-            if (strcmp(topic, concat4(MQTT_CLIENT, "/", TopicPulse, "/set")) == 0)
-            {
-              JsonDocument doc;
-              DeserializationError err = deserializeJson(doc, payload, length);
-              if (err)
-              {
-                Serial.print("DEBUG: JSON error in pulse_bpm/set: ");
-                Serial.println(err.c_str());
-                return;
-              }
-              if (doc["state"].is<uint8_t>())
-              {
-                MQTTCommandPulseBpm = doc["state"];
-                MQTTCommandPulseBpmReceived = true;
-              }
-            }
-            else
-            { // Process "<MQTT_CLIENT>/breath_bpm/set"
-              if (strcmp(topic, concat4(MQTT_CLIENT, "/", TopicBreath, "/set")) == 0)
-              {
-                JsonDocument doc;
-                DeserializationError err = deserializeJson(doc, payload, length);
-                if (err)
-                {
-                  Serial.print("DEBUG: JSON error in breath_bpm/set: ");
-                  Serial.println(err.c_str());
-                  return;
-                }
-                if (doc["state"].is<uint8_t>())
-                {
-                  MQTTCommandBreathBpm = doc["state"];
-                  MQTTCommandBreathBpmReceived = true;
-                }
-              }
-              else
-              { // Process "<MQTT_CLIENT>/rainbow_duration/set"
-                if (strcmp(topic, concat4(MQTT_CLIENT, "/", TopicRainbow, "/set")) == 0)
-                {
-                  JsonDocument doc;
-                  DeserializationError err = deserializeJson(doc, payload, length);
-                  if (err)
-                  {
-                    Serial.print("DEBUG: JSON error in rainbow_duration/set: ");
-                    Serial.println(err.c_str());
-                    return;
-                  }
-                  if (doc["state"].is<float>())
-                  {
-                    MQTTCommandRainbowSec = doc["state"];
-                    MQTTCommandRainbowSecReceived = true;
-                  }
-                }
-                else
-                {
-                  Serial.print("WARNING: Unhandled MQTT topic: ");
-                  Serial.println(topic);
-                }
-              }
-            }
-          }
-        }
+    }
+  }
+#ifdef MQTT_HOME_ASSISTANT
+  MQTTDiscoveryLoop();
+#endif
+  MQTTEventQueueLoop();
+}
+
+#ifdef MQTT_PLAIN_ENABLED
+bool MQTTReportStatus()
+{
+  char message[5];
+  snprintf(message, sizeof(message), "%d", MQTTStatusState);
+  // MQTTPublish(concat2(MQTT_CLIENT, "/report/temperature"), message, MQTT_RETAIN_STATE_MESSAGES);
+  if (!MQTTPublish(concat2(MQTT_CLIENT, "/report/setpoint"), message, MQTT_RETAIN_STATE_MESSAGES))
+    return false;
+  LastSentStatus = MQTTStatusState;
+  return true;
+}
+
+bool MQTTReportPowerState()
+{
+  if (!MQTTPublish(concat2(MQTT_CLIENT, "/report/powerState"), MQTTStatusMainPower == 0 ? MQTT_STATE_OFF : MQTT_STATE_ON, MQTT_RETAIN_STATE_MESSAGES))
+    return false;
+  LastSentMainPowerState = MQTTStatusMainPower;
+  return true;
+}
+
+#ifdef DIMMING_SUNRISE_SUNSET
+bool MQTTReportSun()
+{
+  char message[6];
+  minutesToTimeStr(MQTTStatusSunrise, message, sizeof(message));
+  if (!MQTTPublish(concat2(MQTT_CLIENT, "/report/sunrise"), message, MQTT_RETAIN_STATE_MESSAGES))
+    return false;
+  minutesToTimeStr(MQTTStatusSunset, message, sizeof(message));
+  if (!MQTTPublish(concat2(MQTT_CLIENT, "/report/sunset"), message, MQTT_RETAIN_STATE_MESSAGES))
+    return false;
+  if (!MQTTPublish(concat2(MQTT_CLIENT, "/report/night"), MQTTStatusNightTime ? MQTT_STATE_ON : MQTT_STATE_OFF, MQTT_RETAIN_STATE_MESSAGES))
+    return false;
+  LastSentSunrise = MQTTStatusSunrise;
+  LastSentSunset = MQTTStatusSunset;
+  LastSentNightTime = MQTTStatusNightTime;
+  return true;
+}
+#endif
+
+bool MQTTReportWiFiSignal()
+{
+  char signal[5];
+  int SignalLevel = WiFi.RSSI();
+  snprintf(signal, sizeof(signal), "%d", SignalLevel);
+  if (!MQTTPublish(concat2(MQTT_CLIENT, "/report/signal"), signal, MQTT_RETAIN_STATE_MESSAGES)) // Reports the signal strength
+    return false;
+  LastSentSignalLevel = SignalLevel;
+  return true;
+}
+#endif // MQTT_PLAIN_ENABLED
+
+// State reporting: every reported entity (one state topic) has a bit in MQTTStateDirty. A bit is set when a status
+// value differs from the last sent one, when a command was received for the entity, or when the last report is older
+// than MQTT_REPORT_STATUS_EVERY_SEC. Dirty entities are sent MQTT_STATE_DEBOUNCE_MS after the first change, so a burst
+// of commands collapses into one message per entity, and every entity has a token bucket (MQTT_STATE_BURST messages,
+// one new token every MQTT_STATE_REFILL_MS), so a stream of changes can't flood the broker. An entity without token
+// stays dirty and is sent with its latest state as soon as it has one again.
+
+struct MQTTEntityState
+{
+  uint32_t sent_ms;   // last report, for the periodic refresh
+  uint32_t refill_ms; // last token refill
+  uint32_t command_ms; // first command not yet answered with a report, 0 = none
+  uint8_t tokens;
+};
+
+MQTTEntityState MQTTEntities[MQTTEntityCount];
+uint32_t MQTTStateDirty = 0;
+uint32_t MQTTStateDirtySince = 0;
+
+static_assert(MQTTEntityCount <= 32, "MQTTStateDirty has one bit per entity");
+
+void MQTTStateMarkDirty(uint32_t entities)
+{
+  if (MQTTStateDirty == 0)
+  {
+    MQTTStateDirtySince = millis();
+  }
+  MQTTStateDirty |= entities;
+}
+
+// A command for the entity was received: report its state, and how long it took until the report was sent.
+void MQTTStateCommandReceived(uint8_t entity)
+{
+  if (MQTTEntities[entity].command_ms == 0)
+  {
+    MQTTEntities[entity].command_ms = millis();
+  }
+  MQTTStateMarkDirty(MQTT_ENTITY(entity));
+}
+
+// Compare the status values with the last sent ones, one bit per entity that changed.
+uint32_t MQTTStateChanges()
+{
+  uint32_t changes = 0;
+#ifdef MQTT_PLAIN_ENABLED
+  if (MQTTStatusMainPower != LastSentMainPowerState)
+    changes |= MQTT_ENTITY(MQTTEntityPower);
+  if (MQTTStatusState != LastSentStatus)
+    changes |= MQTT_ENTITY(MQTTEntitySetpoint);
+#ifdef DIMMING_SUNRISE_SUNSET
+  if (MQTTStatusSunrise != LastSentSunrise || MQTTStatusSunset != LastSentSunset || MQTTStatusNightTime != LastSentNightTime)
+    changes |= MQTT_ENTITY(MQTTEntitySun);
+#endif
+  // ignore deviations smaller than 3 dBm
+  if (abs(WiFi.RSSI() - LastSentSignalLevel) > 2)
+    changes |= MQTT_ENTITY(MQTTEntitySignal);
+#endif
+
+#ifdef MQTT_HOME_ASSISTANT
+  if (MQTTStatusMainPower != LastSentMainPowerState || MQTTStatusMainBrightness != LastSentMainBrightness || MQTTStatusMainGraphic != LastSentMainGraphic)
+    changes |= MQTT_ENTITY(MQTTEntityMain);
+  if (MQTTStatusBackPower != LastSentBackPowerState || MQTTStatusBackBrightness != LastSentBackBrightness || strcmp(MQTTStatusBackPattern, LastSentBackPattern) != 0 || MQTTStatusBackColorPhase != LastSentBackColorPhase)
+    changes |= MQTT_ENTITY(MQTTEntityBack);
+  if (MQTTStatusUseTwelveHours != LastSentUseTwelveHours)
+    changes |= MQTT_ENTITY(MQTTEntityTwelveHours);
+  if (MQTTStatusBlankZeroHours != LastSentBlankZeroHours)
+    changes |= MQTT_ENTITY(MQTTEntityBlankZeroHours);
+  // the back light state contains the pattern parameters as well
+  if (MQTTStatusPulseBpm != LastSentPulseBpm)
+    changes |= MQTT_ENTITY(MQTTEntityPulse) | MQTT_ENTITY(MQTTEntityBack);
+  if (MQTTStatusBreathBpm != LastSentBreathBpm)
+    changes |= MQTT_ENTITY(MQTTEntityBreath) | MQTT_ENTITY(MQTTEntityBack);
+  if (MQTTStatusRainbowSec != LastSentRainbowSec)
+    changes |= MQTT_ENTITY(MQTTEntityRainbow) | MQTT_ENTITY(MQTTEntityBack);
+#ifdef DIMMING_SUNRISE_SUNSET
+  if (MQTTStatusSunrise != LastSentSunrise || MQTTStatusSunset != LastSentSunset || MQTTStatusNightTime != LastSentNightTime)
+    changes |= MQTT_ENTITY(MQTTEntitySun);
+#endif
+#ifdef MQTT_BACKLIGHT_ZONES
+  for (uint8_t zone = 1; zone < NUM_BACKLIGHT_ZONES; zone++)
+  {
+    if (MQTTStatusZonePower[zone] != LastSentZonePower[zone] || MQTTStatusZoneBrightness[zone] != LastSentZoneBrightness[zone] || strcmp(MQTTStatusZonePattern[zone], LastSentZonePattern[zone]) != 0 || MQTTStatusZoneColorPhase[zone] != LastSentZoneColorPhase[zone])
+      changes |= MQTT_ENTITY(MQTTEntityZone + zone - 1);
+  }
+#endif
+#endif
+  return changes;
+}
+
+bool MQTTReportEntity(uint8_t entity)
+{
+  switch (entity)
+  {
+#ifdef MQTT_PLAIN_ENABLED
+  case MQTTEntityPower:
+    return MQTTReportPowerState();
+  case MQTTEntitySetpoint:
+    return MQTTReportStatus();
+  case MQTTEntitySignal:
+    return MQTTReportWiFiSignal();
+#endif
+#ifdef MQTT_HOME_ASSISTANT
+  case MQTTEntityMain:
+    return MQTTReportMain();
+  case MQTTEntityBack:
+    return MQTTReportBack();
+  case MQTTEntityTwelveHours:
+    if (!MQTTReportSwitch(concat3(MQTT_CLIENT, "/", Topic12hr), MQTTStatusUseTwelveHours))
+      return false;
+    LastSentUseTwelveHours = MQTTStatusUseTwelveHours;
+    return true;
+  case MQTTEntityBlankZeroHours:
+    if (!MQTTReportSwitch(concat3(MQTT_CLIENT, "/", TopicBlank0), MQTTStatusBlankZeroHours))
+      return false;
+    LastSentBlankZeroHours = MQTTStatusBlankZeroHours;
+    return true;
+  case MQTTEntityPulse:
+    if (!MQTTReportNumber(concat3(MQTT_CLIENT, "/", TopicPulse), MQTTStatusPulseBpm))
+      return false;
+    LastSentPulseBpm = MQTTStatusPulseBpm;
+    return true;
+  case MQTTEntityBreath:
+    if (!MQTTReportNumber(concat3(MQTT_CLIENT, "/", TopicBreath), MQTTStatusBreathBpm))
+      return false;
+    LastSentBreathBpm = MQTTStatusBreathBpm;
+    return true;
+  case MQTTEntityRainbow:
+    if (!MQTTReportNumber(concat3(MQTT_CLIENT, "/", TopicRainbow), round1(MQTTStatusRainbowSec)))
+      return false;
+    LastSentRainbowSec = MQTTStatusRainbowSec;
+    return true;
+#endif
+#ifdef DIMMING_SUNRISE_SUNSET
+  case MQTTEntitySun:
+    return MQTTReportSun();
+#endif
+  default:
+#ifdef MQTT_BACKLIGHT_ZONES
+    if (entity >= MQTTEntityZone && entity < MQTTEntityCount)
+    {
+      return MQTTReportZone(entity - MQTTEntityZone + 1);
+    }
+#endif
+    return true;
+  }
+}
+
+bool MQTTStateTakeToken(MQTTEntityState &state, uint32_t now)
+{
+  uint32_t refill = (now - state.refill_ms) / MQTT_STATE_REFILL_MS;
+  if (refill > 0)
+  {
+    if (state.tokens + refill >= MQTT_STATE_BURST)
+    {
+      state.tokens = MQTT_STATE_BURST;
+      state.refill_ms = now;
+    }
+    else
+    {
+      state.tokens += refill;
+      state.refill_ms += refill * MQTT_STATE_REFILL_MS;
+    }
+  }
+  if (state.tokens == 0)
+  {
+    return false;
+  }
+  state.tokens--;
+  return true;
+}
+
+void MQTTStateLoop()
+{
+  if (!MQTTIsConnected())
+    return;
+
+  if (!availabilityReported && !MQTTReportAvailability(MQTT_ALIVE_MSG_ONLINE))
+    return;
+
+  uint32_t now = millis();
+  uint32_t changes = MQTTStateChanges();
+  for (uint8_t entity = 0; entity < MQTTEntityCount; entity++)
+  { // periodic refresh, only for the entities not sent for a while
+    if ((now - MQTTEntities[entity].sent_ms) > (MQTT_REPORT_STATUS_EVERY_SEC * 1000))
+    {
+      changes |= MQTT_ENTITY(entity);
+    }
+  }
+  changes &= ~MQTTStateDirty;
+  if (changes != 0)
+  {
+    MQTTStateMarkDirty(changes);
+  }
+  if (MQTTStateDirty == 0 || (now - MQTTStateDirtySince) < MQTT_STATE_DEBOUNCE_MS)
+    return;
+  if (MQTTCommandsWaiting)
+    return; // not applied yet, the state would still be the old one
+
+#ifdef DEBUG_OUTPUT_MQTT
+  Serial.printf("DEBUG: Reporting MQTT state, dirty entities: 0x%08x\n", MQTTStateDirty);
+#endif
+  for (uint8_t entity = 0; entity < MQTTEntityCount; entity++)
+  {
+    if ((MQTTStateDirty & MQTT_ENTITY(entity)) == 0 || !MQTTStateTakeToken(MQTTEntities[entity], now))
+      continue;
+    if (!MQTTReportEntity(entity))
+      return; // try again in the next loop
+    MQTTStateDirty &= ~MQTT_ENTITY(entity);
+    MQTTEntities[entity].sent_ms = now;
+    if (MQTTEntities[entity].command_ms != 0)
+    {
+      uint32_t latency_ms = now - MQTTEntities[entity].command_ms;
+      MQTTCmdStats.answered++;
+      MQTTCmdStats.latency_ms_sum += latency_ms;
+      if (latency_ms > MQTTCmdStats.max_latency_ms)
+      {
+        MQTTCmdStats.max_latency_ms = latency_ms;
       }
+      MQTTEntities[entity].command_ms = 0;
     }
   }
-#endif // MQTT_HOME_ASSISTANT
+}
+
+// Diagnostics: one compact JSON message every MQTT_DIAGNOSTICS_EVERY_SEC, the timings are for the last interval.
+// Keys and Home Assistant sensors: see MQTTDiagnosticSensors[]. The timer keys are only sent while the timer runs,
+// the backlight program keys only while a program is loaded.
+uint32_t MQTTLastDiagnosticsMs = 0;
+
+void MQTTReportDiagnostics()
+{
+  static TFTs::DrawStats last_draw = {};
+  static MQTTCommandBatchStats last_cmd = {};
+  static uint32_t last_rx = 0;
+  static uint32_t last_tx = 0;
+  const TFTs::DrawStats &draw = tfts.getDrawStats();
+  uint32_t draws = draw.draws - last_draw.draws;
+  uint32_t decodes = draw.decodes - last_draw.decodes;
+  uint32_t answered = MQTTCmdStats.answered - last_cmd.answered;
+
+  JsonDocument diag(&MQTTJsonArena);
+  diag["uptime"] = (uint32_t)(esp_timer_get_time() / 1000000);
+  diag["heap"] = ESP.getFreeHeap();
+  diag["heap_block"] = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+  diag["psram"] = ESP.getPsramSize() - ESP.getFreePsram();
+  diag["loop_p50"] = round1(loop_stats.percentileUs(50) / 1000.0);
+  diag["loop_p99"] = round1(loop_stats.percentileUs(99) / 1000.0);
+  if (draws > 0)
+  {
+    diag["cache_hit"] = round1((draw.cache_hits - last_draw.cache_hits) * 100.0 / draws);
+    diag["push_ms"] = round1((draw.push_us_sum - last_draw.push_us_sum) / 1000.0 / draws);
+  }
+  if (decodes > 0)
+  {
+    diag["decode_ms"] = round1((draw.decode_us_sum - last_draw.decode_us_sum) / 1000.0 / decodes);
+  }
+  diag["ntp_offset"] = Clock::getNtpOffsetMs();
+  diag["ntp_jitter"] = Clock::getNtpJitterMs();
+  diag["wifi_reconnects"] = WifiReconnects;
+  diag["mqtt_reconnects"] = MQTTConnStats.connects > 0 ? MQTTConnStats.connects - 1 : 0;
+  diag["mqtt_queue"] = __builtin_popcount(MQTTStateDirty) + MQTTEventQueueDepth(); // state messages and events waiting to be sent
+  diag["mqtt_rx"] = MQTTRxStats.messages - last_rx;
+  diag["mqtt_tx"] = MQTTStats.messages - last_tx;
+  if (answered > 0)
+  {
+    diag["cmd_latency"] = (MQTTCmdStats.latency_ms_sum - last_cmd.latency_ms_sum) / answered;
+  }
+  diag["redraws_avoided"] = MQTTCmdStats.redraws_avoided;
+  if (stopwatch.isRunning())
+  { // of the running timer, reset when it is started
+    diag["timer_fps"] = round1(stopwatch.getFps());
+    diag["timer_dropped"] = stopwatch.getDroppedFrames();
+  }
+  BacklightProgram &program = backlights.getProgram();
+  if (program.isLoaded())
+  { // max. frame time since the program was loaded, overruns of the instruction budget since the start
+    diag["program_max_us"] = program.getMaxFrameUs();
+    diag["program_overruns"] = program.getBudgetOverruns();
+  }
+#ifdef MQTT_MSGPACK
+  if (MQTTStats.msgpack_json_bytes > 0)
+  {
+    diag["msgpack_size"] = round1(MQTTStats.msgpack_bytes * 100.0 / MQTTStats.msgpack_json_bytes); // in % of JSON
+  }
+#endif
 
-#ifdef DEBUG_OUTPUT_MQTT
-  Serial.println("DEBUG: Exiting MQTTCallback...");
+#ifdef MQTT_HOME_ASSISTANT
+  if (!MQTTPublish(concat3(MQTT_CLIENT, "/", TopicDiagnostics), &diag, MQTT_RETAIN_STATE_MESSAGES))
+    return;
+#else
+  if (!MQTTPublish(concat2(MQTT_CLIENT, "/report/diagnostics"), &diag, MQTT_RETAIN_STATE_MESSAGES))
+    return;
 #endif
-} // end of MQTTCallback
+  last_draw = draw;
+  last_cmd = MQTTCmdStats;
+  last_rx = MQTTRxStats.messages;
+  last_tx = MQTTStats.messages;
+  loop_stats.reset();
+}
 
-void MQTTLoopFrequently()
+void MQTTLoopInFreeTime()
 {
-  MQTTclient.loop();
-  checkIfMQTTIsConnected();
+#ifdef MQTT_HOME_ASSISTANT
+  if (MQTTIsConnected() && !discoveryReported && !MQTTDiscoveryReplayActive) // Check if discovery messages are already sent
+  {
+#ifdef DEBUG_OUTPUT_MQTT
+    Serial.println("");
+    Serial.println("DEBUG: Disovery messages not sent yet!");
+    Serial.println("DEBUG: Sending discovery messages...");
+#endif
+    MQTTDiscoveryStart(0, false);
+  }
+#endif
+  MQTTStateLoop();
+  if (MQTT_DIAGNOSTICS_EVERY_SEC > 0 && MQTTIsConnected() && (millis() - MQTTLastDiagnosticsMs) > (MQTT_DIAGNOSTICS_EVERY_SEC * 1000))
+  {
+    MQTTLastDiagnosticsMs = millis();
+    MQTTReportDiagnostics();
+  }
 }
 
-void MQTTLoopInFreeTime()
+#ifdef MQTT_HOME_ASSISTANT
+// The discovery messages are built once and kept serialized in SPIFFS (MQTT_DISCOVERY_CACHE_FILE), together with
+// a key over everything they depend on (build, MQTT_CLIENT, MAC, clock face names) and a hash of their content.
+// They are only rebuilt if the key changed. The messages are replayed from MQTTLoopFrequently(), one message
+// every MQTT_DISCOVERY_INTERVAL_MS, and only resent if the content hash differs from the last sent one, or if
+// Home Assistant asks for them with its "online" birth message.
+//
+// File: header, then per message: uint16 topic length, topic, uint16 payload length, payload.
+
+struct MQTTDiscoveryHeader
+{
+  uint32_t magic;
+  uint32_t key;       // of the inputs, the messages are rebuilt if it changes
+  uint32_t hash;      // FNV-1a of all topics and payloads
+  uint32_t sent_hash; // hash of the messages last sent completely, with retain
+  uint16_t count;
+};
+const uint32_t MQTTDiscoveryMagic = 0x43444148; // "HADC"
+
+MQTTDiscoveryHeader MQTTDiscovery = {};
+fs::File MQTTDiscoveryBuildFile;
+fs::File MQTTDiscoveryReplayFile;
+uint16_t MQTTDiscoveryReplayIndex = 0;
+uint32_t MQTTDiscoveryReplayNext = 0; // millis() of the next message
+uint32_t MQTTDiscoveryFailedMs = 0;   // millis() of the last failed build
+uint16_t MQTTDiscoveryRetrySec = 0;  // wait this long after a failed build before the next try, 0 = the last build was fine
+
+uint32_t MQTTHash(const void *data, size_t length, uint32_t hash = 2166136261u)
 {
-  MQTTReportBackOnChange();
-  MQTTPeriodicReportBack();
+  const uint8_t *bytes = (const uint8_t *)data;
+  for (size_t i = 0; i < length; i++)
+  {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
 }
 
-#ifdef MQTT_PLAIN_ENABLED
-void MQTTReportStatus(bool forceUpdate)
+// Writes the serialized JSON to the cache file and hashes it on the way.
+class MQTTDiscoveryWriter : public Print
 {
-  if ((LastSentStatus != MQTTStatusState) || forceUpdate)
+public:
+  size_t write(uint8_t c) override
+  {
+    hash = (hash ^ c) * 16777619u;
+    return MQTTDiscoveryBuildFile.write(c);
+  }
+  size_t write(const uint8_t *data, size_t size) override
   {
-    char message[5];
-    snprintf(message, sizeof(message), "%d", MQTTStatusState);
-    MQTTPublish(concat2(MQTT_CLIENT, "/report/setpoint"), message, MQTT_RETAIN_STATE_MESSAGES);
-    // MQTTPublish(concat2(MQTT_CLIENT, "/report/temperature"), message, MQTT_RETAIN_STATE_MESSAGES);
-    LastSentStatus = MQTTStatusState;
+    hash = MQTTHash(data, size, hash);
+    return MQTTDiscoveryBuildFile.write(data, size);
   }
+  uint32_t hash = 2166136261u;
+};
+MQTTDiscoveryWriter MQTTDiscoveryOut;
+
+// Used by MQTTBuildDiscovery() instead of MQTTPublish(): appends one message to the cache file.
+bool MQTTDiscoveryAdd(const char *topic, JsonDocument *json)
+{
+  uint16_t topic_length = strlen(topic);
+  uint16_t payload_length = measureJson(*json);
+  MQTTDiscoveryOut.write((const uint8_t *)&topic_length, sizeof(topic_length));
+  MQTTDiscoveryOut.write((const uint8_t *)topic, topic_length);
+  MQTTDiscoveryOut.write((const uint8_t *)&payload_length, sizeof(payload_length));
+  bool ok = serializeJson(*json, MQTTDiscoveryOut) == payload_length;
+  json->clear();
+  MQTTDiscovery.count++;
+  return ok;
 }
 
-void MQTTReportPowerState(bool forceUpdate)
+uint32_t MQTTDiscoveryKey()
 {
-  if ((MQTTStatusMainPower != LastSentMainPowerState) || forceUpdate)
+  uint32_t key = MQTTHash(__DATE__ __TIME__ MQTT_CLIENT, sizeof(__DATE__ __TIME__ MQTT_CLIENT));
+  String mac = WiFi.macAddress();
+  key = MQTTHash(mac.c_str(), mac.length(), key);
+  for (uint8_t i = 1; i <= tfts.NumberOfClockFaces; i++)
   {
-    MQTTPublish(concat2(MQTT_CLIENT, "/report/powerState"), MQTTStatusMainPower == 0 ? MQTT_STATE_OFF : MQTT_STATE_ON, MQTT_RETAIN_STATE_MESSAGES);
-    LastSentMainPowerState = MQTTStatusMainPower;
+    String name = tfts.clockFaceToName(i);
+    key = MQTTHash(name.c_str(), name.length() + 1, key);
   }
+  return key;
 }
 
-void MQTTReportWiFiSignal()
+// A failed build is retried from MQTTDiscoveryStart() with a backoff, and only the first failure in a row is printed.
+void MQTTDiscoveryFailed(const char *error)
 {
-  char signal[5];
-  int SignalLevel = WiFi.RSSI();
-  // ignore deviations smaller than 3 dBm
-  if (abs(SignalLevel - LastSentSignalLevel) > 2)
+  if (MQTTDiscoveryRetrySec == 0)
+  {
+    Serial.println(error);
+    Serial.printf("Retrying in %u s.\n", MQTT_DISCOVERY_RETRY_MIN_SEC);
+    MQTTDiscoveryRetrySec = MQTT_DISCOVERY_RETRY_MIN_SEC;
+  }
+  else
   {
-    snprintf(signal, sizeof(signal), "%d", SignalLevel);
-    MQTTPublish(concat2(MQTT_CLIENT, "/report/signal"), signal, MQTT_RETAIN_STATE_MESSAGES); // Reports the signal strength
-    LastSentSignalLevel = SignalLevel;
+    MQTTDiscoveryRetrySec = min(MQTTDiscoveryRetrySec * 2, MQTT_DISCOVERY_RETRY_WAIT_SEC);
   }
+  MQTTDiscoveryFailedMs = millis();
 }
-#endif // MQTT_PLAIN_ENABLED
 
-void MQTTReportBackEverything(bool forceUpdateEverything)
+// Loads the cached discovery messages, or builds them if the cache is missing or outdated.
+void MQTTDiscoveryPrepare()
 {
-  if (MQTTclient.connected())
+  uint32_t key = MQTTDiscoveryKey();
+  fs::File f = SPIFFS.open(MQTT_DISCOVERY_CACHE_FILE, "r");
+  if (f)
   {
-#ifdef MQTT_PLAIN_ENABLED
-    if (!availabilityReported)
-      MQTTReportAvailability(MQTT_ALIVE_MSG_ONLINE);
-    MQTTReportPowerState(forceUpdateEverything);
-    MQTTReportStatus(forceUpdateEverything);
-    MQTTReportWiFiSignal();
-#endif
+    bool ok = f.read((uint8_t *)&MQTTDiscovery, sizeof(MQTTDiscovery)) == sizeof(MQTTDiscovery);
+    f.close();
+    if (ok && MQTTDiscovery.magic == MQTTDiscoveryMagic && MQTTDiscovery.key == key)
+    {
+      Serial.printf("Using %u cached discovery messages.\n", MQTTDiscovery.count);
+      return;
+    }
+  }
 
-#ifdef MQTT_HOME_ASSISTANT
-    MQTTReportState(forceUpdateEverything);
-#endif
+  uint32_t start = millis();
+  MQTTDiscoveryBuildFile = SPIFFS.open(MQTT_DISCOVERY_CACHE_FILE, "w");
+  if (!MQTTDiscoveryBuildFile)
+  {
+    MQTTDiscovery.magic = 0;
+    MQTTDiscoveryFailed("ERROR: Can't write the discovery cache!");
+    return;
+  }
+  MQTTDiscovery = {};
+  MQTTDiscoveryOut.hash = 2166136261u;
+  MQTTDiscoveryBuildFile.write((const uint8_t *)&MQTTDiscovery, sizeof(MQTTDiscovery)); // placeholder
+  bool ok = MQTTBuildDiscovery();
+  MQTTDiscovery.magic = ok ? MQTTDiscoveryMagic : 0;
+  MQTTDiscovery.key = key;
+  MQTTDiscovery.hash = MQTTDiscoveryOut.hash;
+  MQTTDiscoveryBuildFile.seek(0);
+  MQTTDiscoveryBuildFile.write((const uint8_t *)&MQTTDiscovery, sizeof(MQTTDiscovery));
+  MQTTDiscoveryBuildFile.close();
+  if (!ok)
+  {
+    MQTTDiscoveryFailed("ERROR: Can't build the discovery messages!");
+    return;
+  }
+  MQTTDiscoveryRetrySec = 0;
+  Serial.printf("Built %u discovery messages in %u ms.\n", MQTTDiscovery.count, millis() - start);
+}
 
-    lastTimeSent = millis();
+// Start sending the discovery messages after delay_ms. Only if they changed since they were sent last, unless forced.
+void MQTTDiscoveryStart(uint32_t delay_ms, bool force)
+{
+  if (MQTTDiscovery.magic != MQTTDiscoveryMagic)
+  { // the last build failed, try again when the backoff is over
+    if (millis() - MQTTDiscoveryFailedMs < MQTTDiscoveryRetrySec * 1000UL)
+    {
+      return;
+    }
+    MQTTDiscoveryPrepare();
+    if (MQTTDiscovery.magic != MQTTDiscoveryMagic)
+    {
+      return;
+    }
+  }
+  if (!force && MQTT_HOME_ASSISTANT_RETAIN_DISCOVERY_MESSAGES && MQTTDiscovery.sent_hash == MQTTDiscovery.hash)
+  { // the broker still has them
+    discoveryReported = true;
+    return;
+  }
+  if (MQTTDiscoveryReplayActive)
+  {
+    MQTTDiscoveryReplayFile.close();
+  }
+  MQTTDiscoveryReplayFile = SPIFFS.open(MQTT_DISCOVERY_CACHE_FILE, "r");
+  if (!MQTTDiscoveryReplayFile || !MQTTDiscoveryReplayFile.seek(sizeof(MQTTDiscoveryHeader)))
+  {
+    Serial.println("ERROR: Can't read the discovery cache!");
+    return;
   }
+  MQTTDiscoveryReplayIndex = 0;
+  MQTTDiscoveryReplayNext = millis() + delay_ms;
+  MQTTDiscoveryReplayActive = true;
 }
 
-void MQTTReportBackOnChange()
+void MQTTDiscoveryStop(bool completed)
 {
-  if (MQTTclient.connected())
+  MQTTDiscoveryReplayFile.close();
+  MQTTDiscoveryReplayActive = false;
+  discoveryReported = completed;
+  if (!completed)
   {
-#ifdef MQTT_PLAIN_ENABLED
-    MQTTReportPowerState(false);
-    MQTTReportStatus(false);
-#endif
-#ifdef MQTT_HOME_ASSISTANT
-    // Home Assistant reporting
-    if (!discoveryReported) // Check if discovery messages are already sent
+    Serial.println("ERROR: Failure while sending discovery messages!");
+    return;
+  }
+  MQTTReportAvailability(MQTT_ALIVE_MSG_ONLINE); // Publish online status
+  MQTTStateMarkDirty(MQTT_ENTITY_ALL);           // the entities may be new to Home Assistant
+  if (MQTT_HOME_ASSISTANT_RETAIN_DISCOVERY_MESSAGES && MQTTDiscovery.sent_hash != MQTTDiscovery.hash)
+  {
+    MQTTDiscovery.sent_hash = MQTTDiscovery.hash;
+    fs::File f = SPIFFS.open(MQTT_DISCOVERY_CACHE_FILE, "r+");
+    if (f)
     {
-#ifdef DEBUG_OUTPUT_MQTT
-      Serial.println("");
-      Serial.println("DEBUG: Disovery messages not sent yet!");
-      Serial.println("DEBUG: Sending discovery messages...");
-#endif
-      discoveryReported = MQTTReportDiscovery();
-      if (!discoveryReported)
-      {
-        Serial.println("ERROR: Failure while sending discovery messages!");
-      }
+      f.seek(offsetof(MQTTDiscoveryHeader, sent_hash));
+      f.write((const uint8_t *)&MQTTDiscovery.sent_hash, sizeof(MQTTDiscovery.sent_hash));
+      f.close();
     }
-    MQTTReportState(false); // Report only the device states which changed
-#endif
   }
 }
 
-void MQTTPeriodicReportBack()
-{ // Report/Send all device states with a limiter to not report too often
-  if (((millis() - lastTimeSent) > (MQTT_REPORT_STATUS_EVERY_SEC * 1000)) && MQTTclient.connected())
+// Sends the next discovery message when it is due, streamed from the file into the MQTT packet.
+void MQTTDiscoveryLoop()
+{
+  if (!MQTTDiscoveryReplayActive || (int32_t)(millis() - MQTTDiscoveryReplayNext) < 0)
   {
-#ifdef DEBUG_OUTPUT_MQTT
-    Serial.println("");
-    Serial.println("DEBUG: Sending periodic MQTT report...");
-#endif
-    MQTTConnected = MQTTclient.connected(); // Check regularly if still connected to the MQTT broker
-#ifdef MQTT_HOME_ASSISTANT
-    if (!discoveryReported) // Check if discovery messages are already sent
-    {
-#ifdef DEBUG_OUTPUT_MQTT
-      Serial.println("");
-      Serial.println("DEBUG: Disovery messages not sent yet!");
-      Serial.println("DEBUG: Sending discovery messages...");
-#endif
-      discoveryReported = MQTTReportDiscovery();
-      if (!discoveryReported)
-      {
-        Serial.println("ERROR: Failure while sending discovery messages!");
-      }
+    return;
+  }
+  if (MQTTDiscoveryReplayIndex >= MQTTDiscovery.count)
+  {
+    MQTTDiscoveryStop(true);
+    return;
+  }
+  if (!MQTTIsConnected())
+  {
+    MQTTDiscoveryStop(false);
+    return;
+  }
+
+  fs::File &f = MQTTDiscoveryReplayFile;
+  uint16_t topic_length, payload_length;
+  char topic[128];
+  bool ok = f.read((uint8_t *)&topic_length, sizeof(topic_length)) == sizeof(topic_length) && topic_length < sizeof(topic) &&
+            f.read((uint8_t *)topic, topic_length) == topic_length &&
+            f.read((uint8_t *)&payload_length, sizeof(payload_length)) == sizeof(payload_length);
+  bool started = false;
+  if (ok)
+  {
+    topic[topic_length] = '\0';
+    ok = started = MQTTclient.beginPublish(topic, payload_length, MQTT_HOME_ASSISTANT_RETAIN_DISCOVERY_MESSAGES);
+  }
+  uint8_t chunk[64];
+  for (uint16_t sent = 0; ok && sent < payload_length; sent += sizeof(chunk))
+  {
+    size_t length = min((size_t)(payload_length - sent), sizeof(chunk));
+    ok = f.read(chunk, length) == length && MQTTclient.write(chunk, length) == length;
+  }
+  if (!ok || !MQTTclient.endPublish())
+  {
+    if (started)
+    { // the header announced payload_length bytes, the broker would read the next packet as the rest of this one
+      Serial.println("ERROR: Discovery message cut off, reconnecting!");
+      MQTTclient.disconnect();
     }
-#endif
-    MQTTReportBackEverything(true); // Report all device states
+    MQTTDiscoveryStop(false);
+    return;
   }
+#ifdef DEBUG_OUTPUT_MQTT
+  Serial.printf("DEBUG: TX MQTT discovery: %s (%u bytes)\n", topic, payload_length);
+#endif
+  MQTTStats.messages++;
+  MQTTStats.bytes += payload_length;
+  MQTTDiscoveryReplayIndex++;
+  MQTTDiscoveryReplayNext = millis() + MQTT_DISCOVERY_INTERVAL_MS;
 }
+#endif // MQTT_HOME_ASSISTANT
 
 #ifdef MQTT_HOME_ASSISTANT
-bool MQTTReportDiscovery()
+// Builds all discovery messages, see MQTTDiscoveryPrepare().
+struct MQTTDiagnosticSensor
 {
-  JsonDocument discovery;
+  const char *key; // in the diagnostics message, see MQTTReportDiagnostics()
+  const char *name;
+  const char *unit;
+  const char *device_class;
+  const char *icon;
+  bool total; // counter since the start
+};
+
+const MQTTDiagnosticSensor MQTTDiagnosticSensors[] = {
+    {"uptime", "Uptime", "s", "duration", "mdi:timer-outline", true},
+    {"heap", "Free heap", "B", "data_size", "mdi:memory", false},
+    {"heap_block", "Largest free block", "B", "data_size", "mdi:memory", false},
+    {"psram", "PSRAM used", "B", "data_size", "mdi:memory", false},
+    {"loop_p50", "Loop time p50", "ms", "duration", "mdi:timer-sand", false},
+    {"loop_p99", "Loop time p99", "ms", "duration", "mdi:timer-sand", false},
+    {"cache_hit", "Image cache hit rate", "%", NULL, "mdi:image-multiple", false},
+    {"decode_ms", "Image decode time", "ms", "duration", "mdi:image-refresh", false},
+    {"push_ms", "Display push time", "ms", "duration", "mdi:monitor-arrow-down", false},
+    {"ntp_offset", "NTP offset", "ms", "duration", "mdi:clock-check-outline", false},
+    {"ntp_jitter", "NTP jitter", "ms", "duration", "mdi:clock-alert-outline", false},
+    {"wifi_reconnects", "WiFi reconnects", NULL, NULL, "mdi:wifi-refresh", true},
+    {"mqtt_reconnects", "MQTT reconnects", NULL, NULL, "mdi:lan-connect", true},
+    {"mqtt_queue", "MQTT queue", NULL, NULL, "mdi:tray-full", false},
+    {"mqtt_rx", "MQTT messages received", NULL, NULL, "mdi:download-network", false},
+    {"mqtt_tx", "MQTT messages sent", NULL, NULL, "mdi:upload-network", false},
+    {"cmd_latency", "Command to state latency", "ms", "duration", "mdi:timer-sync-outline", false},
+    {"redraws_avoided", "Redraws avoided", NULL, NULL, "mdi:monitor-shimmer", true},
+    {"timer_fps", "Timer frame rate", "fps", NULL, "mdi:timer-play-outline", false},
+    {"timer_dropped", "Timer frames dropped", NULL, NULL, "mdi:timer-alert-outline", false},
+    {"program_max_us", "Backlight program max. frame time", "μs", "duration", "mdi:led-strip-variant", false},
+    {"program_overruns", "Backlight program overruns", NULL, NULL, "mdi:led-strip-variant-off", true},
+#ifdef MQTT_MSGPACK
+    {"msgpack_size", "MessagePack size", "%", NULL, "mdi:package-variant-closed", false},
+#endif
+};
+
+bool MQTTBuildDiscovery()
+{
+  JsonDocument discovery(&MQTTJsonArena);
 
   // Main Light
   discovery.clear();
@@ -983,8 +2397,7 @@ bool MQTTReportDiscovery()
     discovery["effect_list"][i - 1] = tfts.clockFaceToName(i);
   }
 
-  delay(150);
-  if (!MQTTPublish(concat5("homeassistant/light/", MQTT_CLIENT, "_", TopicFront, "/config"), &discovery, MQTT_HOME_ASSISTANT_RETAIN_DISCOVERY_MESSAGES))
+  if (!MQTTDiscoveryAdd(concat5("homeassistant/light/", MQTT_CLIENT, "_", TopicFront, "/config"), &discovery))
     return false;
 
   // Back Light
@@ -1015,10 +2428,53 @@ bool MQTTReportDiscovery()
     discovery["effect_list"][i] = backlights.patterns_str[i];
   }
 
-  delay(150);
-  if (!MQTTPublish(concat5("homeassistant/light/", MQTT_CLIENT, "_", TopicBack, "/config"), &discovery, MQTT_HOME_ASSISTANT_RETAIN_DISCOVERY_MESSAGES))
+  if (!MQTTDiscoveryAdd(concat5("homeassistant/light/", MQTT_CLIENT, "_", TopicBack, "/config"), &discovery))
     return false;
 
+#ifdef MQTT_BACKLIGHT_ZONES
+  // Back Light Zones
+  for (uint8_t zone = 1; zone < NUM_BACKLIGHT_ZONES; zone++)
+  {
+    char id[48];
+    char state_topic[64];
+    char command_topic[64];
+    char config_topic[96];
+    snprintf(id, sizeof(id), "%s_%s%u", MQTT_CLIENT, TopicBackZone, zone);
+    MQTTZoneTopic(zone, "", state_topic, sizeof(state_topic));
+    MQTTZoneTopic(zone, "/set", command_topic, sizeof(command_topic));
+    snprintf(config_topic, sizeof(config_topic), "homeassistant/light/%s/config", id);
+
+    discovery.clear();
+    discovery["device"]["identifiers"][0] = MQTT_CLIENT;
+    discovery["device"]["manufacturer"] = MQTT_HOME_ASSISTANT_DISCOVERY_DEVICE_MANUFACTURER;
+    discovery["device"]["model"] = MQTT_HOME_ASSISTANT_DISCOVERY_DEVICE_MODEL;
+    discovery["device"]["name"] = MQTT_HOME_ASSISTANT_DISCOVERY_DEVICE_MODEL;
+    discovery["device"]["sw_version"] = MQTT_HOME_ASSISTANT_DISCOVERY_SW_VERSION;
+    discovery["device"]["hw_version"] = MQTT_HOME_ASSISTANT_DISCOVERY_HW_VERSION;
+    discovery["device"]["connections"][0][0] = "mac";
+    discovery["device"]["connections"][0][1] = WiFi.macAddress();
+    discovery["unique_id"] = id;
+    discovery["object_id"] = id;
+    discovery["availability_topic"] = concat3(MQTT_CLIENT, "/", MQTT_ALIVE_TOPIC);
+    discovery["name"] = backlights.getZoneName(zone);
+    discovery["icon"] = "mdi:led-strip-variant";
+    discovery["schema"] = "json";
+    discovery["state_topic"] = state_topic;
+    discovery["command_topic"] = command_topic;
+    discovery["brightness"] = true;
+    discovery["brightness_scale"] = MQTT_BRIGHTNESS_BACK_MAX;
+    discovery["supported_color_modes"][0] = "hs";
+    discovery["effect"] = true;
+    for (size_t i = 0; i < backlights.num_patterns; i++)
+    {
+      discovery["effect_list"][i] = backlights.patterns_str[i];
+    }
+
+    if (!MQTTDiscoveryAdd(config_topic, &discovery))
+      return false;
+  }
+#endif // MQTT_BACKLIGHT_ZONES
+
   // Use Twelwe Hours
   discovery.clear();
   discovery["device"]["identifiers"][0] = MQTT_CLIENT;
@@ -1044,8 +2500,7 @@ bool MQTTReportDiscovery()
   discovery["payload_on"] = "{\"state\":\"ON\"}";
   discovery["payload_off"] = "{\"state\":\"OFF\"}";
 
-  delay(150);
-  if (!MQTTPublish(concat5("homeassistant/switch/", MQTT_CLIENT, "_", Topic12hr, "/config"), &discovery, MQTT_HOME_ASSISTANT_RETAIN_DISCOVERY_MESSAGES))
+  if (!MQTTDiscoveryAdd(concat5("homeassistant/switch/", MQTT_CLIENT, "_", Topic12hr, "/config"), &discovery))
     return false;
 
   // Blank Zero Hours
@@ -1073,8 +2528,7 @@ bool MQTTReportDiscovery()
   discovery["payload_on"] = "{\"state\":\"ON\"}";
   discovery["payload_off"] = "{\"state\":\"OFF\"}";
 
-  delay(150);
-  if (!MQTTPublish(concat5("homeassistant/switch/", MQTT_CLIENT, "_", TopicBlank0, "/config"), &discovery, MQTT_HOME_ASSISTANT_RETAIN_DISCOVERY_MESSAGES))
+  if (!MQTTDiscoveryAdd(concat5("homeassistant/switch/", MQTT_CLIENT, "_", TopicBlank0, "/config"), &discovery))
     return false;
 
   // Pulses per minute
@@ -1104,8 +2558,7 @@ bool MQTTReportDiscovery()
   discovery["mode"] = "slider";
   discovery["value_template"] = "{{ value_json.state }}";
 
-  delay(150);
-  if (!MQTTPublish(concat5("homeassistant/number/", MQTT_CLIENT, "_", TopicPulse, "/config"), &discovery, MQTT_HOME_ASSISTANT_RETAIN_DISCOVERY_MESSAGES))
+  if (!MQTTDiscoveryAdd(concat5("homeassistant/number/", MQTT_CLIENT, "_", TopicPulse, "/config"), &discovery))
     return false;
 
   // Breathes per minute
@@ -1135,8 +2588,7 @@ bool MQTTReportDiscovery()
   discovery["mode"] = "slider";
   discovery["value_template"] = "{{ value_json.state }}";
 
-  delay(150);
-  if (!MQTTPublish(concat5("homeassistant/number/", MQTT_CLIENT, "_", TopicBreath, "/config"), &discovery, MQTT_HOME_ASSISTANT_RETAIN_DISCOVERY_MESSAGES))
+  if (!MQTTDiscoveryAdd(concat5("homeassistant/number/", MQTT_CLIENT, "_", TopicBreath, "/config"), &discovery))
     return false;
 
   // Rainbow duration
@@ -1166,20 +2618,197 @@ bool MQTTReportDiscovery()
   discovery["mode"] = "slider";
   discovery["value_template"] = "{{ value_json.state }}";
 
-  delay(150);
-  if (!MQTTPublish(concat5("homeassistant/number/", MQTT_CLIENT, "_", TopicRainbow, "/config"), &discovery, MQTT_HOME_ASSISTANT_RETAIN_DISCOVERY_MESSAGES))
+  if (!MQTTDiscoveryAdd(concat5("homeassistant/number/", MQTT_CLIENT, "_", TopicRainbow, "/config"), &discovery))
     return false;
 
+  // Timer mode command ("stopwatch", "countdown 90", "start", "stop", "reset", "off")
   discovery.clear();
-  delay(120);
-  MQTTReportAvailability(MQTT_ALIVE_MSG_ONLINE); // Publish online status
+  discovery["device"]["identifiers"][0] = MQTT_CLIENT;
+  discovery["device"]["manufacturer"] = MQTT_HOME_ASSISTANT_DISCOVERY_DEVICE_MANUFACTURER;
+  discovery["device"]["model"] = MQTT_HOME_ASSISTANT_DISCOVERY_DEVICE_MODEL;
+  discovery["device"]["name"] = MQTT_HOME_ASSISTANT_DISCOVERY_DEVICE_MODEL;
+  discovery["device"]["sw_version"] = MQTT_HOME_ASSISTANT_DISCOVERY_SW_VERSION;
+  discovery["device"]["hw_version"] = MQTT_HOME_ASSISTANT_DISCOVERY_HW_VERSION;
+  discovery["device"]["connections"][0][0] = "mac";
+  discovery["device"]["connections"][0][1] = WiFi.macAddress();
+  discovery["unique_id"] = concat2(MQTT_CLIENT, "_timer");
+  discovery["object_id"] = concat2(MQTT_CLIENT, "_timer");
+  discovery["availability_topic"] = concat3(MQTT_CLIENT, "/", MQTT_ALIVE_TOPIC);
+  discovery["name"] = "Timer";
+  discovery["icon"] = "mdi:timer-outline";
+  discovery["command_topic"] = concat2(MQTT_CLIENT, MQTT_TIMER_TOPIC);
+  discovery["max"] = sizeof(MQTTCommandTimer) - 1;
+
+  if (!MQTTDiscoveryAdd(concat4("homeassistant/text/", MQTT_CLIENT, "_timer", "/config"), &discovery))
+    return false;
+
+  // World clock zones (JSON) or "next" / "home"
+  discovery.clear();
+  discovery["device"]["identifiers"][0] = MQTT_CLIENT;
+  discovery["device"]["manufacturer"] = MQTT_HOME_ASSISTANT_DISCOVERY_DEVICE_MANUFACTURER;
+  discovery["device"]["model"] = MQTT_HOME_ASSISTANT_DISCOVERY_DEVICE_MODEL;
+  discovery["device"]["name"] = MQTT_HOME_ASSISTANT_DISCOVERY_DEVICE_MODEL;
+  discovery["device"]["sw_version"] = MQTT_HOME_ASSISTANT_DISCOVERY_SW_VERSION;
+  discovery["device"]["hw_version"] = MQTT_HOME_ASSISTANT_DISCOVERY_HW_VERSION;
+  discovery["device"]["connections"][0][0] = "mac";
+  discovery["device"]["connections"][0][1] = WiFi.macAddress();
+  discovery["unique_id"] = concat2(MQTT_CLIENT, "_world_clock");
+  discovery["object_id"] = concat2(MQTT_CLIENT, "_world_clock");
+  discovery["availability_topic"] = concat3(MQTT_CLIENT, "/", MQTT_ALIVE_TOPIC);
+  discovery["entity_category"] = "config";
+  discovery["name"] = "World clock";
+  discovery["icon"] = "mdi:earth";
+  discovery["command_topic"] = concat2(MQTT_CLIENT, MQTT_WORLD_CLOCK_TOPIC);
+  discovery["max"] = sizeof(MQTTCommandWorldClock) - 1;
+
+  if (!MQTTDiscoveryAdd(concat4("homeassistant/text/", MQTT_CLIENT, "_world_clock", "/config"), &discovery))
+    return false;
+
+#ifdef DIMMING_SUNRISE_SUNSET
+  // Sunrise
+  discovery.clear();
+  discovery["device"]["identifiers"][0] = MQTT_CLIENT;
+  discovery["device"]["manufacturer"] = MQTT_HOME_ASSISTANT_DISCOVERY_DEVICE_MANUFACTURER;
+  discovery["device"]["model"] = MQTT_HOME_ASSISTANT_DISCOVERY_DEVICE_MODEL;
+  discovery["device"]["name"] = MQTT_HOME_ASSISTANT_DISCOVERY_DEVICE_MODEL;
+  discovery["device"]["sw_version"] = MQTT_HOME_ASSISTANT_DISCOVERY_SW_VERSION;
+  discovery["device"]["hw_version"] = MQTT_HOME_ASSISTANT_DISCOVERY_HW_VERSION;
+  discovery["device"]["connections"][0][0] = "mac";
+  discovery["device"]["connections"][0][1] = WiFi.macAddress();
+  discovery["unique_id"] = concat2(MQTT_CLIENT, "_sunrise");
+  discovery["object_id"] = concat2(MQTT_CLIENT, "_sunrise");
+  discovery["availability_topic"] = concat3(MQTT_CLIENT, "/", MQTT_ALIVE_TOPIC);
+  discovery["entity_category"] = "diagnostic";
+  discovery["name"] = "Sunrise";
+  discovery["icon"] = "mdi:weather-sunset-up";
+  discovery["state_topic"] = concat3(MQTT_CLIENT, "/", TopicSun);
+  discovery["value_template"] = "{{ value_json.sunrise }}";
+
+  if (!MQTTDiscoveryAdd(concat4("homeassistant/sensor/", MQTT_CLIENT, "_sunrise", "/config"), &discovery))
+    return false;
+
+  // Sunset
+  discovery.clear();
+  discovery["device"]["identifiers"][0] = MQTT_CLIENT;
+  discovery["device"]["manufacturer"] = MQTT_HOME_ASSISTANT_DISCOVERY_DEVICE_MANUFACTURER;
+  discovery["device"]["model"] = MQTT_HOME_ASSISTANT_DISCOVERY_DEVICE_MODEL;
+  discovery["device"]["name"] = MQTT_HOME_ASSISTANT_DISCOVERY_DEVICE_MODEL;
+  discovery["device"]["sw_version"] = MQTT_HOME_ASSISTANT_DISCOVERY_SW_VERSION;
+  discovery["device"]["hw_version"] = MQTT_HOME_ASSISTANT_DISCOVERY_HW_VERSION;
+  discovery["device"]["connections"][0][0] = "mac";
+  discovery["device"]["connections"][0][1] = WiFi.macAddress();
+  discovery["unique_id"] = concat2(MQTT_CLIENT, "_sunset");
+  discovery["object_id"] = concat2(MQTT_CLIENT, "_sunset");
+  discovery["availability_topic"] = concat3(MQTT_CLIENT, "/", MQTT_ALIVE_TOPIC);
+  discovery["entity_category"] = "diagnostic";
+  discovery["name"] = "Sunset";
+  discovery["icon"] = "mdi:weather-sunset-down";
+  discovery["state_topic"] = concat3(MQTT_CLIENT, "/", TopicSun);
+  discovery["value_template"] = "{{ value_json.sunset }}";
+
+  if (!MQTTDiscoveryAdd(concat4("homeassistant/sensor/", MQTT_CLIENT, "_sunset", "/config"), &discovery))
+    return false;
+
+  // Night time (dimmed)
+  discovery.clear();
+  discovery["device"]["identifiers"][0] = MQTT_CLIENT;
+  discovery["device"]["manufacturer"] = MQTT_HOME_ASSISTANT_DISCOVERY_DEVICE_MANUFACTURER;
+  discovery["device"]["model"] = MQTT_HOME_ASSISTANT_DISCOVERY_DEVICE_MODEL;
+  discovery["device"]["name"] = MQTT_HOME_ASSISTANT_DISCOVERY_DEVICE_MODEL;
+  discovery["device"]["sw_version"] = MQTT_HOME_ASSISTANT_DISCOVERY_SW_VERSION;
+  discovery["device"]["hw_version"] = MQTT_HOME_ASSISTANT_DISCOVERY_HW_VERSION;
+  discovery["device"]["connections"][0][0] = "mac";
+  discovery["device"]["connections"][0][1] = WiFi.macAddress();
+  discovery["unique_id"] = concat2(MQTT_CLIENT, "_night");
+  discovery["object_id"] = concat2(MQTT_CLIENT, "_night");
+  discovery["availability_topic"] = concat3(MQTT_CLIENT, "/", MQTT_ALIVE_TOPIC);
+  discovery["entity_category"] = "diagnostic";
+  discovery["name"] = "Night Time";
+  discovery["icon"] = "mdi:weather-night";
+  discovery["state_topic"] = concat3(MQTT_CLIENT, "/", TopicSun);
+  discovery["value_template"] = "{{ value_json.night }}";
+  discovery["payload_on"] = "ON";
+  discovery["payload_off"] = "OFF";
+
+  if (!MQTTDiscoveryAdd(concat4("homeassistant/binary_sensor/", MQTT_CLIENT, "_night", "/config"), &discovery))
+    return false;
+#endif
+
+  // Events, see MQTTEventQueueLoop()
+  discovery.clear();
+  discovery["device"]["identifiers"][0] = MQTT_CLIENT;
+  discovery["device"]["manufacturer"] = MQTT_HOME_ASSISTANT_DISCOVERY_DEVICE_MANUFACTURER;
+  discovery["device"]["model"] = MQTT_HOME_ASSISTANT_DISCOVERY_DEVICE_MODEL;
+  discovery["device"]["name"] = MQTT_HOME_ASSISTANT_DISCOVERY_DEVICE_MODEL;
+  discovery["device"]["sw_version"] = MQTT_HOME_ASSISTANT_DISCOVERY_SW_VERSION;
+  discovery["device"]["hw_version"] = MQTT_HOME_ASSISTANT_DISCOVERY_HW_VERSION;
+  discovery["device"]["connections"][0][0] = "mac";
+  discovery["device"]["connections"][0][1] = WiFi.macAddress();
+  discovery["unique_id"] = concat3(MQTT_CLIENT, "_", TopicEvent);
+  discovery["object_id"] = concat3(MQTT_CLIENT, "_", TopicEvent);
+  discovery["availability_topic"] = concat3(MQTT_CLIENT, "/", MQTT_ALIVE_TOPIC);
+  discovery["name"] = "Event";
+  discovery["icon"] = "mdi:gesture-tap-button";
+  discovery["state_topic"] = concat3(MQTT_CLIENT, "/", TopicEvent);
+  discovery["event_types"][0] = EventBus::event_str[EventBus::button_pressed];
+  discovery["event_types"][1] = EventBus::event_str[EventBus::power_changed];
+  discovery["event_types"][2] = EventBus::event_str[EventBus::mqtt_connected];
+
+  if (!MQTTDiscoveryAdd(concat5("homeassistant/event/", MQTT_CLIENT, "_", TopicEvent, "/config"), &discovery))
+    return false;
+
+  // Diagnostics, all from the same state topic
+  for (const MQTTDiagnosticSensor &sensor : MQTTDiagnosticSensors)
+  {
+    char id[48], value_template[48], topic[96];
+    snprintf(id, sizeof(id), "%s_%s", MQTT_CLIENT, sensor.key);
+    snprintf(value_template, sizeof(value_template), "{{ value_json.%s }}", sensor.key);
+    snprintf(topic, sizeof(topic), "homeassistant/sensor/%s/config", id);
+
+    discovery.clear();
+    discovery["device"]["identifiers"][0] = MQTT_CLIENT;
+    discovery["device"]["manufacturer"] = MQTT_HOME_ASSISTANT_DISCOVERY_DEVICE_MANUFACTURER;
+    discovery["device"]["model"] = MQTT_HOME_ASSISTANT_DISCOVERY_DEVICE_MODEL;
+    discovery["device"]["name"] = MQTT_HOME_ASSISTANT_DISCOVERY_DEVICE_MODEL;
+    discovery["device"]["sw_version"] = MQTT_HOME_ASSISTANT_DISCOVERY_SW_VERSION;
+    discovery["device"]["hw_version"] = MQTT_HOME_ASSISTANT_DISCOVERY_HW_VERSION;
+    discovery["device"]["connections"][0][0] = "mac";
+    discovery["device"]["connections"][0][1] = WiFi.macAddress();
+    discovery["unique_id"] = id;
+    discovery["object_id"] = id;
+    discovery["availability_topic"] = concat3(MQTT_CLIENT, "/", MQTT_ALIVE_TOPIC);
+    discovery["entity_category"] = "diagnostic";
+    discovery["name"] = sensor.name;
+    discovery["icon"] = sensor.icon;
+    discovery["state_topic"] = concat3(MQTT_CLIENT, "/", TopicDiagnostics);
+    discovery["value_template"] = value_template;
+    discovery["state_class"] = sensor.total ? "total_increasing" : "measurement";
+    if (sensor.unit != NULL)
+    {
+      discovery["unit_of_measurement"] = sensor.unit;
+    }
+    if (sensor.device_class != NULL)
+    {
+      discovery["device_class"] = sensor.device_class;
+    }
+    if (MQTT_DIAGNOSTICS_EVERY_SEC > 0)
+    {
+      discovery["expire_after"] = 3 * MQTT_DIAGNOSTICS_EVERY_SEC;
+    }
+
+    if (!MQTTDiscoveryAdd(topic, &discovery))
+      return false;
+  }
 
+  discovery.clear();
   return true;
 }
 #endif // MQTT_HOME_ASSISTANT
 
 bool MQTTReportAvailability(const char *status)
 {
+  if (!MQTTIsConnected())
+    return false;
   availabilityReported = MQTTclient.publish(concat3(MQTT_CLIENT, "/", MQTT_ALIVE_TOPIC), status, MQTT_RETAIN_ALIVE_MESSAGES); // normally published with 'retain' flag set to true
 #ifdef DEBUG_OUTPUT_MQTT
   Serial.print("DEBUG: Sent availability: ");
@@ -1195,6 +2824,82 @@ double round1(double value) // Helper function to round a double to one decimal
   return (int)(value * 10 + 0.5) / 10.0;
 }
 
+#ifdef MQTT_BACKLIGHT_ZONES
+void MQTTZoneTopic(uint8_t zone, const char *suffix, char *topic, size_t size) // Helper function to build "<MQTT_CLIENT>/back_z<zone><suffix>"
+{
+  snprintf(topic, size, "%s/%s%u%s", MQTT_CLIENT, TopicBackZone, zone, suffix);
+}
+
+// Process "<MQTT_CLIENT>/back_z<zone>/set" (suffix without "<MQTT_CLIENT>/"), same JSON as "<MQTT_CLIENT>/back/set".
+// Returns false for all other topics.
+bool MQTTReceiveZone(const char *suffix, MQTTMessage &msg, JsonDocument &doc)
+{
+  const size_t prefix_length = sizeof(TopicBackZone) - 1;
+  if (strncmp(suffix, TopicBackZone, prefix_length) != 0 || !endsWith(suffix, "/set"))
+  {
+    return false;
+  }
+  // the zone number has to be followed directly by "/set", "back_z1junk/set" is not zone 1
+  const char *p = suffix + prefix_length;
+  unsigned int zone = 0;
+  for (; isdigit(*p); p++)
+  {
+    if (zone < NUM_BACKLIGHT_ZONES) // already out of range otherwise, don't overflow
+    {
+      zone = zone * 10 + (*p - '0');
+    }
+  }
+  if (p == suffix + prefix_length || strcmp(p, "/set") != 0)
+  {
+    return false;
+  }
+  if (zone < 1 || zone >= NUM_BACKLIGHT_ZONES)
+  {
+    return true;
+  }
+
+  if (!MQTTParseJson(msg, doc))
+  {
+    return true;
+  }
+  if (doc["state"].is<const char *>())
+  {
+    MQTTCommandZonePower[zone] = (strcmp(doc["state"].as<const char *>(), MQTT_STATE_ON) == 0);
+    MQTTCommandZonePowerReceived[zone] = true;
+  }
+  if (doc["brightness"].is<int>())
+  {
+    MQTTCommandZoneBrightness[zone] = doc["brightness"];
+    MQTTCommandZoneBrightnessReceived[zone] = true;
+  }
+  if (doc["effect"].is<const char *>())
+  {
+    strncpy(MQTTCommandZonePattern[zone], doc["effect"], sizeof(MQTTCommandZonePattern[zone]) - 1);
+    MQTTCommandZonePattern[zone][sizeof(MQTTCommandZonePattern[zone]) - 1] = '\0';
+    MQTTCommandZonePatternReceived[zone] = true;
+  }
+  if (doc["color"].is<JsonObject>())
+  {
+    MQTTCommandZoneColorPhase[zone] = backlights.hueToPhase(doc["color"]["h"]);
+    MQTTCommandZoneColorPhaseReceived[zone] = true;
+  }
+  MQTTStateCommandReceived(MQTTEntityZone + zone - 1);
+  return true;
+}
+#endif // MQTT_BACKLIGHT_ZONES
+
+void minutesToTimeStr(int16_t minutes, char *str, size_t size) // Helper function to format minutes after midnight as "HH:MM"
+{
+  if (minutes < 0)
+  {
+    snprintf(str, size, "--:--");
+  }
+  else
+  {
+    snprintf(str, size, "%02d:%02d", minutes / 60, minutes % 60);
+  }
+}
+
 bool endsWith(const char *str, const char *suffix) // Helper function to check if 'str' ends with 'suffix'
 {
   if (!str || !suffix)
@@ -14,6 +14,13 @@
 
 #define MQTT_RETAIN_ALIVE_MESSAGES true
 #define MQTT_RETAIN_STATE_MESSAGES false
+
+#define MQTT_BACKLIGHT_PROGRAM_TOPIC "/directive/backlightProgram"
+#define MQTT_TIMER_TOPIC "/directive/timer"
+#define MQTT_WORLD_CLOCK_TOPIC "/directive/worldClock"
+#define MQTT_BATCH_TOPIC "/directive/batch" // {"powerState": "ON", "setpoint": 20, ...}
+#define MQTT_BATCH_KEY_PREFIX "directive/"  // batch key -> topic of the single command
+#define MQTT_BATCH_KEY_SUFFIX ""
 #endif // MQTT_PLAIN_ENABLED
 
 #ifdef MQTT_HOME_ASSISTANT
@@ -35,11 +42,27 @@
 
 #define MQTT_BRIGHTNESS_MAIN_MAX 255
 #define MQTT_BRIGHTNESS_BACK_MAX 7
+
+#define MQTT_BACKLIGHT_PROGRAM_TOPIC "/back/program/set"
+#define MQTT_TIMER_TOPIC "/timer/set"
+#define MQTT_WORLD_CLOCK_TOPIC "/world_clock/set"
+#define MQTT_BATCH_TOPIC "/batch/set" // {"main": {"state": "ON", "brightness": 200}, "timer": "start", ...}
+#define MQTT_BATCH_KEY_PREFIX ""      // batch key -> topic of the single command
+#define MQTT_BATCH_KEY_SUFFIX "/set"
+
+// Every backlight zone besides zone 0 ("Back") is an own light in Home Assistant.
+#if NUM_BACKLIGHT_ZONES > 1
+#define MQTT_BACKLIGHT_ZONES
+#endif
 #endif // NOT MQTT_HOME_ASSISTANT
 
 #define MQTT_STATE_ON "ON"
 #define MQTT_STATE_OFF "OFF"
 
+#ifdef MQTT_MSGPACK
+#define MQTT_MSGPACK_TOPIC "/msgpack" // "<MQTT_CLIENT>/msgpack/<topic>": the JSON topics with MessagePack payloads
+#endif
+
 extern bool MQTTConnected;
 
 // commands from server
@@ -75,6 +98,24 @@ extern uint8_t MQTTCommandBreathBpm;
 extern bool MQTTCommandBreathBpmReceived;
 extern float MQTTCommandRainbowSec;
 extern bool MQTTCommandRainbowSecReceived;
+extern uint8_t MQTTCommandBackProgram[]; // backlight program, binary or hex encoded on the wire
+extern size_t MQTTCommandBackProgramLength;
+extern bool MQTTCommandBackProgramReceived;
+extern char MQTTCommandTimer[]; // timer mode command, see Stopwatch::command()
+extern bool MQTTCommandTimerReceived;
+extern char MQTTCommandWorldClock[]; // zone list as JSON or "next"/"home", see WorldClock::command()
+extern bool MQTTCommandWorldClockReceived;
+#ifdef MQTT_BACKLIGHT_ZONES
+// per backlight zone, index 0 is not used (see MQTTCommandBack...)
+extern bool MQTTCommandZonePower[];
+extern bool MQTTCommandZonePowerReceived[];
+extern uint8_t MQTTCommandZoneBrightness[];
+extern bool MQTTCommandZoneBrightnessReceived[];
+extern char MQTTCommandZonePattern[][24];
+extern bool MQTTCommandZonePatternReceived[];
+extern uint16_t MQTTCommandZoneColorPhase[];
+extern bool MQTTCommandZoneColorPhaseReceived[];
+#endif
 
 // status to server
 extern bool MQTTStatusMainPower;
@@ -93,12 +134,81 @@ extern bool MQTTStatusBlankZeroHours;
 extern uint8_t MQTTStatusPulseBpm;
 extern uint8_t MQTTStatusBreathBpm;
 extern float MQTTStatusRainbowSec;
+#ifdef MQTT_BACKLIGHT_ZONES
+extern bool MQTTStatusZonePower[];
+extern uint8_t MQTTStatusZoneBrightness[];
+extern char MQTTStatusZonePattern[][24];
+extern uint16_t MQTTStatusZoneColorPhase[];
+#endif
+#ifdef DIMMING_SUNRISE_SUNSET
+extern int16_t MQTTStatusSunrise; // minutes after local midnight, -1 = none/unknown
+extern int16_t MQTTStatusSunset;
+extern bool MQTTStatusNightTime;
+#endif
+
+// JSON messages sent, for diagnostics
+struct MQTTPublishStats
+{
+  uint32_t messages;
+  uint32_t bytes;
+  uint32_t failed;
+  uint32_t heap_allocs;    // JSON document allocations that did not fit into MQTT_JSON_ARENA_SIZE
+  uint32_t arena_peak;     // bytes of MQTT_JSON_ARENA_SIZE used at most
+  uint32_t msgpack_bytes;      // MQTT_MSGPACK: the copies sent as MessagePack...
+  uint32_t msgpack_json_bytes; // ...and their size as JSON
+};
+extern MQTTPublishStats MQTTStats;
+
+// Messages received, for diagnostics
+struct MQTTReceiveStats
+{
+  uint32_t messages;
+  uint32_t unhandled;       // no handler for the topic
+  uint64_t callback_us_sum; // time spent in the callback for handled messages
+  uint32_t max_callback_us;
+};
+extern MQTTReceiveStats MQTTRxStats;
+
+// Connections to the broker, for diagnostics
+#define MQTT_CONNECT_NO_CERTIFICATE -5 // MQTT_USE_TLS: CA certificate not loaded, besides the PubSubClient state() codes
+struct MQTTConnectionStats
+{
+  uint32_t attempts;
+  uint32_t connects;
+  uint32_t disconnects;      // connection lost after it was made
+  uint32_t failures[11];     // failed attempts by reason, index state() - MQTT_CONNECT_NO_CERTIFICATE
+  uint32_t last_connect_ms;  // time to connect incl. TLS handshake, last successful attempt
+  uint32_t max_connect_ms;
+};
+extern MQTTConnectionStats MQTTConnStats;
+
+// Outbound events, for diagnostics
+struct MQTTEventQueueStats
+{
+  uint32_t queued;
+  uint32_t sent;
+  uint32_t spilled; // written to the spill file because the RAM queue was full
+  uint32_t dropped; // spill file full or not readable
+};
+extern MQTTEventQueueStats MQTTEventStats;
+
+// Received commands applied together, for diagnostics
+struct MQTTCommandBatchStats
+{
+  uint32_t commands;        // messages and batch entries with a handler
+  uint32_t batches;         // times the collected commands were applied, see MQTTCommandsDue()
+  uint32_t redraws_avoided; // display redraws saved by redrawing once per batch
+  uint32_t answered;        // commands answered with a state report...
+  uint32_t latency_ms_sum;  // ...and the time from receiving the command until the report was sent
+  uint32_t max_latency_ms;
+};
+extern MQTTCommandBatchStats MQTTCmdStats;
 
 // functions
-bool MQTTStart(bool restart);
+void MQTTStart();
 void MQTTLoopFrequently();
 void MQTTLoopInFreeTime();
-void MQTTReportBackEverything(bool force);
+bool MQTTCommandsDue();
 
 // unused functions
 // void MQTTStop();
@@ -164,7 +164,9 @@ const String Menu::state_str[Menu::num_states] = {
     "blank_hours_zero",
     "utc_offset_hour",
     "utc_offset_15m",
-    "selected_graphic"};
+    "selected_graphic",
+    "timer_mode",
+    "world_zone"};
 #else
 const String Menu::state_str[Menu::num_states] = {
     "idle",
@@ -176,5 +178,7 @@ const String Menu::state_str[Menu::num_states] = {
     "utc_offset_hour",
     "utc_offset_15m",
     "selected_graphic",
+    "timer_mode",
+    "world_zone",
     "start_wps"};
 #endif
@@ -28,6 +28,8 @@ public:
     utc_offset_hour,     // Change the UTC offset by an hour.
     utc_offset_15m,      // Change the UTC offset by 15 minutes.
     selected_graphic,    // Select clock "font" 0...9 -> first char in file name "00.bmp to 90.bmp".
+    timer_mode,          // Switch between clock, stopwatch and countdown.
+    world_zone,          // Select the shown time zone of the world clock.
     // When there's more things to change in the menu, add them here.
     num_states
   };
@@ -43,6 +45,8 @@ public:
     utc_offset_hour,     // Change the UTC offset by an hour.
     utc_offset_15m,      // Change the UTC offset by 15 minutes.
     selected_graphic,    // Select clock "font" 0...9 -> first char in file name "00.bmp to 90.bmp".
+    timer_mode,          // Switch between clock, stopwatch and countdown.
+    world_zone,          // Select the shown time zone of the world clock.
     start_wps,           // connect to WiFi using wps pushbutton mode
     // When there's more things to change in the menu, add them here.
     num_states
@@ -67,32 +67,74 @@ bool NTPClient::forceUpdate()
 {
   DBG("Update from NTP Server...");
 
+  if (!this->startRequest())
+  {
+    return false;
+  }
+
+  // Wait till data is there or timeout...
+  while (this->poll() == REQUEST_WAITING)
+  {
+    delay(10);
+  }
+  return this->_requestState == REQUEST_COMPLETED;
+}
+
+bool NTPClient::startRequest()
+{
+  if (!this->_udpSetup)
+    this->begin(); // setup the UDP client if needed
+
   // flush any existing packets
   while (this->_udp->parsePacket() != 0)
     this->_udp->flush();
 
+  this->_requestStart = millis(); // T1, also sent as transmit timestamp and checked in the answer
   if (!this->sendNTPPacket())
   {
     DBG("NTP err: Could not send packet");
+    this->_requestState = REQUEST_FAILED;
     return false;
   }
 
-  // Wait till data is there or timeout...
-  byte timeout = 0;
-  int cb = 0;
-  do
+  this->_requestState = REQUEST_WAITING;
+  return true;
+}
+
+NTPClient::RequestState NTPClient::poll()
+{
+  if (this->_requestState != REQUEST_WAITING)
   {
-    delay(10);
-    cb = this->_udp->parsePacket();
-    if (timeout > 100)
+    return this->_requestState;
+  }
+
+  if (this->_udp->parsePacket() == 0)
+  {
+    if (millis() - this->_requestStart > this->_requestTimeout)
     {
       DBG("NTP Timeout!");
-      return false; // timeout after 1000 ms
+      this->_requestState = REQUEST_FAILED;
     }
-    timeout++;
-  } while (cb == 0);
+    return this->_requestState;
+  }
+
+  this->_requestState = this->readNTPPacket() ? REQUEST_COMPLETED : REQUEST_FAILED;
+  return this->_requestState;
+}
+
+bool NTPClient::consumeResult()
+{
+  if (this->_requestState != REQUEST_COMPLETED)
+  {
+    return false;
+  }
+  this->_requestState = REQUEST_IDLE;
+  return true;
+}
 
-  this->_lastUpdate = millis() - (10 * (timeout + 1)); // Account for delay in reading the time
+bool NTPClient::readNTPPacket()
+{
+  unsigned long receivedAt = millis(); // T4
 
   byte _packetBuffer[NTP_PACKET_SIZE];
   // clear  buffer before receiving data from server
@@ -171,13 +213,35 @@ bool NTPClient::forceUpdate()
     return false;
   }
 
-  unsigned long highWord = word(_packetBuffer[40], _packetBuffer[41]);
-  unsigned long lowWord = word(_packetBuffer[42], _packetBuffer[43]);
-  // combine the four bytes (two words) into a long integer
-  // this is NTP time (seconds since Jan 1 1900):
-  unsigned long secsSince1900 = highWord << 16 | lowWord;
+  // The server copies our transmit timestamp into the origin timestamp, anything else is an old or foreign answer.
+  if (_packetBuffer[24] != 0 || _packetBuffer[25] != 0 || _packetBuffer[26] != 0 || _packetBuffer[27] != 0 ||
+      _packetBuffer[28] != byte(this->_requestStart >> 24) || _packetBuffer[29] != byte(this->_requestStart >> 16) ||
+      _packetBuffer[30] != byte(this->_requestStart >> 8) || _packetBuffer[31] != byte(this->_requestStart))
+  {
+#ifdef DEBUG_NTPClient
+    Serial.println("err: NTP origin timestamp does not match the request");
+#endif
+    return false;
+  }
 
-  this->_currentEpoc = secsSince1900 - SEVENZYYEARS;
+  // Receive (T2) and transmit (T3) timestamps of the server, with the fraction of the second.
+  uint64_t serverReceived = ntpToEpochMs(_packetBuffer + 32);
+  uint64_t serverTransmitted = ntpToEpochMs(_packetBuffer + 40);
+  if (serverTransmitted < serverReceived)
+  {
+#ifdef DEBUG_NTPClient
+    Serial.println("err: NTP transmit timestamp before receive timestamp");
+#endif
+    return false;
+  }
+
+  // Round trip delay = (T4 - T1) - (T3 - T2). The answer travelled about half of it, so the time at T4 is T3 + delay / 2.
+  unsigned long roundTrip = receivedAt - this->_requestStart;
+  unsigned long serverTime = (unsigned long)(serverTransmitted - serverReceived);
+  this->_roundTripDelay = roundTrip > serverTime ? roundTrip - serverTime : 0;
+
+  this->_currentEpochMs = serverTransmitted + this->_roundTripDelay / 2;
+  this->_lastUpdate = receivedAt;
 
   return true;
 }
@@ -196,9 +260,21 @@ bool NTPClient::update()
 
 unsigned long NTPClient::getEpochTime() const
 {
-  return this->_timeOffset +                      // User offset
-         this->_currentEpoc +                     // Epoc returned by the NTP server
-         ((millis() - this->_lastUpdate) / 1000); // Time since last update
+  return this->_timeOffset +            // User offset
+         this->getEpochMillis() / 1000; // Epoc returned by the NTP server plus the time since last update
+}
+
+uint64_t NTPClient::getEpochMillis() const
+{
+  return this->_currentEpochMs + (unsigned long)(millis() - this->_lastUpdate);
+}
+
+uint64_t NTPClient::ntpToEpochMs(const byte *timestamp)
+{
+  // 32 bit seconds since Jan 1 1900 and 32 bit fraction of a second, big endian
+  uint32_t secsSince1900 = uint32_t(timestamp[0]) << 24 | uint32_t(timestamp[1]) << 16 | uint32_t(timestamp[2]) << 8 | timestamp[3];
+  uint32_t fraction = uint32_t(timestamp[4]) << 24 | uint32_t(timestamp[5]) << 16 | uint32_t(timestamp[6]) << 8 | timestamp[7];
+  return uint64_t(secsSince1900 - SEVENZYYEARS) * 1000 + ((uint64_t(fraction) * 1000) >> 32);
 }
 
 int NTPClient::getDay() const
@@ -250,9 +326,21 @@ void NTPClient::setUpdateInterval(unsigned long updateInterval)
   this->_updateInterval = updateInterval;
 }
 
+void NTPClient::setRequestTimeout(unsigned long requestTimeout)
+{
+  this->_requestTimeout = requestTimeout;
+}
+
 void NTPClient::setPoolServerName(const char *poolServerName)
 {
   this->_poolServerName = poolServerName;
+  this->_useServerIP = false;
+}
+
+void NTPClient::setPoolServerIP(IPAddress poolServerIP)
+{
+  this->_poolServerIP = poolServerIP;
+  this->_useServerIP = true;
 }
 
 bool NTPClient::sendNTPPacket()
@@ -271,12 +359,26 @@ bool NTPClient::sendNTPPacket()
   _packetBuffer[13] = 0x4E;
   _packetBuffer[14] = 49;
   _packetBuffer[15] = 52;
+  // Transmit timestamp: the local send time in millis(), the server returns it as origin timestamp.
+  _packetBuffer[44] = byte(this->_requestStart >> 24);
+  _packetBuffer[45] = byte(this->_requestStart >> 16);
+  _packetBuffer[46] = byte(this->_requestStart >> 8);
+  _packetBuffer[47] = byte(this->_requestStart);
 
   // all NTP fields have been given values, now
   // you can send a packet requesting a timestamp:
   bool returnValue;
 
-  returnValue = this->_udp->beginPacket(this->_poolServerName, 123); // NTP requests are to port 123
+  if (this->_useServerIP)
+  {
+    if (this->_poolServerIP == IPAddress(0, 0, 0, 0))
+      return false; // not resolved
+    returnValue = this->_udp->beginPacket(this->_poolServerIP, 123); // NTP requests are to port 123
+  }
+  else
+  {
+    returnValue = this->_udp->beginPacket(this->_poolServerName, 123); // resolves the name, blocks
+  }
 
   if (returnValue)
   {
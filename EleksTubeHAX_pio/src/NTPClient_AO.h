@@ -11,25 +11,44 @@
 #define SEVENZYYEARS 2208988800UL
 #define NTP_PACKET_SIZE 48
 #define NTP_DEFAULT_LOCAL_PORT 1337
+#define NTP_DEFAULT_REQUEST_TIMEOUT 1000 // In ms
 
 //#define DEBUG_NTPClient
 
 class NTPClient
 {
+public:
+  enum RequestState
+  {
+    REQUEST_IDLE,      // no request running, no unused result
+    REQUEST_WAITING,   // request sent, waiting for the answer
+    REQUEST_COMPLETED, // valid answer received, not yet consumed
+    REQUEST_FAILED     // send error, timeout or invalid answer
+  };
+
 private:
   UDP *_udp;
   bool _udpSetup = false;
 
   const char *_poolServerName = "pool.ntp.org"; // Default time server
+  IPAddress _poolServerIP;                      // Used instead of the name when _useServerIP is set
+  bool _useServerIP = false;
   int _port = NTP_DEFAULT_LOCAL_PORT;
   long _timeOffset = 0;
 
   unsigned long _updateInterval = 60000; // In ms
 
-  unsigned long _currentEpoc = 0; // In s
-  unsigned long _lastUpdate = 0;  // In ms
+  uint64_t _currentEpochMs = 0;      // In ms, server time at _lastUpdate, corrected by half the round trip
+  unsigned long _lastUpdate = 0;     // In ms
+  unsigned long _roundTripDelay = 0; // In ms, without the processing time on the server
+
+  RequestState _requestState = REQUEST_IDLE;
+  unsigned long _requestStart = 0;                             // In ms
+  unsigned long _requestTimeout = NTP_DEFAULT_REQUEST_TIMEOUT; // In ms
 
   bool sendNTPPacket();
+  bool readNTPPacket();
+  static uint64_t ntpToEpochMs(const byte *timestamp);
 
 public:
   explicit NTPClient(UDP &udp);
@@ -45,6 +64,14 @@ public:
    */
   void setPoolServerName(const char *poolServerName);
 
+  /**
+   * Set an already resolved time server address. Avoids the blocking DNS lookup
+   * in every request, an unresolved address (0.0.0.0) makes the request fail.
+   *
+   * @param poolServerIP
+   */
+  void setPoolServerIP(IPAddress poolServerIP);
+
   /**
    * Starts the underlying UDP client with the default local port
    */
@@ -64,12 +91,41 @@ public:
   bool update();
 
   /**
-   * This will force the update from the NTP Server.
+   * This will force the update from the NTP Server. Blocks until the answer is received or the request timed out.
    *
    * @return true on success, false on failure
    */
   bool forceUpdate();
 
+  /**
+   * Sends a request to the NTP Server and returns immediately. A running request is dropped.
+   *
+   * @return true if the request was sent, false on failure
+   */
+  bool startRequest();
+
+  /**
+   * Advances a running request: checks for the answer, validates it and handles the timeout.
+   * Never blocks, call it regularly from the main loop.
+   *
+   * @return the state of the request
+   */
+  RequestState poll();
+
+  RequestState getRequestState() const { return _requestState; }
+
+  /**
+   * Marks the result of a completed request as used, getEpochTime() keeps returning the time of it.
+   *
+   * @return true if there was a new result, false otherwise
+   */
+  bool consumeResult();
+
+  /**
+   * Set how long to wait for the answer of the NTP Server
+   */
+  void setRequestTimeout(unsigned long requestTimeout);
+
   int getDay() const;
   int getHours() const;
   int getMinutes() const;
@@ -96,6 +152,21 @@ public:
    */
   unsigned long getEpochTime() const;
 
+  /**
+   * @return time in milliseconds since Jan. 1, 1970, without the time offset
+   */
+  uint64_t getEpochMillis() const;
+
+  /**
+   * @return the local millis() value the last valid answer was received at
+   */
+  unsigned long getLastUpdate() const { return _lastUpdate; }
+
+  /**
+   * @return round trip delay of the last valid request in ms, network only
+   */
+  unsigned long getRoundTripDelay() const { return _roundTripDelay; }
+
   /**
    * Stops the underlying UDP client
    */
@@ -0,0 +1,131 @@
+#include "NtpFilter.h"
+#include <math.h>
+
+void NtpFilter::reset()
+{
+  num_samples = 0;
+  offset = 0;
+  delay = 0;
+  jitter = 0;
+  num_truechimers = 0;
+  num_falsetickers = 0;
+}
+
+void NtpFilter::addSample(uint8_t server, int64_t offset_ms, uint32_t delay_ms)
+{
+  if (num_samples >= NTP_BURST_SAMPLES || server >= max_servers)
+  {
+    return;
+  }
+  samples[num_samples].server = server;
+  samples[num_samples].offset = offset_ms;
+  samples[num_samples].delay = delay_ms;
+  num_samples++;
+}
+
+bool NtpFilter::compute()
+{
+  // Clock filter: the sample with the lowest delay of every server.
+  const Sample *best[max_servers] = {};
+  for (uint8_t i = 0; i < num_samples; i++)
+  {
+    const Sample &s = samples[i];
+    if (best[s.server] == NULL || s.delay < best[s.server]->delay)
+    {
+      best[s.server] = &s;
+    }
+  }
+  const Sample *candidates[max_servers];
+  uint8_t num_candidates = 0;
+  for (uint8_t server = 0; server < max_servers; server++)
+  {
+    if (best[server] != NULL)
+    {
+      candidates[num_candidates++] = best[server];
+    }
+  }
+  if (num_candidates == 0)
+  {
+    num_truechimers = 0;
+    num_falsetickers = 0;
+    return false;
+  }
+
+  // Selection: the point covered by the most correctness intervals. It is always one of the interval ends.
+  int64_t low[max_servers], high[max_servers];
+  for (uint8_t i = 0; i < num_candidates; i++)
+  {
+    int64_t error = candidates[i]->delay / 2 + min_error_ms;
+    low[i] = candidates[i]->offset - error;
+    high[i] = candidates[i]->offset + error;
+  }
+  uint8_t best_count = 0;
+  int64_t best_point = 0;
+  for (uint8_t p = 0; p < 2 * num_candidates; p++)
+  {
+    int64_t point = p < num_candidates ? low[p] : high[p - num_candidates];
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < num_candidates; i++)
+    {
+      if (low[i] <= point && point <= high[i])
+      {
+        count++;
+      }
+    }
+    if (count > best_count)
+    {
+      best_count = count;
+      best_point = point;
+    }
+  }
+  num_truechimers = best_count;
+  num_falsetickers = num_candidates - best_count;
+  if (2 * best_count <= num_candidates && num_candidates > 1)
+  { // no majority, don't trust any of them
+    return false;
+  }
+
+  // Combine the truechimers: median offset, lowest delay.
+  int64_t offsets[max_servers];
+  bool truechimer[max_servers] = {};
+  uint8_t n = 0;
+  delay = UINT32_MAX;
+  for (uint8_t i = 0; i < num_candidates; i++)
+  {
+    if (low[i] <= best_point && best_point <= high[i])
+    {
+      truechimer[candidates[i]->server] = true;
+      offsets[n++] = candidates[i]->offset;
+      if (candidates[i]->delay < delay)
+      {
+        delay = candidates[i]->delay;
+      }
+    }
+  }
+  for (uint8_t i = 1; i < n; i++)
+  { // insertion sort, n is tiny
+    int64_t value = offsets[i];
+    int8_t j = i - 1;
+    for (; j >= 0 && offsets[j] > value; j--)
+    {
+      offsets[j + 1] = offsets[j];
+    }
+    offsets[j + 1] = value;
+  }
+  offset = (n % 2 == 1) ? offsets[n / 2] : (offsets[n / 2 - 1] + offsets[n / 2]) / 2;
+
+  // Jitter: RMS difference of all samples of the truechimers to the result.
+  double sum = 0;
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < num_samples; i++)
+  {
+    if (truechimer[samples[i].server])
+    {
+      double diff = double(samples[i].offset - offset);
+      sum += diff * diff;
+      count++;
+    }
+  }
+  jitter = uint32_t(sqrt(sum / count) + 0.5);
+  return true;
+}
@@ -0,0 +1,59 @@
+#ifndef NTP_FILTER_H
+#define NTP_FILTER_H
+
+#include <stdint.h>
+#include "GLOBAL_DEFINES.h"
+
+/*
+ * Combines the samples of one NTP burst into a single offset, similar to the clock filter and
+ * selection of a full NTP daemon, scaled down for a handful of samples:
+ *  - Clock filter: of every server only the sample with the lowest round trip delay is used,
+ *    because a short round trip leaves the smallest room for asymmetric network delays.
+ *  - Selection (Marzullo's algorithm): every server says the true offset is within offset +- delay/2.
+ *    The offset range most of the servers agree on is found, servers outside of it are falsetickers.
+ *    If no majority agrees, the burst has no result.
+ *  - The result is the median offset of the remaining servers (truechimers), the jitter is the RMS
+ *    difference of all their samples to it.
+ *
+ * Offsets are "NTP time - local time" in ms.
+ */
+
+class NtpFilter
+{
+public:
+  NtpFilter() { reset(); }
+
+  void reset();
+  void addSample(uint8_t server, int64_t offset_ms, uint32_t delay_ms);
+  uint8_t getNumSamples() { return num_samples; }
+
+  // Runs the filter, returns false if there is no trustworthy result.
+  bool compute();
+
+  int64_t getOffset() { return offset; }
+  uint32_t getDelay() { return delay; }   // lowest round trip delay of the truechimers
+  uint32_t getJitter() { return jitter; }
+  uint8_t getNumTruechimers() { return num_truechimers; }
+  uint8_t getNumFalsetickers() { return num_falsetickers; }
+
+  const static uint8_t max_servers = 8;
+  const static uint32_t min_error_ms = 2; // precision of a sample: the ms resolution of both clocks
+
+private:
+  struct Sample
+  {
+    uint8_t server;
+    int64_t offset;
+    uint32_t delay;
+  };
+  Sample samples[NTP_BURST_SAMPLES];
+  uint8_t num_samples;
+
+  int64_t offset;
+  uint32_t delay;
+  uint32_t jitter;
+  uint8_t num_truechimers;
+  uint8_t num_falsetickers;
+};
+
+#endif // NTP_FILTER_H
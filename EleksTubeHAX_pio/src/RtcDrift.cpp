@@ -0,0 +1,81 @@
+#include "RtcDrift.h"
+#include <Arduino.h>
+
+void RtcDrift::begin(StoredConfig::Config::RtcDrift *config_)
+{
+  config = config_;
+
+  if (config->is_valid != StoredConfig::valid)
+  {
+    Serial.println("Loaded RTC drift config is invalid, RTC is not calibrated yet.");
+    config->ppm = 0;
+    config->aging = 0;
+    config->segment_start = 0;
+    config->segment_error_ms = 0;
+    config->corrections_ms = 0;
+    config->calibrated = 0;
+    config->is_valid = StoredConfig::valid;
+  }
+  else if (hasSegment())
+  { // continue the fit with the start of the segment, the points measured before the restart are lost
+    addPoint(0, config->segment_error_ms);
+  }
+}
+
+void RtcDrift::startSegment(uint32_t epoch, float error_ms)
+{
+  config->segment_start = epoch;
+  config->segment_error_ms = error_ms;
+  config->corrections_ms = 0;
+  n = 0;
+  sum_t = sum_u = sum_tt = sum_tu = 0;
+  addPoint(0, error_ms);
+}
+
+void RtcDrift::addPoint(double t, double u)
+{
+  n++;
+  sum_t += t;
+  sum_u += u;
+  sum_tt += t * t;
+  sum_tu += t * u;
+}
+
+bool RtcDrift::addMeasurement(uint32_t epoch, float error_ms)
+{
+  if (!hasSegment() || epoch < config->segment_start)
+  {
+    startSegment(epoch, error_ms);
+    return false;
+  }
+  double t = (epoch - config->segment_start) / 3600.0;
+  addPoint(t, error_ms + config->corrections_ms);
+
+  // Needs enough time for the drift to be clearly above the measurement error.
+  double denominator = n * sum_tt - sum_t * sum_t;
+  if (n < 2 || t < RTC_DRIFT_MIN_HOURS || denominator <= 0)
+  {
+    return false;
+  }
+  double slope = (n * sum_tu - sum_t * sum_u) / denominator; // ms per hour
+  config->ppm = slope / 3.6;
+  config->calibrated = StoredConfig::valid;
+  return true;
+}
+
+float RtcDrift::predictError(uint32_t epoch)
+{
+  if (!hasSegment() || !isCalibrated() || epoch < config->segment_start)
+  {
+    return 0;
+  }
+  float hours = (epoch - config->segment_start) / 3600.0f;
+  return config->segment_error_ms + config->ppm * 3.6f * hours - config->corrections_ms;
+}
+
+void RtcDrift::applyAging(int8_t steps, uint32_t epoch, float error_ms)
+{
+  config->aging += steps;
+  config->ppm -= steps * 0.1f; // expected remaining drift, measured again in the new segment
+  startSegment(epoch, error_ms);
+}
@@ -0,0 +1,57 @@
+#ifndef RTC_DRIFT_H
+#define RTC_DRIFT_H
+
+#include <stdint.h>
+#include "GLOBAL_DEFINES.h"
+#include "StoredConfig.h"
+
+/*
+ * Tracks the drift of the RTC against NTP.
+ *
+ * After every NTP sync the error of the RTC (RTC time - NTP time, in ms) is measured. Writing the RTC
+ * changes the error, but not the drift, so all corrections are added up and the fit runs on the
+ * "unwrapped" error: measured error + sum of all corrections. A least squares line through these points
+ * gives the drift in ppm (1 ppm = 3.6 ms per hour, positive = RTC runs fast).
+ *
+ * A segment is the time the RTC oscillator is unchanged. Changing the DS3231 aging register starts a new one.
+ * The model (drift and the start of the segment) is kept in the stored config, so it survives restarts
+ * and can predict the RTC error while there is no network.
+ */
+
+class RtcDrift
+{
+public:
+  RtcDrift() : config(NULL), n(0), sum_t(0), sum_u(0), sum_tt(0), sum_tu(0) {}
+
+  void begin(StoredConfig::Config::RtcDrift *config_);
+
+  // Starts a new segment, the RTC has now the given error.
+  void startSegment(uint32_t epoch, float error_ms);
+  bool hasSegment() { return config->segment_start != 0; }
+
+  // The RTC was written, its error changed from error_before_ms to error_after_ms.
+  void addCorrection(float error_before_ms, float error_after_ms) { config->corrections_ms += error_before_ms - error_after_ms; }
+
+  // Adds a measured RTC error. Returns true, if the drift was (re)calculated.
+  bool addMeasurement(uint32_t epoch, float error_ms);
+
+  // Expected RTC error at this time, from the start of the segment and the drift. 0 if not calibrated yet.
+  float predictError(uint32_t epoch);
+
+  bool isCalibrated() { return config->calibrated == StoredConfig::valid; }
+  float getPpm() { return config->ppm; }
+  int8_t getAging() { return config->aging; }
+
+  // The DS3231 aging register was changed by steps (0.1 ppm each, positive = slower), the drift changes accordingly.
+  void applyAging(int8_t steps, uint32_t epoch, float error_ms);
+
+private:
+  StoredConfig::Config::RtcDrift *config;
+
+  // Least squares sums, t in hours since the segment start, u unwrapped error in ms
+  uint16_t n;
+  double sum_t, sum_u, sum_tt, sum_tu;
+  void addPoint(double t, double u);
+};
+
+#endif // RTC_DRIFT_H
@@ -0,0 +1,120 @@
+#include "SolarTime.h"
+#include <math.h>
+
+void SolarTime::setLocation(double lat, double lon)
+{
+  if (lat < -90 || lat > 90 || lon < -180 || lon > 180)
+  {
+    Serial.println("ERROR: Invalid location for sunrise/sunset calculation!");
+    return;
+  }
+  if (location_valid && lat == latitude && lon == longitude)
+  {
+    return;
+  }
+  latitude = lat;
+  longitude = lon;
+  location_valid = true;
+  year = 0; // force recalculation
+}
+
+bool SolarTime::update(uint16_t local_year, uint8_t local_month, uint8_t local_day, int32_t tz_offset_sec)
+{
+  if (!location_valid)
+  {
+    return false;
+  }
+  if (local_year == year && local_month == month && local_day == day && tz_offset_sec == tz_offset)
+  {
+    return false; // cached result is still valid
+  }
+  year = local_year;
+  month = local_month;
+  day = local_day;
+  tz_offset = tz_offset_sec;
+
+  double rise_utc, set_utc;
+  if (calculate(latitude, longitude, year, month, day, rise_utc, set_utc, polar_day))
+  {
+    sunrise = toLocalMinutes(rise_utc, tz_offset);
+    sunset = toLocalMinutes(set_utc, tz_offset);
+  }
+  else
+  {
+    sunrise = -1;
+    sunset = -1;
+  }
+
+  if (sunrise >= 0)
+  {
+    Serial.printf("Sunrise %02d:%02d, sunset %02d:%02d (%04d-%02d-%02d)\n", sunrise / 60, sunrise % 60, sunset / 60, sunset % 60, year, month, day);
+  }
+  else
+  {
+    Serial.println(polar_day ? "No sunset today (polar day)." : "No sunrise today (polar night).");
+  }
+  return true;
+}
+
+bool SolarTime::isNight(uint16_t minute_of_day)
+{
+  if (sunrise < 0 || sunset < 0)
+  {
+    return !polar_day;
+  }
+  int16_t day_start = (sunrise + SOLAR_BRIGHT_AFTER_SUNRISE_MIN + 1440) % 1440;
+  int16_t day_end = (sunset + SOLAR_DIM_AFTER_SUNSET_MIN + 1440) % 1440;
+  if (day_start < day_end)
+  {
+    return (minute_of_day < day_start) || (minute_of_day >= day_end);
+  }
+  else
+  { // day time wraps around local midnight, possible with an unusual time zone for the location
+    return (minute_of_day >= day_end) && (minute_of_day < day_start);
+  }
+}
+
+bool SolarTime::calculate(double lat, double lon, uint16_t y, uint8_t m, uint8_t d, double &sunrise_utc, double &sunset_utc, bool &polar_day)
+{
+  // day of the year
+  static const uint16_t days_before_month[12] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+  bool leap = ((y % 4 == 0) && (y % 100 != 0)) || (y % 400 == 0);
+  uint16_t doy = days_before_month[(m - 1) % 12] + d;
+  if (leap && m > 2)
+  {
+    doy++;
+  }
+
+  // fractional year in radians, at noon
+  double gamma = 2.0 * M_PI / (leap ? 366 : 365) * (doy - 1);
+
+  // equation of time in minutes and solar declination in radians
+  double eqtime = 229.18 * (0.000075 + 0.001868 * cos(gamma) - 0.032077 * sin(gamma) - 0.014615 * cos(2 * gamma) - 0.040849 * sin(2 * gamma));
+  double decl = 0.006918 - 0.399912 * cos(gamma) + 0.070257 * sin(gamma) - 0.006758 * cos(2 * gamma) + 0.000907 * sin(2 * gamma) - 0.002697 * cos(3 * gamma) + 0.00148 * sin(3 * gamma);
+
+  // hour angle of sunrise, 90.833 deg zenith includes refraction and the size of the sun disc
+  double lat_rad = lat * M_PI / 180.0;
+  double cos_ha = cos(90.833 * M_PI / 180.0) / (cos(lat_rad) * cos(decl)) - tan(lat_rad) * tan(decl);
+  if (cos_ha > 1.0 || cos_ha < -1.0)
+  {
+    polar_day = cos_ha < -1.0;
+    return false;
+  }
+  polar_day = false;
+  double ha_deg = acos(cos_ha) * 180.0 / M_PI;
+
+  sunrise_utc = 720.0 - 4.0 * (lon + ha_deg) - eqtime;
+  sunset_utc = 720.0 - 4.0 * (lon - ha_deg) - eqtime;
+  return true;
+}
+
+int16_t SolarTime::toLocalMinutes(double utc_minutes, int32_t tz_offset_sec)
+{
+  int32_t local = lround(utc_minutes) + tz_offset_sec / 60;
+  local %= 1440;
+  if (local < 0)
+  {
+    local += 1440;
+  }
+  return local;
+}
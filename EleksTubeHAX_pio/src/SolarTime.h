@@ -0,0 +1,59 @@
+#ifndef SOLAR_TIME_H
+#define SOLAR_TIME_H
+
+#include "GLOBAL_DEFINES.h"
+
+#if defined(DIMMING_SUNRISE_SUNSET) && !defined(DIMMING)
+#error "DIMMING_SUNRISE_SUNSET needs DIMMING to be enabled!"
+#endif
+
+/*
+ * Sunrise and sunset for the location of the clock, using the NOAA "General Solar Position" equations.
+ * Accuracy is about one to two minutes, which is good enough to switch the dimming.
+ *
+ * The times are calculated once per day (or when the location or time zone changes) and cached.
+ * All times are in minutes after local midnight.
+ */
+
+class SolarTime
+{
+public:
+  SolarTime() : latitude(0), longitude(0), location_valid(false), year(0), month(0), day(0), tz_offset(0),
+                sunrise(-1), sunset(-1), polar_day(false) {}
+
+  void setLocation(double lat, double lon);
+  bool hasLocation() { return location_valid; }
+
+  // Recalculate sunrise and sunset, if the local date, the time zone or the location has changed.
+  // Returns true, if the times were recalculated.
+  bool update(uint16_t local_year, uint8_t local_month, uint8_t local_day, int32_t tz_offset_sec);
+
+  // -1 if the sun doesn't rise or set on this day (polar night or polar day)
+  int16_t getSunrise() { return sunrise; }
+  int16_t getSunset() { return sunset; }
+  // Night is between sunset + SOLAR_DIM_AFTER_SUNSET_MIN and sunrise + SOLAR_BRIGHT_AFTER_SUNRISE_MIN.
+  bool isNight(uint16_t minute_of_day);
+
+  // NOAA equations, sunrise and sunset in minutes after midnight UTC (may be outside of 0..1439).
+  // Returns false if there is no sunrise/sunset on this day, polar_day is then set if the sun is up all day.
+  static bool calculate(double lat, double lon, uint16_t y, uint8_t m, uint8_t d, double &sunrise_utc, double &sunset_utc, bool &polar_day);
+
+private:
+  double latitude;
+  double longitude;
+  bool location_valid;
+
+  // Inputs of the cached result
+  uint16_t year;
+  uint8_t month;
+  uint8_t day;
+  int32_t tz_offset;
+
+  int16_t sunrise;
+  int16_t sunset;
+  bool polar_day;
+
+  static int16_t toLocalMinutes(double utc_minutes, int32_t tz_offset_sec);
+};
+
+#endif // SOLAR_TIME_H
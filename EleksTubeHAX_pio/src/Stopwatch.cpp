@@ -0,0 +1,217 @@
+#include "Stopwatch.h"
+#include <esp_timer.h>
+
+const char *Stopwatch::mode_str[Stopwatch::num_modes] = {"off", "stopwatch", "countdown"};
+
+void Stopwatch::loop()
+{
+  if (!isActive())
+  {
+    return;
+  }
+
+  int64_t now_us = esp_timer_get_time();
+  if (now_us < next_frame_us)
+  {
+    return;
+  }
+
+  const int64_t frame_us = 1000000 / TIMER_FPS;
+  if (running && next_frame_us != 0)
+  {
+    // keep the frame grid, every frame time we missed completely is a dropped frame
+    int64_t late_frames = (now_us - next_frame_us) / frame_us;
+    dropped_frames += late_frames;
+    next_frame_us += (late_frames + 1) * frame_us;
+  }
+  else
+  {
+    next_frame_us = now_us + frame_us;
+  }
+
+  if (running && mode == countdown && elapsedUs() >= countdown_us)
+  {
+    stop();
+    accumulated_us = countdown_us;
+    Serial.println("Countdown finished.");
+  }
+
+  draw();
+
+  if (running)
+  {
+    int64_t end_us = esp_timer_get_time();
+    if (end_us - now_us > max_frame_us)
+    {
+      max_frame_us = end_us - now_us;
+    }
+    frames++;
+    window_frames++;
+    if (end_us - window_start_us >= 1000000)
+    {
+      fps = window_frames * 1000000.0f / (end_us - window_start_us);
+      window_start_us = end_us;
+      window_frames = 0;
+    }
+  }
+}
+
+void Stopwatch::draw(TFTs::show_t show)
+{
+  uint32_t ms = getShownMs();
+  uint8_t hundredths = (ms / 10) % 100;
+  uint8_t seconds = (ms / 1000) % 60;
+  uint8_t minutes = (ms / 60000) % 100;
+
+  // hundredths first, they change on every frame
+  tfts.setDigit(SECONDS_ONES, hundredths % 10, show);
+  tfts.setDigit(SECONDS_TENS, hundredths / 10, show);
+  tfts.setDigit(MINUTES_ONES, seconds % 10, show);
+  tfts.setDigit(MINUTES_TENS, seconds / 10, show);
+  tfts.setDigit(HOURS_ONES, minutes % 10, show);
+  tfts.setDigit(HOURS_TENS, minutes / 10, show);
+}
+
+void Stopwatch::setMode(mode_t new_mode)
+{
+  if (new_mode >= num_modes)
+  {
+    return;
+  }
+  mode = new_mode;
+  reset();
+  Serial.print("Timer mode: ");
+  Serial.println(mode_str[mode]);
+  if (isActive() && !tfts.cacheClockFace())
+  {
+    Serial.println("No image cache, the timer digits are loaded from the flash and frames will be dropped.");
+  }
+}
+
+void Stopwatch::start()
+{
+  if (!isActive() || running)
+  {
+    return;
+  }
+  if (mode == countdown && accumulated_us >= countdown_us)
+  {
+    reset(); // finished, start again
+  }
+  start_us = esp_timer_get_time();
+  running = true;
+  resetStats();
+}
+
+void Stopwatch::stop()
+{
+  if (!running)
+  {
+    return;
+  }
+  accumulated_us += esp_timer_get_time() - start_us;
+  running = false;
+  printStats();
+}
+
+void Stopwatch::reset()
+{
+  running = false;
+  accumulated_us = 0;
+  next_frame_us = 0;
+}
+
+void Stopwatch::setCountdown(uint32_t seconds)
+{
+  if (seconds == 0 || seconds > 99 * 60 + 59)
+  {
+    seconds = TIMER_COUNTDOWN_DEFAULT_SEC;
+  }
+  countdown_us = uint64_t(seconds) * 1000000;
+  if (mode == countdown && !running)
+  {
+    reset();
+  }
+}
+
+bool Stopwatch::command(const char *cmd)
+{
+  if (strcasecmp(cmd, "stopwatch") == 0)
+  {
+    setMode(stopwatch);
+  }
+  else if (strncasecmp(cmd, "countdown", 9) == 0 && (cmd[9] == '\0' || cmd[9] == ' '))
+  {
+    if (cmd[9] == ' ')
+    {
+      setCountdown(atoi(cmd + 10));
+    }
+    setMode(countdown);
+  }
+  else if (strcasecmp(cmd, "start") == 0)
+  {
+    start();
+  }
+  else if (strcasecmp(cmd, "stop") == 0)
+  {
+    stop();
+  }
+  else if (strcasecmp(cmd, "toggle") == 0)
+  {
+    toggle();
+  }
+  else if (strcasecmp(cmd, "reset") == 0)
+  {
+    reset();
+  }
+  else if (strcasecmp(cmd, "off") == 0)
+  {
+    setMode(off);
+  }
+  else
+  {
+    Serial.print("Unknown timer command: ");
+    Serial.println(cmd);
+    return false;
+  }
+  return true;
+}
+
+uint64_t Stopwatch::elapsedUs()
+{
+  return accumulated_us + (running ? esp_timer_get_time() - start_us : 0);
+}
+
+uint32_t Stopwatch::getShownMs()
+{
+  uint64_t us = elapsedUs();
+  if (mode == countdown)
+  {
+    us = us >= countdown_us ? 0 : countdown_us - us;
+  }
+  return us / 1000;
+}
+
+void Stopwatch::resetStats()
+{
+  frames = 0;
+  dropped_frames = 0;
+  max_frame_us = 0;
+  window_start_us = start_us;
+  window_frames = 0;
+  fps = 0;
+  next_frame_us = 0;
+}
+
+void Stopwatch::printStats()
+{
+  Serial.print("Timer: ");
+  Serial.print(frames);
+  Serial.print(" frames, ");
+  Serial.print(fps, 1);
+  Serial.print(" fps, ");
+  Serial.print(dropped_frames);
+  Serial.print(" dropped, max. frame time ");
+  Serial.print(max_frame_us);
+  Serial.println(" us");
+}
@@ -0,0 +1,76 @@
+#ifndef STOPWATCH_H
+#define STOPWATCH_H
+
+#include "GLOBAL_DEFINES.h"
+#include "TFTs.h"
+
+/*
+ * Timer mode: a stopwatch or countdown shown as MM:SS:hh (minutes on the hours displays, seconds on the minutes
+ * displays, hundredths on the seconds displays) instead of the clock.
+ *
+ * loop() draws a frame every 1/TIMER_FPS s. Only the changed digits are sent, normally just the two right-most
+ * displays. All ten digits of the clock face are loaded into the PSRAM image cache when the mode is entered, so no
+ * frame has to read the flash. Frames which are not drawn in time are counted as dropped.
+ */
+
+class Stopwatch
+{
+public:
+  Stopwatch() : mode(off), running(false), start_us(0), accumulated_us(0), countdown_us(uint64_t(TIMER_COUNTDOWN_DEFAULT_SEC) * 1000000),
+                next_frame_us(0), frames(0), dropped_frames(0), max_frame_us(0), window_start_us(0), window_frames(0), fps(0) {}
+
+  enum mode_t
+  {
+    off,
+    stopwatch,
+    countdown,
+    num_modes
+  };
+  const static char *mode_str[num_modes];
+
+  void loop(); // draws the next frame, if it is due
+  void draw(TFTs::show_t show = TFTs::yes);
+
+  void setMode(mode_t new_mode);
+  void setNextMode(int8_t step) { setMode(mode_t((mode + num_modes + step % num_modes) % num_modes)); }
+  mode_t getMode() { return mode; }
+  const char *getModeStr() { return mode_str[mode]; }
+  bool isActive() { return mode != off; }
+  bool isRunning() { return running; }
+
+  void start();
+  void stop();
+  void toggle() { running ? stop() : start(); }
+  void reset();
+  void setCountdown(uint32_t seconds);
+  // Text command from MQTT: "stopwatch", "countdown [seconds]", "start", "stop", "toggle", "reset" or "off".
+  bool command(const char *cmd);
+
+  uint32_t getShownMs(); // time on the displays
+
+  // Diagnostics
+  float getFps() { return fps; } // frames drawn per second during the last full second
+  uint32_t getFrames() { return frames; }
+  uint32_t getDroppedFrames() { return dropped_frames; }
+  uint32_t getMaxFrameUs() { return max_frame_us; }
+  void printStats();
+
+private:
+  mode_t mode;
+  bool running;
+  int64_t start_us;        // esp_timer at start()
+  uint64_t accumulated_us; // elapsed time before the last start()
+  uint64_t countdown_us;
+  uint64_t elapsedUs();
+
+  int64_t next_frame_us;
+  uint32_t frames, dropped_frames, max_frame_us;
+  int64_t window_start_us;
+  uint16_t window_frames;
+  float fps;
+  void resetStats();
+};
+
+extern Stopwatch stopwatch;
+
+#endif // STOPWATCH_H
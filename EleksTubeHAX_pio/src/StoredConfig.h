@@ -64,6 +64,44 @@ public:
       char password[str_buffer_size];
       uint8_t WPS_connected; // Write StoredConfig::valid here when valid data is loaded.
     } wifi;
+
+    struct RtcDrift
+    {
+      float ppm;              // drift of the RTC, positive = RTC runs fast
+      int8_t aging;           // value programmed into the DS3231 aging register
+      uint32_t segment_start; // UTC time of the first measurement with the current aging value, 0 = none
+      float segment_error_ms; // RTC error at segment_start
+      float corrections_ms;   // sum of all changes of the RTC time since segment_start
+      uint8_t calibrated;     // StoredConfig::valid, when ppm was measured
+      uint8_t is_valid;       // Write StoredConfig::valid here when valid data is loaded.
+    } rtc_drift;
+
+    struct TimeZone
+    {
+      char rule[48];    // POSIX TZ rule, empty = use the fixed uclock.time_zone_offset
+      uint8_t is_valid; // Write StoredConfig::valid here when valid data is loaded.
+    } time_zone;
+
+    struct WorldClock
+    {
+      char label[WORLD_CLOCK_MAX_ZONES][WORLD_CLOCK_LABEL_SIZE];
+      char rule[WORLD_CLOCK_MAX_ZONES][48]; // POSIX TZ rule of each zone
+      uint8_t count;                        // configured zones, without the home time zone
+      uint8_t rotate_sec;                   // show every zone this long, 0 = switch only from the menu or MQTT
+      uint8_t is_valid;                     // Write StoredConfig::valid here when valid data is loaded.
+    } world_clock;
+
+    struct BacklightZones
+    {
+      struct Zone
+      {
+        uint8_t pattern;
+        uint16_t color_phase;
+        uint8_t intensity;
+      } zone[BACKLIGHT_ZONES_MAX]; // zone 0 is not used, it follows the backlights config above
+      uint8_t count;               // NUM_BACKLIGHT_ZONES of the build that saved the zones
+      uint8_t is_valid;            // Write StoredConfig::valid here when valid data is loaded.
+    } backlight_zones;
   } config;
 
   const static uint8_t valid = 0x55; // neither 0x00 nor 0xFF, signaling loaded config isn't just default data.
@@ -1,6 +1,7 @@
 #include "TFTs.h"
 #include "WiFi_WPS.h"
 #include "MQTT_client_ips.h"
+#include "EventBus.h"
 
 void TFTs::begin()
 {
@@ -13,7 +14,9 @@ void TFTs::begin()
   ledcAttachPin(TFT_ENABLE_PIN, TFT_PWM_CHANNEL); // Attach the pin to the PWM channel
 #else
   pinMode(TFT_ENABLE_PIN, OUTPUT); // Set pin for turning display power on and off.
+  buildDimmingLUT(dimming);
 #endif
+  allocateImageCache();
   InvalidateImageInBuffer(); // Signal, that the image in the buffer is invalid and needs to be reloaded and refilled
   init();                    // Initialize the super class.
   fillScreen(TFT_BLACK);     // to avoid/reduce flickering patterns on the screens
@@ -92,6 +95,24 @@ void TFTs::showNoWifiStatus()
   print("NO WIFI !");
 }
 
+void TFTs::setZoneLabel(const char *label)
+{
+  if (strcmp(label, zone_label) != 0)
+  {
+    strncpy(zone_label, label, sizeof(zone_label) - 1);
+    zone_label[sizeof(zone_label) - 1] = '\0';
+    zone_label_changed = true;
+  }
+}
+
+void TFTs::showZoneLabel()
+{
+  setTextColor(TFT_WHITE, TFT_BLACK);
+  fillRect(0, 0, TFT_WIDTH, 27, TFT_BLACK);
+  setCursor(5, 0, 4); // Font 4. 26 pixel high
+  print(zone_label);
+}
+
 void TFTs::showNoMqttStatus()
 {
   chip_select.setSecondsTens();
@@ -104,6 +125,10 @@ void TFTs::showNoMqttStatus()
 void TFTs::enableAllDisplays()
 {
   // Turn "power" on to displays.
+  if (!TFTsEnabled)
+  {
+    events.publish(EventBus::power_changed, 1);
+  }
   TFTsEnabled = true;
 #ifndef DIM_WITH_ENABLE_PIN_PWM
   digitalWrite(TFT_ENABLE_PIN, ACTIVATEDISPLAYS);
@@ -116,6 +141,10 @@ void TFTs::enableAllDisplays()
 void TFTs::disableAllDisplays()
 {
   // Turn "power" off to displays.
+  if (TFTsEnabled)
+  {
+    events.publish(EventBus::power_changed, 0);
+  }
   TFTsEnabled = false;
 #ifndef DIM_WITH_ENABLE_PIN_PWM
   digitalWrite(TFT_ENABLE_PIN, DEACTIVATEDISPLAYS);
@@ -143,9 +172,13 @@ void TFTs::setDigit(uint8_t digit, uint8_t value, show_t show)
   { // only do this, if the displays are enabled
     uint8_t old_value = digits[digit];
     digits[digit] = value;
+    bool new_label = (digit == HOURS_TENS && zone_label_changed); // redraw with the new label, even if the digit did not change
 
-    if (show != no && (old_value != value || show == force))
+    if (show != no && (old_value != value || show == force || new_label))
     {
+      if (digit == HOURS_TENS)
+        zone_label_changed = false;
+
       showDigit(digit);
 
       if (digit == SECONDS_ONES)
@@ -189,6 +222,10 @@ void TFTs::showDigit(uint8_t digit)
         NextNumber = 0; // pre-load only seconds, because they are drawn first
       NextFileRequired = current_graphic * 10 + NextNumber;
     }
+    if (digit == HOURS_TENS && zone_label[0] != '\0')
+    { // world clock zone label
+      showZoneLabel();
+    }
 #ifdef HARDWARE_IPSTUBE_CLOCK
     chip_select.update();
 #endif
@@ -198,6 +235,10 @@ void TFTs::showDigit(uint8_t digit)
 
 void TFTs::LoadNextImage()
 {
+  if (getCachedImage(NextFileRequired) != NULL)
+  {
+    return; // nothing to do, will be drawn from the cache
+  }
   if (NextFileRequired != FileInBuffer)
   {
 #ifdef DEBUG_OUTPUT_IMAGES
@@ -208,12 +249,13 @@ void TFTs::LoadNextImage()
 }
 
 void TFTs::InvalidateImageInBuffer()
-{                     // force reload from Flash with new dimming settings
+{                     // force reload from Flash
   FileInBuffer = 255; // invalid, always load first image
 }
 
 void TFTs::ProcessUpdatedDimming()
 {
+  dimming_fade.jump(dimming);
 #ifdef DIM_WITH_ENABLE_PIN_PWM
   // hardware dimming is done via PWM on the pin defined by TFT_ENABLE_PIN
   // ONLY for IPSTUBE clocks in the moment! Other clocks may be damaged!
@@ -227,12 +269,184 @@ void TFTs::ProcessUpdatedDimming()
     ledcWrite(TFT_PWM_CHANNEL, CALCDIMVALUE(0));
   }
 #else
-  // "software" dimming is done via alpha blending in the image drawing function
-  // signal that the image in the buffer is invalid and needs to be reloaded and refilled
-  InvalidateImageInBuffer();
+  // "software" dimming is done with the lookup tables while sending the image to the display
+  buildDimmingLUT(dimming);
 #endif
 }
 
+void TFTs::fadeTo(uint8_t target)
+{
+  dimming = target;
+#ifndef DIM_WITH_ENABLE_PIN_PWM
+  if (image_cache[0] == NULL)
+  { // without the image cache every step would need six images from the flash, so switch directly
+    ProcessUpdatedDimming();
+    return;
+  }
+#endif
+  dimming_fade.start(target);
+}
+
+void TFTs::loopFade()
+{
+  if (!dimming_fade.update())
+  {
+    return;
+  }
+#ifdef DIM_WITH_ENABLE_PIN_PWM
+  if (TFTsEnabled)
+  {
+    ledcWrite(TFT_PWM_CHANNEL, CALCDIMVALUE(dimming_fade.value()));
+  }
+#else
+  buildDimmingLUT(dimming_fade.value());
+  showAllDigits(); // all images come from the cache, no flash access
+#endif
+}
+
+#ifndef DIM_WITH_ENABLE_PIN_PWM
+void TFTs::buildDimmingLUT(uint8_t level)
+{
+  for (uint8_t i = 0; i < 64; i++)
+  {
+    if (i < 32)
+    {
+      dim_lut_r[i] = (i * level) / 255;
+      dim_lut_b[i] = (i * level) / 255;
+    }
+    dim_lut_g[i] = (i * level) / 255;
+  }
+}
+
+void TFTs::dimImage(const uint16_t *image, uint16_t *dimmed, uint16_t rows)
+{
+  for (uint32_t i = 0; i < (uint32_t)rows * TFT_WIDTH; i++)
+  {
+    // 16 BPP pixel format: R5, G6, B5 ; bin: RRRR RGGG GGGB BBBB
+    uint16_t c = image[i];
+    dimmed[i] = (dim_lut_r[c >> 11] << 11) | (dim_lut_g[(c >> 5) & 0x3F] << 5) | dim_lut_b[c & 0x1F];
+  }
+}
+#endif
+
+void TFTs::allocateImageCache()
+{
+  if (!psramFound())
+  {
+    Serial.println("No PSRAM found, digits are always loaded from the flash.");
+    return;
+  }
+  for (uint8_t i = 0; i < 10; i++)
+  {
+    image_cache[i] = (uint16_t *)ps_malloc(sizeof(UnpackedImageBuffer));
+    image_cache_file[i] = 255; // empty
+    if (image_cache[i] == NULL)
+    {
+      Serial.println("ERROR: Not enough PSRAM for the image cache!");
+      for (uint8_t j = 0; j < i; j++)
+      {
+        free(image_cache[j]);
+        image_cache[j] = NULL;
+      }
+      return;
+    }
+  }
+#ifndef DIM_WITH_ENABLE_PIN_PWM
+  for (uint8_t i = 0; i < 10; i++)
+  {
+    dimmed_cache[i] = (uint16_t *)ps_malloc(sizeof(UnpackedImageBuffer));
+    dimmed_cache_file[i] = 255; // empty
+    if (dimmed_cache[i] == NULL)
+    { // not fatal, the images are dimmed while sending them
+      Serial.println("Not enough PSRAM for the dimmed images.");
+      for (uint8_t j = 0; j < i; j++)
+      {
+        free(dimmed_cache[j]);
+        dimmed_cache[j] = NULL;
+      }
+      return;
+    }
+  }
+#endif
+}
+
+uint16_t *TFTs::getCachedImage(uint8_t file_index)
+{
+  uint8_t slot = file_index % 10;
+  if (image_cache[slot] != NULL && image_cache_file[slot] == file_index)
+  {
+    return image_cache[slot];
+  }
+  return NULL;
+}
+
+void TFTs::storeInCache(uint8_t file_index)
+{
+  uint8_t slot = file_index % 10;
+  if (image_cache[slot] != NULL)
+  {
+    memcpy(image_cache[slot], UnpackedImageBuffer, sizeof(UnpackedImageBuffer));
+    image_cache_file[slot] = file_index;
+#ifndef DIM_WITH_ENABLE_PIN_PWM
+    dimmed_cache_file[slot] = 255; // the dimmed copy is of the old image
+#endif
+  }
+}
+
+bool TFTs::cacheClockFace()
+{
+  if (image_cache[0] == NULL)
+  {
+    return false;
+  }
+  for (uint8_t i = 0; i < 10; i++)
+  {
+    uint8_t file_index = current_graphic * 10 + i;
+    if (getCachedImage(file_index) == NULL && !LoadImageIntoBuffer(file_index))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// slot: the image is image_cache[slot], its dimmed copy is kept for the next draw at the same dimming level.
+void TFTs::pushDimmedImage(const uint16_t *image, int8_t slot)
+{
+  bool oldSwapBytes = getSwapBytes();
+  setSwapBytes(true);
+#ifndef DIM_WITH_ENABLE_PIN_PWM
+  uint8_t level = dimming_fade.value();
+  if (level < 255 && slot >= 0 && dimmed_cache[slot] != NULL)
+  {
+    if (dimmed_cache_file[slot] != image_cache_file[slot] || dimmed_cache_level[slot] != level)
+    {
+      dimImage(image, dimmed_cache[slot], TFT_HEIGHT);
+      dimmed_cache_file[slot] = image_cache_file[slot];
+      dimmed_cache_level[slot] = level;
+    }
+    image = dimmed_cache[slot];
+  }
+  else if (level < 255)
+  {
+    // Dim one line at a time while sending, the image itself stays undimmed.
+    static uint16_t line[TFT_WIDTH];
+    startWrite();
+    setAddrWindow(0, 0, TFT_WIDTH, TFT_HEIGHT);
+    for (uint16_t row = 0; row < TFT_HEIGHT; row++)
+    {
+      dimImage(image + row * TFT_WIDTH, line, 1);
+      pushPixels(line, TFT_WIDTH);
+    }
+    endWrite();
+    setSwapBytes(oldSwapBytes);
+    return;
+  }
+#endif
+  pushImage(0, 0, TFT_WIDTH, TFT_HEIGHT, image);
+  setSwapBytes(oldSwapBytes);
+}
+
 bool TFTs::FileExists(const char *path)
 {
   fs::File f = SPIFFS.open(path, "r");
@@ -274,6 +488,7 @@ int8_t TFTs::CountNumberOfClockFaces()
 bool TFTs::LoadImageIntoBuffer(uint8_t file_index)
 {
   uint32_t StartTime = millis();
+  uint32_t start_us = micros();
 
   fs::File bmpFS;
   // Filenames are no bigger than "255.bmp\0"
@@ -338,8 +553,6 @@ bool TFTs::LoadImageIntoBuffer(uint8_t file_index)
   Serial.print(h);
   Serial.print(", ");
   Serial.println(bitDepth);
-  Serial.print(" dimming: ");
-  Serial.println(dimming);
   Serial.print(" offset x, y: ");
   Serial.print(x);
   Serial.print(", ");
@@ -412,20 +625,15 @@ bool TFTs::LoadImageIntoBuffer(uint8_t file_index)
         r = c >> 16;
       }
 
-      uint16_t color = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | ((b & 0xFF) >> 3);
-#ifndef DIM_WITH_ENABLE_PIN_PWM // skip alpha blending for dimming if hardware dimming is used
-      if (dimming < 255)
-      { // only dim when needed
-        color = alphaBlend(dimming, color, TFT_BLACK);
-      } // dimming
-#endif
-
-      UnpackedImageBuffer[row + y][col + x] = color;
+      // dimming is applied when the image is sent to the display
+      UnpackedImageBuffer[row + y][col + x] = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | ((b & 0xFF) >> 3);
     } // col
   } // row
   FileInBuffer = file_index;
+  storeInCache(file_index);
 
   bmpFS.close();
+  countDecode(start_us);
 #ifdef DEBUG_OUTPUT_IMAGES
   Serial.print("img load time: ");
   Serial.println(millis() - StartTime);
@@ -460,6 +668,7 @@ int8_t TFTs::CountNumberOfClockFaces()
 bool TFTs::LoadImageIntoBuffer(uint8_t file_index)
 {
   uint32_t StartTime = millis();
+  uint32_t start_us = micros();
 
   fs::File bmpFS;
   // Filenames are no bigger than "255.clk\0"
@@ -481,7 +690,6 @@ bool TFTs::LoadImageIntoBuffer(uint8_t file_index)
   }
 
   int16_t w, h, row, col;
-  uint16_t r, g, b;
 
   // black background - clear whole buffer
   memset(UnpackedImageBuffer, '\0', sizeof(UnpackedImageBuffer));
@@ -515,8 +723,6 @@ bool TFTs::LoadImageIntoBuffer(uint8_t file_index)
   Serial.print(w);
   Serial.print(", ");
   Serial.println(h);
-  Serial.print(" dimming: ");
-  Serial.println(dimming);
   Serial.print(" offset x, y: ");
   Serial.print(x);
   Serial.print(", ");
@@ -529,42 +735,18 @@ bool TFTs::LoadImageIntoBuffer(uint8_t file_index)
   for (row = 0; row < h; row++)
   {
     bmpFS.read(lineBuffer, sizeof(lineBuffer));
-    uint8_t PixM, PixL;
 
-    // Colors are already in 16-bit R5, G6, B5 format
+    // Colors are already in 16-bit R5, G6, B5 format, dimming is applied when the image is sent to the display
     for (col = 0; col < w; col++)
     {
-#ifdef DIM_WITH_ENABLE_PIN_PWM
-      // skip alpha blending for dimming if hardware dimming is used
       UnpackedImageBuffer[row + y][col + x] = (lineBuffer[col * 2 + 1] << 8) | (lineBuffer[col * 2]);
-#else
-      if (dimming == 255)
-      { // not needed, copy directly
-        UnpackedImageBuffer[row + y][col + x] = (lineBuffer[col * 2 + 1] << 8) | (lineBuffer[col * 2]);
-      }
-      else
-      {
-        // 16 BPP pixel format: R5, G6, B5 ; bin: RRRR RGGG GGGB BBBB
-        PixM = lineBuffer[col * 2 + 1];
-        PixL = lineBuffer[col * 2];
-        // align to 8-bit value (MSB left aligned)
-        r = (PixM) & 0xF8;
-        g = ((PixM << 5) | (PixL >> 3)) & 0xFC;
-        b = (PixL << 3) & 0xF8;
-        r *= dimming;
-        g *= dimming;
-        b *= dimming;
-        r = r >> 8;
-        g = g >> 8;
-        b = b >> 8;
-        UnpackedImageBuffer[row + y][col + x] = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
-      } // dimming
-#endif
     } // col
   } // row
   FileInBuffer = file_index;
+  storeInCache(file_index);
 
   bmpFS.close();
+  countDecode(start_us);
 #ifdef DEBUG_OUTPUT_IMAGES
   Serial.print("img load time: ");
   Serial.println(millis() - StartTime);
@@ -573,6 +755,17 @@ bool TFTs::LoadImageIntoBuffer(uint8_t file_index)
 }
 #endif
 
+void TFTs::countDecode(uint32_t start_us)
+{
+  uint32_t decode_us = micros() - start_us;
+  draw_stats.decodes++;
+  draw_stats.decode_us_sum += decode_us;
+  if (decode_us > draw_stats.max_decode_us)
+  {
+    draw_stats.max_decode_us = decode_us;
+  }
+}
+
 void TFTs::DrawImage(uint8_t file_index)
 {
 
@@ -582,19 +775,35 @@ void TFTs::DrawImage(uint8_t file_index)
   Serial.print("Drawing image: ");
   Serial.println(file_index);
 #endif
+  const uint16_t *image = NULL;
+  image = getCachedImage(file_index);
+  int8_t slot = image != NULL ? file_index % 10 : -1;
+  draw_stats.draws++;
+  if (image != NULL || file_index == FileInBuffer)
+  {
+    draw_stats.cache_hits++;
+  }
   // check if file is already loaded into buffer; skip loading if it is. Saves 50 to 150 msec of time.
-  if (file_index != FileInBuffer)
+  if (image == NULL)
   {
+    if (file_index != FileInBuffer)
+    {
 #ifdef DEBUG_OUTPUT_IMAGES
-    Serial.println("Not preloaded; loading now...");
+      Serial.println("Not preloaded; loading now...");
 #endif
-    LoadImageIntoBuffer(file_index);
+      LoadImageIntoBuffer(file_index);
+    }
+    image = reinterpret_cast<uint16_t *>(UnpackedImageBuffer);
   }
 
-  bool oldSwapBytes = getSwapBytes();
-  setSwapBytes(true);
-  pushImage(0, 0, TFT_WIDTH, TFT_HEIGHT, reinterpret_cast<uint16_t *>(UnpackedImageBuffer));
-  setSwapBytes(oldSwapBytes);
+  uint32_t push_start_us = micros();
+  pushDimmedImage(image, slot);
+  uint32_t push_us = micros() - push_start_us;
+  draw_stats.push_us_sum += push_us;
+  if (push_us > draw_stats.max_push_us)
+  {
+    draw_stats.max_push_us = push_us;
+  }
 
 #ifdef DEBUG_OUTPUT_IMAGES
   Serial.print("img transfer time: ");
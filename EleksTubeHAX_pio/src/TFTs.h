@@ -10,6 +10,7 @@
 
 #include <TFT_eSPI.h>
 #include "ChipSelect.h"
+#include "Fade.h"
 
 class TFTs : public TFT_eSPI
 {
@@ -32,7 +33,7 @@ public:
   // A digit of 0xFF means blank the screen.
   const static uint8_t blanked = 255;
 
-  uint8_t dimming = 255; // amount of dimming graphics
+  uint8_t dimming = 255; // amount of dimming graphics, target value if a fade is running
   uint8_t current_graphic = 1;
 
   void begin();
@@ -62,8 +63,26 @@ public:
 
   uint8_t NumberOfClockFaces = 0;
   void LoadNextImage();
-  void InvalidateImageInBuffer(); // force reload from Flash with new dimming settings
-  void ProcessUpdatedDimming();
+  void InvalidateImageInBuffer(); // force reload from Flash
+  void ProcessUpdatedDimming();   // apply the dimming value immediately, caller has to redraw the digits
+  void fadeTo(uint8_t target);    // ramp the dimming value to target over DIMMING_FADE_DURATION_MS
+  void loopFade();                // advance a running fade, redraws the digits if software dimming is used
+  bool isFading() { return dimming_fade.isActive(); }
+  bool cacheClockFace();          // load all ten digits of the current clock face into the image cache, false without PSRAM
+  void setZoneLabel(const char *label); // shown at the top of the hours tens display, "" = none
+
+  // Cost of drawing the digits, for diagnostics.
+  struct DrawStats
+  {
+    uint32_t draws;
+    uint32_t cache_hits;    // drawn from the image cache or the preloaded buffer, nothing read from the flash while drawing
+    uint32_t decodes;       // images read from the flash and unpacked, preloaded or not
+    uint64_t decode_us_sum;
+    uint32_t max_decode_us;
+    uint64_t push_us_sum;   // sending the image to the display over SPI, incl. software dimming
+    uint32_t max_push_us;
+  };
+  const DrawStats &getDrawStats() { return draw_stats; }
 
   String clockFaceToName(uint8_t clockFace);
   uint8_t nameToClockFace(String name);
@@ -76,15 +95,45 @@ private:
   int8_t CountNumberOfClockFaces();
   bool LoadImageIntoBuffer(uint8_t file_index);
   void DrawImage(uint8_t file_index);
+  DrawStats draw_stats = {};
+  void countDecode(uint32_t start_us);
   uint16_t read16(fs::File &f);
   uint32_t read32(fs::File &f);
 
-  static uint16_t UnpackedImageBuffer[TFT_HEIGHT][TFT_WIDTH];
+  static uint16_t UnpackedImageBuffer[TFT_HEIGHT][TFT_WIDTH]; // always holds the undimmed image
   uint8_t FileInBuffer = 255; // invalid, always load first image
   uint8_t NextFileRequired = 0;
 
+  // Dimming
+  Fade dimming_fade;
+  void pushDimmedImage(const uint16_t *image, int8_t slot = -1);
+#ifndef DIM_WITH_ENABLE_PIN_PWM
+  // Software dimming is applied while sending the image, using per channel lookup tables for the current dimming value.
+  uint8_t dim_lut_r[32];
+  uint8_t dim_lut_g[64];
+  uint8_t dim_lut_b[32];
+  void buildDimmingLUT(uint8_t level);
+  void dimImage(const uint16_t *image, uint16_t *dimmed, uint16_t rows);
+  // Dimmed copies of the cached images, valid for dimmed_cache_level, so a redraw at the same level only sends them.
+  uint16_t *dimmed_cache[10] = {NULL};
+  uint8_t dimmed_cache_file[10];
+  uint8_t dimmed_cache_level[10];
+#endif
+
+  // Undimmed images of the current clock face (slot = digit value), only if PSRAM is available.
+  // Needed to redraw all digits on every fade step and for the timer mode frames without reading the flash.
+  uint16_t *image_cache[10] = {NULL};
+  uint8_t image_cache_file[10];
+  void allocateImageCache();
+  uint16_t *getCachedImage(uint8_t file_index);
+  void storeInCache(uint8_t file_index);
+
   String patterns_str[9] = {"1", "2", "3", "4", "5", "6", "7", "8", "9"};
   void loadClockFacesNames();
+
+  char zone_label[WORLD_CLOCK_LABEL_SIZE] = "";
+  bool zone_label_changed = false;
+  void showZoneLabel();
 };
 
 extern TFTs tfts;
@@ -0,0 +1,417 @@
+#include "TimeZone.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+// IANA zone names and their POSIX rules (tz database 2024), the zones most likely reported by the geolocation.
+// Zones with rules POSIX can't express (Morocco's Ramadan) use their main offset.
+struct ZoneRule
+{
+  const char *name;
+  const char *rule;
+};
+
+static const char rule_cet[] = "CET-1CEST,M3.5.0,M10.5.0/3";
+static const char rule_eet[] = "EET-2EEST,M3.5.0/3,M10.5.0/4";
+static const char rule_wet[] = "WET0WEST,M3.5.0/1,M10.5.0";
+static const char rule_us_eastern[] = "EST5EDT,M3.2.0,M11.1.0";
+static const char rule_us_central[] = "CST6CDT,M3.2.0,M11.1.0";
+static const char rule_us_mountain[] = "MST7MDT,M3.2.0,M11.1.0";
+static const char rule_us_pacific[] = "PST8PDT,M3.2.0,M11.1.0";
+static const char rule_au_eastern[] = "AEST-10AEDT,M10.1.0,M4.1.0/3";
+
+static const ZoneRule zone_rules[] = {
+    {"UTC", "UTC0"},
+    {"Etc/UTC", "UTC0"},
+    {"Etc/GMT", "GMT0"},
+    // Europe
+    {"Europe/London", "GMT0BST,M3.5.0/1,M10.5.0"},
+    {"Europe/Dublin", "GMT0IST,M3.5.0/1,M10.5.0"},
+    {"Europe/Lisbon", rule_wet},
+    {"Atlantic/Canary", rule_wet},
+    {"Atlantic/Faroe", rule_wet},
+    {"Atlantic/Madeira", rule_wet},
+    {"Atlantic/Reykjavik", "GMT0"},
+    {"Atlantic/Azores", "<-01>1<+00>,M3.5.0/0,M10.5.0/1"},
+    {"Europe/Amsterdam", rule_cet},
+    {"Europe/Andorra", rule_cet},
+    {"Europe/Belgrade", rule_cet},
+    {"Europe/Berlin", rule_cet},
+    {"Europe/Bratislava", rule_cet},
+    {"Europe/Brussels", rule_cet},
+    {"Europe/Budapest", rule_cet},
+    {"Europe/Copenhagen", rule_cet},
+    {"Europe/Gibraltar", rule_cet},
+    {"Europe/Ljubljana", rule_cet},
+    {"Europe/Luxembourg", rule_cet},
+    {"Europe/Madrid", rule_cet},
+    {"Europe/Malta", rule_cet},
+    {"Europe/Monaco", rule_cet},
+    {"Europe/Oslo", rule_cet},
+    {"Europe/Paris", rule_cet},
+    {"Europe/Podgorica", rule_cet},
+    {"Europe/Prague", rule_cet},
+    {"Europe/Rome", rule_cet},
+    {"Europe/San_Marino", rule_cet},
+    {"Europe/Sarajevo", rule_cet},
+    {"Europe/Skopje", rule_cet},
+    {"Europe/Stockholm", rule_cet},
+    {"Europe/Tirane", rule_cet},
+    {"Europe/Vaduz", rule_cet},
+    {"Europe/Vatican", rule_cet},
+    {"Europe/Vienna", rule_cet},
+    {"Europe/Warsaw", rule_cet},
+    {"Europe/Zagreb", rule_cet},
+    {"Europe/Zurich", rule_cet},
+    {"Africa/Ceuta", rule_cet},
+    {"Europe/Athens", rule_eet},
+    {"Europe/Bucharest", rule_eet},
+    {"Europe/Helsinki", rule_eet},
+    {"Europe/Kiev", rule_eet},
+    {"Europe/Kyiv", rule_eet},
+    {"Europe/Mariehamn", rule_eet},
+    {"Europe/Riga", rule_eet},
+    {"Europe/Sofia", rule_eet},
+    {"Europe/Tallinn", rule_eet},
+    {"Europe/Vilnius", rule_eet},
+    {"Asia/Nicosia", rule_eet},
+    {"Europe/Chisinau", "EET-2EEST,M3.5.0,M10.5.0/3"},
+    {"Europe/Kaliningrad", "EET-2"},
+    {"Europe/Istanbul", "<+03>-3"},
+    {"Europe/Minsk", "<+03>-3"},
+    {"Europe/Moscow", "MSK-3"},
+    {"Europe/Samara", "<+04>-4"},
+    // Africa
+    {"Africa/Abidjan", "GMT0"},
+    {"Africa/Accra", "GMT0"},
+    {"Africa/Algiers", "CET-1"},
+    {"Africa/Cairo", "EET-2EEST,M4.5.5/0,M10.5.4/24"},
+    {"Africa/Casablanca", "<+01>-1"},
+    {"Africa/Johannesburg", "SAST-2"},
+    {"Africa/Lagos", "WAT-1"},
+    {"Africa/Nairobi", "EAT-3"},
+    {"Africa/Tunis", "CET-1"},
+    // Asia
+    {"Asia/Beirut", "EET-2EEST,M3.5.0/0,M10.5.0/0"},
+    {"Asia/Jerusalem", "IST-2IDT,M3.4.4/26,M10.5.0"},
+    {"Asia/Tel_Aviv", "IST-2IDT,M3.4.4/26,M10.5.0"},
+    {"Asia/Amman", "<+03>-3"},
+    {"Asia/Baghdad", "<+03>-3"},
+    {"Asia/Damascus", "<+03>-3"},
+    {"Asia/Qatar", "<+03>-3"},
+    {"Asia/Riyadh", "<+03>-3"},
+    {"Asia/Tehran", "<+0330>-3:30"},
+    {"Asia/Baku", "<+04>-4"},
+    {"Asia/Dubai", "<+04>-4"},
+    {"Asia/Tbilisi", "<+04>-4"},
+    {"Asia/Yerevan", "<+04>-4"},
+    {"Asia/Kabul", "<+0430>-4:30"},
+    {"Asia/Karachi", "PKT-5"},
+    {"Asia/Tashkent", "<+05>-5"},
+    {"Asia/Yekaterinburg", "<+05>-5"},
+    {"Asia/Colombo", "<+0530>-5:30"},
+    {"Asia/Kolkata", "IST-5:30"},
+    {"Asia/Calcutta", "IST-5:30"},
+    {"Asia/Kathmandu", "<+0545>-5:45"},
+    {"Asia/Dhaka", "<+06>-6"},
+    {"Asia/Yangon", "<+0630>-6:30"},
+    {"Asia/Bangkok", "<+07>-7"},
+    {"Asia/Ho_Chi_Minh", "<+07>-7"},
+    {"Asia/Jakarta", "WIB-7"},
+    {"Asia/Novosibirsk", "<+07>-7"},
+    {"Asia/Hong_Kong", "HKT-8"},
+    {"Asia/Kuala_Lumpur", "<+08>-8"},
+    {"Asia/Manila", "PST-8"},
+    {"Asia/Shanghai", "CST-8"},
+    {"Asia/Singapore", "<+08>-8"},
+    {"Asia/Taipei", "CST-8"},
+    {"Asia/Seoul", "KST-9"},
+    {"Asia/Tokyo", "JST-9"},
+    {"Asia/Vladivostok", "<+10>-10"},
+    // Australia and Pacific
+    {"Australia/Perth", "AWST-8"},
+    {"Australia/Darwin", "ACST-9:30"},
+    {"Australia/Adelaide", "ACST-9:30ACDT,M10.1.0,M4.1.0/3"},
+    {"Australia/Brisbane", "AEST-10"},
+    {"Australia/Canberra", rule_au_eastern},
+    {"Australia/Hobart", rule_au_eastern},
+    {"Australia/Melbourne", rule_au_eastern},
+    {"Australia/Sydney", rule_au_eastern},
+    {"Australia/Lord_Howe", "<+1030>-10:30<+11>-11,M10.1.0,M4.1.0"},
+    {"Pacific/Guam", "ChST-10"},
+    {"Pacific/Port_Moresby", "<+10>-10"},
+    {"Pacific/Noumea", "<+11>-11"},
+    {"Pacific/Auckland", "NZST-12NZDT,M9.5.0,M4.1.0/3"},
+    {"Pacific/Chatham", "<+1245>-12:45<+1345>,M9.5.0/2:45,M4.1.0/3:45"},
+    {"Pacific/Fiji", "<+12>-12"},
+    {"Pacific/Apia", "<+13>-13"},
+    {"Pacific/Tongatapu", "<+13>-13"},
+    {"Pacific/Kiritimati", "<+14>-14"},
+    {"Pacific/Honolulu", "HST10"},
+    // America
+    {"America/New_York", rule_us_eastern},
+    {"America/Detroit", rule_us_eastern},
+    {"America/Indiana/Indianapolis", rule_us_eastern},
+    {"America/Kentucky/Louisville", rule_us_eastern},
+    {"America/Nassau", rule_us_eastern},
+    {"America/Toronto", rule_us_eastern},
+    {"America/Chicago", rule_us_central},
+    {"America/Winnipeg", rule_us_central},
+    {"America/Denver", rule_us_mountain},
+    {"America/Boise", rule_us_mountain},
+    {"America/Edmonton", rule_us_mountain},
+    {"America/Los_Angeles", rule_us_pacific},
+    {"America/Tijuana", rule_us_pacific},
+    {"America/Vancouver", rule_us_pacific},
+    {"America/Phoenix", "MST7"},
+    {"America/Anchorage", "AKST9AKDT,M3.2.0,M11.1.0"},
+    {"America/Adak", "HST10HDT,M3.2.0,M11.1.0"},
+    {"America/Halifax", "AST4ADT,M3.2.0,M11.1.0"},
+    {"America/St_Johns", "NST3:30NDT,M3.2.0,M11.1.0"},
+    {"America/Puerto_Rico", "AST4"},
+    {"America/Regina", "CST6"},
+    {"America/Mexico_City", "CST6"},
+    {"America/Havana", "CST5CDT,M3.2.0/0,M11.1.0/1"},
+    {"America/Panama", "EST5"},
+    {"America/Bogota", "<-05>5"},
+    {"America/Lima", "<-05>5"},
+    {"America/Caracas", "<-04>4"},
+    {"America/La_Paz", "<-04>4"},
+    {"America/Santiago", "<-04>4<-03>,M9.1.6/24,M4.1.6/24"},
+    {"America/Argentina/Buenos_Aires", "<-03>3"},
+    {"America/Montevideo", "<-03>3"},
+    {"America/Sao_Paulo", "<-03>3"},
+    {"America/Nuuk", "<-02>2<-01>,M3.5.0/-1,M10.5.0/0"},
+};
+
+const char *TimeZone::findRule(const char *zone_name)
+{
+  for (size_t i = 0; i < sizeof(zone_rules) / sizeof(zone_rules[0]); i++)
+  {
+    if (strcmp(zone_rules[i].name, zone_name) == 0)
+    {
+      return zone_rules[i].rule;
+    }
+  }
+  return NULL;
+}
+
+// Days since 1970-01-01, valid for all years (H. Hinnant's algorithm)
+int32_t TimeZone::daysFromCivil(int32_t year, uint8_t month, uint8_t day)
+{
+  year -= month <= 2;
+  int32_t era = (year >= 0 ? year : year - 399) / 400;
+  int32_t yoe = year - era * 400;
+  int32_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  int32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+int32_t TimeZone::yearFromDays(int32_t days)
+{
+  days += 719468;
+  int32_t era = (days >= 0 ? days : days - 146096) / 146097;
+  int32_t doe = days - era * 146097;
+  int32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  int32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  int32_t mp = (5 * doy + 2) / 153;
+  return yoe + era * 400 + (mp >= 10); // January and February belong to the next year
+}
+
+const char *TimeZone::parseName(const char *p)
+{
+  const char *name = p;
+  if (*p == '<')
+  {
+    while (*p && *p != '>')
+      p++;
+    return *p == '>' ? p + 1 : NULL;
+  }
+  while (isalpha((unsigned char)*p))
+    p++;
+  return p - name >= 3 ? p : NULL;
+}
+
+const char *TimeZone::parseTime(const char *p, int32_t &seconds)
+{
+  int32_t sign = 1;
+  if (*p == '+' || *p == '-')
+  {
+    sign = *p == '-' ? -1 : 1;
+    p++;
+  }
+  if (!isdigit((unsigned char)*p))
+  {
+    return NULL;
+  }
+  int32_t value[3] = {0, 0, 0};
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    if (i > 0)
+    {
+      if (*p != ':' || !isdigit((unsigned char)p[1]))
+        break;
+      p++;
+    }
+    while (isdigit((unsigned char)*p))
+    {
+      value[i] = value[i] * 10 + (*p - '0');
+      p++;
+    }
+  }
+  if (value[0] > 167 || value[1] > 59 || value[2] > 59)
+  {
+    return NULL;
+  }
+  seconds = sign * (value[0] * 3600 + value[1] * 60 + value[2]);
+  return p;
+}
+
+const char *TimeZone::parseTransition(const char *p, Transition &t)
+{
+  t.time = 7200; // 02:00 local time, if not given
+  char *end;
+  if (*p == 'M')
+  {
+    t.type = 'M';
+    long m = strtol(p + 1, &end, 10);
+    if (*end != '.')
+      return NULL;
+    long w = strtol(end + 1, &end, 10);
+    if (*end != '.')
+      return NULL;
+    long d = strtol(end + 1, &end, 10);
+    if (m < 1 || m > 12 || w < 1 || w > 5 || d < 0 || d > 6)
+      return NULL;
+    t.month = m;
+    t.week = w;
+    t.wday = d;
+  }
+  else
+  {
+    t.type = *p == 'J' ? 'J' : 'n';
+    if (*p == 'J')
+      p++;
+    if (!isdigit((unsigned char)*p))
+      return NULL;
+    long n = strtol(p, &end, 10);
+    if (n > 365 || (t.type == 'J' && n < 1))
+      return NULL;
+    t.day = n;
+  }
+  p = end;
+  if (*p == '/')
+  {
+    p = parseTime(p + 1, t.time);
+  }
+  return p;
+}
+
+bool TimeZone::setRule(const char *posix)
+{
+  int32_t new_std, new_dst;
+  Transition new_start, new_end;
+  bool new_has_dst = false;
+
+  const char *p = parseName(posix);
+  if (p == NULL || (p = parseTime(p, new_std)) == NULL)
+  {
+    return false;
+  }
+  new_std = -new_std; // POSIX counts west of UTC positive
+  new_dst = new_std + 3600;
+  if (*p)
+  {
+    new_has_dst = true;
+    if ((p = parseName(p)) == NULL)
+      return false;
+    if (*p && *p != ',')
+    {
+      if ((p = parseTime(p, new_dst)) == NULL)
+        return false;
+      new_dst = -new_dst;
+    }
+    if (*p == ',')
+    {
+      if ((p = parseTransition(p + 1, new_start)) == NULL || *p != ',')
+        return false;
+      if ((p = parseTransition(p + 1, new_end)) == NULL)
+        return false;
+    }
+    else
+    { // no rules given, use the US rules like glibc
+      parseTransition("M3.2.0", new_start);
+      parseTransition("M11.1.0", new_end);
+    }
+    if (*p)
+    {
+      return false;
+    }
+  }
+
+  std_offset = new_std;
+  dst_offset = new_dst;
+  has_dst = new_has_dst;
+  start = new_start;
+  end = new_end;
+  cached_year = INT32_MIN;
+  return true;
+}
+
+int64_t TimeZone::transitionUtc(int32_t year, const Transition &t, int32_t offset)
+{
+  int32_t days;
+  if (t.type == 'M')
+  {
+    static const uint8_t days_in_month[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    int32_t first = daysFromCivil(year, t.month, 1);
+    int32_t first_wday = ((first % 7) + 11) % 7; // 1970-01-01 was a Thursday
+    int32_t mday = 1 + (t.wday - first_wday + 7) % 7 + (t.week - 1) * 7;
+    int32_t month_days = days_in_month[t.month - 1] + (t.month == 2 && isLeapYear(year));
+    while (mday > month_days) // week 5 is the last one
+      mday -= 7;
+    days = first + mday - 1;
+  }
+  else if (t.type == 'J')
+  {
+    days = daysFromCivil(year, 1, 1) + t.day - 1 + (isLeapYear(year) && t.day >= 60);
+  }
+  else
+  {
+    days = daysFromCivil(year, 1, 1) + t.day;
+  }
+  return int64_t(days) * 86400 + t.time - offset;
+}
+
+void TimeZone::updateYear(int32_t year)
+{
+  cached_year = year;
+  cached_start = transitionUtc(year, start, std_offset); // starts in standard time
+  cached_end = transitionUtc(year, end, dst_offset);     // ends in daylight saving time
+}
+
+bool TimeZone::isDst(time_t utc)
+{
+  if (!has_dst)
+  {
+    return false;
+  }
+  int64_t local = int64_t(utc) + std_offset;
+  int32_t days = local >= 0 ? local / 86400 : (local - 86399) / 86400;
+  int32_t year = yearFromDays(days);
+  if (year != cached_year)
+  {
+    updateYear(year);
+  }
+  if (cached_start < cached_end)
+  {
+    return utc >= cached_start && utc < cached_end;
+  }
+  // Southern hemisphere: DST over the new year
+  return utc >= cached_start || utc < cached_end;
+}
+
+int32_t TimeZone::getOffset(time_t utc)
+{
+  return isDst(utc) ? dst_offset : std_offset;
+}
@@ -0,0 +1,58 @@
+#ifndef TIME_ZONE_H
+#define TIME_ZONE_H
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Local time offset from a POSIX TZ rule, like "CET-1CEST,M3.5.0,M10.5.0/3", without any network access.
+ *
+ * Supported: names as letters or <+03>, offsets [+-]hh[:mm[:ss]] (west of UTC positive, as in POSIX),
+ * optional DST offset (default one hour ahead) and the transition rules Mm.w.d, Jn and n with an
+ * optional /time, which may be negative or above 24h. DST without rules uses the US rules.
+ *
+ * A table maps the IANA zone names (as returned by the geolocation) to their rules, see findRule().
+ */
+
+class TimeZone
+{
+public:
+  TimeZone() : std_offset(0), dst_offset(0), has_dst(false), cached_year(INT32_MIN), cached_start(0), cached_end(0) {}
+
+  // Returns false and keeps the previous rule, if the string can't be parsed.
+  bool setRule(const char *posix);
+  // Rule for an IANA zone name like "Europe/Berlin", NULL if the zone is not in the table.
+  static const char *findRule(const char *zone_name);
+
+  // Offset of the local time to UTC in seconds, east of UTC positive.
+  int32_t getOffset(time_t utc);
+  bool isDst(time_t utc);
+
+private:
+  struct Transition
+  {
+    char type; // 'M' month.week.day, 'J' julian day 1..365 without Feb 29, 'n' day 0..365
+    uint8_t month, week, wday;
+    uint16_t day;
+    int32_t time; // local time of the transition in seconds after midnight
+  };
+
+  int32_t std_offset, dst_offset; // east of UTC positive
+  bool has_dst;
+  Transition start, end;
+
+  // Transitions of one year, in UTC
+  int32_t cached_year;
+  int64_t cached_start, cached_end;
+  void updateYear(int32_t year);
+  int64_t transitionUtc(int32_t year, const Transition &t, int32_t offset);
+
+  static int32_t daysFromCivil(int32_t year, uint8_t month, uint8_t day);
+  static int32_t yearFromDays(int32_t days);
+  static bool isLeapYear(int32_t year) { return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0; }
+  static const char *parseName(const char *p);
+  static const char *parseTime(const char *p, int32_t &seconds);
+  static const char *parseTransition(const char *p, Transition &t);
+};
+
+#endif // TIME_ZONE_H
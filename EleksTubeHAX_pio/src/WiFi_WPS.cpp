@@ -12,7 +12,12 @@ extern StoredConfig stored_config;
 WifiState_t WifiState = disconnected;
 
 uint32_t TimeOfWifiReconnectAttempt = 0;
+uint32_t WifiReconnects = 0;
+bool WifiWasConnected = false;
 double GeoLocTZoffset = 0;
+String GeoLocTZname;
+double GeoLocLatitude = 0;
+double GeoLocLongitude = 0;
 
 #ifdef WIFI_USE_WPS // WPS code
 
@@ -46,6 +51,11 @@ void WiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info)
     Serial.print("Got IP: ");
     Serial.println(WiFi.localIP());
     WifiState = connected;
+    if (WifiWasConnected)
+    {
+      WifiReconnects++;
+    }
+    WifiWasConnected = true;
     break;
   case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
     WifiState = disconnected;
@@ -242,6 +252,9 @@ bool GetGeoLocationTimeZoneOffset()
     Serial.println(String("Geo TZ Offset: ") + String(IPG.offset));          // we are interested in this one, type = double
     Serial.println(String("Geo Current Time: ") + String(IPG.current_time)); // currently not used
     GeoLocTZoffset = IPG.offset;
+    GeoLocTZname = IPG.tz; // picks the time zone rule
+    GeoLocLatitude = IPG.latitude; // used for sunrise/sunset
+    GeoLocLongitude = IPG.longitude;
     return true;
   }
   else
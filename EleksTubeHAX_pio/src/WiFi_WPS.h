@@ -17,8 +17,12 @@ void WiFiStartWps();
 void WifiReconnect();
 
 extern WifiState_t WifiState;
+extern uint32_t WifiReconnects; // connections after the first one, for diagnostics
 
 bool GetGeoLocationTimeZoneOffset();
 extern double GeoLocTZoffset;
+extern String GeoLocTZname;
+extern double GeoLocLatitude;
+extern double GeoLocLongitude;
 
 #endif // WIFI_WPS_H
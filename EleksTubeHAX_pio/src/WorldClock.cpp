@@ -0,0 +1,136 @@
+#include "WorldClock.h"
+#include "Clock.h"
+#include "TFTs.h"
+#include <ArduinoJson.h>
+
+void WorldClock::begin(StoredConfig::Config::WorldClock *config_)
+{
+  config = config_;
+
+  if (config->is_valid != StoredConfig::valid)
+  {
+    Serial.println("Loaded World clock config is invalid, using default.  This is normal on first boot.");
+    config->count = 0;
+    config->rotate_sec = 0;
+    config->is_valid = StoredConfig::valid;
+  }
+  if (config->count > WORLD_CLOCK_MAX_ZONES)
+  {
+    config->count = 0;
+  }
+  for (uint8_t i = 0; i < config->count; i++)
+  {
+    config->label[i][WORLD_CLOCK_LABEL_SIZE - 1] = '\0';
+    if (!zones[i].setRule(config->rule[i]))
+    {
+      Serial.print("Invalid world clock zone, removing all zones: ");
+      Serial.println(config->label[i]);
+      config->count = 0;
+      break;
+    }
+  }
+  millis_last_switch = millis();
+}
+
+void WorldClock::loop()
+{
+  if (config->count == 0 || config->rotate_sec == 0)
+  {
+    return;
+  }
+  uint32_t since_switch = millis() - millis_last_switch;
+  uint32_t rotate_ms = config->rotate_sec * 1000UL;
+  if (!prefetched && since_switch + WORLD_CLOCK_PREFETCH_MS >= rotate_ms)
+  { // load the digits now, not when the new zone is drawn (no-op once the whole clock face is cached)
+    tfts.cacheClockFace();
+    prefetched = true;
+  }
+  if (since_switch >= rotate_ms)
+  {
+    step(1);
+  }
+}
+
+void WorldClock::show(uint8_t zone_index)
+{
+  if (zone_index > config->count)
+  {
+    zone_index = 0;
+  }
+  millis_last_switch = millis();
+  prefetched = false;
+  if (zone_index == index)
+  {
+    return;
+  }
+  index = zone_index;
+  uclock.setDisplayZone(index == 0 ? NULL : &zones[index - 1]);
+  tfts.setZoneLabel(index == 0 ? "" : config->label[index - 1]);
+}
+
+bool WorldClock::addZone(const char *label, const char *name_or_rule)
+{
+  if (config->count >= WORLD_CLOCK_MAX_ZONES || label == NULL || name_or_rule == NULL)
+  {
+    return false;
+  }
+  const char *rule = TimeZone::findRule(name_or_rule);
+  if (rule == NULL)
+  {
+    rule = name_or_rule;
+  }
+  uint8_t i = config->count;
+  if (strlen(rule) >= sizeof(config->rule[i]) || !zones[i].setRule(rule))
+  {
+    Serial.print("Unknown time zone: ");
+    Serial.println(name_or_rule);
+    return false;
+  }
+  strcpy(config->rule[i], rule);
+  strncpy(config->label[i], label, WORLD_CLOCK_LABEL_SIZE - 1);
+  config->label[i][WORLD_CLOCK_LABEL_SIZE - 1] = '\0';
+  config->count++;
+  return true;
+}
+
+bool WorldClock::command(const char *cmd)
+{
+  if (strcasecmp(cmd, "next") == 0)
+  {
+    step(1);
+    return false;
+  }
+  if (strcasecmp(cmd, "home") == 0)
+  {
+    show(0);
+    return false;
+  }
+
+  JsonDocument doc;
+  DeserializationError err = deserializeJson(doc, cmd);
+  if (err)
+  {
+    Serial.print("World clock: JSON error: ");
+    Serial.println(err.c_str());
+    return false;
+  }
+  show(0); // the shown zone may be removed
+  if (doc["zones"].is<JsonArray>())
+  {
+    config->count = 0;
+    for (JsonObject zone : doc["zones"].as<JsonArray>())
+    {
+      addZone(zone["label"].as<const char *>(), zone["tz"].as<const char *>());
+    }
+  }
+  if (doc["rotate_sec"].is<uint8_t>())
+  {
+    config->rotate_sec = doc["rotate_sec"];
+  }
+  Serial.print("World clock: ");
+  Serial.print(config->count);
+  Serial.print(" zones, rotating every ");
+  Serial.print(config->rotate_sec);
+  Serial.println(" s");
+  return true;
+}
@@ -0,0 +1,46 @@
+#ifndef WORLD_CLOCK_H
+#define WORLD_CLOCK_H
+
+#include "GLOBAL_DEFINES.h"
+#include "StoredConfig.h"
+#include "TimeZone.h"
+
+/*
+ * Up to WORLD_CLOCK_MAX_ZONES more time zones, shown in turn with the home time zone of the clock.
+ * Each zone has its own TZ rule and a short label, which is drawn on the hours tens display.
+ *
+ * The zones rotate every rotate_sec seconds, or are selected from the menu or over MQTT. The image cache is
+ * filled WORLD_CLOCK_PREFETCH_MS before a scheduled switch, so the new digits are drawn without reading the flash.
+ */
+
+class WorldClock
+{
+public:
+  WorldClock() : config(NULL), index(0), millis_last_switch(0), prefetched(false) {}
+
+  void begin(StoredConfig::Config::WorldClock *config_);
+  void loop();
+
+  void show(uint8_t zone_index); // 0 = home time zone, 1..getCount() = configured zones
+  void step(int8_t steps) { show((index + steps + (getCount() + 1) * 8) % (getCount() + 1)); }
+  uint8_t getIndex() { return index; }
+  uint8_t getCount() { return config->count; }
+  const char *getLabel(uint8_t zone_index) { return zone_index == 0 ? "Home" : config->label[zone_index - 1]; }
+
+  // Configuration over MQTT, kept in the stored config:
+  //   {"zones":[{"label":"NYC","tz":"America/New_York"},{"label":"TYO","tz":"JST-9"}],"rotate_sec":10}
+  // or "next" / "home" to switch the shown zone. Returns true if the configuration changed and needs to be saved.
+  bool command(const char *cmd);
+
+private:
+  StoredConfig::Config::WorldClock *config;
+  TimeZone zones[WORLD_CLOCK_MAX_ZONES];
+  uint8_t index;
+  uint32_t millis_last_switch;
+  bool prefetched;
+  bool addZone(const char *label, const char *name_or_rule);
+};
+
+extern WorldClock worldclock;
+
+#endif // WORLD_CLOCK_H
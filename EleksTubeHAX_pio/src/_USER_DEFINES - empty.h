@@ -13,6 +13,7 @@
 // #define DEBUG_OUTPUT_IMAGES // uncomment for Debug printing of image loading and drawing
 // #define DEBUG_OUTPUT_MQTT // uncomment for Debug printing of MQTT messages
 // #define DEBUG_OUTPUT_RTC // uncomment for Debug printing of RTC chip initialization and time setting
+// #define DEBUG_OUTPUT_EVENTS // uncomment for Debug printing of published events and event bus statistics
 
 // ************* Type of the clock hardware  *************
 #define HARDWARE_Elekstube_CLOCK // uncomment for the original Elekstube clock
@@ -21,6 +22,7 @@
 // #define HARDWARE_NovelLife_SE_CLOCK   // uncomment for the NovelLife SE version (Gesture only) - tested and working!; Non-SE version (Buttons only) NOT tested!; Pro version (Buttons and Gesture) NOT tested!
 // #define HARDWARE_PunkCyber_CLOCK      // uncomment for the PunkCyber / RGB Glow tube / PCBway clock
 // #define HARDWARE_IPSTUBE_CLOCK        // uncomment for the IPSTUBE clock models (H401 and H402)
+// #define RTC_NO_AGING_REGISTER         // uncomment if the clock has a DS1307 or PCF8523 instead of a DS3231 RTC, the RTC drift is then corrected in software only
 
 // ************* Clock font file type selection (.clk or .bmp)  *************
 // #define USE_CLK_FILES   // select between .CLK and .BMP images
@@ -31,6 +33,12 @@
 #define DAY_TIME 7                   // full brightness after 7 am
 #define BACKLIGHT_DIMMED_INTENSITY 1 // 0..7
 #define TFT_DIMMED_INTENSITY 20      // 0..255
+// #define DIMMING_SUNRISE_SUNSET       // uncomment to dim between sunset and sunrise instead of NIGHT_TIME and DAY_TIME. Location is taken from the geolocation or from below
+// #define SOLAR_LATITUDE 46.24         // fixed location for sunrise/sunset, if GEOLOCATION_ENABLED is not used (degrees, north positive)
+// #define SOLAR_LONGITUDE 14.36        // (degrees, east positive)
+
+// ************* Backlight effects *************
+// #define BACKLIGHT_HOUR_CHIME // uncomment to flash the backlights at every full hour (not during night time)
 
 // ************* WiFi config *************
 #define WIFI_CONNECT_TIMEOUT_SEC 20
@@ -39,6 +47,9 @@
 #define WIFI_SSID "__enter_your_wifi_ssid_here__"       // not needed if WPS is used
 #define WIFI_PASSWD "__enter_your_wifi_password_here__" // not needed if WPS is used.  Caution - Hard coded password is stored as clear text in BIN file
 
+//  *************  Time zone  *************
+// #define TIME_ZONE "Europe/Berlin" // zone name (see TimeZone.cpp) or POSIX TZ rule, switches DST without network. Without it the UTC offset from the menu or the geolocation is used
+
 //  *************  Geolocation  *************
 // Get your API Key on https://www.abstractapi.com/ (login) --> https://app.abstractapi.com/api/ip-geolocation/tester (key) *************
 // #define GEOLOCATION_ENABLED // enable after creating an account and copying Geolocation API below:
@@ -96,4 +107,7 @@
 // Don't forget to copy the correct certificate file into the 'data' folder and rename it to mqtt-ca-root.pem!
 // Example CA cert (Let's Encrypt CA cert) can be found in the 'data - other graphics' subfolder in the root of this repo
 
+// #define MQTT_MSGPACK // Also publish the JSON messages as MessagePack under "<MQTT_CLIENT>/msgpack/..." and accept commands there.
+// For own controllers talking to many clocks: same topics and fields as the JSON ones, but smaller. Home Assistant needs the JSON topics.
+
 #endif // USER_DEFINES_H_
@@ -9,15 +9,23 @@
 #include <stdint.h>
 #include "GLOBAL_DEFINES.h"
 #include "nvs_flash.h"
+#include "EventBus.h"
 #include "Buttons.h"
 #include "Backlights.h"
 #include "TFTs.h"
 #include "Clock.h"
 #include "Menu.h"
+#include "Stopwatch.h"
+#include "WorldClock.h"
+#include "LoopStats.h"
 #include "StoredConfig.h"
 #include "WiFi_WPS.h"
+#ifdef DIMMING_SUNRISE_SUNSET
+#include "SolarTime.h"
+#endif
 #if defined(MQTT_PLAIN_ENABLED) || defined(MQTT_HOME_ASSISTANT)
 #include "MQTT_client_ips.h"
+#include "MQTTCommands.h"
 #endif
 #ifdef HARDWARE_NovelLife_SE_CLOCK // NovelLife_SE Clone XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
 // #include "Gestures.h"
@@ -36,16 +44,25 @@ SparkFun_APDS9960 apds = SparkFun_APDS9960();
 int volatile isr_flag = 0;
 #endif // NovelLife_SE Clone XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
 
+EventBus events;
 Backlights backlights;
 Buttons buttons;
 TFTs tfts;
 Clock uclock;
 Menu menu;
+Stopwatch stopwatch;
+WorldClock worldclock;
+LoopStats loop_stats;
 StoredConfig stored_config;
+#ifdef DIMMING_SUNRISE_SUNSET
+SolarTime solar;
+#endif
 
 #ifdef DIMMING
 bool isDimmingNeeded = false;
 uint8_t hour_old = 255;
+uint8_t minute_old = 255;
+int8_t night_time_old = -1; // unknown after boot
 #endif
 bool DstNeedsUpdate = false;
 uint8_t yesterday = 0;
@@ -56,7 +73,7 @@ uint32_t lastMQTTCommandExecuted = (uint32_t)-1;
 void updateClockDisplay(TFTs::show_t show = TFTs::yes);
 void setupMenu(void);
 #ifdef DIMMING
-bool isNightTime(uint8_t current_hour);
+bool isNightTime(uint8_t current_hour, uint8_t current_minute);
 void checkDimmingNeeded(void);
 #endif
 void UpdateDstEveryNight(void);
@@ -90,7 +107,7 @@ void setup()
   stored_config.begin();
   stored_config.load();
 
-  backlights.begin(&stored_config.config.backlights);
+  backlights.begin(&stored_config.config.backlights, &stored_config.config.backlight_zones);
   buttons.begin();
   menu.begin();
 
@@ -132,7 +149,8 @@ void setup()
   tfts.setTextColor(TFT_MAGENTA, TFT_BLACK);
   tfts.print("Clock start...");
   Serial.println("Clock start-up...");
-  uclock.begin(&stored_config.config.uclock);
+  uclock.begin(&stored_config.config.uclock, &stored_config.config.rtc_drift, &stored_config.config.time_zone);
+  worldclock.begin(&stored_config.config.world_clock);
   tfts.println("Done!");
   Serial.println("Clock start-up done!");
   tfts.setTextColor(TFT_WHITE, TFT_BLACK);
@@ -142,12 +160,16 @@ void setup()
   tfts.setTextColor(TFT_YELLOW, TFT_BLACK);
   tfts.print("MQTT start...");
   Serial.println("MQTT start...");
-  MQTTStart(false);
+  MQTTStart(); // connects in the background
   tfts.println("Done!");
   Serial.println("MQTT start Done!");
   tfts.setTextColor(TFT_WHITE, TFT_BLACK);
 #endif
 
+#if defined(DIMMING_SUNRISE_SUNSET) && defined(SOLAR_LATITUDE) && defined(SOLAR_LONGITUDE)
+  solar.setLocation(SOLAR_LATITUDE, SOLAR_LONGITUDE); // fixed location, replaced by the geolocation if enabled
+#endif
+
 #ifdef GEOLOCATION_ENABLED
   tfts.setTextColor(TFT_CYAN, TFT_BLACK);
   tfts.println("GeoLoc query...");
@@ -156,9 +178,20 @@ void setup()
   {
     tfts.print("TZ: ");
     Serial.print("TZ: ");
-    tfts.println(GeoLocTZoffset);
-    Serial.println(GeoLocTZoffset);
-    uclock.setTimeZoneOffset(GeoLocTZoffset * 3600);
+    if (uclock.setTimeZone(GeoLocTZname.c_str()))
+    { // the rule handles daylight saving time, no nightly geolocation query needed
+      tfts.println(GeoLocTZname);
+      Serial.println(GeoLocTZname);
+    }
+    else
+    {
+      tfts.println(GeoLocTZoffset);
+      Serial.println(GeoLocTZoffset);
+      uclock.setTimeZoneOffset(GeoLocTZoffset * 3600);
+    }
+#ifdef DIMMING_SUNRISE_SUNSET
+    solar.setLocation(GeoLocLatitude, GeoLocLongitude);
+#endif
     Serial.println();
     Serial.print("Saving config! Triggerd by timezone change...");
     stored_config.save();
@@ -208,189 +241,20 @@ void setup()
 void loop()
 {
   uint32_t millis_at_top = millis();
+  uint32_t micros_at_top = micros();
+  uint32_t sleep_ms = 0;
   // Do all the maintenance work
   WifiReconnect(); // if not connected attempt to reconnect
 
 #if defined(MQTT_PLAIN_ENABLED) || defined(MQTT_HOME_ASSISTANT)
   MQTTLoopFrequently();
 
-  bool MQTTCommandReceived =
-      MQTTCommandMainPowerReceived ||
-      MQTTCommandBackPowerReceived ||
-      MQTTCommandStateReceived ||
-      MQTTCommandBrightnessReceived ||
-      MQTTCommandMainBrightnessReceived ||
-      MQTTCommandBackBrightnessReceived ||
-      MQTTCommandPatternReceived ||
-      MQTTCommandBackPatternReceived ||
-      MQTTCommandBackColorPhaseReceived ||
-      MQTTCommandGraphicReceived ||
-      MQTTCommandMainGraphicReceived ||
-      MQTTCommandUseTwelveHoursReceived ||
-      MQTTCommandBlankZeroHoursReceived ||
-      MQTTCommandPulseBpmReceived ||
-      MQTTCommandBreathBpmReceived ||
-      MQTTCommandRainbowSecReceived;
-
-  if (MQTTCommandMainPowerReceived)
-  {
-    MQTTCommandMainPowerReceived = false;
-    if (MQTTCommandMainPower)
-    {
-      if (!tfts.isEnabled()) // perform reinit, enable, redraw only if displays are actually off. HA sends ON command together with clock face change which causes flickering.
-      {
-#ifdef HARDWARE_Elekstube_CLOCK // original EleksTube hardware and direct clones need a reinit to wake up the displays properly
-        tfts.reinit();
-#else
-        tfts.enableAllDisplays(); // for all other clocks, just enable the displays
-#endif
-        updateClockDisplay(TFTs::force); // redraw all the clock digits -> needed because the displays was blanked before turning off
-      }
-    }
-    else
-    {
-      tfts.chip_select.setAll();
-      tfts.fillScreen(TFT_BLACK); // blank the screens before turning off -> needed for all clocks without a real "power switch curcuit" to "simulate" the off-switched displays
-      tfts.disableAllDisplays();
-    }
-  }
-
-  if (MQTTCommandBackPowerReceived)
-  {
-    MQTTCommandBackPowerReceived = false;
-    if (MQTTCommandBackPower)
-    {
-      backlights.PowerOn();
-    }
-    else
-    {
-      backlights.PowerOff();
-    }
-  }
-
-  if (MQTTCommandStateReceived)
+  if (MQTTCommandsDue())
   {
-    MQTTCommandStateReceived = false;
-    randomSeed(millis());
-    uint8_t idx;
-    if (MQTTCommandState >= 90)
+    if (applyMQTTCommands())
     {
-      idx = random(1, tfts.NumberOfClockFaces + 1);
+      lastMQTTCommandExecuted = millis(); // the changed states are reported from MQTTLoopInFreeTime()
     }
-    else
-    {
-      idx = (MQTTCommandState / 5) - 1;
-    } // 10..40 -> graphic 1..6
-    Serial.print("Graphic change request from MQTT; command: ");
-    Serial.print(MQTTCommandState);
-    Serial.print(", index: ");
-    Serial.println(idx);
-    uclock.setClockGraphicsIdx(idx);
-    tfts.current_graphic = uclock.getActiveGraphicIdx();
-    updateClockDisplay(TFTs::force); // redraw everything
-  }
-
-  if (MQTTCommandMainBrightnessReceived)
-  {
-    MQTTCommandMainBrightnessReceived = false;
-    tfts.dimming = MQTTCommandMainBrightness;
-    tfts.ProcessUpdatedDimming();
-    updateClockDisplay(TFTs::force);
-  }
-
-  if (MQTTCommandBackBrightnessReceived)
-  {
-    MQTTCommandBackBrightnessReceived = false;
-    backlights.setIntensity(uint8_t(MQTTCommandBackBrightness));
-  }
-
-  if (MQTTCommandPatternReceived)
-  {
-    MQTTCommandPatternReceived = false;
-
-    for (int8_t i = 0; i < Backlights::num_patterns; i++)
-    {
-      Serial.print("New pattern ");
-      Serial.print(MQTTCommandPattern);
-      Serial.print(", check pattern ");
-      Serial.println(Backlights::patterns_str[i]);
-      if (strcmp(MQTTCommandPattern, (Backlights::patterns_str[i]).c_str()) == 0)
-      {
-        backlights.setPattern(Backlights::patterns(i));
-        break;
-      }
-    }
-  }
-
-  if (MQTTCommandBackPatternReceived)
-  {
-    MQTTCommandBackPatternReceived = false;
-    for (int8_t i = 0; i < Backlights::num_patterns; i++)
-    {
-      Serial.print("new pattern ");
-      Serial.print(MQTTCommandBackPattern);
-      Serial.print(", check pattern ");
-      Serial.println(Backlights::patterns_str[i]);
-      if (strcmp(MQTTCommandBackPattern, (Backlights::patterns_str[i]).c_str()) == 0)
-      {
-        backlights.setPattern(Backlights::patterns(i));
-        break;
-      }
-    }
-  }
-
-  if (MQTTCommandBackColorPhaseReceived)
-  {
-    MQTTCommandBackColorPhaseReceived = false;
-
-    backlights.setColorPhase(MQTTCommandBackColorPhase);
-  }
-
-  if (MQTTCommandGraphicReceived)
-  {
-    MQTTCommandGraphicReceived = false;
-
-    uclock.setClockGraphicsIdx(MQTTCommandGraphic);
-    tfts.current_graphic = uclock.getActiveGraphicIdx();
-    updateClockDisplay(TFTs::force); // redraw everything
-  }
-
-  if (MQTTCommandMainGraphicReceived)
-  {
-    MQTTCommandMainGraphicReceived = false;
-    uclock.setClockGraphicsIdx(MQTTCommandMainGraphic);
-    tfts.current_graphic = uclock.getActiveGraphicIdx();
-    updateClockDisplay(TFTs::force); // redraw everything
-  }
-
-  if (MQTTCommandUseTwelveHoursReceived)
-  {
-    MQTTCommandUseTwelveHoursReceived = false;
-    uclock.setTwelveHour(MQTTCommandUseTwelveHours);
-  }
-
-  if (MQTTCommandBlankZeroHoursReceived)
-  {
-    MQTTCommandBlankZeroHoursReceived = false;
-    uclock.setBlankHoursZero(MQTTCommandBlankZeroHours);
-  }
-
-  if (MQTTCommandPulseBpmReceived)
-  {
-    MQTTCommandPulseBpmReceived = false;
-    backlights.setPulseRate(MQTTCommandPulseBpm);
-  }
-
-  if (MQTTCommandBreathBpmReceived)
-  {
-    MQTTCommandBreathBpmReceived = false;
-    backlights.setBreathRate(MQTTCommandBreathBpm);
-  }
-
-  if (MQTTCommandRainbowSecReceived)
-  {
-    MQTTCommandRainbowSecReceived = false;
-    backlights.setRainbowDuration(MQTTCommandRainbowSec);
   }
 
   MQTTStatusMainPower = tfts.isEnabled();
@@ -410,13 +274,20 @@ void loop()
   MQTTStatusPulseBpm = backlights.getPulseRate();
   MQTTStatusBreathBpm = backlights.getBreathRate();
   MQTTStatusRainbowSec = backlights.getRainbowDuration();
-
-  if (MQTTCommandReceived)
+#ifdef MQTT_BACKLIGHT_ZONES
+  for (uint8_t zone = 1; zone < NUM_BACKLIGHT_ZONES; zone++)
   {
-    lastMQTTCommandExecuted = millis();
-
-    MQTTReportBackEverything(true);
+    MQTTStatusZonePower[zone] = backlights.getZonePower(zone);
+    MQTTStatusZoneBrightness[zone] = backlights.getZoneIntensity(zone);
+    strcpy(MQTTStatusZonePattern[zone], backlights.getZonePatternStr(zone).c_str());
+    MQTTStatusZoneColorPhase[zone] = backlights.getZoneColorPhase(zone);
   }
+#endif
+#ifdef DIMMING_SUNRISE_SUNSET
+  MQTTStatusSunrise = solar.getSunrise();
+  MQTTStatusSunset = solar.getSunset();
+  MQTTStatusNightTime = night_time_old > 0;
+#endif
 
   if (lastMQTTCommandExecuted != -1)
   {
@@ -439,8 +310,20 @@ void loop()
 
 // if the device has one button only,, no power button functionality is needed!
 #ifndef ONE_BUTTON_ONLY_MENU
-  // Power button: If in menu, exit menu. Else turn off displays and backlight.
-  if (buttons.power.isDownEdge() && (menu.getState() == Menu::idle))
+  // Power button: If in menu, exit menu. In timer mode, start/stop (short press) or reset (long press) the timer. Else turn off displays and backlight.
+  if (stopwatch.isActive() && (menu.getState() == Menu::idle))
+  {
+    if (buttons.power.isUpEdge())
+    {
+      stopwatch.toggle();
+    }
+    else if (buttons.power.isDownLongEdge())
+    {
+      stopwatch.reset();
+      stopwatch.draw();
+    }
+  }
+  else if (buttons.power.isDownEdge() && (menu.getState() == Menu::idle))
   { // Power button was pressed: if in the menu, exit menu, else turn off displays and backlight.
     if (tfts.isEnabled())
     { // check if tft state is enabled -> switch OFF the LCDs and LED backlights
@@ -463,14 +346,32 @@ void loop()
 #endif // ONE_BUTTON_ONLY_MENU
 
   menu.loop(buttons); // Must be called after buttons.loop()
-  backlights.loop();
   uclock.loop();
 
 #ifdef DIMMING
   checkDimmingNeeded(); // night or day time brightness change
 #endif
 
+  events.dispatch(); // Deliver clock events before the backlights and digits are drawn, so both react in the same frame
+  backlights.loop();
+  if (menu.getState() == Menu::idle)
+  { // the fade redraws the digits, don't overwrite the menu
+    tfts.loopFade();
+  }
+
+  if (stopwatch.isActive())
+  {
+    worldclock.show(0); // no zone label on the timer
+  }
+  else
+  {
+    worldclock.loop(); // switches the shown time zone on schedule
+  }
   updateClockDisplay(); // Draw only the changed clock digits!
+  if (menu.getState() == Menu::idle)
+  {
+    stopwatch.loop(); // timer mode frames, if active
+  }
 
   UpdateDstEveryNight();
 
@@ -679,6 +580,28 @@ void loop()
         tfts.println("graphic:");
         tfts.printf("    %d\n", uclock.getActiveGraphicIdx());
       }
+      // time zone shown by the world clock
+      else if (menu_state == Menu::world_zone)
+      {
+        if (menu_change != 0)
+        {
+          worldclock.step(menu_change);
+        }
+        setupMenu();
+        tfts.println("Time zone:");
+        tfts.println(worldclock.getLabel(worldclock.getIndex()));
+      }
+      // clock, stopwatch or countdown
+      else if (menu_state == Menu::timer_mode)
+      {
+        if (menu_change != 0)
+        {
+          stopwatch.setNextMode(menu_change);
+        }
+        setupMenu();
+        tfts.println("Timer mode:");
+        tfts.println(stopwatch.isActive() ? stopwatch.getModeStr() : "off (clock)");
+      }
 #ifdef WIFI_USE_WPS //  WPS code
       // connect to WiFi using wps pushbutton mode
       else if (menu_state == Menu::start_wps)
@@ -721,7 +644,13 @@ void loop()
       { // Daylight savings time changes at 3 in the morning
         if (GetGeoLocationTimeZoneOffset())
         {
-          uclock.setTimeZoneOffset(GeoLocTZoffset * 3600);
+          if (!uclock.setTimeZone(GeoLocTZname.c_str()))
+          {
+            uclock.setTimeZoneOffset(GeoLocTZoffset * 3600);
+          }
+#ifdef DIMMING_SUNRISE_SUNSET
+          solar.setLocation(GeoLocLatitude, GeoLocLongitude);
+#endif
           DstNeedsUpdate = false; // done for this night; retry if not sucessfull
         }
       }
@@ -729,10 +658,12 @@ void loop()
       time_in_loop = millis() - millis_at_top;
       if (time_in_loop < 20)
       {
-        delay(20 - time_in_loop);
+        sleep_ms = 20 - time_in_loop;
+        delay(sleep_ms);
       }
     }
   }
+  loop_stats.add(micros() - micros_at_top - sleep_ms * 1000);
 #ifdef DEBUG_OUTPUT
   if (time_in_loop <= 2) // if the loop time is less than 2ms, we don't need to print it in detail
     Serial.print(".");
@@ -846,8 +777,15 @@ void setupMenu()
 }
 
 #ifdef DIMMING
-bool isNightTime(uint8_t current_hour)
-{ // check the actual hour is in the defined "night time"
+bool isNightTime(uint8_t current_hour, uint8_t current_minute)
+{ // check the actual time is in the defined "night time"
+#ifdef DIMMING_SUNRISE_SUNSET
+  if (solar.hasLocation())
+  { // between sunset and sunrise, with minute resolution
+    return solar.isNight(current_hour * 60 + current_minute);
+  }
+  // no location known (yet), use the fixed hours
+#endif
   if (DAY_TIME < NIGHT_TIME)
   { // "Night" spans across midnight so it is split between two days
     return (current_hour < DAY_TIME) || (current_hour >= NIGHT_TIME);
@@ -859,32 +797,68 @@ bool isNightTime(uint8_t current_hour)
 }
 
 void checkDimmingNeeded()
-{                                             // dim the display in the defined night time
-  uint8_t current_hour = uclock.getHour24();  // for internal calcs we always use 24h format
-  isDimmingNeeded = current_hour != hour_old; // check, if the hour has changed since last loop (from time passing by or from timezone change)
+{                                              // dim the display in the defined night time
+  uint8_t current_hour = uclock.getHour24();   // for internal calcs we always use 24h format
+  uint8_t current_minute = uclock.getMinute(); // night time is checked once per minute
+  if (current_minute == minute_old && current_hour == hour_old)
+  {
+    return;
+  }
+  minute_old = current_minute;
+#ifdef DIMMING_SUNRISE_SUNSET
+  solar.update(uclock.getYear(), uclock.getMonth(), uclock.getDay(), uclock.getTimeZoneOffset()); // recalculates only once per day
+#endif
+  bool night_time = isNightTime(current_hour, current_minute);
+  // The dimming is set every hour (from time passing by or from timezone change) and when the night time begins or ends.
+  isDimmingNeeded = (current_hour != hour_old) || (night_time != night_time_old);
   if (isDimmingNeeded)
   {
     Serial.print("Current hour = ");
     Serial.print(current_hour);
-    Serial.print(", Night Time Start = ");
-    Serial.print(NIGHT_TIME);
-    Serial.print(", Day Time Start = ");
-    Serial.println(DAY_TIME);
-    if (isNightTime(current_hour))
+#ifdef DIMMING_SUNRISE_SUNSET
+    if (solar.hasLocation())
+    {
+      Serial.print(", Sunset = ");
+      Serial.print(solar.getSunset());
+      Serial.print(" min, Sunrise = ");
+      Serial.print(solar.getSunrise());
+      Serial.println(" min");
+    }
+    else
+#endif
+    {
+      Serial.print(", Night Time Start = ");
+      Serial.print(NIGHT_TIME);
+      Serial.print(", Day Time Start = ");
+      Serial.println(DAY_TIME);
+    }
+    uint8_t new_dimming = night_time ? TFT_DIMMED_INTENSITY : 255; // 0..255
+    if (night_time)
     { // check if it is in the defined night time
       Serial.println("Set to night time mode (dimmed)!");
-      tfts.dimming = TFT_DIMMED_INTENSITY;
-      tfts.ProcessUpdatedDimming();
-      backlights.setDimming(true);
     }
     else
     {
       Serial.println("Set to day time mode (max brightness)!");
-      tfts.dimming = 255; // 0..255
+    }
+    if (night_time_old < 0)
+    { // first check after boot: no fade, start with the right brightness
+      tfts.dimming = new_dimming;
       tfts.ProcessUpdatedDimming();
-      backlights.setDimming(false);
     }
-    updateClockDisplay(TFTs::force); // redraw all the clock digits -> software dimming will be done here
+    else
+    {
+      tfts.fadeTo(new_dimming);
+    }
+    if (night_time != night_time_old)
+    { // backlights (and other subscribers) follow via the event bus
+      events.publish(EventBus::dimming_changed, night_time);
+      night_time_old = night_time;
+    }
+    if (!tfts.isFading())
+    {
+      updateClockDisplay(TFTs::force); // redraw all the clock digits -> software dimming will be done here
+    }
     hour_old = current_hour;
   }
 }
@@ -892,6 +866,11 @@ void checkDimmingNeeded()
 
 void UpdateDstEveryNight()
 {
+  if (uclock.hasTimeZoneRule())
+  { // DST is known from the time zone rule, only a fixed offset needs the nightly geolocation query
+    DstNeedsUpdate = false;
+    return;
+  }
   uint8_t currentDay = uclock.getDay();
   // This `DstNeedsUpdate` is True between 3:00:05 and 3:00:59. Has almost one minute of time slot to fetch updates, incl. eventual retries.
   DstNeedsUpdate = (currentDay != yesterday) && (uclock.getHour24() == 3) && (uclock.getMinute() == 0) && (uclock.getSecond() > 5);
@@ -906,6 +885,19 @@ void UpdateDstEveryNight()
 
 void updateClockDisplay(TFTs::show_t show)
 {
+  if (stopwatch.isActive())
+  { // the timer draws its own frames, only redraw it if forced
+    if (show == TFTs::force)
+    {
+      tfts.cacheClockFace(); // the clock face may have changed
+      stopwatch.draw(show);
+    }
+    return;
+  }
+  if (!uclock.takeDigitsChanged() && show != TFTs::force)
+  { // nothing new since the last call, the digits are cached in the clock
+    return;
+  }
   // refresh starting on seconds
   tfts.setDigit(SECONDS_ONES, uclock.getSecondsOnes(), show);
   tfts.setDigit(SECONDS_TENS, uclock.getSecondsTens(), show);
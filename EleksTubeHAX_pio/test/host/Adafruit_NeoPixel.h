@@ -0,0 +1,88 @@
+#ifndef HOST_ADAFRUIT_NEOPIXEL_H
+#define HOST_ADAFRUIT_NEOPIXEL_H
+
+// NeoPixel strip that keeps the pixel colors and counts show() calls, for the host tests.
+
+#include "Arduino.h"
+#include <vector>
+
+#define NEO_GRB ((1 << 6) | (1 << 4) | (0 << 2) | (2))
+#define NEO_KHZ800 0x0000
+
+class Adafruit_NeoPixel
+{
+public:
+  Adafruit_NeoPixel(uint16_t n, int16_t pin = 6, uint16_t type = NEO_GRB + NEO_KHZ800) : pixels(n, 0) {}
+  void begin() {}
+  void show() { shows++; }
+  void clear() { std::fill(pixels.begin(), pixels.end(), 0); }
+  void fill(uint32_t c = 0, uint16_t first = 0, uint16_t count = 0)
+  {
+    uint16_t end = (count == 0 || first + count > pixels.size()) ? pixels.size() : first + count;
+    for (uint16_t i = first; i < end; i++)
+      pixels[i] = c;
+  }
+  void setPixelColor(uint16_t n, uint32_t c)
+  {
+    if (n < pixels.size())
+      pixels[n] = c;
+  }
+  void setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b) { setPixelColor(n, Color(r, g, b)); }
+  uint32_t getPixelColor(uint16_t n) const { return n < pixels.size() ? pixels[n] : 0; }
+  void setBrightness(uint8_t b) { brightness = b; }
+  uint8_t getBrightness() const { return brightness; }
+  uint16_t numPixels() const { return pixels.size(); }
+  static uint32_t Color(uint8_t r, uint8_t g, uint8_t b) { return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b; }
+  static uint32_t ColorHSV(uint16_t hue, uint8_t sat = 255, uint8_t val = 255)
+  {
+    // same sextant math as the library, without its rounding details
+    uint8_t r, g, b;
+    hue = (hue * 1530L + 32768) / 65536;
+    if (hue < 510)
+    {
+      b = 0;
+      if (hue < 255)
+        r = 255, g = hue;
+      else
+        r = 510 - hue, g = 255;
+    }
+    else if (hue < 1020)
+    {
+      r = 0;
+      if (hue < 765)
+        g = 255, b = hue - 510;
+      else
+        g = 1020 - hue, b = 255;
+    }
+    else if (hue < 1530)
+    {
+      g = 0;
+      if (hue < 1275)
+        r = hue - 1020, b = 255;
+      else
+        r = 255, b = 1530 - hue;
+    }
+    else
+      r = 255, g = b = 0;
+    uint32_t v1 = 1 + val;
+    uint16_t s1 = 1 + sat;
+    uint8_t s2 = 255 - sat;
+    return ((((((r * s1) >> 8) + s2) * v1) & 0xff00) << 8) | (((((g * s1) >> 8) + s2) * v1) & 0xff00) |
+           (((((b * s1) >> 8) + s2) * v1) >> 8);
+  }
+  static uint8_t gamma8(uint8_t x) { return (uint8_t)(powf(x / 255.0f, 2.6f) * 255.0f + 0.5f); }
+  static uint32_t gamma32(uint32_t x)
+  {
+    return ((uint32_t)gamma8(x >> 16) << 16) | ((uint32_t)gamma8(x >> 8) << 8) | gamma8(x);
+  }
+  static uint8_t sine8(uint8_t x) { return (uint8_t)((sinf(x * 2 * (float)M_PI / 256) + 1) * 127.5f + 0.5f); }
+
+  // host only
+  std::vector<uint32_t> pixels;
+  uint32_t shows = 0;
+
+private:
+  uint8_t brightness = 0;
+};
+
+#endif // HOST_ADAFRUIT_NEOPIXEL_H
@@ -0,0 +1,373 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+/*
+ * Host (native) replacement for the parts of the Arduino core used by the firmware modules under test.
+ * Header only, the tests include the .cpp files of the modules they check.
+ *
+ * Time is simulated: millis(), micros(), delay() and esp_timer_get_time() read hostTimeUs, which only moves
+ * when a test calls hostAdvanceMs()/hostAdvanceUs() (or the code under test calls delay()).
+ * Serial collects everything printed in Serial.output, so tests can check log messages.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <math.h>
+#include <string>
+#include <algorithm>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define RISING 1
+#define FALLING 2
+#define CHANGE 3
+#define LSBFIRST 0
+#define MSBFIRST 1
+#define PROGMEM
+#define IRAM_ATTR
+#define F(x) (x)
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+#define DEG_TO_RAD 0.017453292519943295769236907684886
+#define RAD_TO_DEG 57.295779513082320876798154814105
+#define radians(deg) ((deg) * DEG_TO_RAD)
+#define degrees(rad) ((rad) * RAD_TO_DEG)
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+using std::abs;
+using std::max;
+using std::min;
+
+enum gpio_num_t
+{
+  GPIO_NUM_0 = 0,
+  GPIO_NUM_2 = 2,
+  GPIO_NUM_3 = 3,
+  GPIO_NUM_4 = 4,
+  GPIO_NUM_5 = 5,
+  GPIO_NUM_12 = 12,
+  GPIO_NUM_13 = 13,
+  GPIO_NUM_14 = 14,
+  GPIO_NUM_15 = 15,
+  GPIO_NUM_18 = 18,
+  GPIO_NUM_19 = 19,
+  GPIO_NUM_21 = 21,
+  GPIO_NUM_22 = 22,
+  GPIO_NUM_23 = 23,
+  GPIO_NUM_25 = 25,
+  GPIO_NUM_26 = 26,
+  GPIO_NUM_27 = 27,
+  GPIO_NUM_32 = 32,
+  GPIO_NUM_33 = 33
+};
+
+// ************* Simulated time *************
+inline uint64_t hostTimeUs = 1000000; // not 0, some modules use 0 as "never"
+
+inline void hostAdvanceUs(uint64_t us) { hostTimeUs += us; }
+inline void hostAdvanceMs(uint32_t ms) { hostTimeUs += (uint64_t)ms * 1000; }
+inline unsigned long millis() { return (unsigned long)(uint32_t)(hostTimeUs / 1000); }
+inline unsigned long micros() { return (unsigned long)(uint32_t)hostTimeUs; }
+inline void delay(unsigned long ms) { hostAdvanceMs(ms); }
+inline void delayMicroseconds(unsigned int us) { hostAdvanceUs(us); }
+inline void yield() {}
+
+// ************* Deterministic random numbers *************
+inline uint32_t hostRandomState = 1;
+inline void randomSeed(unsigned long seed) { hostRandomState = seed ? seed : 1; }
+inline long random(long howbig)
+{
+  if (howbig <= 0)
+    return 0;
+  hostRandomState = hostRandomState * 1103515245u + 12345u;
+  return (hostRandomState >> 8) % howbig;
+}
+inline long random(long howsmall, long howbig) { return howsmall >= howbig ? howsmall : howsmall + random(howbig - howsmall); }
+
+// ************* GPIO, no hardware *************
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) { return HIGH; }
+inline int analogRead(uint8_t) { return 0; }
+inline void shiftOut(uint8_t, uint8_t, uint8_t, uint8_t) {}
+inline uint32_t ledcSetup(uint8_t, uint32_t freq, uint8_t) { return freq; }
+inline void ledcAttachPin(uint8_t, uint8_t) {}
+inline void ledcWrite(uint8_t, uint32_t) {}
+inline uint32_t ledcChangeFrequency(uint8_t, uint32_t freq, uint8_t) { return freq; }
+inline void attachInterrupt(uint8_t, void (*)(void), int) {}
+inline void detachInterrupt(uint8_t) {}
+#define digitalPinToInterrupt(p) (p)
+inline uint16_t word(uint8_t h, uint8_t l) { return (h << 8) | l; }
+
+inline size_t strlcpy(char *dst, const char *src, size_t size)
+{
+  size_t length = strlen(src);
+  if (size > 0)
+  {
+    size_t copy = length < size - 1 ? length : size - 1;
+    memcpy(dst, src, copy);
+    dst[copy] = '\0';
+  }
+  return length;
+}
+
+// ************* String *************
+class String
+{
+public:
+  String() {}
+  String(const char *str) : s(str ? str : "") {}
+  String(const std::string &str) : s(str) {}
+  String(char c) : s(1, c) {}
+  String(int value) : s(std::to_string(value)) {}
+  String(unsigned int value) : s(std::to_string(value)) {}
+  String(long value) : s(std::to_string(value)) {}
+  String(unsigned long value) : s(std::to_string(value)) {}
+  String(long long value) : s(std::to_string(value)) {}
+  String(unsigned long long value) : s(std::to_string(value)) {}
+  String(double value, unsigned int decimals = 2)
+  {
+    char buffer[48];
+    snprintf(buffer, sizeof(buffer), "%.*f", decimals, value);
+    s = buffer;
+  }
+
+  const char *c_str() const { return s.c_str(); }
+  unsigned int length() const { return s.size(); }
+  bool isEmpty() const { return s.empty(); }
+  bool reserve(unsigned int size)
+  {
+    s.reserve(size);
+    return true;
+  }
+  bool concat(const char *str)
+  {
+    s += str ? str : "";
+    return true;
+  }
+  bool concat(const String &str)
+  {
+    s += str.s;
+    return true;
+  }
+  bool concat(char c)
+  {
+    s += c;
+    return true;
+  }
+  char charAt(unsigned int index) const { return index < s.size() ? s[index] : '\0'; }
+  char operator[](unsigned int index) const { return charAt(index); }
+  void toCharArray(char *buffer, unsigned int size) const { strlcpy(buffer, s.c_str(), size); }
+  void getBytes(unsigned char *buffer, unsigned int size) const { strlcpy((char *)buffer, s.c_str(), size); }
+  int indexOf(char c, unsigned int from = 0) const { return find(s.find(c, from)); }
+  int indexOf(const String &str, unsigned int from = 0) const { return find(s.find(str.s, from)); }
+  int lastIndexOf(char c) const { return find(s.rfind(c)); }
+  String substring(unsigned int from) const { return from < s.size() ? String(s.substr(from)) : String(); }
+  String substring(unsigned int from, unsigned int to) const { return from < s.size() && to > from ? String(s.substr(from, to - from)) : String(); }
+  void replace(const String &find, const String &replacement)
+  {
+    if (find.s.empty())
+      return;
+    for (size_t pos = s.find(find.s); pos != std::string::npos; pos = s.find(find.s, pos + replacement.s.size()))
+      s.replace(pos, find.s.size(), replacement.s);
+  }
+  void remove(unsigned int index) { s.erase(std::min((size_t)index, s.size())); }
+  void remove(unsigned int index, unsigned int count) { s.erase(std::min((size_t)index, s.size()), count); }
+  void trim()
+  {
+    size_t first = s.find_first_not_of(" \t\r\n");
+    size_t last = s.find_last_not_of(" \t\r\n");
+    s = first == std::string::npos ? "" : s.substr(first, last - first + 1);
+  }
+  void toLowerCase() { std::transform(s.begin(), s.end(), s.begin(), ::tolower); }
+  void toUpperCase() { std::transform(s.begin(), s.end(), s.begin(), ::toupper); }
+  long toInt() const { return atol(s.c_str()); }
+  float toFloat() const { return atof(s.c_str()); }
+  bool startsWith(const String &prefix) const { return s.compare(0, prefix.s.size(), prefix.s) == 0; }
+  bool endsWith(const String &suffix) const { return s.size() >= suffix.s.size() && s.compare(s.size() - suffix.s.size(), suffix.s.size(), suffix.s) == 0; }
+  bool equals(const String &other) const { return s == other.s; }
+  bool equalsIgnoreCase(const String &other) const { return strcasecmp(s.c_str(), other.s.c_str()) == 0; }
+  int compareTo(const String &other) const { return s.compare(other.s); }
+
+  String &operator+=(const String &other)
+  {
+    s += other.s;
+    return *this;
+  }
+  String &operator+=(const char *other)
+  {
+    s += other;
+    return *this;
+  }
+  String &operator+=(char c)
+  {
+    s += c;
+    return *this;
+  }
+  bool operator==(const String &other) const { return s == other.s; }
+  bool operator==(const char *other) const { return s == (other ? other : ""); }
+  bool operator!=(const String &other) const { return s != other.s; }
+  bool operator!=(const char *other) const { return !(*this == other); }
+  bool operator<(const String &other) const { return s < other.s; }
+
+  std::string s;
+
+private:
+  static int find(size_t pos) { return pos == std::string::npos ? -1 : (int)pos; }
+};
+inline String operator+(const String &a, const String &b) { return String(a.s + b.s); }
+inline String operator+(const char *a, const String &b) { return String(std::string(a) + b.s); }
+inline String operator+(const String &a, const char *b) { return String(a.s + b); }
+
+// ************* Print, Stream, Serial *************
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size)
+  {
+    size_t n = 0;
+    while (size--)
+      n += write(*buffer++);
+    return n;
+  }
+  size_t write(const char *str) { return str ? write((const uint8_t *)str, strlen(str)) : 0; }
+  size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+
+  size_t print(const char *str) { return write(str); }
+  size_t print(const String &str) { return write(str.c_str()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char value, int base = 10) { return print((unsigned long)value, base); }
+  size_t print(int value, int base = 10) { return print((long)value, base); }
+  size_t print(unsigned int value, int base = 10) { return print((unsigned long)value, base); }
+  size_t print(long value, int base = 10) { return base == 10 ? printf("%ld", value) : print((unsigned long)value, base); }
+  size_t print(unsigned long value, int base = 10) { return printf(base == 16 ? "%lX" : base == 8 ? "%lo" : "%lu", value); }
+  size_t print(long long value, int base = 10) { return printf("%lld", value); }
+  size_t print(unsigned long long value, int base = 10) { return printf("%llu", value); }
+  size_t print(double value, int decimals = 2) { return printf("%.*f", decimals, value); }
+
+  template <typename T>
+  size_t println(const T &value)
+  {
+    size_t n = print(value);
+    return n + println();
+  }
+  template <typename T>
+  size_t println(const T &value, int format)
+  {
+    size_t n = print(value, format);
+    return n + println();
+  }
+  size_t println() { return write("\r\n"); }
+
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+  {
+    char buffer[512];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (length < 0)
+      return 0;
+    return write((const uint8_t *)buffer, std::min((size_t)length, sizeof(buffer) - 1));
+  }
+};
+
+class Stream : public Print
+{
+public:
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+  virtual int peek() { return -1; }
+  virtual void flush() {}
+  void setTimeout(unsigned long) {}
+  size_t readBytes(uint8_t *buffer, size_t length)
+  {
+    size_t n = 0;
+    int c;
+    while (n < length && (c = read()) >= 0)
+      buffer[n++] = c;
+    return n;
+  }
+  size_t readBytes(char *buffer, size_t length) { return readBytes((uint8_t *)buffer, length); }
+  String readStringUntil(char terminator)
+  {
+    String result;
+    int c;
+    while ((c = read()) >= 0 && c != terminator)
+      result += (char)c;
+    return result;
+  }
+  String readString() { return readStringUntil('\0'); }
+};
+
+class HardwareSerial : public Stream
+{
+public:
+  void begin(unsigned long) {}
+  using Print::write;
+  size_t write(uint8_t c) override
+  {
+    output += (char)c;
+    if (echo)
+      putchar(c);
+    return 1;
+  }
+  size_t write(const uint8_t *buffer, size_t size) override
+  {
+    output.append((const char *)buffer, size);
+    if (echo)
+      fwrite(buffer, 1, size, stdout);
+    return size;
+  }
+  bool contains(const char *text) const { return output.find(text) != std::string::npos; }
+  void clear() { output.clear(); }
+
+  std::string output;
+  bool echo = false; // also print to stdout, for debugging a test
+};
+inline HardwareSerial Serial;
+
+// ************* ESP *************
+class EspClass
+{
+public:
+  uint32_t getFreeHeap() { return free_heap; }
+  uint32_t getMinFreeHeap() { return free_heap; }
+  uint32_t getMaxAllocHeap() { return free_heap; }
+  uint32_t getHeapSize() { return 320 * 1024; }
+  uint32_t getPsramSize() { return psram_size; }
+  uint32_t getFreePsram() { return psram_size; }
+  uint32_t getMaxAllocPsram() { return psram_size; }
+  uint32_t getCycleCount() { return (uint32_t)(hostTimeUs * 240); }
+  uint64_t getEfuseMac() { return 0x0000AABBCCDDEEFFULL; }
+  void restart() { restarts++; }
+
+  uint32_t free_heap = 200 * 1024;
+  uint32_t psram_size = 0;
+  uint32_t restarts = 0;
+};
+inline EspClass ESP;
+inline bool psramFound() { return ESP.psram_size > 0; }
+inline void *ps_malloc(size_t size) { return malloc(size); }
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+
+#endif // HOST_ARDUINO_H
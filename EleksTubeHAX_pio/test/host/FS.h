@@ -0,0 +1,158 @@
+#ifndef HOST_FS_H
+#define HOST_FS_H
+
+// In-memory file system for the host tests, with the semantics of the ESP32 core's fs::FS (SPIFFS).
+// Open files share the content with the file system, so a file written by one handle is seen by all.
+
+#include "Arduino.h"
+#include <map>
+#include <memory>
+
+namespace fs
+{
+enum SeekMode
+{
+  SeekSet = 0,
+  SeekCur = 1,
+  SeekEnd = 2
+};
+
+class FS;
+
+class File : public Stream
+{
+public:
+  File() {}
+  File(std::shared_ptr<std::string> data, const std::string &path, bool readable, bool writable, bool append, FS *fs)
+      : data(data), path(path), readable(readable), writable(writable), append(append), fs(fs) {}
+
+  operator bool() const { return data != nullptr; }
+
+  using Print::write;
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override;
+  int available() override { return data && readable ? (int)(data->size() - pos) : 0; }
+  int read() override
+  {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+  }
+  int peek() override { return available() > 0 ? (uint8_t)(*data)[pos] : -1; }
+  size_t read(uint8_t *buffer, size_t size)
+  {
+    if (!data || !readable)
+      return 0;
+    size_t n = std::min(size, data->size() - pos);
+    memcpy(buffer, data->data() + pos, n);
+    pos += n;
+    return n;
+  }
+  bool seek(uint32_t offset, SeekMode mode = SeekSet)
+  {
+    if (!data)
+      return false;
+    size_t target = mode == SeekSet ? offset : mode == SeekCur ? pos + offset : data->size() + offset;
+    if (target > data->size())
+      return false;
+    pos = target;
+    return true;
+  }
+  size_t position() const { return pos; }
+  size_t size() const { return data ? data->size() : 0; }
+  void flush() override {}
+  void close() { data.reset(); }
+  bool isDirectory() { return false; }
+  const char *name() const { return path.c_str(); }
+  const char *path_() const { return path.c_str(); }
+
+private:
+  std::shared_ptr<std::string> data;
+  std::string path;
+  size_t pos = 0;
+  bool readable = false;
+  bool writable = false;
+  bool append = false;
+  FS *fs = nullptr;
+};
+
+class FS
+{
+public:
+  File open(const char *path, const char *mode = "r", bool create = false)
+  {
+    std::string name(path);
+    bool exists_ = files.count(name) > 0;
+    bool plus = strchr(mode, '+') != NULL;
+    if (mode[0] == 'r' && !exists_)
+      return File();
+    if (mode[0] == 'w' || !exists_)
+      files[name] = std::make_shared<std::string>();
+    opens++;
+    File f(files[name], name, mode[0] == 'r' || plus, mode[0] != 'r' || plus, mode[0] == 'a', this);
+    return f;
+  }
+  File open(const String &path, const char *mode = "r", bool create = false) { return open(path.c_str(), mode, create); }
+  bool exists(const char *path) { return files.count(path) > 0; }
+  bool exists(const String &path) { return exists(path.c_str()); }
+  bool remove(const char *path) { return files.erase(path) > 0; }
+  bool remove(const String &path) { return remove(path.c_str()); }
+  bool rename(const char *from, const char *to)
+  {
+    auto it = files.find(from);
+    if (it == files.end())
+      return false;
+    files[to] = it->second;
+    files.erase(from);
+    return true;
+  }
+  bool rename(const String &from, const String &to) { return rename(from.c_str(), to.c_str()); }
+  size_t usedBytes()
+  {
+    size_t used = 0;
+    for (auto &file : files)
+      used += file.second->size();
+    return used;
+  }
+
+  // host only
+  void reset()
+  {
+    files.clear();
+    opens = 0;
+  }
+  std::string content(const char *path) { return exists(path) ? *files[path] : std::string(); }
+  void setContent(const char *path, const std::string &content) { files[path] = std::make_shared<std::string>(content); }
+
+  std::map<std::string, std::shared_ptr<std::string>> files;
+  size_t capacity = 1024 * 1024; // writes fail when the used bytes would exceed this
+  uint32_t opens = 0;
+};
+
+inline size_t File::write(const uint8_t *buffer, size_t size)
+{
+  if (!data || !writable)
+    return 0;
+  size_t used = fs->usedBytes();
+  size_t grow = append ? size : (pos + size > data->size() ? pos + size - data->size() : 0);
+  if (used + grow > fs->capacity)
+    return 0;
+  if (append)
+    pos = data->size();
+  if (pos + size > data->size())
+    data->resize(pos + size);
+  memcpy(&(*data)[pos], buffer, size);
+  pos += size;
+  return size;
+}
+} // namespace fs
+
+#ifndef FS_NO_GLOBALS
+using fs::File;
+using fs::FS;
+using fs::SeekCur;
+using fs::SeekEnd;
+using fs::SeekMode;
+using fs::SeekSet;
+#endif
+
+#endif // HOST_FS_H
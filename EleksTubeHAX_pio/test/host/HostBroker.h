@@ -0,0 +1,127 @@
+#ifndef HOST_BROKER_H
+#define HOST_BROKER_H
+
+// In-process stand-in for the MQTT broker the device's PubSubClient talks to. It keeps retained messages,
+// honours the device's subscriptions (with + and # wildcards) and logs everything the device publishes with
+// the fake clock's time, so tests can replay Home Assistant traffic and check what came back.
+
+#include "Arduino.h"
+#include <deque>
+#include <map>
+#include <vector>
+
+struct HostMessage
+{
+  std::string topic;
+  std::string payload;
+  bool retain = false;
+  uint32_t ms = 0;
+};
+
+class HostBroker
+{
+public:
+  bool accept = true;    // answer connection attempts with success
+  int refuse_state = 5;  // PubSubClient state reported when accept is false (MQTT_CONNECT_UNAUTHORIZED)
+  bool connected = false;
+  uint32_t connects = 0;
+  std::string will_topic;
+  std::string will_payload;
+  bool will_retain = false;
+  std::vector<std::string> subscriptions;
+  std::map<std::string, std::string> retained;
+  std::vector<HostMessage> published; // by the device
+  std::deque<HostMessage> inbound;    // to the device
+
+  static bool matches(const std::string &filter, const std::string &topic)
+  {
+    size_t f = 0, t = 0;
+    while (f < filter.size())
+    {
+      if (filter[f] == '#')
+        return true;
+      if (filter[f] == '+')
+      {
+        while (t < topic.size() && topic[t] != '/')
+          t++;
+        f++;
+        continue;
+      }
+      if (t >= topic.size() || filter[f] != topic[t])
+        return false;
+      f++;
+      t++;
+    }
+    return t == topic.size();
+  }
+
+  bool subscribed(const std::string &topic) const
+  {
+    for (const std::string &filter : subscriptions)
+      if (matches(filter, topic))
+        return true;
+    return false;
+  }
+
+  // A message from another client (e.g. Home Assistant).
+  void send(const std::string &topic, const std::string &payload, bool retain = false)
+  {
+    if (retain)
+      retained[topic] = payload;
+    if (connected && subscribed(topic))
+      inbound.push_back({topic, payload, retain, (uint32_t)millis()});
+  }
+
+  void receive(const std::string &topic, const std::string &payload, bool retain)
+  {
+    published.push_back({topic, payload, retain, (uint32_t)millis()});
+    if (retain)
+      retained[topic] = payload;
+    if (subscribed(topic))
+      inbound.push_back({topic, payload, false, (uint32_t)millis()});
+  }
+
+  void subscribe(const std::string &filter)
+  {
+    subscriptions.push_back(filter);
+    for (auto &message : retained)
+      if (matches(filter, message.first))
+        inbound.push_back({message.first, message.second, true, (uint32_t)millis()});
+  }
+
+  // The connection drops without a clean disconnect: the broker publishes the last will.
+  void drop()
+  {
+    if (connected && !will_topic.empty() && will_retain)
+      retained[will_topic] = will_payload;
+    connected = false;
+    subscriptions.clear();
+    inbound.clear();
+  }
+
+  size_t count(const std::string &filter, uint32_t since_ms = 0) const
+  {
+    size_t n = 0;
+    for (const HostMessage &message : published)
+      if (message.ms >= since_ms && matches(filter, message.topic))
+        n++;
+    return n;
+  }
+
+  const HostMessage *last(const std::string &filter) const
+  {
+    for (auto it = published.rbegin(); it != published.rend(); ++it)
+      if (matches(filter, it->topic))
+        return &*it;
+    return nullptr;
+  }
+
+  void reset()
+  {
+    *this = HostBroker();
+  }
+};
+
+inline HostBroker broker;
+
+#endif // HOST_BROKER_H
@@ -0,0 +1,79 @@
+#ifndef HOST_NTP_H
+#define HOST_NTP_H
+
+// Fake NTP servers behind the fake UDP socket. Every server (by address) has its own offset from the true time,
+// network delay in both directions and can drop the requests; mangle() can break the answers.
+
+#include "WiFi.h"
+#include "WiFiUdp.h"
+#include <functional>
+#include <map>
+
+struct HostNtpServer
+{
+  int32_t offset_ms = 0; // a falseticker has a big one
+  uint32_t out_ms = 15;  // request travel time
+  uint32_t back_ms = 15; // answer travel time
+  uint32_t proc_ms = 1;  // between the receive and transmit timestamps of the server
+  bool lose = false;
+  uint32_t answered = 0;
+};
+
+struct HostNtp
+{
+  uint64_t epoch_ms_at_zero = 1760000000000ULL; // true UTC when hostTimeUs is 0 (2025-10-09)
+  std::map<uint32_t, HostNtpServer> servers;     // by address
+  std::function<void(std::vector<uint8_t> &answer)> mangle;
+
+  uint64_t trueMs(uint64_t at_us = hostTimeUs) const { return epoch_ms_at_zero + at_us / 1000; }
+
+  // Adds a server and its DNS name.
+  HostNtpServer &add(const char *name, IPAddress ip)
+  {
+    WiFi.hosts[name] = ip;
+    return servers[(uint32_t)ip];
+  }
+  void attach(WiFiUDP &udp)
+  {
+    udp.responder = [this](WiFiUDP &udp, const HostPacket &request)
+    { answer(udp, request); };
+  }
+  void reset() { *this = HostNtp(); }
+
+  static void put(uint8_t *p, uint64_t epoch_ms)
+  {
+    uint32_t seconds = epoch_ms / 1000 + 2208988800UL;
+    uint32_t fraction = (uint32_t)((((epoch_ms % 1000) << 32) + 999) / 1000);
+    for (int i = 0; i < 4; i++)
+    {
+      p[i] = seconds >> (24 - 8 * i);
+      p[4 + i] = fraction >> (24 - 8 * i);
+    }
+  }
+
+  void answer(WiFiUDP &udp, const HostPacket &request)
+  {
+    IPAddress ip = request.ip;
+    if (!request.host.empty() && WiFi.hosts.count(request.host))
+      ip = WiFi.hosts[request.host];
+    auto it = servers.find((uint32_t)ip);
+    if (it == servers.end() || it->second.lose || request.data.size() != 48)
+      return;
+    HostNtpServer &server = it->second;
+    server.answered++;
+    std::vector<uint8_t> answer(48, 0);
+    answer[0] = 0x24; // LI 0, version 4, mode 4 (server)
+    answer[1] = 2;    // stratum
+    put(&answer[16], trueMs() - 60000 + server.offset_ms);               // reference timestamp
+    memcpy(&answer[24], &request.data[40], 8);                           // origin = our transmit timestamp
+    uint64_t received = trueMs(hostTimeUs + server.out_ms * 1000ULL) + server.offset_ms;
+    put(&answer[32], received);
+    put(&answer[40], received + server.proc_ms);
+    if (mangle)
+      mangle(answer);
+    udp.deliver(answer, (server.out_ms + server.proc_ms + server.back_ms) * 1000);
+  }
+};
+inline HostNtp hostNtp;
+
+#endif // HOST_NTP_H
@@ -0,0 +1,58 @@
+#ifndef HOST_PREFERENCES_H
+#define HOST_PREFERENCES_H
+
+// In-memory NVS, shared by all Preferences instances like the flash partition.
+
+#include "Arduino.h"
+#include <map>
+#include <vector>
+
+inline std::map<std::string, std::vector<uint8_t>> hostNvs;
+
+class Preferences
+{
+public:
+  bool begin(const char *name, bool readOnly = false)
+  {
+    prefix = std::string(name) + "/";
+    return true;
+  }
+  void end() {}
+  bool isKey(const char *key) { return hostNvs.count(prefix + key) > 0; }
+  bool remove(const char *key) { return hostNvs.erase(prefix + key) > 0; }
+  size_t getBytesLength(const char *key) { return isKey(key) ? hostNvs[prefix + key].size() : 0; }
+  size_t getBytes(const char *key, void *buffer, size_t length)
+  {
+    if (!isKey(key) || hostNvs[prefix + key].size() > length)
+      return 0;
+    std::vector<uint8_t> &value = hostNvs[prefix + key];
+    memcpy(buffer, value.data(), value.size());
+    return value.size();
+  }
+  size_t putBytes(const char *key, const void *buffer, size_t length)
+  {
+    hostNvs[prefix + key].assign((const uint8_t *)buffer, (const uint8_t *)buffer + length);
+    return length;
+  }
+  uint32_t getUInt(const char *key, uint32_t defaultValue = 0)
+  {
+    uint32_t value = defaultValue;
+    getBytes(key, &value, sizeof(value));
+    return value;
+  }
+  size_t putUInt(const char *key, uint32_t value) { return putBytes(key, &value, sizeof(value)); }
+  String getString(const char *key, String defaultValue = String())
+  {
+    if (!isKey(key))
+      return defaultValue;
+    std::vector<uint8_t> &value = hostNvs[prefix + key];
+    return String(std::string(value.begin(), value.end()).c_str());
+  }
+  size_t putString(const char *key, const char *value) { return putBytes(key, value, strlen(value)); }
+  size_t putString(const char *key, String value) { return putString(key, value.c_str()); }
+
+private:
+  std::string prefix;
+};
+
+#endif // HOST_PREFERENCES_H
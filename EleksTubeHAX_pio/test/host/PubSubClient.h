@@ -0,0 +1,155 @@
+#ifndef HOST_PUBSUBCLIENT_H
+#define HOST_PUBSUBCLIENT_H
+
+// PubSubClient with the library's API and limits, talking to the in-process broker (HostBroker.h).
+
+#include "Arduino.h"
+#include "WiFi.h"
+#include <functional>
+
+#define MQTT_CONNECTION_TIMEOUT -4
+#define MQTT_CONNECTION_LOST -3
+#define MQTT_CONNECT_FAILED -2
+#define MQTT_DISCONNECTED -1
+#define MQTT_CONNECTED 0
+#define MQTT_CONNECT_BAD_PROTOCOL 1
+#define MQTT_CONNECT_BAD_CLIENT_ID 2
+#define MQTT_CONNECT_UNAVAILABLE 3
+#define MQTT_CONNECT_BAD_CREDENTIALS 4
+#define MQTT_CONNECT_UNAUTHORIZED 5
+#define MQTT_MAX_PACKET_SIZE 256
+#define MQTT_MAX_HEADER_SIZE 5
+
+class PubSubClient : public Print
+{
+public:
+  typedef void (*Callback)(char *, uint8_t *, unsigned int);
+
+  PubSubClient(Client &client) {}
+  PubSubClient &setServer(const char *domain, uint16_t port) { return *this; }
+  PubSubClient &setCallback(Callback callback)
+  {
+    this->callback = callback;
+    return *this;
+  }
+  PubSubClient &setClient(Client &client) { return *this; }
+  PubSubClient &setKeepAlive(uint16_t keepAlive) { return *this; }
+  PubSubClient &setSocketTimeout(uint16_t timeout) { return *this; }
+  bool setBufferSize(uint16_t size)
+  {
+    buffer_size = size;
+    return true;
+  }
+  uint16_t getBufferSize() { return buffer_size; }
+
+  bool connect(const char *id, const char *user, const char *pass, const char *willTopic, uint8_t willQos, bool willRetain, const char *willMessage, bool cleanSession = true)
+  {
+    if (!broker.accept)
+    {
+      client_state = broker.refuse_state;
+      return false;
+    }
+    broker.connected = true;
+    broker.connects++;
+    broker.subscriptions.clear();
+    broker.inbound.clear();
+    broker.will_topic = willTopic ? willTopic : "";
+    broker.will_payload = willMessage ? willMessage : "";
+    broker.will_retain = willRetain;
+    client_state = MQTT_CONNECTED;
+    return true;
+  }
+  void disconnect()
+  {
+    broker.connected = false;
+    client_state = MQTT_DISCONNECTED;
+  }
+
+  bool publish(const char *topic, const char *payload) { return publish(topic, (const uint8_t *)payload, payload ? strlen(payload) : 0, false); }
+  bool publish(const char *topic, const char *payload, bool retained) { return publish(topic, (const uint8_t *)payload, payload ? strlen(payload) : 0, retained); }
+  bool publish(const char *topic, const uint8_t *payload, unsigned int length) { return publish(topic, payload, length, false); }
+  bool publish(const char *topic, const uint8_t *payload, unsigned int length, bool retained)
+  {
+    if (!connected() || MQTT_MAX_HEADER_SIZE + 2 + strlen(topic) + length > buffer_size)
+      return false;
+    broker.receive(topic, std::string((const char *)payload, length), retained);
+    return true;
+  }
+
+  // Streamed publish: not limited by the buffer size.
+  bool beginPublish(const char *topic, unsigned int length, bool retained)
+  {
+    if (!connected())
+      return false;
+    stream_topic = topic;
+    stream_payload.clear();
+    stream_length = length;
+    stream_retain = retained;
+    return true;
+  }
+  using Print::write;
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override
+  {
+    if (!connected())
+      return 0;
+    stream_payload.append((const char *)buffer, size);
+    return size;
+  }
+  int endPublish()
+  {
+    if (!connected() || stream_payload.size() != stream_length)
+      return 0; // the broker would see a malformed packet
+    broker.receive(stream_topic, stream_payload, stream_retain);
+    return 1;
+  }
+
+  bool subscribe(const char *topic, uint8_t qos = 0)
+  {
+    if (!connected())
+      return false;
+    broker.subscribe(topic);
+    return true;
+  }
+  bool unsubscribe(const char *topic) { return connected(); }
+
+  // Handles one incoming packet, like the library: the payload points into the receive buffer and is not
+  // terminated (the byte after it is garbage); packets larger than the buffer are dropped.
+  bool loop()
+  {
+    if (!connected())
+      return false;
+    if (!broker.inbound.empty())
+    {
+      HostMessage message = broker.inbound.front();
+      broker.inbound.pop_front();
+      if (MQTT_MAX_HEADER_SIZE + 2 + message.topic.size() + message.payload.size() <= buffer_size && callback)
+      {
+        std::vector<char> topic(message.topic.begin(), message.topic.end());
+        topic.push_back(0);
+        std::vector<uint8_t> payload(message.payload.begin(), message.payload.end());
+        payload.push_back('~');
+        callback(topic.data(), payload.data(), (unsigned int)message.payload.size());
+      }
+    }
+    return true;
+  }
+  bool connected()
+  {
+    if (client_state == MQTT_CONNECTED && !broker.connected)
+      client_state = MQTT_CONNECTION_LOST;
+    return client_state == MQTT_CONNECTED;
+  }
+  int state() { return client_state; }
+
+private:
+  Callback callback = nullptr;
+  uint16_t buffer_size = MQTT_MAX_PACKET_SIZE;
+  int client_state = MQTT_DISCONNECTED;
+  std::string stream_topic;
+  std::string stream_payload;
+  size_t stream_length = 0;
+  bool stream_retain = false;
+};
+
+#endif // HOST_PUBSUBCLIENT_H
@@ -0,0 +1,93 @@
+#ifndef HOST_RTCLIB_H
+#define HOST_RTCLIB_H
+
+// Simulated DS3231 on the fake clock. Its oscillator runs off by hostRtc.ppm (positive = fast), corrected by
+// the aging offset register (0x10 on the fake I2C bus, about 0.1 ppm per step, positive slows it down). Like
+// the real chip, writing the time restarts the divider chain, so the next second starts a full second later.
+
+#include "Arduino.h"
+#include "Wire.h"
+#include <math.h>
+
+class DateTime
+{
+public:
+  DateTime(uint32_t t = 0) : t(t) {}
+  DateTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour = 0, uint8_t min = 0, uint8_t sec = 0)
+  { // days from civil, valid for the proleptic Gregorian calendar
+    int y = year - (month <= 2);
+    int era = y / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int32_t days = era * 146097 + doe - 719468;
+    t = (uint32_t)days * 86400 + hour * 3600 + min * 60 + sec;
+  }
+  uint32_t unixtime() const { return t; }
+
+private:
+  uint32_t t;
+};
+
+struct HostRtc
+{
+  double ppm = 0;          // oscillator error without the aging offset
+  uint32_t seconds = 0;    // time at the last write
+  double elapsed_us = 0;   // RTC time since then
+  uint64_t updated_us = 0; // hostTimeUs of the last update of elapsed_us
+  uint32_t read_us = 0;    // I2C time of one read, added to the fake clock
+  uint32_t reads = 0;
+  uint32_t writes = 0;
+  bool lost_power = false;
+
+  double effectivePpm() { return ppm - 0.1 * (int8_t)Wire.reg(0x68, 0x10); }
+  void update()
+  {
+    elapsed_us += (hostTimeUs - updated_us) * (1.0 + effectivePpm() * 1e-6);
+    updated_us = hostTimeUs;
+  }
+  // Sets the time of the chip, without counting it as a write by the firmware.
+  void set(uint32_t t, uint32_t fraction_ms = 0)
+  {
+    seconds = t;
+    elapsed_us = fraction_ms * 1000.0;
+    updated_us = hostTimeUs;
+  }
+  uint32_t now()
+  {
+    update();
+    return seconds + (uint32_t)floor(elapsed_us / 1e6);
+  }
+  // How far the RTC is ahead of the given time in ms.
+  double errorMs(double true_ms)
+  {
+    update();
+    return seconds * 1000.0 + elapsed_us / 1000.0 - true_ms;
+  }
+  void reset() { *this = HostRtc(); }
+};
+inline HostRtc hostRtc;
+
+class RTC_DS3231
+{
+public:
+  bool begin() { return true; }
+  DateTime now()
+  {
+    hostAdvanceUs(hostRtc.read_us);
+    hostRtc.reads++;
+    return DateTime(hostRtc.now());
+  }
+  void adjust(const DateTime &dt)
+  {
+    hostRtc.writes++;
+    hostRtc.lost_power = false;
+    hostRtc.set(dt.unixtime());
+  }
+  bool lostPower() { return hostRtc.lost_power; }
+  int readSqwPinMode() { return 0; }
+  bool isEnabled32K() { return false; }
+  float getTemperature() { return 25; }
+};
+
+#endif // HOST_RTCLIB_H
@@ -0,0 +1,20 @@
+#ifndef HOST_SPIFFS_H
+#define HOST_SPIFFS_H
+
+#include "FS.h"
+
+class SPIFFSFS : public fs::FS
+{
+public:
+  bool begin(bool formatOnFail = false) { return true; }
+  void end() {}
+  bool format()
+  {
+    reset();
+    return true;
+  }
+  size_t totalBytes() { return capacity; }
+};
+inline SPIFFSFS SPIFFS;
+
+#endif // HOST_SPIFFS_H
@@ -0,0 +1,68 @@
+#ifndef HOST_TFT_ESPI_H
+#define HOST_TFT_ESPI_H
+
+// Display driver that counts what is sent to it, for the host tests.
+
+#include "Arduino.h"
+
+#define TFT_BLACK 0x0000
+#define TFT_WHITE 0xFFFF
+#define TFT_RED 0xF800
+#define TFT_GREENYELLOW 0xB7E0
+#define TFT_MAGENTA 0xF81F
+#define TFT_YELLOW 0xFFE0
+#define TFT_CYAN 0x07FF
+#define TFT_ORANGE 0xFDA0
+#define TFT_BLUE 0x001F
+#define TFT_GREEN 0x07E0
+#define TFT_DARKGREY 0x7BEF
+#define TL_DATUM 0
+#define TC_DATUM 1
+#define MC_DATUM 4
+#define BC_DATUM 7
+
+class TFT_eSPI : public Print
+{
+public:
+  TFT_eSPI() {}
+  void init() {}
+  void fillScreen(uint32_t color) {}
+  void fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color) {}
+  void setTextColor(uint16_t color, uint16_t background) {}
+  void setTextColor(uint16_t color) {}
+  void setTextDatum(uint8_t datum) {}
+  void setCursor(int16_t x, int16_t y, uint8_t font) {}
+  void setCursor(int16_t x, int16_t y) {}
+  int16_t drawString(const char *string, int32_t x, int32_t y, uint8_t font) { return 0; }
+  int16_t drawString(const String &string, int32_t x, int32_t y, uint8_t font) { return 0; }
+  void pushImage(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t *data)
+  {
+    pushed_pixels += w * h;
+    last_push = data;
+  }
+  void pushImage(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t *data) { pushImage(x, y, w, h, (uint16_t *)data); }
+  void setAddrWindow(int32_t x, int32_t y, int32_t w, int32_t h) {}
+  void pushPixels(const void *data, uint32_t len)
+  {
+    pushed_pixels += len;
+    last_push = (const uint16_t *)data;
+  }
+  void startWrite() {}
+  void endWrite() {}
+  bool getSwapBytes() { return swap_bytes; }
+  void setSwapBytes(bool swap) { swap_bytes = swap; }
+  uint16_t alphaBlend(uint8_t alpha, uint16_t fgc, uint16_t bgc) { return alpha > 127 ? fgc : bgc; }
+  int16_t width() { return 135; }
+  int16_t height() { return 240; }
+  using Print::write;
+  size_t write(uint8_t c) override { return 1; }
+
+  // host only
+  uint64_t pushed_pixels = 0;
+  const uint16_t *last_push = nullptr;
+
+private:
+  bool swap_bytes = false;
+};
+
+#endif // HOST_TFT_ESPI_H
@@ -0,0 +1,183 @@
+#ifndef HOST_TIMELIB_H
+#define HOST_TIMELIB_H
+
+// TimeLib with the library's calendar math and sync behaviour, running on the fake clock (millis()).
+
+#include "Arduino.h"
+#include <time.h>
+
+typedef struct
+{
+  uint8_t Second;
+  uint8_t Minute;
+  uint8_t Hour;
+  uint8_t Wday; // day of week, sunday is day 1
+  uint8_t Day;
+  uint8_t Month;
+  uint8_t Year; // offset from 1970
+} tmElements_t;
+typedef enum
+{
+  timeNotSet,
+  timeNeedsSync,
+  timeSet
+} timeStatus_t;
+typedef time_t (*getExternalTime)();
+
+#define tmYearToCalendar(Y) ((Y) + 1970)
+#define CalendarYrToTm(Y) ((Y) - 1970)
+#define SECS_PER_MIN ((time_t)(60UL))
+#define SECS_PER_HOUR ((time_t)(3600UL))
+#define SECS_PER_DAY ((time_t)(SECS_PER_HOUR * 24UL))
+#define LEAP_YEAR(Y) (((1970 + (Y)) > 0) && !((1970 + (Y)) % 4) && (((1970 + (Y)) % 100) || !((1970 + (Y)) % 400)))
+
+inline const uint8_t hostMonthDays[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+inline void breakTime(time_t timeInput, tmElements_t &tm)
+{
+  uint32_t time = (uint32_t)timeInput;
+  tm.Second = time % 60;
+  time /= 60;
+  tm.Minute = time % 60;
+  time /= 60;
+  tm.Hour = time % 24;
+  time /= 24;
+  tm.Wday = ((time + 4) % 7) + 1;
+
+  uint8_t year = 0;
+  unsigned long days = 0;
+  while ((unsigned)(days += (LEAP_YEAR(year) ? 366 : 365)) <= time)
+    year++;
+  tm.Year = year;
+  days -= LEAP_YEAR(year) ? 366 : 365;
+  time -= days;
+
+  uint8_t month;
+  for (month = 0; month < 12; month++)
+  {
+    uint8_t monthLength = (month == 1 && LEAP_YEAR(year)) ? 29 : hostMonthDays[month];
+    if (time >= monthLength)
+      time -= monthLength;
+    else
+      break;
+  }
+  tm.Month = month + 1;
+  tm.Day = time + 1;
+}
+
+inline time_t makeTime(const tmElements_t &tm)
+{
+  uint32_t seconds = tm.Year * (SECS_PER_DAY * 365);
+  for (int i = 0; i < tm.Year; i++)
+    if (LEAP_YEAR(i))
+      seconds += SECS_PER_DAY;
+  for (int i = 1; i < tm.Month; i++)
+    seconds += SECS_PER_DAY * ((i == 2 && LEAP_YEAR(tm.Year)) ? 29 : hostMonthDays[i - 1]);
+  seconds += (tm.Day - 1) * SECS_PER_DAY;
+  seconds += tm.Hour * SECS_PER_HOUR;
+  seconds += tm.Minute * SECS_PER_MIN;
+  seconds += tm.Second;
+  return (time_t)seconds;
+}
+
+struct HostTimeLib
+{
+  uint32_t sysTime = 0;
+  uint32_t prevMillis = 0;
+  uint32_t nextSyncTime = 0;
+  uint32_t syncInterval = 300;
+  timeStatus_t status = timeNotSet;
+  getExternalTime provider = nullptr;
+};
+inline HostTimeLib hostTimeLib;
+
+inline void setTime(time_t t)
+{
+  hostTimeLib.sysTime = (uint32_t)t;
+  hostTimeLib.nextSyncTime = (uint32_t)t + hostTimeLib.syncInterval;
+  hostTimeLib.status = timeSet;
+  hostTimeLib.prevMillis = millis();
+}
+
+inline time_t now()
+{
+  while (millis() - hostTimeLib.prevMillis >= 1000)
+  {
+    hostTimeLib.sysTime++;
+    hostTimeLib.prevMillis += 1000;
+  }
+  if (hostTimeLib.nextSyncTime <= hostTimeLib.sysTime && hostTimeLib.provider)
+  {
+    time_t t = hostTimeLib.provider();
+    if (t != 0)
+    {
+      setTime(t);
+    }
+    else
+    {
+      hostTimeLib.nextSyncTime = hostTimeLib.sysTime + hostTimeLib.syncInterval;
+      hostTimeLib.status = (hostTimeLib.status == timeNotSet) ? timeNotSet : timeNeedsSync;
+    }
+  }
+  return (time_t)hostTimeLib.sysTime;
+}
+
+inline void adjustTime(long adjustment) { hostTimeLib.sysTime += adjustment; }
+inline timeStatus_t timeStatus()
+{
+  now();
+  return hostTimeLib.status;
+}
+inline void setSyncProvider(getExternalTime getTimeFunction)
+{
+  hostTimeLib.provider = getTimeFunction;
+  hostTimeLib.nextSyncTime = hostTimeLib.sysTime;
+  now();
+}
+inline void setSyncInterval(time_t interval)
+{
+  hostTimeLib.syncInterval = (uint32_t)interval;
+  hostTimeLib.nextSyncTime = hostTimeLib.sysTime + hostTimeLib.syncInterval;
+}
+
+inline int hour(time_t t)
+{
+  tmElements_t tm;
+  breakTime(t, tm);
+  return tm.Hour;
+}
+inline int minute(time_t t) { return (t / 60) % 60; }
+inline int second(time_t t) { return t % 60; }
+inline int day(time_t t)
+{
+  tmElements_t tm;
+  breakTime(t, tm);
+  return tm.Day;
+}
+inline int weekday(time_t t)
+{
+  tmElements_t tm;
+  breakTime(t, tm);
+  return tm.Wday;
+}
+inline int month(time_t t)
+{
+  tmElements_t tm;
+  breakTime(t, tm);
+  return tm.Month;
+}
+inline int year(time_t t)
+{
+  tmElements_t tm;
+  breakTime(t, tm);
+  return tmYearToCalendar(tm.Year);
+}
+inline int hourFormat12(time_t t)
+{
+  int h = hour(t) % 12;
+  return h == 0 ? 12 : h;
+}
+inline uint8_t isAM(time_t t) { return hour(t) < 12; }
+inline uint8_t isPM(time_t t) { return hour(t) >= 12; }
+
+#endif // HOST_TIMELIB_H
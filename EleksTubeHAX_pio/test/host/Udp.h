@@ -0,0 +1,50 @@
+#ifndef HOST_UDP_H
+#define HOST_UDP_H
+
+#include "Arduino.h"
+
+class IPAddress
+{
+public:
+  IPAddress() {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : bytes{a, b, c, d} {}
+  explicit IPAddress(uint32_t address) { memcpy(bytes, &address, 4); }
+  operator uint32_t() const
+  {
+    uint32_t address;
+    memcpy(&address, bytes, 4);
+    return address;
+  }
+  bool operator==(const IPAddress &other) const { return memcmp(bytes, other.bytes, 4) == 0; }
+  bool operator!=(const IPAddress &other) const { return !(*this == other); }
+  uint8_t operator[](int index) const { return bytes[index]; }
+  String toString() const
+  {
+    char buffer[16];
+    snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", bytes[0], bytes[1], bytes[2], bytes[3]);
+    return String(buffer);
+  }
+
+private:
+  uint8_t bytes[4] = {0, 0, 0, 0};
+};
+
+#define INADDR_NONE IPAddress()
+
+class UDP : public Stream
+{
+public:
+  virtual uint8_t begin(uint16_t port) = 0;
+  virtual void stop() = 0;
+  virtual int beginPacket(IPAddress ip, uint16_t port) = 0;
+  virtual int beginPacket(const char *host, uint16_t port) = 0;
+  virtual int endPacket() = 0;
+  virtual int parsePacket() = 0;
+  virtual int read(unsigned char *buffer, size_t len) = 0;
+  virtual int read(char *buffer, size_t len) = 0;
+  virtual IPAddress remoteIP() = 0;
+  virtual uint16_t remotePort() = 0;
+  using Stream::read;
+};
+
+#endif // HOST_UDP_H
@@ -0,0 +1,97 @@
+#ifndef HOST_WIFI_H
+#define HOST_WIFI_H
+
+// Host WiFi: always connected, the TCP client is wired to the in-process broker, and host names resolve
+// from a table the test fills (unknown names fail, like a DNS timeout).
+
+#include "Arduino.h"
+#include "Udp.h"
+#include "WiFiUdp.h"
+#include "HostBroker.h"
+#include <map>
+
+class Client : public Stream
+{
+public:
+  virtual int connect(const char *host, uint16_t port) { return 1; }
+  virtual uint8_t connected() { return broker.connected; }
+  virtual void stop() {}
+  using Print::write;
+  size_t write(uint8_t c) override { return 1; }
+  int available() override { return (int)broker.inbound.size(); }
+};
+
+class WiFiClient : public Client
+{
+public:
+  void setTimeout(uint32_t seconds) {}
+};
+
+enum WiFiEvent_t
+{
+  ARDUINO_EVENT_WIFI_STA_START,
+  ARDUINO_EVENT_WIFI_STA_CONNECTED,
+  ARDUINO_EVENT_WIFI_STA_GOT_IP,
+  ARDUINO_EVENT_WIFI_STA_DISCONNECTED,
+  ARDUINO_EVENT_WPS_ER_SUCCESS,
+  ARDUINO_EVENT_WPS_ER_FAILED,
+  ARDUINO_EVENT_WPS_ER_TIMEOUT,
+  ARDUINO_EVENT_WPS_ER_PIN
+};
+enum wifi_mode_t
+{
+  WIFI_MODE_NULL,
+  WIFI_MODE_STA
+};
+#define WIFI_STA WIFI_MODE_STA
+typedef struct
+{
+  struct
+  {
+    int reason;
+  } wifi_sta_disconnected;
+} WiFiEventInfo_t;
+
+typedef enum
+{
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_DISCONNECTED = 6
+} wl_status_t;
+
+class WiFiClass
+{
+public:
+  wl_status_t wifi_status = WL_CONNECTED;
+  int8_t rssi = -60;
+  std::map<std::string, IPAddress> hosts; // for hostByName()
+  uint32_t lookups = 0;
+
+  String macAddress() { return String("24:0A:C4:12:34:56"); }
+  IPAddress localIP() { return IPAddress(192, 168, 1, 50); }
+  String SSID() { return String("host"); }
+  int8_t RSSI() { return rssi; }
+  wl_status_t status() { return wifi_status; }
+  void begin() {}
+  void begin(const char *ssid, const char *password) {}
+  bool reconnect() { return true; }
+  bool mode(wifi_mode_t mode) { return true; }
+  bool config(IPAddress local, IPAddress gateway, IPAddress subnet, IPAddress dns = IPAddress()) { return true; }
+  bool disconnect(bool wifioff = false, bool eraseap = false) { return true; }
+  int onEvent(void (*callback)(WiFiEvent_t, WiFiEventInfo_t)) { return 0; }
+  bool setHostname(const char *hostname) { return true; }
+  int hostByName(const char *host, IPAddress &result)
+  {
+    lookups++;
+    auto it = hosts.find(host);
+    if (it == hosts.end())
+      return 0;
+    result = it->second;
+    return 1;
+  }
+};
+inline WiFiClass WiFi;
+
+#endif // HOST_WIFI_H
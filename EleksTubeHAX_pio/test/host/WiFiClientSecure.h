@@ -0,0 +1,14 @@
+#ifndef HOST_WIFICLIENTSECURE_H
+#define HOST_WIFICLIENTSECURE_H
+
+#include "WiFi.h"
+
+class WiFiClientSecure : public WiFiClient
+{
+public:
+  void setInsecure() {}
+  bool loadCACert(Stream &stream, size_t size) { return true; }
+  void setHandshakeTimeout(unsigned long timeout) {}
+};
+
+#endif // HOST_WIFICLIENTSECURE_H
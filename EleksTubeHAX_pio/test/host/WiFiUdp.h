@@ -0,0 +1,106 @@
+#ifndef HOST_WIFIUDP_H
+#define HOST_WIFIUDP_H
+
+// Fake UDP socket. Sent packets are logged; replies come from a responder set by the test, which can delay,
+// drop or mangle them. Received packets only become readable once the fake clock reaches their arrival time.
+
+#include "Udp.h"
+#include <deque>
+#include <functional>
+#include <vector>
+
+struct HostPacket
+{
+  std::vector<uint8_t> data;
+  IPAddress ip;
+  std::string host; // set when the packet was addressed by name (needs a DNS lookup on the device)
+  uint16_t port = 0;
+  uint64_t at_us = 0;
+};
+
+class WiFiUDP : public UDP
+{
+public:
+  // Called for every sent packet; may push replies with deliver().
+  std::function<void(WiFiUDP &udp, const HostPacket &packet)> responder;
+  std::vector<HostPacket> sent;
+  std::deque<HostPacket> incoming;
+
+  void deliver(const std::vector<uint8_t> &data, uint32_t delay_us)
+  {
+    HostPacket packet;
+    packet.data = data;
+    packet.at_us = hostTimeUs + delay_us;
+    auto it = incoming.begin();
+    while (it != incoming.end() && it->at_us <= packet.at_us)
+      ++it;
+    incoming.insert(it, packet);
+  }
+
+  uint8_t begin(uint16_t port) override { return 1; }
+  void stop() override {}
+  int beginPacket(IPAddress ip, uint16_t port) override
+  {
+    outgoing = HostPacket();
+    outgoing.ip = ip;
+    outgoing.port = port;
+    return 1;
+  }
+  int beginPacket(const char *host, uint16_t port) override
+  {
+    outgoing = HostPacket();
+    outgoing.host = host;
+    outgoing.port = port;
+    return 1;
+  }
+  int endPacket() override
+  {
+    outgoing.at_us = hostTimeUs;
+    sent.push_back(outgoing);
+    if (responder)
+      responder(*this, outgoing);
+    return 1;
+  }
+  using Print::write;
+  size_t write(uint8_t c) override
+  {
+    outgoing.data.push_back(c);
+    return 1;
+  }
+  size_t write(const uint8_t *buffer, size_t size) override
+  {
+    outgoing.data.insert(outgoing.data.end(), buffer, buffer + size);
+    return size;
+  }
+  int parsePacket() override
+  {
+    current.clear();
+    position = 0;
+    if (incoming.empty() || incoming.front().at_us > hostTimeUs)
+      return 0;
+    current = incoming.front().data;
+    incoming.pop_front();
+    return (int)current.size();
+  }
+  int available() override { return (int)(current.size() - position); }
+  int read() override { return position < current.size() ? current[position++] : -1; }
+  int read(unsigned char *buffer, size_t len) override
+  {
+    size_t n = std::min(len, current.size() - position);
+    memcpy(buffer, current.data() + position, n);
+    position += n;
+    return (int)n;
+  }
+  int read(char *buffer, size_t len) override { return read((unsigned char *)buffer, len); }
+  int peek() override { return position < current.size() ? current[position] : -1; }
+  void flush() override {}
+  IPAddress remoteIP() override { return IPAddress(); }
+  uint16_t remotePort() override { return 123; }
+
+private:
+  HostPacket outgoing;
+  std::vector<uint8_t> current;
+  size_t position = 0;
+};
+
+#endif // HOST_WIFIUDP_H
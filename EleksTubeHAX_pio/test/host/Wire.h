@@ -0,0 +1,70 @@
+#ifndef HOST_WIRE_H
+#define HOST_WIRE_H
+
+// Fake I2C bus: every device has 256 byte registers. The first byte of a transmission sets the register
+// pointer, the following bytes are written with auto increment, like the DS3231 does it.
+
+#include "Arduino.h"
+#include <array>
+#include <map>
+
+class TwoWire : public Stream
+{
+public:
+  std::map<uint8_t, std::array<uint8_t, 256>> devices; // registers per I2C address
+  uint32_t transmissions = 0;
+
+  bool begin() { return true; }
+  bool begin(int sda, int scl, uint32_t frequency = 0) { return true; }
+  void beginTransmission(uint8_t address)
+  {
+    this->address = address;
+    first = true;
+  }
+  uint8_t endTransmission(bool sendStop = true)
+  {
+    transmissions++;
+    return 0;
+  }
+  size_t write(uint8_t data) override
+  {
+    if (first)
+      pointer = data;
+    else
+      devices[address][pointer++] = data;
+    first = false;
+    return 1;
+  }
+  size_t write(const uint8_t *buffer, size_t size) override
+  {
+    for (size_t i = 0; i < size; i++)
+      write(buffer[i]);
+    return size;
+  }
+  uint8_t requestFrom(int address, int quantity)
+  {
+    this->address = address;
+    remaining = quantity;
+    return quantity;
+  }
+  int available() override { return remaining; }
+  int read() override
+  {
+    if (remaining == 0)
+      return -1;
+    remaining--;
+    return devices[address][pointer++];
+  }
+  int peek() override { return remaining ? devices[address][pointer] : -1; }
+  uint8_t reg(uint8_t address, uint8_t reg) { return devices[address][reg]; }
+
+private:
+  uint8_t address = 0;
+  uint8_t pointer = 0;
+  int remaining = 0;
+  bool first = false;
+};
+
+inline TwoWire Wire, Wire1;
+
+#endif // HOST_WIRE_H
@@ -0,0 +1,58 @@
+/*
+ * Project: Alternative firmware for EleksTube IPS clock
+ * File description: User preferences for the host tests (pio test -e native)
+ *   Every test suite includes this file first, so its guard keeps a _USER_DEFINES.h in the src folder out.
+ *   A suite can pick the plain MQTT mode by defining HOST_MQTT_PLAIN before including it.
+ */
+
+#ifndef USER_DEFINES_H_
+#define USER_DEFINES_H_
+
+// ArduinoJson is built without ARDUINO defined on the host, enable the parts the firmware uses.
+#define ARDUINOJSON_ENABLE_ARDUINO_STRING 1
+#define ARDUINOJSON_ENABLE_ARDUINO_PRINT 1
+#define ARDUINOJSON_ENABLE_ARDUINO_STREAM 1
+#define ARDUINOJSON_ENABLE_PROGMEM 0
+
+#define HARDWARE_Elekstube_CLOCK
+
+#define DIMMING
+#define NIGHT_TIME 22
+#define DAY_TIME 7
+#define BACKLIGHT_DIMMED_INTENSITY 1
+#define TFT_DIMMED_INTENSITY 20
+#define DIMMING_SUNRISE_SUNSET
+#define SOLAR_LATITUDE 46.24
+#define SOLAR_LONGITUDE 14.36
+
+// Three zones over the six LEDs, so the zone topics are covered.
+#define NUM_BACKLIGHT_ZONES (3)
+#define BACKLIGHT_ZONES {{0, 2, "Back"}, {2, 2, "Left"}, {4, 2, "Right"}}
+
+#define WIFI_CONNECT_TIMEOUT_SEC 20
+#define WIFI_RETRY_CONNECTION_SEC 15
+#define WIFI_SSID "host"
+#define WIFI_PASSWD "host"
+
+#define TIME_ZONE "Europe/Berlin"
+#define GEOLOCATION_API_KEY "host"
+
+#ifdef HOST_MQTT_PLAIN
+#define MQTT_PLAIN_ENABLED
+#else
+#define MQTT_HOME_ASSISTANT
+#define MQTT_HOME_ASSISTANT_DISCOVERY_DEVICE_MANUFACTURER "EleksMaker"
+#define MQTT_HOME_ASSISTANT_DISCOVERY_DEVICE_MODEL "Elekstube IPS"
+#define MQTT_HOME_ASSISTANT_DISCOVERY_SW_VERSION "1.1"
+#define MQTT_HOME_ASSISTANT_DISCOVERY_HW_VERSION "2.3.04"
+#endif
+
+#define MQTT_BROKER "broker"
+#define MQTT_PORT 1883
+#define MQTT_USERNAME "user"
+#define MQTT_PASSWORD "password"
+#define MQTT_CLIENT "clock"
+#define MQTT_SAVE_PREFERENCES_AFTER_SEC 60
+#define MQTT_MSGPACK
+
+#endif // USER_DEFINES_H_
@@ -0,0 +1,15 @@
+#ifndef HOST_ESP_HEAP_CAPS_H
+#define HOST_ESP_HEAP_CAPS_H
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+inline size_t heap_caps_get_free_size(unsigned) { return 200 * 1024; }
+inline size_t heap_caps_get_largest_free_block(unsigned) { return 110 * 1024; }
+inline void *heap_caps_malloc(size_t size, unsigned) { return malloc(size); }
+
+#endif // HOST_ESP_HEAP_CAPS_H
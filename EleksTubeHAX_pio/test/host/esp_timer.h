@@ -0,0 +1,7 @@
+#ifndef HOST_ESP_TIMER_H
+#define HOST_ESP_TIMER_H
+
+#include "Arduino.h" // hostTimeUs
+inline int64_t esp_timer_get_time() { return (int64_t)hostTimeUs; }
+
+#endif // HOST_ESP_TIMER_H
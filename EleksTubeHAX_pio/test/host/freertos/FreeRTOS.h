@@ -0,0 +1,60 @@
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+// Host replacement for FreeRTOS: there is only one thread, a created task runs to its end before
+// xTaskCreatePinnedToCore() returns, critical sections and mutexes do nothing.
+
+#include <stdint.h>
+
+typedef void *TaskHandle_t;
+typedef void *SemaphoreHandle_t;
+typedef void *QueueHandle_t;
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xffffffff
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) (ms)
+#define tskIDLE_PRIORITY 0
+
+typedef struct
+{
+  int unused;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(mux) (void)(mux)
+#define portEXIT_CRITICAL(mux) (void)(mux)
+#define portENTER_CRITICAL_ISR(mux) (void)(mux)
+#define portEXIT_CRITICAL_ISR(mux) (void)(mux)
+
+inline uint32_t hostTasksCreated = 0;
+inline bool hostTaskCreateFails = false; // lets a test check the error path
+
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *, uint32_t, void *parameter, UBaseType_t, TaskHandle_t *handle, BaseType_t)
+{
+  if (hostTaskCreateFails)
+    return pdFAIL;
+  hostTasksCreated++;
+  if (handle)
+    *handle = (TaskHandle_t)task;
+  task(parameter);
+  return pdPASS;
+}
+inline BaseType_t xTaskCreate(TaskFunction_t task, const char *name, uint32_t stack, void *parameter, UBaseType_t priority, TaskHandle_t *handle)
+{
+  return xTaskCreatePinnedToCore(task, name, stack, parameter, priority, handle, 0);
+}
+inline void vTaskDelete(TaskHandle_t) {}
+inline void vTaskDelay(TickType_t) {}
+inline TickType_t xTaskGetTickCount() { return 0; }
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { return (SemaphoreHandle_t)1; }
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t) { return pdTRUE; }
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t) { return pdTRUE; }
+
+#endif // HOST_FREERTOS_H
@@ -0,0 +1,100 @@
+// Backlight programs on the host (pio test -e native): frame time for all 34 LEDs of the largest clock.
+// Timed with the host clock, the simulated micros() doesn't advance while the program runs. The ESP32 at 240 MHz
+// is roughly 10-20 times slower than a desktop CPU, so the host average has to stay far below the budget.
+
+#include "_USER_DEFINES.h"
+#include <unity.h>
+#include <chrono>
+
+#include "BacklightProgram.cpp"
+
+const uint16_t LEDS = 34;
+const uint32_t BACKLIGHT_FRAME_BUDGET_US = 500;
+const int FRAMES = 1000;
+
+// script_backlight_asm.py --hex of the example in its header: a rainbow running along the LEDs, 9 instructions per LED
+const char *rainbow_hex = "424C01030104120401400B091F00";
+// a loop of 18 rounds, 118 of the 128 instructions per LED
+const char *heavy_hex = "424C0101000101091301111A1CF7040903091E01030B1F00";
+
+size_t fromHex(const char *hex, uint8_t *data)
+{
+  size_t length = strlen(hex) / 2;
+  for (size_t i = 0; i < length; i++)
+  {
+    char byte[3] = {hex[2 * i], hex[2 * i + 1], '\0'};
+    data[i] = strtoul(byte, NULL, 16);
+  }
+  return length;
+}
+
+// Average and worst frame time over FRAMES frames, in µs.
+void benchmark(const char *name, const char *hex, uint32_t first_color)
+{
+  uint8_t data[BACKLIGHT_PROGRAM_MAX_SIZE + BacklightProgram::header_size];
+  BacklightProgram program;
+  TEST_ASSERT_TRUE(program.load(data, fromHex(hex, data)));
+
+  uint32_t colors[LEDS];
+  BacklightProgram::Inputs inputs = {12345, LEDS, 0, 0, 7};
+  TEST_ASSERT_TRUE(program.runFrame(inputs, colors));
+  TEST_ASSERT_EQUAL_HEX32(first_color, colors[0]); // same as script_backlight_asm.py --run 34
+
+  double total_us = 0, max_us = 0;
+  for (int frame = 0; frame < FRAMES; frame++)
+  {
+    inputs.time_ms += 20;
+    auto start = std::chrono::steady_clock::now();
+    TEST_ASSERT_TRUE(program.runFrame(inputs, colors));
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    total_us += us;
+    max_us = us > max_us ? us : max_us;
+  }
+  char line[120];
+  snprintf(line, sizeof(line), "%s: %u LEDs, %.2f us per frame, max. %.2f us", name, LEDS, total_us / FRAMES, max_us);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_LESS_THAN(BACKLIGHT_FRAME_BUDGET_US, total_us / FRAMES);
+  TEST_ASSERT_EQUAL(0, program.getBudgetOverruns());
+  TEST_ASSERT_EQUAL(0, program.getRuntimeErrors());
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_rainbow_frame_is_within_budget(void)
+{
+  benchmark("rainbow", rainbow_hex, 0x03FC00);
+}
+
+void test_heavy_frame_is_within_budget(void)
+{
+  benchmark("118 steps per LED", heavy_hex, 0x00EE11);
+}
+
+void test_program_over_the_step_budget_is_stopped(void)
+{
+  // the same loop with 20 rounds needs 130 instructions
+  uint8_t data[64];
+  size_t length = fromHex("424C0101000101091301131A1CF7040903091E01030B1F00", data);
+  BacklightProgram program;
+  TEST_ASSERT_TRUE(program.load(data, length));
+  uint32_t colors[LEDS];
+  BacklightProgram::Inputs inputs = {12345, LEDS, 0, 0, 7};
+  TEST_ASSERT_FALSE(program.runFrame(inputs, colors));
+  TEST_ASSERT_EQUAL(1, program.getBudgetOverruns());
+  TEST_ASSERT_EQUAL(0, colors[LEDS - 1]);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_rainbow_frame_is_within_budget);
+  RUN_TEST(test_heavy_frame_is_within_budget);
+  RUN_TEST(test_program_over_the_step_budget_is_stopped);
+  return UNITY_END();
+}
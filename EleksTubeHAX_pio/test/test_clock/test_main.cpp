@@ -0,0 +1,216 @@
+// The disciplined clock and its references, on the host (pio test -e native): the rate estimate of a crystal
+// that runs off, and the Clock reading the simulated DS3231 (test/host/RTClib.h) to find its second boundary.
+
+#include "_USER_DEFINES.h"
+#include <unity.h>
+
+#include "NTPClient_AO.cpp"
+#define private public // the tests reset the static state of the clock between runs
+#include "Clock.cpp"
+#undef private
+#include "NtpFilter.cpp"
+#include "RtcDrift.cpp"
+#include "TimeZone.cpp"
+#include "DisciplinedClock.cpp"
+#include "EventBus.cpp"
+#include "HostNtp.h"
+
+EventBus events;
+StoredConfig stored_config;
+WifiState_t WifiState = disconnected;
+
+const uint64_t EPOCH_US = 1760000000ULL * 1000000; // true time at the start of a simulation
+
+// Deterministic noise in [-max_us, max_us].
+int64_t noiseUs(uint32_t &seed, int64_t max_us)
+{
+  seed = seed * 1103515245 + 12345;
+  return (int64_t)((seed >> 8) % (2 * max_us + 1)) - max_us;
+}
+
+void resetClock()
+{
+  hostTimeLib = HostTimeLib();
+  hostRtc.reset();
+  Wire.devices.clear();
+  Clock::rtc_check = Clock::rtc_check_none;
+  Clock::rtc_cache_valid = false;
+  Clock::rtc_stats = {};
+  Clock::ms_known = false;
+  Clock::disciplined_clock = DisciplinedClock();
+  Clock::millis_last_ntp = 0;
+  Clock::ntp_result_ready = false;
+  hostNtp.reset();
+  WifiState = disconnected;
+}
+
+void setUp(void)
+{
+  resetClock();
+  Serial.clear();
+}
+
+void tearDown(void) {}
+
+void test_rate_converges_on_a_fast_crystal(void)
+{
+  const double crystal_ppm = 37;
+  DisciplinedClock clock;
+  uint32_t seed = 1;
+  uint64_t last_us = 0;
+  float rate_at_2h = 0;
+  int64_t max_error_us = 0;
+  // A reference every 10 minutes with +-10 ms noise, like the RTC second between NTP syncs.
+  for (int step = 0; step <= 6 * 6; step++)
+  {
+    uint64_t true_us = step * 600000000ULL;
+    for (uint64_t t = true_us - (step ? 600000000ULL : 0); t < true_us; t += 50000)
+    { // never backwards, also while a correction is slewed out
+      uint64_t now_us = clock.now((int64_t)(t * (1 + crystal_ppm * 1e-6)));
+      TEST_ASSERT_GREATER_OR_EQUAL(last_us, now_us);
+      last_us = now_us;
+    }
+    int64_t error_us = clock.discipline((int64_t)(true_us * (1 + crystal_ppm * 1e-6)), EPOCH_US + true_us + noiseUs(seed, 10000));
+    if (step == 12)
+      rate_at_2h = clock.getRatePpm();
+    if (step >= 12 && llabs(error_us) > max_error_us)
+      max_error_us = llabs(error_us);
+  }
+  char line[100];
+  snprintf(line, sizeof(line), "rate after 2 h %.1f ppm, after 6 h %.1f ppm, max error after 2 h %lld us", rate_at_2h,
+           clock.getRatePpm(), (long long)max_error_us);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_FLOAT_WITHIN(8, crystal_ppm, rate_at_2h);
+  TEST_ASSERT_FLOAT_WITHIN(2, crystal_ppm, clock.getRatePpm());
+  TEST_ASSERT_LESS_OR_EQUAL(30000, max_error_us);
+}
+
+void test_small_error_is_slewed_big_error_sets_the_time(void)
+{
+  DisciplinedClock clock;
+  clock.discipline(0, EPOCH_US);
+  // 100 ms ahead: slewed out at max_slew_ppm, the time keeps going forward
+  TEST_ASSERT_EQUAL_INT64(100000, clock.discipline(1000000, EPOCH_US + 900000));
+  TEST_ASSERT_EQUAL_INT64(EPOCH_US + 1000000, clock.now(1000000));
+  TEST_ASSERT_EQUAL_INT64(EPOCH_US + 2000000 - 500, clock.now(2000000));
+  uint64_t slewed_us = 100000 * 1000000LL / DisciplinedClock::max_slew_ppm;
+  TEST_ASSERT_EQUAL_INT64(EPOCH_US + 900000 + slewed_us, clock.now(1000000 + slewed_us));
+  // 5 s: set
+  TEST_ASSERT_EQUAL_INT64(-5000000, clock.discipline(400000000, EPOCH_US + 404900000));
+  TEST_ASSERT_EQUAL_INT64(EPOCH_US + 404900000, clock.now(400000000));
+}
+
+void test_rtc_is_polled_at_a_bounded_rate(void)
+{
+  hostRtc.set(EPOCH_US / 1000000, 300); // the RTC second started 300 ms ago
+  hostRtc.read_us = 100;
+  Clock clock;
+  StoredConfig::Config config = {};
+  clock.begin(&config.uclock, &config.rtc_drift, &config.time_zone);
+  TEST_ASSERT_FALSE(Clock::ms_known);
+
+  // A fast loop, one pass every 200 us: the boundary comes after 700 ms.
+  uint32_t reads = hostRtc.reads;
+  uint64_t start_us = hostTimeUs;
+  while (!Clock::ms_known && hostTimeUs - start_us < 3000000)
+  {
+    clock.loop();
+    hostAdvanceUs(200);
+  }
+  TEST_ASSERT_TRUE(Serial.contains("Clock aligned with the RTC second."));
+  uint32_t measure_us = hostTimeUs - start_us;
+  TEST_ASSERT_LESS_OR_EQUAL(measure_us / Clock::rtc_poll_us + 2, hostRtc.reads - reads);
+  // the clock follows the RTC second within half the poll interval
+  TEST_ASSERT_FLOAT_WITHIN(Clock::rtc_poll_us / 2000.0 + 1, 0, hostRtc.errorMs(Clock::nowMs()));
+  char line[100];
+  snprintf(line, sizeof(line), "%u RTC reads in %u ms, error %.1f ms", (unsigned)(hostRtc.reads - reads),
+           (unsigned)(measure_us / 1000), hostRtc.errorMs(Clock::nowMs()));
+  TEST_MESSAGE(line);
+}
+
+// The error of the clock against the true time of the fake NTP servers, in ms.
+double clockErrorMs()
+{
+  return (double)(int64_t)(Clock::nowMs() - hostNtp.trueMs());
+}
+
+void test_drift_correction_keeps_the_ms(void)
+{
+  // The calibrated model predicts the RTC 1.4 s ahead, and it is.
+  uint64_t true_ms = hostNtp.trueMs();
+  hostAdvanceMs(1600 - true_ms % 1000); // the true time is x.600 s...
+  uint32_t true_s = hostNtp.trueMs() / 1000;
+  hostRtc.set(true_s + 2, 0); // ...the RTC just started second x + 2
+  StoredConfig::Config config = {};
+  config.rtc_drift.is_valid = StoredConfig::valid;
+  config.rtc_drift.calibrated = StoredConfig::valid;
+  config.rtc_drift.segment_start = true_s - 3600;
+  config.rtc_drift.segment_error_ms = 1400;
+  Clock clock;
+  clock.begin(&config.uclock, &config.rtc_drift, &config.time_zone);
+  TEST_ASSERT_TRUE(Serial.contains("Using RTC time."));
+  // Rounded to whole seconds the clock was 400 ms ahead.
+  TEST_ASSERT_FLOAT_WITHIN(2, 0, clockErrorMs());
+}
+
+// Runs the clock like main.cpp, in 1 ms steps while it measures something, in 50 ms steps otherwise.
+// Returns the biggest clock error outside of the measurements.
+double runClock(Clock &clock, uint32_t hours)
+{
+  double max_error_ms = 0;
+  uint64_t end_us = hostTimeUs + hours * 3600000000ULL;
+  while (hostTimeUs < end_us)
+  {
+    clock.loop();
+    bool busy = Clock::rtc_check != Clock::rtc_check_none || clock.ntp_burst_active || clock.ntp_request_running;
+    if (!busy && Clock::ms_known)
+      max_error_ms = fmax(max_error_ms, fabs(clockErrorMs()));
+    hostAdvanceUs(busy ? 1000 : 50000);
+  }
+  return max_error_ms;
+}
+
+void test_drifting_rtc_is_calibrated_and_followed(void)
+{
+  hostRtc.ppm = 8; // gains 29 ms per hour
+  hostRtc.set(hostNtp.trueMs() / 1000);
+  hostNtp.add("0.pool.ntp.org", IPAddress(192, 0, 2, 10));
+  hostNtp.add("1.pool.ntp.org", IPAddress(192, 0, 2, 11));
+  hostNtp.add("2.pool.ntp.org", IPAddress(192, 0, 2, 12));
+  hostNtp.add("3.pool.ntp.org", IPAddress(192, 0, 2, 13));
+  hostNtp.attach(Clock::ntpUDP);
+  WifiState = connected;
+  StoredConfig::Config config = {};
+  Clock clock;
+  clock.begin(&config.uclock, &config.rtc_drift, &config.time_zone);
+
+  // Hourly NTP syncs measure the drift, then it is trimmed with the aging register.
+  double max_error_ms = runClock(clock, RTC_DRIFT_MIN_HOURS + 2);
+  TEST_ASSERT_TRUE(Clock::rtc_drift.isCalibrated());
+  TEST_ASSERT_INT_WITHIN(3, 80, (int8_t)Wire.reg(0x68, 0x10));
+  TEST_ASSERT_FLOAT_WITHIN(0.3, 0, hostRtc.effectivePpm());
+  char line[120];
+  snprintf(line, sizeof(line), "with NTP: aging %d, RTC drift left %.2f ppm, max error %.1f ms",
+           (int8_t)Wire.reg(0x68, 0x10), hostRtc.effectivePpm(), max_error_ms);
+  TEST_MESSAGE(line);
+
+  // Without NTP the clock follows the calibrated RTC, aligned with its second every 10 minutes.
+  WifiState = disconnected;
+  uint32_t ntp_requests = Clock::ntpUDP.sent.size();
+  max_error_ms = runClock(clock, 24);
+  TEST_ASSERT_EQUAL(ntp_requests, Clock::ntpUDP.sent.size());
+  TEST_ASSERT_LESS_OR_EQUAL(30, max_error_ms);
+  snprintf(line, sizeof(line), "24 h without NTP: max error %.1f ms", max_error_ms);
+  TEST_MESSAGE(line);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_rate_converges_on_a_fast_crystal);
+  RUN_TEST(test_small_error_is_slewed_big_error_sets_the_time);
+  RUN_TEST(test_rtc_is_polled_at_a_bounded_rate);
+  RUN_TEST(test_drift_correction_keeps_the_ms);
+  RUN_TEST(test_drifting_rtc_is_calibrated_and_followed);
+  return UNITY_END();
+}
@@ -0,0 +1,186 @@
+// The event bus on the host (pio test -e native): one dispatch() per loop pass of LOOP_US, like main.cpp.
+// Checks that the latency from publish to delivery stays within the frames the per-frame limits allow, and the
+// statistics the bus keeps about it.
+
+#include "_USER_DEFINES.h"
+#include <unity.h>
+
+#include <vector>
+
+#include "EventBus.cpp"
+#define private public // the pulse brightness of the backlights
+#include "Backlights.cpp"
+#undef private
+#include "BacklightProgram.cpp"
+#include "Fade.cpp"
+#include "NtpFilter.cpp"
+
+EventBus events;
+Clock uclock;
+
+const uint32_t LOOP_US = 5000;
+
+struct Delivery
+{
+  EventBus::event_t type;
+  uint8_t value;
+  uint32_t latency_us;
+};
+std::vector<Delivery> deliveries;
+uint32_t handler_us = 0; // time every handler call takes
+
+void record(const EventBus::Event &event, void *context)
+{
+  deliveries.push_back({event.type, event.value, (uint32_t)(micros() - event.published_us)});
+  hostAdvanceUs(handler_us);
+}
+
+void loopPass(EventBus &bus)
+{
+  bus.dispatch();
+  hostAdvanceUs(LOOP_US);
+}
+
+void setUp(void)
+{
+  deliveries.clear();
+  handler_us = 0;
+}
+
+void tearDown(void)
+{
+}
+
+// A burst fills the queue: EVENT_BUS_MAX_EVENTS_PER_FRAME events per frame, in order, and each one waits at most
+// the frames needed for the ones before it.
+void test_burst_latency_is_bounded_by_the_frame_limit(void)
+{
+  EventBus bus;
+  bus.subscribe(EventBus::all_events, record);
+  for (uint8_t i = 0; i < EVENT_BUS_QUEUE_SIZE; i++)
+    TEST_ASSERT_TRUE(bus.publish(EventBus::button_pressed, i));
+  TEST_ASSERT_FALSE(bus.publish(EventBus::button_pressed, 99));
+  TEST_ASSERT_EQUAL(1, bus.getDroppedEvents());
+
+  const uint32_t frames = (EVENT_BUS_QUEUE_SIZE + EVENT_BUS_MAX_EVENTS_PER_FRAME - 1) / EVENT_BUS_MAX_EVENTS_PER_FRAME;
+  for (uint32_t frame = 0; frame < frames + 2; frame++)
+    loopPass(bus);
+  TEST_ASSERT_EQUAL(EVENT_BUS_QUEUE_SIZE, deliveries.size());
+  for (uint8_t i = 0; i < EVENT_BUS_QUEUE_SIZE; i++)
+  {
+    TEST_ASSERT_EQUAL(i, deliveries[i].value);
+    TEST_ASSERT_LESS_OR_EQUAL((i / EVENT_BUS_MAX_EVENTS_PER_FRAME) * LOOP_US, deliveries[i].latency_us);
+  }
+  TEST_ASSERT_LESS_OR_EQUAL((frames - 1) * LOOP_US, bus.getMaxLatencyUs());
+  TEST_ASSERT_EQUAL(EVENT_BUS_QUEUE_SIZE - EVENT_BUS_MAX_EVENTS_PER_FRAME, bus.getDeferredEvents());
+}
+
+// Slow handlers: a frame stops after EVENT_BUS_DISPATCH_BUDGET_US, the rest follows in the next frames.
+void test_dispatch_time_is_bounded_by_the_budget(void)
+{
+  EventBus bus;
+  bus.subscribe(EventBus::all_events, record);
+  handler_us = 700;
+  for (uint8_t i = 0; i < 6; i++)
+    bus.publish(EventBus::second_tick, i);
+
+  uint8_t handled = bus.dispatch(); // 700, 1400, 2100 us: stops after the third
+  TEST_ASSERT_EQUAL(3, handled);
+  TEST_ASSERT_LESS_OR_EQUAL(EVENT_BUS_DISPATCH_BUDGET_US + handler_us, bus.getMaxDispatchUs());
+  TEST_ASSERT_EQUAL(3, bus.getDeferredEvents());
+  hostAdvanceUs(LOOP_US);
+  TEST_ASSERT_EQUAL(3, bus.dispatch());
+  TEST_ASSERT_EQUAL(6, deliveries.size());
+  TEST_ASSERT_EQUAL(3, bus.getDeferredEvents());
+  TEST_ASSERT_EQUAL(3 * handler_us + LOOP_US + 2 * handler_us, bus.getMaxLatencyUs()); // the first frame, the loop, two handlers
+}
+
+// An event waiting for several frames is one deferred event, not one per frame.
+void test_event_waiting_several_frames_is_deferred_once(void)
+{
+  EventBus bus;
+  bus.subscribe(EventBus::all_events, record);
+  handler_us = EVENT_BUS_DISPATCH_BUDGET_US + 1; // one event per frame
+  for (uint8_t i = 0; i < 4; i++)
+    bus.publish(EventBus::minute_rollover, i);
+  loopPass(bus);
+  TEST_ASSERT_EQUAL(3, bus.getDeferredEvents());
+  bus.publish(EventBus::minute_rollover, 4); // new, in the same queue behind them
+  for (int frame = 0; frame < 6; frame++)
+    loopPass(bus);
+  TEST_ASSERT_EQUAL(5, deliveries.size());
+  TEST_ASSERT_EQUAL(4, bus.getDeferredEvents()); // 1, 2, 3 and 4, each once
+  TEST_ASSERT_EQUAL(0, bus.getQueueDepth());
+
+  // an empty queue defers nothing
+  bus.publish(EventBus::hour_chime, 5);
+  handler_us = 0;
+  loopPass(bus);
+  TEST_ASSERT_EQUAL(4, bus.getDeferredEvents());
+}
+
+// Subscribers only get the events of their mask, in the order they subscribed.
+void test_subscribers_get_their_events(void)
+{
+  EventBus bus;
+  static std::vector<int> calls;
+  calls.clear();
+  bus.subscribe(EventBus::maskOf(EventBus::second_tick), [](const EventBus::Event &e, void *c) { calls.push_back(1); });
+  bus.subscribe(EventBus::maskOf(EventBus::second_tick) | EventBus::maskOf(EventBus::power_changed),
+                [](const EventBus::Event &e, void *c) { calls.push_back(2); });
+  bus.publish(EventBus::second_tick, 0);
+  bus.publish(EventBus::power_changed, 1);
+  bus.publish(EventBus::face_changed, 2);
+  TEST_ASSERT_EQUAL(3, bus.dispatch());
+  TEST_ASSERT_EQUAL(3, calls.size());
+  TEST_ASSERT_EQUAL(1, calls[0]);
+  TEST_ASSERT_EQUAL(2, calls[1]);
+  TEST_ASSERT_EQUAL(2, calls[2]);
+  for (int i = 2; i < EVENT_BUS_MAX_SUBSCRIBERS; i++)
+    TEST_ASSERT_TRUE(bus.subscribe(EventBus::all_events, record));
+  TEST_ASSERT_FALSE(bus.subscribe(EventBus::all_events, record));
+}
+
+// The pulse pattern follows the seconds tick only if whole pulses fit into a second, otherwise its phase runs on:
+// at 72 bpm a restart at every tick would make the brightness jump once a second.
+void test_pulse_is_continuous_over_the_tick(void)
+{
+  StoredConfig::Config config = {};
+  Backlights backlights;
+  backlights.begin(&config.backlights, &config.backlight_zones);
+  const uint8_t rates[] = {60, 72, 90, 100};
+  for (uint8_t bpm : rates)
+  {
+    backlights.setPulseRate(bpm);
+    events.publish(EventBus::second_tick, 0); // in phase with the ticks from here
+    events.dispatch();
+    int max_step = 0;
+    int last = backlights.pulseBrightness(7);
+    for (int ms = 0; ms < 5000; ms++)
+    {
+      if (ms % 1000 == 999)
+      {
+        events.publish(EventBus::second_tick, 0);
+        events.dispatch();
+      }
+      hostAdvanceMs(1);
+      int brightness = backlights.pulseBrightness(7);
+      max_step = abs(brightness - last) > max_step ? abs(brightness - last) : max_step;
+      last = brightness;
+    }
+    char name[16];
+    snprintf(name, sizeof(name), "%u bpm", bpm);
+    TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(6, max_step, name); // the steepest slope of |sin| at 100 bpm is 2.7 per ms
+  }
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_burst_latency_is_bounded_by_the_frame_limit);
+  RUN_TEST(test_dispatch_time_is_bounded_by_the_budget);
+  RUN_TEST(test_event_waiting_several_frames_is_deferred_once);
+  RUN_TEST(test_subscribers_get_their_events);
+  RUN_TEST(test_pulse_is_continuous_over_the_tick);
+  return UNITY_END();
+}
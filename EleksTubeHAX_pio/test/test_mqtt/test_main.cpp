@@ -0,0 +1,875 @@
+// Home Assistant traffic against the MQTT client, on the host (pio test -e native).
+// The client talks to the in-process broker (test/host/HostBroker.h), the clock is simulated: one loop pass every
+// LOOP_MS, like main.cpp. Every scenario prints its command-to-state latency and the messages it caused.
+
+#include "_USER_DEFINES.h"
+#include <unity.h>
+#include <chrono>
+
+#include "MQTT_client_ips.cpp"
+#include "MQTTCommands.cpp"
+#include "EventBus.cpp"
+#include "LoopStats.cpp"
+#include "NTPClient_AO.cpp"
+#include "Clock.cpp"
+#include "RtcDrift.cpp"
+#include "TimeZone.cpp"
+#include "DisciplinedClock.cpp"
+#include "NtpFilter.cpp"
+#include "WorldClock.cpp"
+#include "Backlights.cpp"
+#include "BacklightProgram.cpp"
+#include "Fade.cpp"
+#include "Stopwatch.cpp"
+
+EventBus events;
+Backlights backlights;
+TFTs tfts;
+Clock uclock;
+Stopwatch stopwatch;
+WorldClock worldclock;
+LoopStats loop_stats;
+StoredConfig stored_config;
+uint32_t WifiReconnects = 0;
+WifiState_t WifiState = connected;
+
+String TFTs::clockFaceToName(uint8_t clockFace)
+{
+  return patterns_str[clockFace - 1];
+}
+
+uint8_t TFTs::nameToClockFace(String name)
+{
+  for (int i = 0; i < 9; i++)
+  {
+    if (patterns_str[i] == name)
+    {
+      return i + 1;
+    }
+  }
+  return 1;
+}
+
+uint32_t timer_digits_set = 0;
+
+void TFTs::setDigit(uint8_t digit, uint8_t value, show_t show)
+{
+  timer_digits_set++;
+}
+
+bool TFTs::cacheClockFace()
+{
+  return true;
+}
+
+// TFTs as far as applyMQTTCommands() uses it
+void TFTs::reinit()
+{
+  TFTsEnabled = true;
+}
+
+void TFTs::enableAllDisplays()
+{
+  TFTsEnabled = true;
+}
+
+void TFTs::disableAllDisplays()
+{
+  TFTsEnabled = false;
+}
+
+void TFTs::ProcessUpdatedDimming()
+{
+}
+
+void TFTs::setZoneLabel(const char *label)
+{
+}
+
+void ChipSelect::setAll(bool update_)
+{
+}
+
+uint32_t redraws = 0;
+
+void updateClockDisplay(TFTs::show_t show)
+{
+  redraws++;
+}
+
+const uint32_t LOOP_MS = 5;
+
+StoredConfig::Config &config = stored_config.config;
+
+void reportStatus()
+{
+  MQTTStatusMainPower = tfts.isEnabled();
+  MQTTStatusMainBrightness = tfts.dimming;
+  MQTTStatusMainGraphic = uclock.getActiveGraphicIdx();
+  MQTTStatusBackPower = backlights.getPower();
+  MQTTStatusBackBrightness = backlights.getIntensity();
+  strcpy(MQTTStatusBackPattern, backlights.getPatternStr().c_str());
+  MQTTStatusBackColorPhase = backlights.getColorPhase();
+  MQTTStatusPulseBpm = backlights.getPulseRate();
+  MQTTStatusBreathBpm = backlights.getBreathRate();
+  MQTTStatusRainbowSec = backlights.getRainbowDuration();
+  for (uint8_t zone = 0; zone < NUM_BACKLIGHT_ZONES; zone++)
+  {
+    MQTTStatusZonePower[zone] = backlights.getZonePower(zone);
+    MQTTStatusZoneBrightness[zone] = backlights.getZoneIntensity(zone);
+    strcpy(MQTTStatusZonePattern[zone], backlights.getZonePatternStr(zone).c_str());
+    MQTTStatusZoneColorPhase[zone] = backlights.getZoneColorPhase(zone);
+  }
+  MQTTStatusSunrise = 6 * 60 + 12;
+  MQTTStatusSunset = 20 * 60 + 41;
+  MQTTStatusNightTime = false;
+}
+
+void loopPass()
+{
+  MQTTLoopFrequently();
+  if (MQTTCommandsDue())
+  {
+    applyMQTTCommands();
+  }
+  reportStatus();
+  events.dispatch();
+  MQTTLoopInFreeTime();
+  hostAdvanceMs(LOOP_MS);
+}
+
+void runFor(uint32_t ms)
+{
+  for (uint32_t t = 0; t < ms; t += LOOP_MS)
+    loopPass();
+}
+
+// Runs until a message matching filter is published (or timeout_ms), returns it.
+const HostMessage *runUntil(const char *filter, uint32_t timeout_ms = 2000)
+{
+  size_t before = broker.count(filter);
+  for (uint32_t t = 0; t < timeout_ms && broker.count(filter) == before; t += LOOP_MS)
+    loopPass();
+  return broker.count(filter) > before ? broker.last(filter) : nullptr;
+}
+
+struct Scenario
+{
+  const char *name;
+  uint32_t start_ms;
+  size_t start_messages;
+  size_t start_received;
+
+  Scenario(const char *name) : name(name), start_ms(millis()), start_messages(broker.published.size()), start_received(MQTTRxStats.messages) {}
+
+  void report(const HostMessage *answer)
+  {
+    size_t bytes = 0;
+    for (size_t i = start_messages; i < broker.published.size(); i++)
+      bytes += broker.published[i].payload.size();
+    char line[160];
+    snprintf(line, sizeof(line), "%s: latency %d ms, %u received, %u published (%u bytes)", name,
+             answer ? (int)(answer->ms - start_ms) : -1, (unsigned)(MQTTRxStats.messages - start_received),
+             (unsigned)(broker.published.size() - start_messages), (unsigned)bytes);
+    TEST_MESSAGE(line);
+  }
+};
+
+void parse(const HostMessage *message, JsonDocument &doc)
+{
+  TEST_ASSERT_NOT_NULL(message);
+  TEST_ASSERT_TRUE_MESSAGE(deserializeJson(doc, message->payload) == DeserializationError::Ok, message->payload.c_str());
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_connect_publishes_availability_and_discovery(void)
+{
+  Scenario scenario("connect");
+  MQTTStart();
+  runFor(100);
+  TEST_ASSERT_TRUE(broker.connected);
+  TEST_ASSERT_EQUAL_STRING("online", broker.retained["clock/status"].c_str());
+  TEST_ASSERT_TRUE(broker.subscribed("homeassistant/status"));
+  TEST_ASSERT_TRUE(broker.subscribed("clock/main/set"));
+  TEST_ASSERT_TRUE(broker.subscribed("clock/back_z2/set"));
+
+  runFor(MQTTDiscovery.count * MQTT_DISCOVERY_INTERVAL_MS + 500);
+  TEST_ASSERT_TRUE(discoveryReported);
+  TEST_ASSERT_EQUAL(MQTTDiscovery.count, broker.count("homeassistant/#"));
+  for (const HostMessage &message : broker.published)
+  {
+    if (!HostBroker::matches("homeassistant/#", message.topic))
+      continue;
+    TEST_ASSERT_TRUE(message.retain);
+    JsonDocument doc;
+    parse(&message, doc);
+    TEST_ASSERT_TRUE_MESSAGE(doc["unique_id"].is<const char *>(), message.topic.c_str());
+  }
+  // all entities report their state once the discovery is through
+  TEST_ASSERT_NOT_NULL(broker.last("clock/main"));
+  TEST_ASSERT_NOT_NULL(broker.last("clock/back_z1"));
+  scenario.report(broker.last("clock/main"));
+}
+
+void test_ha_birth_resends_discovery(void)
+{
+  runFor(1000);
+  Scenario scenario("birth");
+  size_t discovery_before = broker.count("homeassistant/#");
+  broker.send("homeassistant/status", "online");
+  const HostMessage *first = runUntil("homeassistant/#", 1000);
+  TEST_ASSERT_NOT_NULL(first);
+  uint32_t delay_ms = first->ms - scenario.start_ms;
+  TEST_ASSERT_GREATER_OR_EQUAL(100, delay_ms); // random delay, so not all devices answer at once
+  TEST_ASSERT_LESS_OR_EQUAL(400 + LOOP_MS, delay_ms);
+
+  runFor(MQTTDiscovery.count * MQTT_DISCOVERY_INTERVAL_MS + 500);
+  TEST_ASSERT_EQUAL(discovery_before + MQTTDiscovery.count, broker.count("homeassistant/#"));
+  const HostMessage *main = broker.last("clock/main");
+  TEST_ASSERT_GREATER_THAN(first->ms, main->ms); // states are sent again after the discovery
+  scenario.report(broker.last("homeassistant/#"));
+}
+
+void test_light_set_is_answered_with_state(void)
+{
+  runFor(1000);
+  Scenario scenario("light set");
+  broker.send("clock/main/set", "{\"state\":\"OFF\",\"brightness\":120}");
+  const HostMessage *state = runUntil("clock/main");
+  JsonDocument doc;
+  parse(state, doc);
+  TEST_ASSERT_EQUAL_STRING("OFF", doc["state"]);
+  TEST_ASSERT_EQUAL(120, doc["brightness"].as<int>());
+  TEST_ASSERT_FALSE(tfts.isEnabled());
+  // coalescing window + debounce + one loop pass
+  TEST_ASSERT_LESS_OR_EQUAL(MQTT_COMMAND_COALESCE_MS + MQTT_STATE_DEBOUNCE_MS + 2 * LOOP_MS, state->ms - scenario.start_ms);
+  runFor(200);
+  TEST_ASSERT_EQUAL(1, broker.count("clock/main", scenario.start_ms)); // one answer, no echo of the intermediate states
+  scenario.report(state);
+}
+
+void test_effect_change(void)
+{
+  runFor(1000);
+  Scenario scenario("effect");
+  uint32_t answered = MQTTCmdStats.answered;
+  broker.send("clock/main/set", "{\"state\":\"ON\",\"effect\":\"3\"}");
+  const HostMessage *state = runUntil("clock/main");
+  JsonDocument doc;
+  parse(state, doc);
+  TEST_ASSERT_EQUAL_STRING("ON", doc["state"]);
+  TEST_ASSERT_EQUAL_STRING("3", doc["effect"]);
+  TEST_ASSERT_EQUAL(3, uclock.getActiveGraphicIdx());
+  TEST_ASSERT_EQUAL(answered + 1, MQTTCmdStats.answered);
+  scenario.report(state);
+}
+
+void test_back_light_color_and_effect(void)
+{
+  runFor(1000);
+  Scenario scenario("back light");
+  broker.send("clock/back/set", "{\"state\":\"ON\",\"effect\":\"Pulse\",\"color\":{\"h\":120,\"s\":100},\"brightness\":4}");
+  const HostMessage *state = runUntil("clock/back");
+  JsonDocument doc;
+  parse(state, doc);
+  TEST_ASSERT_EQUAL_STRING("ON", doc["state"]);
+  TEST_ASSERT_EQUAL_STRING("Pulse", doc["effect"]);
+  TEST_ASSERT_EQUAL(4, doc["brightness"].as<int>());
+  TEST_ASSERT_FLOAT_WITHIN(2.0, 120.0, doc["color"]["h"].as<float>());
+  scenario.report(state);
+}
+
+void test_zone_set(void)
+{
+  runFor(1000);
+  Scenario scenario("zone");
+  broker.send("clock/back_z2/set", "{\"state\":\"OFF\"}");
+  const HostMessage *state = runUntil("clock/back_z2");
+  JsonDocument doc;
+  parse(state, doc);
+  TEST_ASSERT_EQUAL_STRING("OFF", doc["state"]);
+  TEST_ASSERT_FALSE(backlights.getZonePower(2));
+  TEST_ASSERT_TRUE(backlights.getZonePower(1));
+  scenario.report(state);
+}
+
+// A Home Assistant scene switches the displays on, dims them and changes the clock face in one message: the digits
+// are drawn once.
+void test_scene_is_drawn_once(void)
+{
+  runFor(1000);
+  broker.send("clock/main/set", "{\"state\":\"OFF\"}");
+  TEST_ASSERT_NOT_NULL(runUntil("clock/main"));
+  TEST_ASSERT_FALSE(tfts.isEnabled());
+  Scenario scenario("scene");
+  uint32_t draws = redraws;
+  uint32_t avoided = MQTTCmdStats.redraws_avoided;
+  broker.send("clock/main/set", "{\"state\":\"ON\",\"brightness\":90,\"effect\":\"2\"}");
+  const HostMessage *state = runUntil("clock/main");
+  TEST_ASSERT_TRUE(tfts.isEnabled());
+  TEST_ASSERT_EQUAL(90, tfts.dimming);
+  TEST_ASSERT_EQUAL(2, uclock.getActiveGraphicIdx());
+  TEST_ASSERT_EQUAL(draws + 1, redraws);
+  TEST_ASSERT_EQUAL(avoided + 2, MQTTCmdStats.redraws_avoided);
+  scenario.report(state);
+}
+
+// A brightness slider: commands 20 ms apart are applied together and answered with one state message.
+void test_slider_commands_are_coalesced(void)
+{
+  runFor(1000);
+  Scenario scenario("slider");
+  uint32_t batches = MQTTCmdStats.batches;
+  for (int brightness = 50; brightness <= 250; brightness += 50)
+  {
+    char payload[32];
+    snprintf(payload, sizeof(payload), "{\"brightness\":%d}", brightness);
+    broker.send("clock/main/set", payload);
+    runFor(20);
+  }
+  const HostMessage *state = runUntil("clock/main");
+  runFor(500);
+  TEST_ASSERT_EQUAL(batches + 1, MQTTCmdStats.batches);
+  TEST_ASSERT_EQUAL(1, broker.count("clock/main", scenario.start_ms));
+  JsonDocument doc;
+  parse(state, doc);
+  TEST_ASSERT_EQUAL(250, doc["brightness"].as<int>());
+  TEST_ASSERT_EQUAL(250, tfts.dimming);
+  scenario.report(state);
+}
+
+// Commands that keep coming are applied at the latest MQTT_COMMAND_COALESCE_MAX_MS after the first one.
+void test_command_stream_is_not_starved(void)
+{
+  runFor(1000);
+  uint32_t batches = MQTTCmdStats.batches;
+  uint32_t start = millis();
+  for (int i = 0; i < 20; i++)
+  {
+    char payload[32];
+    snprintf(payload, sizeof(payload), "{\"brightness\":%d}", 10 + i);
+    broker.send("clock/main/set", payload);
+    runFor(30);
+    if (MQTTCmdStats.batches > batches)
+      break;
+  }
+  TEST_ASSERT_GREATER_THAN(batches, MQTTCmdStats.batches);
+  TEST_ASSERT_LESS_OR_EQUAL(MQTT_COMMAND_COALESCE_MAX_MS + 30, millis() - start);
+}
+
+void test_steady_state_does_not_allocate_heap(void)
+{
+  runFor(1000);
+  uint32_t heap_allocs = MQTTStats.heap_allocs;
+  size_t published = broker.published.size();
+  // commands, their state reports, the periodic status of all entities and the diagnostics
+  for (int i = 0; i < 20; i++)
+  {
+    char payload[64];
+    snprintf(payload, sizeof(payload), "{\"state\":\"ON\",\"brightness\":%d}", 100 + i);
+    broker.send("clock/main/set", payload);
+    broker.send("clock/back/set", "{\"effect\":\"Rainbow\",\"color\":{\"h\":120,\"s\":100}}");
+    runFor(1000);
+  }
+  runFor(MQTT_REPORT_STATUS_EVERY_SEC * 1000);
+  TEST_ASSERT_GREATER_THAN(published + 40, broker.published.size());
+  TEST_ASSERT_EQUAL(heap_allocs, MQTTStats.heap_allocs);
+  TEST_ASSERT_LESS_OR_EQUAL(MQTT_JSON_ARENA_SIZE, MQTTStats.arena_peak);
+  char line[80];
+  snprintf(line, sizeof(line), "arena peak %u of %u bytes, %u heap allocations", (unsigned)MQTTStats.arena_peak,
+           (unsigned)MQTT_JSON_ARENA_SIZE, (unsigned)MQTTStats.heap_allocs);
+  TEST_MESSAGE(line);
+}
+
+void test_arena_overflow_falls_back_to_heap(void)
+{
+  uint32_t heap_allocs = MQTTStats.heap_allocs;
+  {
+    JsonDocument big(&MQTTJsonArena);
+    for (int i = 0; i < MQTT_JSON_ARENA_SIZE / 8; i++)
+    {
+      char key[8];
+      snprintf(key, sizeof(key), "k%d", i);
+      big[key] = i;
+    }
+    TEST_ASSERT_EQUAL(MQTT_JSON_ARENA_SIZE / 8, big.size());
+    TEST_ASSERT_GREATER_THAN(heap_allocs, MQTTStats.heap_allocs);
+  }
+  // freed, the next document fits into the arena again
+  heap_allocs = MQTTStats.heap_allocs;
+  JsonDocument small(&MQTTJsonArena);
+  small["state"] = "ON";
+  TEST_ASSERT_EQUAL(heap_allocs, MQTTStats.heap_allocs);
+}
+
+void test_reconnect_after_connection_loss(void)
+{
+  runFor(1000);
+  Scenario scenario("reconnect");
+  uint32_t connects = broker.connects;
+  broker.drop();
+  TEST_ASSERT_EQUAL_STRING("offline", broker.retained["clock/status"].c_str()); // last will
+  runFor((MQTT_RECONNECT_MIN_SEC + 1) * 1000);
+  TEST_ASSERT_EQUAL(connects + 1, broker.connects);
+  TEST_ASSERT_EQUAL_STRING("online", broker.retained["clock/status"].c_str());
+  TEST_ASSERT_TRUE(broker.subscribed("clock/main/set"));
+  scenario.report(broker.last("clock/status"));
+}
+
+// Button presses while the broker is away: more than the RAM ring holds, so most go to the spill file. Part of them
+// is sent after the reconnect, then the clock restarts (RAM lost, the file is kept). Every press left in the file
+// must be sent once, none of the ones delivered before the restart again.
+void test_spilled_events_are_not_resent_after_restart(void)
+{
+  const int presses = MQTT_EVENT_QUEUE_SIZE * 3;
+  runFor(1000);
+  SPIFFS.remove(MQTT_EVENT_SPILL_FILE);
+  broker.accept = false;
+  broker.drop();
+  for (int i = 0; i < presses; i++)
+  {
+    events.publish(EventBus::button_pressed, i);
+    loopPass();
+  }
+  TEST_ASSERT_EQUAL(presses - MQTT_EVENT_QUEUE_SIZE + 1, MQTTEventSpilled); // the lost connection is queued first
+  Scenario scenario("events after restart");
+  broker.accept = true;
+  runFor((MQTT_RECONNECT_MIN_SEC + 1) * 1000);
+  runFor(MQTT_EVENT_QUEUE_SIZE * 3 / 2 * MQTT_EVENT_DRAIN_INTERVAL_MS);
+  TEST_ASSERT_GREATER_THAN(0, MQTTEventSpilled);
+
+  // restart: the ring is gone, the spill file stays
+  uint16_t in_file = MQTTEventSpilled;
+  MQTTEventHead = 0;
+  MQTTEventCount = 0;
+  MQTTEventSpilled = 0;
+  MQTTEventQueueRestore();
+  TEST_ASSERT_EQUAL(in_file, MQTTEventSpilled);
+  runFor((MQTT_EVENT_QUEUE_SIZE * 3 + 10) * MQTT_EVENT_DRAIN_INTERVAL_MS);
+  TEST_ASSERT_EQUAL(0, MQTTEventQueueDepth());
+  TEST_ASSERT_FALSE(SPIFFS.exists(MQTT_EVENT_SPILL_FILE));
+
+  int sent[presses] = {};
+  for (size_t i = scenario.start_messages; i < broker.published.size(); i++)
+  {
+    const HostMessage &message = broker.published[i];
+    if (message.topic != "clock/event")
+      continue;
+    JsonDocument doc;
+    parse(&message, doc);
+    if (doc["event_type"].as<String>() == "button_pressed")
+      sent[doc["value"].as<int>()]++;
+  }
+  int lost = 0;
+  for (int i = 0; i < presses; i++)
+  {
+    TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(1, sent[i], "event sent twice");
+    lost += sent[i] == 0;
+    if (i >= presses - in_file)
+      TEST_ASSERT_EQUAL_MESSAGE(1, sent[i], "event from the spill file not sent");
+  }
+  TEST_ASSERT_LESS_OR_EQUAL(MQTT_EVENT_QUEUE_SIZE, lost); // the ring at the restart
+  scenario.report(broker.last("clock/event"));
+}
+
+void test_backlight_program_hex_is_checked(void)
+{
+  const char *program = "424C01030104120401400B091F00";
+  MQTTCommandBackProgramReceived = false;
+  MQTTReceiveBacklightProgram((const byte *)program, strlen(program));
+  TEST_ASSERT_TRUE(MQTTCommandBackProgramReceived);
+  TEST_ASSERT_EQUAL(14, MQTTCommandBackProgramLength);
+  TEST_ASSERT_EQUAL_HEX8(0x1F, MQTTCommandBackProgram[12]);
+
+  // neither may touch the program waiting to be applied
+  const char *bad[] = {"424C01030104120401400B091F0", "424C0103010412040140 B091F00", "424C01030104120401400B091F0g", "0x4C01"};
+  for (const char *hex : bad)
+  {
+    Serial.clear();
+    MQTTCommandBackProgramReceived = false;
+    MQTTReceiveBacklightProgram((const byte *)hex, strlen(hex));
+    TEST_ASSERT_FALSE_MESSAGE(MQTTCommandBackProgramReceived, hex);
+    TEST_ASSERT_TRUE_MESSAGE(Serial.contains("not a valid hex string"), hex);
+    TEST_ASSERT_EQUAL(14, MQTTCommandBackProgramLength);
+    TEST_ASSERT_EQUAL_HEX8(0x1F, MQTTCommandBackProgram[12]);
+  }
+}
+
+// Commands in the form Home Assistant sends them for the discovery of this client: slider moves on the main light,
+// effect and color changes on the back light, a zone, the switches and numbers, the text entities and a batch.
+const char *ha_traffic[][2] = {
+    {"clock/main/set", "{\"state\":\"ON\",\"brightness\":51}"},
+    {"clock/main/set", "{\"state\":\"ON\",\"brightness\":102}"},
+    {"clock/main/set", "{\"state\":\"ON\",\"brightness\":178}"},
+    {"clock/main/set", "{\"state\":\"ON\",\"effect\":\"2\"}"},
+    {"clock/main/set", "{\"state\":\"OFF\"}"},
+    {"clock/back/set", "{\"state\":\"ON\",\"effect\":\"Rainbow\"}"},
+    {"clock/back/set", "{\"state\":\"ON\",\"color\":{\"h\":213.6,\"s\":81.2}}"},
+    {"clock/back/set", "{\"state\":\"ON\",\"brightness\":5,\"color_mode\":\"hs\"}"},
+    {"clock/back_z2/set", "{\"state\":\"ON\",\"color\":{\"h\":30,\"s\":100},\"brightness\":3}"},
+    {"clock/use_twelve_hours/set", "{\"state\":\"ON\"}"},
+    {"clock/blank_zero_hours/set", "{\"state\":\"OFF\"}"},
+    {"clock/pulse_bpm/set", "{\"state\":72}"},
+    {"clock/breath_bpm/set", "{\"state\":12}"},
+    {"clock/rainbow_duration/set", "{\"state\":8.5}"},
+    {"clock/timer/set", "countdown 300"},
+    {"clock/world_clock/set", "{\"zones\":[{\"label\":\"TYO\",\"tz\":\"Asia/Tokyo\"}]}"},
+    {"clock/batch/set", "{\"main\":{\"state\":\"ON\",\"brightness\":200},\"back\":{\"effect\":\"Pulse\"}}"},
+};
+
+// Host time of MQTTCallback() per message of the Home Assistant traffic. The simulated micros() doesn't advance inside
+// the callback, so MQTTRxStats can't be used here.
+void test_callback_latency_with_ha_traffic(void)
+{
+  const int rounds = 200;
+  const size_t messages = sizeof(ha_traffic) / sizeof(ha_traffic[0]);
+  uint32_t unhandled = MQTTRxStats.unhandled;
+  Serial.clear();
+  double total_us = 0, max_us = 0;
+  for (int round = 0; round < rounds; round++)
+  {
+    for (size_t i = 0; i < messages; i++)
+    {
+      std::string topic = ha_traffic[i][0];
+      std::string payload = ha_traffic[i][1];
+      auto start = std::chrono::steady_clock::now();
+      MQTTCallback(&topic[0], (byte *)&payload[0], payload.size());
+      double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+      total_us += us;
+      max_us = us > max_us ? us : max_us;
+    }
+    applyMQTTCommands();
+  }
+  TEST_ASSERT_EQUAL(unhandled, MQTTRxStats.unhandled);
+  // the commands were applied, not rejected by their handlers
+  TEST_ASSERT_EQUAL(Stopwatch::countdown, stopwatch.getMode());
+  TEST_ASSERT_EQUAL(300000, stopwatch.getShownMs());
+  TEST_ASSERT_EQUAL(1, worldclock.getCount());
+  TEST_ASSERT_EQUAL_STRING("TYO", worldclock.getLabel(1));
+  TEST_ASSERT_FALSE(Serial.contains("Unknown timer command"));
+  TEST_ASSERT_FALSE(Serial.contains("World clock: JSON error"));
+  TEST_ASSERT_FALSE(Serial.contains("Unknown time zone"));
+  stopwatch.command("off");
+  worldclock.command("{\"zones\":[]}");
+  char line[120];
+  snprintf(line, sizeof(line), "HA traffic: %u messages, %.2f us per callback, max. %.2f us", (unsigned)(rounds * messages),
+           total_us / (rounds * messages), max_us);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_LESS_THAN(50, total_us / (rounds * messages));
+}
+
+// Only digits directly followed by "/set" select a zone.
+void test_zone_topic_is_parsed_strictly(void)
+{
+  const char *bad[] = {"clock/back_z1junk/set", "clock/back_z/set", "clock/back_z+1/set", "clock/back_z 1/set", "clock/back_z1/set/x"};
+  for (const char *name : bad)
+  {
+    std::string topic = name;
+    std::string payload = "{\"state\":\"OFF\"}";
+    uint32_t unhandled = MQTTRxStats.unhandled;
+    MQTTCommandZonePowerReceived[1] = false;
+    MQTTCallback(&topic[0], (byte *)&payload[0], payload.size());
+    TEST_ASSERT_EQUAL_MESSAGE(unhandled + 1, MQTTRxStats.unhandled, name);
+    TEST_ASSERT_FALSE_MESSAGE(MQTTCommandZonePowerReceived[1], name);
+  }
+  std::string topic = "clock/back_z1/set";
+  std::string payload = "{\"state\":\"OFF\"}";
+  MQTTCallback(&topic[0], (byte *)&payload[0], payload.size());
+  TEST_ASSERT_TRUE(MQTTCommandZonePowerReceived[1]);
+  topic = "clock/back_z99/set"; // a zone this clock doesn't have is ignored, not unhandled
+  uint32_t unhandled = MQTTRxStats.unhandled;
+  MQTTCallback(&topic[0], (byte *)&payload[0], payload.size());
+  TEST_ASSERT_EQUAL(unhandled, MQTTRxStats.unhandled);
+  applyMQTTCommands();
+}
+
+// Size and parse time of the JSON messages the clock publishes and their MessagePack copies (MQTT_MSGPACK).
+void test_msgpack_is_smaller_than_json(void)
+{
+  runFor(1000);
+  MQTTReportDiagnostics();
+  const char *topics[] = {"main", "back", "back_z1", "use_twelve_hours", "diagnostics"};
+  const int rounds = 2000;
+  size_t json_total = 0, msgpack_total = 0;
+  double json_us = 0, msgpack_us = 0;
+  for (const char *name : topics)
+  {
+    const HostMessage *json = broker.last(std::string("clock/") + name);
+    const HostMessage *msgpack = broker.last(std::string("clock/msgpack/") + name);
+    TEST_ASSERT_NOT_NULL_MESSAGE(json, name);
+    TEST_ASSERT_NOT_NULL_MESSAGE(msgpack, name);
+    TEST_ASSERT_LESS_THAN_MESSAGE(json->payload.size(), msgpack->payload.size(), name);
+    json_total += json->payload.size();
+    msgpack_total += msgpack->payload.size();
+
+    JsonDocument from_json, from_msgpack;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++)
+      deserializeJson(from_json, json->payload.data(), json->payload.size());
+    auto middle = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++)
+      deserializeMsgPack(from_msgpack, msgpack->payload.data(), msgpack->payload.size());
+    auto end = std::chrono::steady_clock::now();
+    json_us += std::chrono::duration<double, std::micro>(middle - start).count() / rounds;
+    msgpack_us += std::chrono::duration<double, std::micro>(end - middle).count() / rounds;
+    char a[1024], b[1024];
+    serializeJson(from_json, a, sizeof(a));
+    serializeJson(from_msgpack, b, sizeof(b));
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(a, b, name); // same content
+  }
+  char line[160];
+  snprintf(line, sizeof(line), "JSON %u bytes, parsed in %.2f us; MessagePack %u bytes (%.0f%%), parsed in %.2f us",
+           (unsigned)json_total, json_us, (unsigned)msgpack_total, 100.0 * msgpack_total / json_total, msgpack_us);
+  TEST_MESSAGE(line);
+}
+
+// A backlight program sent as MessagePack bin 8, 16 or 32 arrives as the raw bytes.
+void test_msgpack_bin_program_is_passed_through(void)
+{
+  std::string program("BL\x01\x03\x01\x04\x12\x04\x01\x40\x0b\x09\x1f\x00", 14);
+  std::string large = program.substr(0, 12) + std::string(sizeof(MQTTCommandBackProgram) - 14, '\x13') + program.substr(12);
+  std::string payloads[] = {
+      std::string("\xc4\x0e", 2) + program,
+      std::string("\xc5\x00\x0e", 3) + program,
+      std::string("\xc6\x00\x00\x00\x0e", 5) + program,
+      std::string("\xc5\x01\x03", 3) + large,
+  };
+  for (std::string &payload : payloads)
+  {
+    std::string topic = "clock/msgpack/back/program/set";
+    const std::string &expected = payload.size() > 100 ? large : program;
+    MQTTCommandBackProgramReceived = false;
+    MQTTCallback(&topic[0], (byte *)&payload[0], payload.size());
+    TEST_ASSERT_TRUE(MQTTCommandBackProgramReceived);
+    TEST_ASSERT_EQUAL(expected.size(), MQTTCommandBackProgramLength);
+    TEST_ASSERT_EQUAL_MEMORY(expected.data(), MQTTCommandBackProgram, expected.size());
+  }
+
+  // the length in the header doesn't match
+  std::string topic = "clock/msgpack/back/program/set";
+  std::string truncated = std::string("\xc4\x0f", 2) + program;
+  MQTTCommandBackProgramReceived = false;
+  MQTTCallback(&topic[0], (byte *)&truncated[0], truncated.size());
+  TEST_ASSERT_FALSE(MQTTCommandBackProgramReceived);
+}
+
+// The timer's frame rate and dropped frames are in the diagnostics while it runs, with a Home Assistant sensor each.
+void test_diagnostics_report_the_timer(void)
+{
+  TEST_ASSERT_NOT_NULL(broker.last("homeassistant/sensor/clock_timer_fps/config"));
+  TEST_ASSERT_NOT_NULL(broker.last("homeassistant/sensor/clock_timer_dropped/config"));
+  MQTTReportDiagnostics();
+  JsonDocument doc;
+  parse(broker.last("clock/diagnostics"), doc);
+  TEST_ASSERT_FALSE(doc["timer_fps"].is<float>()); // not running
+
+  stopwatch.command("stopwatch");
+  stopwatch.command("start");
+  for (uint32_t t = 0; t < 3000; t += LOOP_MS)
+  {
+    stopwatch.loop();
+    loopPass();
+  }
+  MQTTReportDiagnostics();
+  parse(broker.last("clock/diagnostics"), doc);
+  TEST_ASSERT_FLOAT_WITHIN(0.5, TIMER_FPS, doc["timer_fps"].as<float>());
+  TEST_ASSERT_EQUAL(0, doc["timer_dropped"].as<int>());
+
+  hostAdvanceMs(200); // a stall of 5 frame times: 4 or 5 frames are missed completely, depending on the phase
+  for (uint32_t t = 0; t < 1000; t += LOOP_MS)
+  {
+    stopwatch.loop();
+    loopPass();
+  }
+  MQTTReportDiagnostics();
+  parse(broker.last("clock/diagnostics"), doc);
+  TEST_ASSERT_LESS_THAN(TIMER_FPS - 0.5, doc["timer_fps"].as<float>());
+  TEST_ASSERT_GREATER_OR_EQUAL(4, doc["timer_dropped"].as<int>());
+  TEST_ASSERT_LESS_OR_EQUAL(5, doc["timer_dropped"].as<int>());
+  TEST_ASSERT_GREATER_THAN(0, timer_digits_set);
+  stopwatch.command("off");
+}
+
+// The frame time of the backlight program is measured on the clock itself, so it is reported in the diagnostics.
+void test_diagnostics_report_the_backlight_program(void)
+{
+  TEST_ASSERT_NOT_NULL(broker.last("homeassistant/sensor/clock_program_max_us/config"));
+  TEST_ASSERT_NOT_NULL(broker.last("homeassistant/sensor/clock_program_overruns/config"));
+  backlights.getProgram().unload();
+  MQTTReportDiagnostics();
+  JsonDocument doc;
+  parse(broker.last("clock/diagnostics"), doc);
+  TEST_ASSERT_FALSE(doc["program_max_us"].is<int>()); // no program
+
+  // the loop with 20 rounds of test_backlight_program: 130 instructions, more than allowed per frame
+  const uint8_t over_budget[] = {0x42, 0x4C, 0x01, 0x01, 0x00, 0x01, 0x01, 0x09, 0x13, 0x01, 0x13, 0x1A,
+                                 0x1C, 0xF7, 0x04, 0x09, 0x03, 0x09, 0x1E, 0x01, 0x03, 0x0B, 0x1F, 0x00};
+  TEST_ASSERT_TRUE(backlights.loadProgram(over_budget, sizeof(over_budget), false));
+  BacklightProgram &program = backlights.getProgram();
+  BacklightProgram::Inputs inputs = {0, NUM_BACKLIGHT_LEDS, 0, 0, 7};
+  uint32_t colors[NUM_BACKLIGHT_LEDS];
+  TEST_ASSERT_FALSE(program.runFrame(inputs, colors));
+  MQTTReportDiagnostics();
+  parse(broker.last("clock/diagnostics"), doc);
+  TEST_ASSERT_EQUAL(program.getMaxFrameUs(), doc["program_max_us"].as<int>());
+  TEST_ASSERT_GREATER_THAN(0, doc["program_overruns"].as<int>());
+  TEST_ASSERT_EQUAL(program.getBudgetOverruns(), doc["program_overruns"].as<int>());
+  program.unload();
+}
+
+// A brightness change every 150 ms, each one applied on its own: the token bucket of the entity lets MQTT_STATE_BURST
+// reports through, then one every MQTT_STATE_REFILL_MS. The last report has the last brightness.
+void test_state_reports_are_rate_limited(void)
+{
+  runFor(MQTT_REPORT_STATUS_EVERY_SEC * 1000); // all buckets full
+  Scenario scenario("state stream");
+  const uint32_t duration_ms = 3000;
+  int brightness = 0;
+  for (uint32_t t = 0; t < duration_ms; t += 150)
+  {
+    char payload[32];
+    brightness = 10 + t / 20;
+    snprintf(payload, sizeof(payload), "{\"brightness\":%d}", brightness);
+    broker.send("clock/main/set", payload);
+    runFor(150);
+  }
+  size_t reports = broker.count("clock/main", scenario.start_ms);
+  TEST_ASSERT_LESS_OR_EQUAL(MQTT_STATE_BURST + duration_ms / MQTT_STATE_REFILL_MS, reports);
+  TEST_ASSERT_GREATER_OR_EQUAL(MQTT_STATE_BURST, reports);
+  const HostMessage *state = runUntil("clock/main", MQTT_STATE_REFILL_MS * 2);
+  JsonDocument doc;
+  parse(state, doc);
+  TEST_ASSERT_EQUAL(brightness, doc["brightness"].as<int>());
+  scenario.report(state);
+}
+
+// The periodic refresh sends an entity MQTT_REPORT_STATUS_EVERY_SEC after its own last report, not all at once.
+void test_periodic_refresh_sends_only_expired_entities(void)
+{
+  runFor(1000);
+  broker.send("clock/main/set", "{\"brightness\":77}");
+  TEST_ASSERT_NOT_NULL(runUntil("clock/main"));
+  uint32_t main_ms = millis();
+  runFor(MQTT_REPORT_STATUS_EVERY_SEC * 1000 - 500);
+  TEST_ASSERT_EQUAL(0, broker.count("clock/main", main_ms + LOOP_MS)); // not expired yet
+  TEST_ASSERT_GREATER_THAN(0, broker.count("clock/back", main_ms + LOOP_MS)); // refreshed on its own schedule
+  runFor(1000);
+  TEST_ASSERT_EQUAL(1, broker.count("clock/main", main_ms + LOOP_MS));
+}
+
+// A failed build of the discovery messages is printed once and retried with a backoff, not in every loop pass.
+void test_failed_discovery_build_is_retried_with_backoff(void)
+{
+  runFor(1000);
+  SPIFFS.remove(MQTT_DISCOVERY_CACHE_FILE);
+  size_t capacity = SPIFFS.capacity;
+  SPIFFS.capacity = SPIFFS.usedBytes() + 100; // the cache doesn't fit
+  MQTTDiscovery.magic = 0;
+  discoveryReported = false;
+  Serial.clear();
+  size_t discovery_before = broker.count("homeassistant/#");
+
+  runFor((1 + 2 + 4) * MQTT_DISCOVERY_RETRY_MIN_SEC * 1000 + 1000); // thousands of loop passes, builds at 0, 10, 30 and 70 s
+  TEST_ASSERT_FALSE(discoveryReported);
+  size_t errors = 0;
+  for (size_t at = Serial.output.find("ERROR"); at != std::string::npos; at = Serial.output.find("ERROR", at + 1))
+    errors++;
+  TEST_ASSERT_EQUAL(1, errors);
+  TEST_ASSERT_EQUAL(MQTT_DISCOVERY_RETRY_MIN_SEC * 8, MQTTDiscoveryRetrySec);
+
+  SPIFFS.capacity = capacity;
+  runFor(MQTT_DISCOVERY_RETRY_MIN_SEC * 1000 * 8); // the next build, at 150 s
+  TEST_ASSERT_EQUAL(MQTTDiscoveryMagic, MQTTDiscovery.magic);
+  for (uint32_t t = 0; t < 30000 && !discoveryReported; t += LOOP_MS)
+    loopPass();
+  TEST_ASSERT_TRUE(discoveryReported);
+  TEST_ASSERT_EQUAL(0, MQTTDiscoveryRetrySec);
+  TEST_ASSERT_TRUE(Serial.contains("Built "));
+  TEST_ASSERT_GREATER_THAN(discovery_before, broker.count("homeassistant/#"));
+}
+
+// A discovery message that can't be read completely after its header went out: the client reconnects instead of
+// leaving a packet shorter than announced on the connection.
+void test_cut_off_discovery_message_reconnects(void)
+{
+  runFor(1000);
+  std::string cache = SPIFFS.content(MQTT_DISCOVERY_CACHE_FILE);
+  uint16_t topic_length;
+  memcpy(&topic_length, &cache[sizeof(MQTTDiscoveryHeader)], sizeof(topic_length));
+  size_t first_payload = sizeof(MQTTDiscoveryHeader) + 2 * sizeof(uint16_t) + topic_length;
+  SPIFFS.setContent(MQTT_DISCOVERY_CACHE_FILE, cache.substr(0, first_payload + 10)); // 10 bytes of the first payload
+
+  uint32_t connects = broker.connects;
+  size_t discovery_before = broker.count("homeassistant/#");
+  Serial.clear();
+  broker.send("homeassistant/status", "online");
+  for (uint32_t t = 0; t < 1000 && broker.connected; t += LOOP_MS)
+    loopPass();
+  TEST_ASSERT_FALSE(broker.connected);
+  TEST_ASSERT_TRUE(Serial.contains("Discovery message cut off"));
+  TEST_ASSERT_EQUAL(discovery_before, broker.count("homeassistant/#"));
+
+  SPIFFS.setContent(MQTT_DISCOVERY_CACHE_FILE, cache);
+  runFor((MQTT_RECONNECT_MIN_SEC + 1) * 1000 + MQTTDiscovery.count * MQTT_DISCOVERY_INTERVAL_MS + 500);
+  TEST_ASSERT_EQUAL(connects + 1, broker.connects);
+  TEST_ASSERT_TRUE(discoveryReported); // the broker still has the retained messages from before
+}
+
+// World clock zones are a setting like the others, saved delayed by main.cpp; switching the shown zone is not.
+void test_world_clock_config_is_a_changed_setting(void)
+{
+  strcpy(MQTTCommandWorldClock, "{\"zones\":[{\"label\":\"TYO\",\"tz\":\"Asia/Tokyo\"}]}");
+  MQTTCommandWorldClockReceived = true;
+  TEST_ASSERT_TRUE(applyMQTTCommands());
+  TEST_ASSERT_EQUAL(1, worldclock.getCount());
+  strcpy(MQTTCommandWorldClock, "next");
+  MQTTCommandWorldClockReceived = true;
+  TEST_ASSERT_FALSE(applyMQTTCommands());
+  TEST_ASSERT_EQUAL(1, worldclock.getIndex());
+  worldclock.command("{\"zones\":[]}");
+}
+
+int main(int argc, char **argv)
+{
+  backlights.begin(&config.backlights, &config.backlight_zones);
+  uclock.begin(&config.uclock, &config.rtc_drift, &config.time_zone);
+  worldclock.begin(&config.world_clock);
+  tfts.NumberOfClockFaces = 3;
+  tfts.enableAllDisplays();
+  uclock.setClockGraphicsIdx(1);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_connect_publishes_availability_and_discovery);
+  RUN_TEST(test_ha_birth_resends_discovery);
+  RUN_TEST(test_light_set_is_answered_with_state);
+  RUN_TEST(test_effect_change);
+  RUN_TEST(test_back_light_color_and_effect);
+  RUN_TEST(test_zone_set);
+  RUN_TEST(test_scene_is_drawn_once);
+  RUN_TEST(test_world_clock_config_is_a_changed_setting);
+  RUN_TEST(test_slider_commands_are_coalesced);
+  RUN_TEST(test_command_stream_is_not_starved);
+  RUN_TEST(test_steady_state_does_not_allocate_heap);
+  RUN_TEST(test_arena_overflow_falls_back_to_heap);
+  RUN_TEST(test_reconnect_after_connection_loss);
+  RUN_TEST(test_spilled_events_are_not_resent_after_restart);
+  RUN_TEST(test_backlight_program_hex_is_checked);
+  RUN_TEST(test_callback_latency_with_ha_traffic);
+  RUN_TEST(test_zone_topic_is_parsed_strictly);
+  RUN_TEST(test_msgpack_is_smaller_than_json);
+  RUN_TEST(test_msgpack_bin_program_is_passed_through);
+  RUN_TEST(test_diagnostics_report_the_timer);
+  RUN_TEST(test_diagnostics_report_the_backlight_program);
+  RUN_TEST(test_state_reports_are_rate_limited);
+  RUN_TEST(test_periodic_refresh_sends_only_expired_entities);
+  RUN_TEST(test_failed_discovery_build_is_retried_with_backoff);
+  RUN_TEST(test_cut_off_discovery_message_reconnects);
+  return UNITY_END();
+}
@@ -0,0 +1,95 @@
+// The plain MQTT mode on the host (pio test -e native), against the in-process broker (test/host/HostBroker.h):
+// the "<MQTT_CLIENT>/report/..." topics, one value per topic.
+
+#define HOST_MQTT_PLAIN
+#include "_USER_DEFINES.h"
+#include <unity.h>
+
+#include "MQTT_client_ips.cpp"
+#include "EventBus.cpp"
+#include "LoopStats.cpp"
+#include "DisciplinedClock.cpp"
+#include "NtpFilter.cpp"
+#include "Backlights.cpp"
+#include "BacklightProgram.cpp"
+#include "Fade.cpp"
+#include "Stopwatch.cpp"
+
+EventBus events;
+Backlights backlights;
+TFTs tfts;
+Clock uclock;
+Stopwatch stopwatch;
+LoopStats loop_stats;
+uint32_t WifiReconnects = 0;
+WifiState_t WifiState = connected;
+DisciplinedClock Clock::disciplined_clock;
+int32_t Clock::ntp_offset_ms = 0;
+uint32_t Clock::ntp_jitter_ms = 0;
+
+void TFTs::setDigit(uint8_t digit, uint8_t value, show_t show) {}
+bool TFTs::cacheClockFace() { return true; }
+
+const uint32_t LOOP_MS = 5;
+
+// The part of main.cpp's loop() that deals with MQTT, the sun times of a day in April.
+void loopPass()
+{
+  MQTTStatusMainPower = true;
+  MQTTStatusState = 1;
+  MQTTStatusSunrise = 6 * 60 + 12;
+  MQTTStatusSunset = 20 * 60 + 41;
+  MQTTLoopFrequently();
+  events.dispatch();
+  MQTTLoopInFreeTime();
+  hostAdvanceMs(LOOP_MS);
+}
+
+void runFor(uint32_t ms)
+{
+  for (uint32_t t = 0; t < ms; t += LOOP_MS)
+    loopPass();
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_connect_reports_the_state(void)
+{
+  MQTTStart();
+  runFor(1000);
+  TEST_ASSERT_TRUE(broker.connected);
+  TEST_ASSERT_TRUE(broker.subscribed("clock/directive/powerState"));
+  TEST_ASSERT_EQUAL_STRING(MQTT_STATE_ON, broker.last("clock/report/powerState")->payload.c_str());
+  TEST_ASSERT_EQUAL_STRING("1", broker.last("clock/report/setpoint")->payload.c_str());
+}
+
+// Sunrise, sunset and the night state, the night state also when only it changes.
+void test_sun_and_night_are_reported(void)
+{
+  runFor(100);
+  TEST_ASSERT_NOT_NULL(broker.last("clock/report/sunrise"));
+  TEST_ASSERT_EQUAL_STRING("06:12", broker.last("clock/report/sunrise")->payload.c_str());
+  TEST_ASSERT_EQUAL_STRING("20:41", broker.last("clock/report/sunset")->payload.c_str());
+  TEST_ASSERT_NOT_NULL(broker.last("clock/report/night"));
+  TEST_ASSERT_EQUAL_STRING(MQTT_STATE_OFF, broker.last("clock/report/night")->payload.c_str());
+
+  uint32_t start_ms = millis();
+  MQTTStatusNightTime = true;
+  runFor(500);
+  TEST_ASSERT_EQUAL(1, broker.count("clock/report/night", start_ms));
+  TEST_ASSERT_EQUAL_STRING(MQTT_STATE_ON, broker.last("clock/report/night")->payload.c_str());
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_connect_reports_the_state);
+  RUN_TEST(test_sun_and_night_are_reported);
+  return UNITY_END();
+}
@@ -0,0 +1,221 @@
+// NTP requests against fake servers on the fake UDP socket (test/host/HostNtp.h), on the host (pio test -e native):
+// delayed, lost and malformed answers, and that the servers are resolved once per burst instead of per request.
+
+#include "_USER_DEFINES.h"
+#include <unity.h>
+
+#include "NTPClient_AO.cpp"
+#define private public // the tests use the NTP socket of the clock
+#include "Clock.cpp"
+#undef private
+#include "NtpFilter.cpp"
+#include "RtcDrift.cpp"
+#include "TimeZone.cpp"
+#include "DisciplinedClock.cpp"
+#include "EventBus.cpp"
+#include "HostNtp.h"
+
+EventBus events;
+StoredConfig stored_config;
+WifiState_t WifiState = connected;
+
+const IPAddress SERVER(192, 0, 2, 1);
+
+WiFiUDP udp;
+NTPClient client(udp);
+
+void setUp(void)
+{
+  hostNtp.reset();
+  hostRtc.reset();
+  WiFi.hosts.clear();
+  WiFi.lookups = 0;
+  udp.sent.clear();
+  udp.incoming.clear();
+  hostNtp.attach(udp);
+  client.setPoolServerIP(SERVER);
+  Serial.clear();
+}
+
+void tearDown(void) {}
+
+// Polls like the main loop does, until the request is done.
+NTPClient::RequestState runRequest()
+{
+  if (!client.startRequest())
+    return client.getRequestState();
+  NTPClient::RequestState state;
+  while ((state = client.poll()) == NTPClient::REQUEST_WAITING)
+    hostAdvanceMs(5);
+  return state;
+}
+
+void test_request_goes_to_the_resolved_address(void)
+{
+  hostNtp.add("time.example", SERVER);
+  TEST_ASSERT_EQUAL(NTPClient::REQUEST_COMPLETED, runRequest());
+  TEST_ASSERT_EQUAL(1, udp.sent.size());
+  TEST_ASSERT_TRUE(udp.sent[0].host.empty()); // no DNS lookup on the device
+  TEST_ASSERT_TRUE(udp.sent[0].ip == SERVER);
+  TEST_ASSERT_EQUAL(123, udp.sent[0].port);
+  TEST_ASSERT_EQUAL(0, WiFi.lookups);
+}
+
+void test_unresolved_server_fails_without_sending(void)
+{
+  client.setPoolServerIP(IPAddress(0, 0, 0, 0));
+  TEST_ASSERT_FALSE(client.startRequest());
+  TEST_ASSERT_EQUAL(NTPClient::REQUEST_FAILED, client.poll());
+  TEST_ASSERT_EQUAL(0, udp.sent.size());
+}
+
+void test_delayed_answer_is_corrected_by_half_the_round_trip(void)
+{
+  HostNtpServer &server = hostNtp.add("time.example", SERVER);
+  server.out_ms = 120;
+  server.back_ms = 120;
+  server.proc_ms = 30;
+  TEST_ASSERT_EQUAL(NTPClient::REQUEST_COMPLETED, runRequest());
+  TEST_ASSERT_TRUE(client.consumeResult());
+  TEST_ASSERT_UINT32_WITHIN(5, 240, client.getRoundTripDelay()); // without the time on the server
+  TEST_ASSERT_INT_WITHIN(5, 0, (int64_t)(client.getEpochMillis() - hostNtp.trueMs()));
+}
+
+void test_asymmetric_delay_error_is_half_the_difference(void)
+{
+  HostNtpServer &server = hostNtp.add("time.example", SERVER);
+  server.out_ms = 200;
+  server.back_ms = 20;
+  TEST_ASSERT_EQUAL(NTPClient::REQUEST_COMPLETED, runRequest());
+  // The client assumes the answer took half the round trip, it is 90 ms late.
+  TEST_ASSERT_INT_WITHIN(5, 90, (int64_t)(client.getEpochMillis() - hostNtp.trueMs()));
+}
+
+void test_lost_answer_times_out(void)
+{
+  hostNtp.add("time.example", SERVER).lose = true;
+  uint32_t start = millis();
+  TEST_ASSERT_EQUAL(NTPClient::REQUEST_FAILED, runRequest());
+  TEST_ASSERT_UINT32_WITHIN(10, NTP_DEFAULT_REQUEST_TIMEOUT, millis() - start);
+  TEST_ASSERT_FALSE(client.consumeResult());
+}
+
+void test_answer_after_the_timeout_is_ignored(void)
+{
+  HostNtpServer &server = hostNtp.add("time.example", SERVER);
+  server.out_ms = NTP_DEFAULT_REQUEST_TIMEOUT;
+  TEST_ASSERT_EQUAL(NTPClient::REQUEST_FAILED, runRequest());
+  // The late answer arrives during the next request, its origin timestamp belongs to the old one.
+  server.out_ms = 15;
+  client.startRequest();
+  hostAdvanceMs(30);
+  udp.incoming.front().at_us = hostTimeUs; // late answer first
+  TEST_ASSERT_EQUAL(NTPClient::REQUEST_FAILED, client.poll());
+}
+
+void checkMalformed(const char *what, std::function<void(std::vector<uint8_t> &)> mangle)
+{
+  hostNtp.mangle = mangle;
+  TEST_ASSERT_EQUAL_MESSAGE(NTPClient::REQUEST_FAILED, runRequest(), what);
+  TEST_ASSERT_FALSE_MESSAGE(client.consumeResult(), what);
+}
+
+void test_malformed_answers_are_rejected(void)
+{
+  hostNtp.add("time.example", SERVER);
+  checkMalformed("short", [](std::vector<uint8_t> &a)
+                 { a.resize(47); });
+  checkMalformed("not synchronized", [](std::vector<uint8_t> &a)
+                 { a[0] |= 0xC0; });
+  checkMalformed("version 3", [](std::vector<uint8_t> &a)
+                 { a[0] = (a[0] & 0xC7) | (3 << 3); });
+  checkMalformed("client mode", [](std::vector<uint8_t> &a)
+                 { a[0] = (a[0] & 0xF8) | 3; });
+  checkMalformed("kiss of death", [](std::vector<uint8_t> &a)
+                 { a[1] = 0; });
+  checkMalformed("stratum 16", [](std::vector<uint8_t> &a)
+                 { a[1] = 16; });
+  checkMalformed("no reference time", [](std::vector<uint8_t> &a)
+                 { memset(&a[16], 0, 8); });
+  checkMalformed("foreign origin", [](std::vector<uint8_t> &a)
+                 { a[31] ^= 1; });
+  checkMalformed("sent before received", [](std::vector<uint8_t> &a)
+                 { memcpy(&a[40], &a[32], 4); a[32]++; });
+
+  hostNtp.mangle = nullptr;
+  TEST_ASSERT_EQUAL(NTPClient::REQUEST_COMPLETED, runRequest());
+}
+
+void addServers()
+{
+  hostNtp.add("0.pool.ntp.org", IPAddress(192, 0, 2, 10));
+  hostNtp.add("1.pool.ntp.org", IPAddress(192, 0, 2, 11));
+  hostNtp.add("2.pool.ntp.org", IPAddress(192, 0, 2, 12));
+  hostNtp.add("3.pool.ntp.org", IPAddress(192, 0, 2, 13));
+  hostNtp.attach(Clock::ntpUDP);
+  Clock::ntpUDP.sent.clear();
+  hostRtc.set(hostNtp.trueMs() / 1000 - 5); // off by seconds, NTP corrects it
+}
+
+void test_burst_resolves_each_server_once(void)
+{
+  addServers();
+  Clock clock;
+  StoredConfig::Config config = {};
+  clock.begin(&config.uclock, &config.rtc_drift, &config.time_zone);
+
+  TEST_ASSERT_EQUAL(NTP_BURST_SAMPLES, Clock::ntpUDP.sent.size());
+  TEST_ASSERT_EQUAL(4, WiFi.lookups);
+  for (const HostPacket &packet : Clock::ntpUDP.sent)
+    TEST_ASSERT_TRUE(packet.host.empty());
+  for (auto &server : hostNtp.servers)
+    TEST_ASSERT_EQUAL(NTP_BURST_SAMPLES / 4, server.second.answered);
+  TEST_ASSERT_TRUE(Serial.contains("NTP burst done: 8 answers"));
+  clock.loop(); // TimeLib syncs with the burst result
+  TEST_ASSERT_INT_WITHIN(20, 0, (int64_t)(Clock::nowMs() - hostNtp.trueMs()));
+}
+
+void test_failed_lookup_only_drops_that_server(void)
+{
+  addServers();
+  WiFi.hosts.erase("2.pool.ntp.org");
+  Clock clock;
+  StoredConfig::Config config = {};
+  clock.begin(&config.uclock, &config.rtc_drift, &config.time_zone);
+
+  TEST_ASSERT_EQUAL(4, WiFi.lookups);
+  TEST_ASSERT_EQUAL(NTP_BURST_SAMPLES - 2, Clock::ntpUDP.sent.size()); // nothing sent to 0.0.0.0
+  TEST_ASSERT_TRUE(Serial.contains("NTP query to 2.pool.ntp.org failed."));
+  TEST_ASSERT_TRUE(Serial.contains("NTP burst done: 6 answers"));
+  clock.loop(); // TimeLib syncs with the burst result
+  TEST_ASSERT_INT_WITHIN(20, 0, (int64_t)(Clock::nowMs() - hostNtp.trueMs()));
+}
+
+void test_burst_rejects_a_falseticker(void)
+{
+  addServers();
+  hostNtp.servers[(uint32_t)IPAddress(192, 0, 2, 11)].offset_ms = 5000;
+  Clock clock;
+  StoredConfig::Config config = {};
+  clock.begin(&config.uclock, &config.rtc_drift, &config.time_zone);
+
+  TEST_ASSERT_TRUE(Serial.contains("3 servers used, 1 rejected"));
+  clock.loop();
+  TEST_ASSERT_INT_WITHIN(20, 0, (int64_t)(Clock::nowMs() - hostNtp.trueMs()));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_request_goes_to_the_resolved_address);
+  RUN_TEST(test_unresolved_server_fails_without_sending);
+  RUN_TEST(test_delayed_answer_is_corrected_by_half_the_round_trip);
+  RUN_TEST(test_asymmetric_delay_error_is_half_the_difference);
+  RUN_TEST(test_lost_answer_times_out);
+  RUN_TEST(test_answer_after_the_timeout_is_ignored);
+  RUN_TEST(test_malformed_answers_are_rejected);
+  RUN_TEST(test_burst_resolves_each_server_once);
+  RUN_TEST(test_failed_lookup_only_drops_that_server);
+  RUN_TEST(test_burst_rejects_a_falseticker);
+  return UNITY_END();
+}
@@ -0,0 +1,99 @@
+// Selection of the NTP samples of one burst, on the host (pio test -e native).
+
+#include "_USER_DEFINES.h"
+#include <unity.h>
+
+#include "NtpFilter.cpp"
+
+NtpFilter filter;
+
+void setUp(void)
+{
+  filter.reset();
+}
+
+void tearDown(void) {}
+
+// Two samples per server, like a burst of 8 over 4 servers.
+void addServer(uint8_t server, int64_t offset_ms, uint32_t delay_ms)
+{
+  filter.addSample(server, offset_ms, delay_ms);
+  filter.addSample(server, offset_ms + 3, delay_ms + 10);
+}
+
+void test_falseticker_is_rejected(void)
+{
+  addServer(0, 1000, 30);
+  addServer(1, 1004, 40);
+  addServer(2, 6000, 20); // 5 s off
+  addServer(3, 998, 36);
+  TEST_ASSERT_TRUE(filter.compute());
+  TEST_ASSERT_EQUAL(3, filter.getNumTruechimers());
+  TEST_ASSERT_EQUAL(1, filter.getNumFalsetickers());
+  TEST_ASSERT_EQUAL_INT64(1000, filter.getOffset()); // median of the truechimers
+  TEST_ASSERT_EQUAL(30, filter.getDelay());          // the falseticker had the lowest delay
+  TEST_ASSERT_LESS_OR_EQUAL(5, filter.getJitter());
+}
+
+void test_two_disagreeing_servers_have_no_result(void)
+{
+  addServer(0, 1000, 30);
+  addServer(1, 1500, 30);
+  TEST_ASSERT_FALSE(filter.compute());
+  TEST_ASSERT_EQUAL(1, filter.getNumTruechimers());
+  TEST_ASSERT_EQUAL(1, filter.getNumFalsetickers());
+}
+
+void test_two_agreeing_servers(void)
+{
+  addServer(0, 1000, 30);
+  addServer(1, 1010, 30); // the intervals +-17 ms overlap
+  TEST_ASSERT_TRUE(filter.compute());
+  TEST_ASSERT_EQUAL(2, filter.getNumTruechimers());
+  TEST_ASSERT_EQUAL_INT64(1005, filter.getOffset());
+}
+
+void test_no_majority_has_no_result(void)
+{
+  addServer(0, 1000, 20);
+  addServer(1, 1000, 20);
+  addServer(2, 3000, 20);
+  addServer(3, 3000, 20);
+  TEST_ASSERT_FALSE(filter.compute());
+}
+
+void test_lowest_delay_sample_of_a_server_is_used(void)
+{
+  filter.addSample(0, 1200, 400); // delayed by a congested link
+  filter.addSample(0, 1000, 20);
+  TEST_ASSERT_TRUE(filter.compute());
+  TEST_ASSERT_EQUAL_INT64(1000, filter.getOffset());
+  TEST_ASSERT_EQUAL(20, filter.getDelay());
+}
+
+void test_no_samples_have_no_result(void)
+{
+  TEST_ASSERT_FALSE(filter.compute());
+  TEST_ASSERT_EQUAL(0, filter.getNumTruechimers());
+}
+
+void test_samples_beyond_the_burst_are_ignored(void)
+{
+  for (int i = 0; i < NTP_BURST_SAMPLES + 4; i++)
+    filter.addSample(i % 4, 1000, 20);
+  filter.addSample(NtpFilter::max_servers, 1000, 20); // no such server
+  TEST_ASSERT_EQUAL(NTP_BURST_SAMPLES, filter.getNumSamples());
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_falseticker_is_rejected);
+  RUN_TEST(test_two_disagreeing_servers_have_no_result);
+  RUN_TEST(test_two_agreeing_servers);
+  RUN_TEST(test_no_majority_has_no_result);
+  RUN_TEST(test_lowest_delay_sample_of_a_server_is_used);
+  RUN_TEST(test_no_samples_have_no_result);
+  RUN_TEST(test_samples_beyond_the_burst_are_ignored);
+  return UNITY_END();
+}
@@ -0,0 +1,129 @@
+// Sunrise and sunset on the host (pio test -e native), against published almanac times (rounded to the
+// minute) for cities on both hemispheres at both solstices, and the polar day and night in Tromsø.
+
+#include "_USER_DEFINES.h"
+#include <unity.h>
+
+#include "SolarTime.cpp"
+
+struct Reference
+{
+  const char *city;
+  double latitude, longitude;
+  uint16_t year;
+  uint8_t month, day;
+  int32_t tz_offset_sec; // local time of the day, incl. daylight saving time
+  const char *sunrise, *sunset;
+};
+
+const Reference references[] = {
+    {"London", 51.5074, -0.1278, 2024, 6, 21, 3600, "04:43", "21:21"},
+    {"London", 51.5074, -0.1278, 2024, 12, 21, 0, "08:04", "15:53"},
+    {"New York", 40.7128, -74.0060, 2024, 6, 20, -4 * 3600, "05:25", "20:31"},
+    {"New York", 40.7128, -74.0060, 2024, 12, 21, -5 * 3600, "07:17", "16:32"},
+    {"Sydney", -33.8688, 151.2093, 2024, 12, 21, 11 * 3600, "05:41", "20:05"},
+    {"Sydney", -33.8688, 151.2093, 2024, 6, 21, 10 * 3600, "07:00", "16:54"},
+    {"Tokyo", 35.6762, 139.6503, 2024, 6, 21, 9 * 3600, "04:25", "19:00"},
+};
+
+const double TROMSO_LAT = 69.6492, TROMSO_LON = 18.9553;
+
+int16_t minutes(const char *hh_mm)
+{
+  return atoi(hh_mm) * 60 + atoi(hh_mm + 3);
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_reference_table(void)
+{
+  int max_error = 0;
+  for (const Reference &ref : references)
+  {
+    SolarTime solar;
+    solar.setLocation(ref.latitude, ref.longitude);
+    TEST_ASSERT_TRUE(solar.update(ref.year, ref.month, ref.day, ref.tz_offset_sec));
+    char line[120];
+    snprintf(line, sizeof(line), "%s %04u-%02u-%02u: %02d:%02d-%02d:%02d, published %s-%s", ref.city, ref.year, ref.month, ref.day,
+             solar.getSunrise() / 60, solar.getSunrise() % 60, solar.getSunset() / 60, solar.getSunset() % 60, ref.sunrise, ref.sunset);
+    TEST_MESSAGE(line);
+    TEST_ASSERT_INT_WITHIN_MESSAGE(2, minutes(ref.sunrise), solar.getSunrise(), ref.city);
+    TEST_ASSERT_INT_WITHIN_MESSAGE(2, minutes(ref.sunset), solar.getSunset(), ref.city);
+    max_error = std::max(max_error, abs(solar.getSunrise() - minutes(ref.sunrise)));
+    max_error = std::max(max_error, abs(solar.getSunset() - minutes(ref.sunset)));
+  }
+  char line[60];
+  snprintf(line, sizeof(line), "max. error %d min", max_error);
+  TEST_MESSAGE(line);
+}
+
+void test_polar_day(void)
+{
+  SolarTime solar;
+  solar.setLocation(TROMSO_LAT, TROMSO_LON);
+  solar.update(2024, 6, 21, 2 * 3600);
+  TEST_ASSERT_EQUAL(-1, solar.getSunrise());
+  TEST_ASSERT_EQUAL(-1, solar.getSunset());
+  for (uint16_t minute = 0; minute < 1440; minute += 30)
+    TEST_ASSERT_FALSE(solar.isNight(minute));
+}
+
+void test_polar_night(void)
+{
+  SolarTime solar;
+  solar.setLocation(TROMSO_LAT, TROMSO_LON);
+  solar.update(2024, 12, 21, 3600);
+  TEST_ASSERT_EQUAL(-1, solar.getSunrise());
+  TEST_ASSERT_EQUAL(-1, solar.getSunset());
+  for (uint16_t minute = 0; minute < 1440; minute += 30)
+    TEST_ASSERT_TRUE(solar.isNight(minute));
+}
+
+// Night starts SOLAR_DIM_AFTER_SUNSET_MIN after sunset and ends SOLAR_BRIGHT_AFTER_SUNRISE_MIN after sunrise.
+void test_night_follows_the_sun(void)
+{
+  SolarTime solar;
+  solar.setLocation(references[0].latitude, references[0].longitude);
+  solar.update(2024, 6, 21, 3600);
+  int16_t day_start = solar.getSunrise() + SOLAR_BRIGHT_AFTER_SUNRISE_MIN;
+  int16_t day_end = solar.getSunset() + SOLAR_DIM_AFTER_SUNSET_MIN;
+  TEST_ASSERT_TRUE(solar.isNight(day_start - 1));
+  TEST_ASSERT_FALSE(solar.isNight(day_start));
+  TEST_ASSERT_FALSE(solar.isNight(day_end - 1));
+  TEST_ASSERT_TRUE(solar.isNight(day_end));
+}
+
+// Recalculated only for a new date, time zone or location.
+void test_result_is_cached(void)
+{
+  SolarTime solar;
+  TEST_ASSERT_FALSE(solar.update(2024, 6, 21, 3600)); // no location yet
+  solar.setLocation(references[0].latitude, references[0].longitude);
+  TEST_ASSERT_TRUE(solar.update(2024, 6, 21, 3600));
+  TEST_ASSERT_FALSE(solar.update(2024, 6, 21, 3600));
+  TEST_ASSERT_TRUE(solar.update(2024, 6, 22, 3600));
+  TEST_ASSERT_TRUE(solar.update(2024, 6, 22, 0));
+  int16_t sunrise_utc = solar.getSunrise();
+  solar.setLocation(references[0].latitude, references[0].longitude); // same place
+  TEST_ASSERT_FALSE(solar.update(2024, 6, 22, 0));
+  solar.setLocation(references[2].latitude, references[2].longitude);
+  TEST_ASSERT_TRUE(solar.update(2024, 6, 22, 0));
+  TEST_ASSERT_NOT_EQUAL(sunrise_utc, solar.getSunrise());
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_reference_table);
+  RUN_TEST(test_polar_day);
+  RUN_TEST(test_polar_night);
+  RUN_TEST(test_night_follows_the_sun);
+  RUN_TEST(test_result_is_cached);
+  return UNITY_END();
+}
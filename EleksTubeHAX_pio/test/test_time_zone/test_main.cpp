@@ -0,0 +1,169 @@
+// TimeZone against the C library's localtime_r(), on the host (pio test -e native). Every rule of the zone table is
+// compared with glibc's reading of the same POSIX rule and with the tz database of the host, including the exact
+// second of every transition. Chatham, Lord Howe, Santiago and Nuuk have the unusual rules.
+
+#include "_USER_DEFINES.h"
+#include <unity.h>
+#include <sys/stat.h>
+
+#include "TimeZone.cpp"
+
+const int FIRST_YEAR = 2025;
+const int LAST_YEAR = 2030;
+
+time_t yearStart(int year)
+{
+  struct tm tm = {};
+  tm.tm_year = year - 1900;
+  tm.tm_mday = 1;
+  return timegm(&tm);
+}
+
+void setLibcZone(const char *tz)
+{
+  setenv("TZ", tz, 1);
+  tzset();
+}
+
+int32_t libcOffset(time_t t, bool *dst = NULL)
+{
+  struct tm tm;
+  localtime_r(&t, &tm);
+  if (dst)
+    *dst = tm.tm_isdst > 0;
+  return (int32_t)tm.tm_gmtoff;
+}
+
+bool hasZoneInfo(const char *name)
+{
+  struct stat st;
+  char path[128];
+  snprintf(path, sizeof(path), "/usr/share/zoneinfo/%s", name);
+  return stat(path, &st) == 0;
+}
+
+void checkAt(TimeZone &zone, time_t t, const char *what, bool check_dst)
+{
+  bool dst;
+  int32_t expected = libcOffset(t, &dst);
+  char message[160];
+  snprintf(message, sizeof(message), "%s at %lld", what, (long long)t);
+  TEST_ASSERT_EQUAL_INT32_MESSAGE(expected, zone.getOffset(t), message);
+  if (check_dst)
+    TEST_ASSERT_EQUAL_MESSAGE(dst, zone.isDst(t), message);
+}
+
+// Compares the zone with the libc zone set by setLibcZone() over the test years. Returns the number of transitions.
+int compareWithLibc(TimeZone &zone, const char *what, bool check_dst)
+{
+  int transitions = 0;
+  time_t end = yearStart(LAST_YEAR + 1);
+  for (time_t t = yearStart(FIRST_YEAR); t < end; t += 6 * 3600)
+  {
+    checkAt(zone, t, what, check_dst);
+    if (libcOffset(t) == libcOffset(t + 6 * 3600))
+      continue;
+    // The exact second of the transition: first second with the new offset.
+    time_t before = t, after = t + 6 * 3600;
+    while (after - before > 1)
+    {
+      time_t middle = before + (after - before) / 2;
+      (libcOffset(middle) == libcOffset(t) ? before : after) = middle;
+    }
+    checkAt(zone, before, what, check_dst);
+    checkAt(zone, after, what, check_dst);
+    transitions++;
+  }
+  return transitions;
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+void test_every_rule_matches_libc(void)
+{
+  for (const ZoneRule &entry : zone_rules)
+  {
+    TimeZone zone;
+    TEST_ASSERT_TRUE_MESSAGE(zone.setRule(entry.rule), entry.rule);
+    setLibcZone(entry.rule);
+    compareWithLibc(zone, entry.rule, true);
+  }
+}
+
+void test_every_zone_matches_the_tz_database(void)
+{
+  if (!hasZoneInfo("Europe/Berlin"))
+    TEST_IGNORE_MESSAGE("no tz database on this host");
+  int checked = 0;
+  for (const ZoneRule &entry : zone_rules)
+  {
+    if (!hasZoneInfo(entry.name) || strcmp(entry.name, "Africa/Casablanca") == 0) // DST during Ramadan isn't a POSIX rule
+      continue;
+    TimeZone zone;
+    zone.setRule(entry.rule);
+    char tz[64];
+    snprintf(tz, sizeof(tz), ":%s", entry.name);
+    setLibcZone(tz);
+    // Only the offset: some zones have negative DST in the database (Europe/Dublin), which POSIX can't express.
+    compareWithLibc(zone, entry.name, false);
+    checked++;
+  }
+  char line[64];
+  snprintf(line, sizeof(line), "%d zones checked", checked);
+  TEST_MESSAGE(line);
+}
+
+// One of the unusual zones against the tz database, it must have DST in every year.
+void checkZone(const char *name, int32_t std_offset, int32_t dst_offset)
+{
+  if (!hasZoneInfo(name))
+    TEST_IGNORE_MESSAGE("no tz database on this host");
+  TimeZone zone;
+  TEST_ASSERT_TRUE(zone.setRule(TimeZone::findRule(name)));
+  char tz[64];
+  snprintf(tz, sizeof(tz), ":%s", name);
+  setLibcZone(tz);
+  TEST_ASSERT_EQUAL(2 * (LAST_YEAR - FIRST_YEAR + 1), compareWithLibc(zone, name, true));
+  bool seen_std = false, seen_dst = false;
+  for (time_t t = yearStart(FIRST_YEAR); t < yearStart(FIRST_YEAR + 1); t += 86400)
+  {
+    int32_t offset = zone.getOffset(t);
+    TEST_ASSERT_TRUE(offset == std_offset || offset == dst_offset);
+    (offset == std_offset ? seen_std : seen_dst) = true;
+  }
+  TEST_ASSERT_TRUE(seen_std && seen_dst);
+}
+
+void test_chatham(void)
+{
+  checkZone("Pacific/Chatham", 12 * 3600 + 45 * 60, 13 * 3600 + 45 * 60); // transitions at 2:45 and 3:45
+}
+
+void test_lord_howe(void)
+{
+  checkZone("Australia/Lord_Howe", 10 * 3600 + 30 * 60, 11 * 3600); // DST is only half an hour
+}
+
+void test_santiago(void)
+{
+  checkZone("America/Santiago", -4 * 3600, -3 * 3600); // transitions at 24:00 on Saturday
+}
+
+void test_nuuk(void)
+{
+  checkZone("America/Nuuk", -2 * 3600, -1 * 3600); // DST starts at -1:00, the day before
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_every_rule_matches_libc);
+  RUN_TEST(test_every_zone_matches_the_tz_database);
+  RUN_TEST(test_chatham);
+  RUN_TEST(test_lord_howe);
+  RUN_TEST(test_santiago);
+  RUN_TEST(test_nuuk);
+  return UNITY_END();
+}
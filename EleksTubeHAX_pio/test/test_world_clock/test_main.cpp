@@ -0,0 +1,198 @@
+// The world clock on the host (pio test -e native): zones configured over MQTT, the digits shown for each zone,
+// the rotation schedule with the image cache filled before every switch, and the zones kept in the stored config.
+
+#include "_USER_DEFINES.h"
+#include <unity.h>
+
+#include "NTPClient_AO.cpp"
+#include "Clock.cpp"
+#include "NtpFilter.cpp"
+#include "RtcDrift.cpp"
+#include "TimeZone.cpp"
+#include "DisciplinedClock.cpp"
+#include "EventBus.cpp"
+#include "WorldClock.cpp"
+
+EventBus events;
+StoredConfig stored_config;
+WifiState_t WifiState = disconnected;
+TFTs tfts;
+Clock uclock;
+WorldClock worldclock;
+
+// 2025-10-09 08:53:20 UTC: 04:53 in New York (EDT), 17:53 in Tokyo
+const time_t START = 1760000000;
+
+// TFTs as far as the world clock uses it
+std::string shown_label;
+std::vector<uint32_t> prefetch_ms;
+
+void TFTs::setZoneLabel(const char *label)
+{
+  shown_label = label;
+}
+
+bool TFTs::cacheClockFace()
+{
+  prefetch_ms.push_back(millis());
+  return true;
+}
+
+void loopFor(uint32_t ms)
+{
+  for (uint32_t t = 0; t < ms; t += 10)
+  {
+    uclock.loop();
+    worldclock.loop();
+    hostAdvanceMs(10);
+  }
+}
+
+// in the home time zone of the default config
+uint8_t homeHour()
+{
+  return (START + uclock.getTimeZoneOffset()) / 3600 % 24;
+}
+
+uint8_t shownHour()
+{
+  return uclock.getHoursTens() * 10 + uclock.getHoursOnes();
+}
+
+void setUp(void)
+{
+  hostTimeLib = HostTimeLib();
+  hostRtc.reset();
+  hostRtc.set(START, 0);
+  Serial.clear();
+  stored_config.config = {};
+  uclock = Clock();
+  uclock.begin(&stored_config.config.uclock, &stored_config.config.rtc_drift, &stored_config.config.time_zone);
+  worldclock = WorldClock();
+  worldclock.begin(&stored_config.config.world_clock);
+  shown_label.clear();
+  prefetch_ms.clear();
+  loopFor(100);
+}
+
+void tearDown(void) {}
+
+void test_zones_are_configured_over_mqtt(void)
+{
+  TEST_ASSERT_EQUAL(0, worldclock.getCount());
+  hostNvs.clear();
+  TEST_ASSERT_TRUE(worldclock.command("{\"zones\":[{\"label\":\"NYC\",\"tz\":\"America/New_York\"},{\"label\":\"TYO\",\"tz\":\"JST-9\"}],\"rotate_sec\":10}"));
+  TEST_ASSERT_TRUE(hostNvs.empty()); // the caller saves the config, delayed like the other MQTT settings
+  TEST_ASSERT_EQUAL(2, worldclock.getCount());
+  TEST_ASSERT_EQUAL_STRING("NYC", worldclock.getLabel(1));
+  TEST_ASSERT_EQUAL_STRING("TYO", worldclock.getLabel(2));
+  TEST_ASSERT_EQUAL_STRING(TimeZone::findRule("America/New_York"), stored_config.config.world_clock.rule[0]);
+  TEST_ASSERT_EQUAL(10, stored_config.config.world_clock.rotate_sec);
+
+  // unknown zones are left out, a JSON error changes nothing
+  TEST_ASSERT_TRUE(worldclock.command("{\"zones\":[{\"label\":\"X\",\"tz\":\"Nowhere/City\"},{\"label\":\"BER\",\"tz\":\"Europe/Berlin\"}]}"));
+  TEST_ASSERT_EQUAL(1, worldclock.getCount());
+  TEST_ASSERT_EQUAL_STRING("BER", worldclock.getLabel(1));
+  TEST_ASSERT_TRUE(Serial.contains("Unknown time zone: Nowhere/City"));
+  TEST_ASSERT_FALSE(worldclock.command("{\"zones\":["));
+  TEST_ASSERT_EQUAL(1, worldclock.getCount());
+  TEST_ASSERT_FALSE(worldclock.command("next")); // only switches the shown zone, nothing to save
+  TEST_ASSERT_FALSE(worldclock.command("home"));
+}
+
+void test_each_zone_shows_its_local_time(void)
+{
+  worldclock.command("{\"zones\":[{\"label\":\"NYC\",\"tz\":\"America/New_York\"},{\"label\":\"TYO\",\"tz\":\"JST-9\"}]}");
+  TEST_ASSERT_EQUAL(homeHour(), shownHour());
+  worldclock.command("next");
+  TEST_ASSERT_EQUAL(1, worldclock.getIndex());
+  TEST_ASSERT_EQUAL_STRING("NYC", shown_label.c_str());
+  TEST_ASSERT_EQUAL(4, shownHour());
+  TEST_ASSERT_EQUAL(5, uclock.getMinutesTens());
+  TEST_ASSERT_EQUAL(3, uclock.getMinutesOnes());
+  worldclock.command("next");
+  TEST_ASSERT_EQUAL_STRING("TYO", shown_label.c_str());
+  TEST_ASSERT_EQUAL(17, shownHour());
+  worldclock.command("next"); // back to the home time zone, no label
+  TEST_ASSERT_EQUAL(0, worldclock.getIndex());
+  TEST_ASSERT_EQUAL_STRING("", shown_label.c_str());
+  TEST_ASSERT_EQUAL(homeHour(), shownHour());
+  worldclock.step(-1);
+  TEST_ASSERT_EQUAL(2, worldclock.getIndex());
+  worldclock.command("home");
+  TEST_ASSERT_EQUAL(0, worldclock.getIndex());
+  TEST_ASSERT_EQUAL(homeHour(), shownHour());
+}
+
+// Every rotate_sec the next zone is shown, the image cache is filled WORLD_CLOCK_PREFETCH_MS before each switch.
+void test_rotation_prefetches_before_every_switch(void)
+{
+  worldclock.command("{\"zones\":[{\"label\":\"NYC\",\"tz\":\"America/New_York\"},{\"label\":\"TYO\",\"tz\":\"JST-9\"}],\"rotate_sec\":5}");
+  uint32_t start_ms = millis();
+  std::vector<uint32_t> switch_ms;
+  uint8_t index = worldclock.getIndex();
+  for (uint32_t t = 0; t < 15500; t += 10)
+  {
+    uclock.loop();
+    worldclock.loop();
+    if (worldclock.getIndex() != index)
+    {
+      index = worldclock.getIndex();
+      switch_ms.push_back(millis() - start_ms);
+    }
+    hostAdvanceMs(10);
+  }
+  TEST_ASSERT_EQUAL(3, switch_ms.size()); // NYC, TYO, home
+  TEST_ASSERT_EQUAL(3, prefetch_ms.size());
+  for (size_t i = 0; i < switch_ms.size(); i++)
+  {
+    TEST_ASSERT_INT_WITHIN(10, (i + 1) * 5000, switch_ms[i]);
+    TEST_ASSERT_INT_WITHIN(10, switch_ms[i] - WORLD_CLOCK_PREFETCH_MS, prefetch_ms[i] - start_ms);
+  }
+  TEST_ASSERT_EQUAL(0, worldclock.getIndex());
+}
+
+void test_no_rotation_without_a_schedule(void)
+{
+  worldclock.command("{\"zones\":[{\"label\":\"NYC\",\"tz\":\"America/New_York\"}],\"rotate_sec\":0}");
+  loopFor(60000);
+  TEST_ASSERT_EQUAL(0, worldclock.getIndex());
+  TEST_ASSERT_EQUAL(0, prefetch_ms.size());
+}
+
+// After a restart the zones come back from the stored config, a broken rule removes them all.
+void test_zones_are_restored_from_the_stored_config(void)
+{
+  worldclock.command("{\"zones\":[{\"label\":\"NYC\",\"tz\":\"America/New_York\"},{\"label\":\"TYO\",\"tz\":\"JST-9\"}],\"rotate_sec\":10}");
+  StoredConfig::Config::WorldClock saved = stored_config.config.world_clock;
+
+  WorldClock restarted;
+  restarted.begin(&saved);
+  TEST_ASSERT_EQUAL(2, restarted.getCount());
+  TEST_ASSERT_EQUAL_STRING("TYO", restarted.getLabel(2));
+  restarted.show(2);
+  TEST_ASSERT_EQUAL(17, shownHour());
+  restarted.show(0);
+
+  strcpy(saved.rule[1], "not a rule");
+  WorldClock broken;
+  broken.begin(&saved);
+  TEST_ASSERT_EQUAL(0, broken.getCount());
+
+  StoredConfig::Config::WorldClock blank = {};
+  WorldClock first_boot;
+  first_boot.begin(&blank);
+  TEST_ASSERT_EQUAL(0, first_boot.getCount());
+  TEST_ASSERT_EQUAL(StoredConfig::valid, blank.is_valid);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_zones_are_configured_over_mqtt);
+  RUN_TEST(test_each_zone_shows_its_local_time);
+  RUN_TEST(test_rotation_prefetches_before_every_switch);
+  RUN_TEST(test_no_rotation_without_a_schedule);
+  RUN_TEST(test_zones_are_restored_from_the_stored_config);
+  return UNITY_END();
+}